@@ -0,0 +1,61 @@
+#pragma once
+#include <cstddef>
+#include <ostream>
+
+/*
+Heap allocation accounting per compiler stage (calc_compiler --alloc-stats).
+
+alloc.cpp replaces the global operator new and delete. While the tracker is
+enabled every allocation is charged to the current stage, and its size and
+stage go into a side table so that a free is taken off the stage that made
+the block, whenever it happens. With the tracker off they are malloc() and
+free() behind one check. For each stage the report shows:
+
+    allocations, bytes    what the stage asked for
+    frees                 blocks of the stage freed so far
+    peak live             most bytes live in the whole process while the stage ran
+    kept                  bytes of the stage still live when it last ended
+
+so "kept" after lex is the tokens and after parse the expression tree.
+Stages are marked with AllocationTracker::enter(). Counting is not
+thread-safe, so the compile server runs one worker while it counts.
+*/
+class AllocationTracker {
+public:
+    enum Stage { Other, Lex, Parse, Codegen, Assemble, Link, StageCount };
+
+    // Static, so they start at zero
+    struct Counters {
+        long allocations;
+        long bytes;
+        long frees;
+        long peakLive;
+        long live;  // Bytes allocated by the stage and not freed yet
+        long kept;
+    };
+
+    static inline bool enabled = false;
+    static inline Stage stage = Other;
+    static inline Counters counters[StageCount];
+    static inline long live = 0;
+    static inline long peakLive = 0;
+
+    // Charge allocations to next from now on; returns the previous stage.
+    // Does nothing with the tracker off, so threads may call it then.
+    static Stage enter(Stage next) {
+        Stage previous = stage;
+        if (!enabled) return previous;
+        counters[previous].kept = counters[previous].live;
+        stage = next;
+        return previous;
+    }
+
+    static const char* name(Stage s) {
+        static const char* const names[StageCount] = {
+            "other", "lex", "parse", "codegen", "assemble", "link"};
+        return names[s];
+    }
+
+    // Print a table of the counters and stop counting
+    static void report(std::ostream& out);
+};
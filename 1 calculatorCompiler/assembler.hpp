@@ -1,25 +1,21 @@
 #pragma once
+#include "target.hpp"
 #include <vector>
 #include <cstdint>
 #include <string>
-#include <map>
 
+// Assembly text to machine code, for any target in target.hpp
 class Assembler {
 public:
-    // Converts a single instruction to machine code
-    uint32_t assembleLine(const std::string& line);
+    explicit Assembler(Machine machine = Machine::Arm64) : machine(machine) {}
+
+    // Converts a single instruction to machine code, appended to out
+    // (a pseudo-instruction may be two words, an empty line or label none)
+    void assembleLine(const std::string& line, std::vector<uint32_t>& out);
     
     // Assembles full program
     std::vector<uint32_t> assemble(const std::vector<std::string>& lines);
 
 private:
-    // Different instruction formats
-    uint32_t assembleMov(const std::string& line);
-    uint32_t assembleArithmetic(const std::string& line);
-    uint32_t assembleLoad(const std::string& line);
-    uint32_t assembleStore(const std::string& line);
-    
-    // Helper functions
-    int parseRegister(const std::string& reg);
-    int parseImmediate(const std::string& imm);
-};
\ No newline at end of file
+    Machine machine;
+};
@@ -0,0 +1,319 @@
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "assembler.hpp"
+#include "constexpr_calc.hpp"
+#include "driver.hpp"
+#include "lexer.hpp"
+#include "onepass.hpp"
+#include "parser.hpp"
+
+/*
+Benchmarks for the calculator compiler.
+
+Compares the tree path (compileToMachineCode: lexer, parser, Expression
+tree, assembly text, assembler) with compileOnePass() on long flat
+expressions: that both give the same words on every target, how fast each
+compiles, and how much memory each needs. Also times the table-driven
+assembler (target.hpp) against the regular expressions it replaced, and
+checks that they encode ARM64 alike. Last, times constant expressions
+through constexpr_calc.hpp against the runtime front end; the static_asserts
+below make every build check that path.
+
+Usage: calc_bench [scale]    (scale multiplies the expression lengths)
+*/
+
+// ConstexprCalc, checked while this file compiles
+static_assert(ConstexprCalc::evaluate("2 + 3 * 4") == 14, "precedence");
+static_assert(ConstexprCalc::evaluate("10 - 4 - 3") == 3, "left associative");
+static_assert(ConstexprCalc::evaluate("8 / 4 / 2") == 1, "left associative");
+static_assert(ConstexprCalc::evaluate("1 / 3") == 1.0 / 3, "same rounding as the runtime");
+static_assert(ConstexprCalc::evaluate("9007199254740993") == 9007199254740992.0, "ties to even");
+
+constexpr auto fahrenheit = CONSTEXPR_CALC("$0 * 9 / 5 + 32");
+static_assert(fahrenheit(100) == 212 && fahrenheit(-40) == -40, "argument");
+static_assert(fahrenheit.arguments == 1 && fahrenheit.nodes == 7, "nothing to fold");
+
+constexpr auto folded = CONSTEXPR_CALC("2 * 3 + $0 - 8 / 4");
+static_assert(folded(1) == 5 && folded.nodes == 5, "2 * 3 and 8 / 4 folded");
+
+// A flat expression of terms random numbers joined by random operators
+static std::string flatExpression(long terms, unsigned seed) {
+    std::mt19937 random(seed);
+    const char* operators[] = {" + ", " - ", " * ", " / "};
+    std::string text = std::to_string(random() % 65536);
+    for (long i = 1; i < terms; i++) {
+        text += operators[random() % 4];
+        text += std::to_string(random() % 65536);
+    }
+    return text;
+}
+
+// The words, or the error message
+static std::string outcome(const std::function<std::vector<uint32_t>()>& compile) {
+    try {
+        std::vector<uint32_t> words = compile();
+        return std::string(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint32_t));
+    } catch (const std::exception& e) {
+        return std::string("error: ") + e.what();
+    }
+}
+
+// Short random texts, mostly expressions, some broken, with odd spacing
+static void equivalenceCheck(Machine machine) {
+    std::mt19937 random(1);
+    const std::string pieces[] = {"+", "-", "*", "/", " ", "  ", "\t", "(", "x", "7", "42",
+                                  "65535", "65536", "2147483647", "2147483648", "00012"};
+    int count = 20000;
+    int mismatches = 0;
+    int errors = 0;
+    for (int i = 0; i < count; i++) {
+        std::string text;
+        if (random() % 2) {
+            text = flatExpression(1 + random() % 30, random());
+        }
+        int extra = random() % 2 ? 0 : random() % 6;
+        for (int k = 0; k < extra; k++) {
+            const std::string& piece = pieces[random() % (sizeof(pieces) / sizeof(pieces[0]))];
+            text.insert(random() % (text.size() + 1), piece);
+        }
+        std::string tree = outcome([&] { return compileToMachineCode(text, machine); });
+        std::string onePass = outcome([&] { return compileOnePass(text, machine); });
+        if (tree != onePass) mismatches++;
+        if (tree.compare(0, 6, "error:") == 0) errors++;
+    }
+    std::cout << "equivalence, " << machineName(machine) << ": " << count << " random texts ("
+              << errors << " rejected), " << mismatches << " differ\n";
+}
+
+// The ARM64 assembler as it was before the target tables: one regular
+// expression per instruction format, built once
+class RegexAssembler {
+public:
+    std::vector<uint32_t> assemble(const std::vector<std::string>& lines) {
+        std::vector<uint32_t> words;
+        for (const auto& raw : lines) {
+            std::string line = raw.substr(std::min(raw.find_first_not_of(' '), raw.size()));
+            std::string instr = line.substr(0, line.find(' '));
+            std::smatch m;
+            if (instr == "mov" && std::regex_search(line, m, movPattern)) {
+                words.push_back(0xD2800000 | (std::stoi(m[1]) & 0x1F) | ((std::stoi(m[2]) & 0xFFFF) << 5));
+            } else if (instr != "ldr" && instr != "str" && std::regex_search(line, m, arithmeticPattern)) {
+                uint32_t base = m[1] == "add" ? 0x8B000000 : m[1] == "sub" ? 0xCB000000
+                              : m[1] == "mul" ? 0x9B007C00 : 0x9AC00C00;
+                words.push_back(base | (std::stoi(m[2]) & 0x1F) | ((std::stoi(m[3]) & 0x1F) << 5) |
+                                ((std::stoi(m[4]) & 0x1F) << 16));
+            } else if (instr == "ldr" && std::regex_search(line, m, loadPattern)) {
+                words.push_back(0xF8400400 | (std::stoi(m[1]) & 0x1F) | ((std::stoi(m[2]) / 8 & 0x1FF) << 12));
+            } else if (instr == "str" && std::regex_search(line, m, storePattern)) {
+                words.push_back(0xF8000C00 | (std::stoi(m[1]) & 0x1F) | ((std::stoi(m[2]) / 8 & 0x1FF) << 12));
+            } else {
+                throw std::runtime_error("Invalid instruction: " + line);
+            }
+        }
+        return words;
+    }
+
+private:
+    std::regex movPattern{R"(mov x(\d+),\s*#(\d+))"};
+    std::regex arithmeticPattern{R"((\w+)\s+x(\d+),\s*x(\d+),\s*x(\d+))"};
+    std::regex loadPattern{R"(ldr x(\d+),\s*\[sp\],\s*#(\d+))"};
+    std::regex storePattern{R"(str x(\d+),\s*\[sp,\s*#-(\d+)\]!)"};
+};
+
+// The assembly text the tree path hands its assembler
+static std::vector<std::string> assemblyLines(const std::string& text, Machine machine) {
+    Lexer lexer(text);
+    auto tokens = lexer.tokenize();
+    Parser parser(tokens);
+    CodeGenerator codegen(machine);
+    parser.parse()->generateCode(codegen);
+    std::vector<std::string> lines;
+    std::stringstream ss(codegen.getCode());
+    std::string line;
+    while (std::getline(ss, line)) {
+        if (!line.empty()) lines.push_back(line);
+    }
+    return lines;
+}
+
+
+static double timeIt(const std::function<void()>& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static const int runsPerRoute = 3;
+
+static double best(const std::function<void()>& fn) {
+    double fastest = 0;
+    for (int i = 0; i < runsPerRoute; i++) {
+        double seconds = timeIt(fn);
+        if (i == 0 || seconds < fastest) fastest = seconds;
+    }
+    return fastest;
+}
+
+static void encoding(const std::string& text) {
+    std::vector<std::string> arm = assemblyLines(text, Machine::Arm64);
+    std::vector<std::string> rv = assemblyLines(text, Machine::Rv64);
+    RegexAssembler regex;
+    Assembler armTables(Machine::Arm64);
+    Assembler rvTables(Machine::Rv64);
+
+    bool same = regex.assemble(arm) == armTables.assemble(arm);
+    std::cout << "encoding (" << arm.size() << " ARM64 lines, " << rv.size() << " RV64 lines), "
+              << (same ? "regular expressions and tables agree" : "REGULAR EXPRESSIONS AND TABLES DIFFER") << "\n";
+    auto report = [](const std::string& route, size_t lines, double seconds) {
+        std::cout << "  " << std::left << std::setw(18) << route << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(10) << seconds * 1000 << " ms"
+                  << std::setw(10) << std::setprecision(1) << lines / seconds / 1e6 << " M lines/s\n";
+    };
+    report("arm64 regex", arm.size(), best([&] { regex.assemble(arm); }));
+    report("arm64 tables", arm.size(), best([&] { armTables.assemble(arm); }));
+    report("rv64 tables", rv.size(), best([&] { rvTables.assemble(rv); }));
+}
+
+static void throughput(const std::string& route, const std::string& text, long terms,
+                       const std::function<std::vector<uint32_t>(const std::string&)>& compile) {
+    double fastest = best([&] { compile(text); });
+    std::cout << "  " << std::left << std::setw(18) << route << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << fastest * 1000 << " ms"
+              << std::setw(10) << std::setprecision(1) << terms / fastest / 1e6 << " M terms/s"
+              << std::setw(10) << text.size() / fastest / (1024 * 1024) << " MiB/s\n";
+}
+
+// Peak RSS of a child process that builds the text and compiles it (or
+// does nothing more, for the baseline), in KiB
+static long peakKiB(long terms, const std::function<void(const std::string&)>& compile) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        std::string text = flatExpression(terms, 7);
+        if (compile) compile(text);
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        long kib = usage.ru_maxrss;
+        ssize_t written = write(fds[1], &kib, sizeof(kib));
+        _exit(written == sizeof(kib) ? 0 : 1);
+    }
+    close(fds[1]);
+    long kib = -1;
+    if (read(fds[0], &kib, sizeof(kib)) != sizeof(kib)) kib = -1;
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    return kib;
+}
+
+static void memory(const std::string& route, long terms,
+                   const std::function<void(const std::string&)>& compile) {
+    long baseline = peakKiB(terms, nullptr);
+    long peak = peakKiB(terms, compile);
+    std::cout << "  " << std::left << std::setw(10) << route << std::right << std::fixed
+              << std::setprecision(1) << std::setw(10) << peak / 1024.0 << " MiB peak RSS"
+              << std::setw(10) << (peak - baseline) / 1024.0 << " MiB above the source"
+              << std::setw(8) << (peak - baseline) * 1024.0 / terms << " bytes/term\n";
+}
+
+// A constant expression and a converter with one argument, each computed
+// through the runtime front end (the converter's text built for every
+// value, as a program without CONSTEXPR_CALC would) and through constexpr_calc.hpp
+static void constantExpressions() {
+    const long count = 1000000;
+    const char* constant = "12 * 8 / 2 + 7 - 3";
+    volatile double input = 21;
+    volatile double sink = 0;
+
+    auto runtime = [](const std::string& text) {
+        Lexer lexer(text);
+        auto tokens = lexer.tokenize();
+        Parser parser(tokens);
+        return parser.parse()->evaluate();
+    };
+    auto report = [count](const std::string& route, double seconds) {
+        std::cout << "  " << std::left << std::setw(28) << route << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(10) << seconds * 1000 << " ms"
+                  << std::setw(10) << std::setprecision(1) << seconds * 1e9 / count << " ns each\n";
+    };
+
+    std::cout << "constant expressions (" << count << " evaluations)\n";
+    std::string text = constant;
+    report("runtime front end", best([&] {
+        for (long i = 0; i < count; i++) sink = runtime(text);
+    }));
+    report("ConstexprCalc at runtime", best([&] {
+        for (long i = 0; i < count; i++) sink = ConstexprCalc::evaluate(text);
+    }));
+    report("ConstexprCalc constant", best([&] {
+        for (long i = 0; i < count; i++) {
+            constexpr double value = ConstexprCalc::evaluate("12 * 8 / 2 + 7 - 3");
+            sink = value;
+        }
+    }));
+
+    report("converter, runtime", best([&] {
+        for (long i = 0; i < count; i++) sink = runtime(std::to_string(int(input)) + " * 9 / 5 + 32");
+    }));
+    report("converter, CONSTEXPR_CALC", best([&] {
+        for (long i = 0; i < count; i++) sink = fahrenheit(input);
+    }));
+}
+
+int main(int argc, char* argv[]) {
+    long scale = argc > 1 ? std::stol(argv[1]) : 1;
+
+    // The tree path recurses once per operator, so its expressions stay
+    // short enough for the default 8 MiB stack (it crashes at about 60,000
+    // terms). Its throughput is measured on an even shorter one, which the
+    // regular expressions of the old assembler get through in reasonable time.
+    long terms = 40000;
+    long shortTerms = 5000;
+    long longTerms = 4000000 * scale;
+
+    equivalenceCheck(Machine::Arm64);
+    equivalenceCheck(Machine::Rv64);
+
+    auto tree = [](const std::string& text) { return compileToMachineCode(text); };
+    auto onePass = [](const std::string& text) { return compileOnePass(text); };
+    auto rvTree = [](const std::string& text) { return compileToMachineCode(text, Machine::Rv64); };
+    auto rvOnePass = [](const std::string& text) { return compileOnePass(text, Machine::Rv64); };
+
+    // Memory first, while this process is still small: the children inherit it
+    std::cout << "memory (" << terms << " terms)\n";
+    memory("tree", terms, tree);
+    memory("one pass", terms, onePass);
+    std::cout << "memory (" << longTerms << " terms)\n";
+    memory("one pass", longTerms, onePass);
+
+    std::string text = flatExpression(shortTerms, 7);
+    encoding(text);
+    std::cout << "throughput (" << shortTerms << " terms, " << text.size() / 1024 << " KiB)\n";
+    throughput("arm64 tree", text, shortTerms, tree);
+    throughput("arm64 one pass", text, shortTerms, onePass);
+    throughput("rv64 tree", text, shortTerms, rvTree);
+    throughput("rv64 one pass", text, shortTerms, rvOnePass);
+
+    std::string longText = flatExpression(longTerms, 7);
+    std::cout << "throughput (" << longTerms << " terms, " << longText.size() / (1024 * 1024) << " MiB)\n";
+    throughput("arm64 one pass", longText, longTerms, onePass);
+    throughput("rv64 one pass", longText, longTerms, rvOnePass);
+
+    constantExpressions();
+    return 0;
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include "selector.hpp"
 #include <string>
 #include <sstream>
 #include <memory>
@@ -24,11 +25,16 @@ For binary operations,
     ldr x1, [sp], #16
     add x0, x0, x1   // 2 + (3 * 4)
 
+That is ARM64. The expressions only ask for operations (load a number, push,
+pop, add, ...), and the target's tables in target.hpp say which
+instructions carry them out, so for RV64 the same expression starts
+li a0, 4 / addi sp, sp, -16 / sd a0, 0(sp) / li a0, 3 / ...
+
 */
 
 class CodeGenerator {
 public:
-    CodeGenerator() : label_count(0) {}
+    explicit CodeGenerator(Machine machine = Machine::Arm64) : machine(machine), label_count(0) {}
     
     // Get the generated assembly code
     std::string getCode() const { return output.str(); }
@@ -43,7 +49,26 @@ public:
         output << "    " << line << "\n";
     }
 
+    // Add the instructions for an operation on the target
+    void emit(Operation operation, int64_t immediate = 0) {
+        switch (machine) {
+            case Machine::Arm64: emitFor<Targets::Arm64>(operation, immediate); break;
+            case Machine::Rv64: emitFor<Targets::Rv64>(operation, immediate); break;
+        }
+    }
+
 private:
     std::stringstream output;
+    Machine machine;
     int label_count;
+
+    template <typename Target>
+    void emitFor(Operation operation, int64_t immediate) {
+        auto selection = InstructionSelector<Target>::select(operation, immediate);
+        for (size_t i = 0; i < selection.count; i++) {
+            std::string line;
+            InstructionSelector<Target>::print(selection.instructions[i], line);
+            emit(line);
+        }
+    }
 };
\ No newline at end of file
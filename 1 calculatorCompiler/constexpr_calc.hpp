@@ -0,0 +1,417 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+
+/*
+The calculator front end again, as constexpr functions, so expressions that
+are fixed when the program is built are parsed and computed by the C++
+compiler instead of going through Lexer, Parser and evaluate() at runtime.
+
+The grammar and precedence are those of Parser::expression/term/factor:
+
+    expression → term (('+' | '-') term)*
+    term       → factor (('*' | '/') factor)*
+    factor     → NUMBER | '$' NUMBER
+
+'$' NUMBER is an argument, only allowed in CONSTEXPR_CALC (see below): its
+value is passed in when the expression is evaluated. Numbers and results are
+doubles, and every operation is done in the same order as in the tree, so a
+result is exactly what evaluate() returns for the same text.
+
+Two ways to use it:
+
+    // A constant, computed while compiling; an error does not compile.
+    // Without the constexpr on the variable it may be computed at runtime.
+    constexpr double area = ConstexprCalc::evaluate("12 * 8 / 2");
+
+    // An evaluator specialized for one expression: parsed while compiling,
+    // constant subexpressions folded, the rest inlined into straight-line code
+    constexpr auto scale = CONSTEXPR_CALC("$0 * 9 / 5 + 32");
+    double fahrenheit = scale(celsius);
+
+Differences from the runtime parser: text after the expression is an error
+(Parser::parse() ignores it), and a division by zero in a constant
+expression does not compile (evaluate() gives an infinity). Numbers are
+rounded exactly as std::stod() rounds them, however long they are, and ones
+too large for a double are errors in both. Called with a string only known
+at runtime, evaluate() works like the runtime front end and throws
+std::runtime_error on errors; `calc_compiler check` compares the two, using
+Calculator::offset() to see where a failed expression stopped.
+*/
+
+namespace ConstexprCalc {
+
+// Reads tokens straight out of the text, like Lexer without the vector
+class Reader {
+public:
+    constexpr explicit Reader(std::string_view text) : text(text) {}
+
+    // Skip whitespace and look at the next character ('\0' at the end)
+    constexpr char peek() {
+        while (position < text.size() && isSpace(text[position])) position++;
+        return position < text.size() ? text[position] : '\0';
+    }
+
+    constexpr bool match(char c) {
+        if (peek() != c) return false;
+        position++;
+        return true;
+    }
+
+    constexpr bool atEnd() { return peek() == '\0'; }
+
+    constexpr bool atNumber() { return isDigit(peek()); }
+
+    // Where reading stopped: at the token that failed, or after the last one
+    constexpr size_t offset() const { return position; }
+
+    constexpr double number() {
+        peek();
+        Digits digits;
+        while (position < text.size() && isDigit(text[position])) {
+            digits.append(text[position++] - '0');
+        }
+        return digits.toDouble();
+    }
+
+    // '$' NUMBER
+    constexpr size_t argument() {
+        position++;
+        if (position >= text.size() || !isDigit(text[position])) {
+            throw std::runtime_error("Expected an argument number after $");
+        }
+        size_t index = 0;
+        while (position < text.size() && isDigit(text[position])) {
+            index = index * 10 + (text[position++] - '0');
+        }
+        return index;
+    }
+
+private:
+    std::string_view text;
+    size_t position = 0;
+
+    // A number as an exact binary integer, rounded to a double only once at
+    // the end, to the nearest (ties to even) as std::stod() rounds it
+    class Digits {
+    public:
+        constexpr void append(int digit) {
+            uint64_t carry = digit;
+            for (size_t i = 0; i < used; i++) {
+                uint64_t product = uint64_t(limbs[i]) * 10 + carry;
+                limbs[i] = uint32_t(product);
+                carry = product >> 32;
+            }
+            if (carry) {
+                if (used == limbCount) {
+                    tooLarge = true;
+                } else {
+                    limbs[used++] = uint32_t(carry);
+                }
+            }
+        }
+
+        constexpr double toDouble() const {
+            size_t bits = bitLength();
+            if (tooLarge || bits > 1024) throw std::runtime_error("Number out of range");
+            if (bits <= 64) return static_cast<double>(top64(64));
+
+            // The 53 highest bits, rounded with the 11 below them and whether
+            // anything further down is set
+            uint64_t high = top64(bits);
+            uint64_t mantissa = high >> 11;
+            uint64_t rest = high & 0x7FF;
+            bool sticky = anyBelow(bits - 64);
+            if (rest > 0x400 || (rest == 0x400 && (sticky || (mantissa & 1)))) {
+                mantissa++;
+                if (mantissa == uint64_t(1) << 53) {
+                    mantissa >>= 1;
+                    bits++;
+                }
+            }
+            if (bits > 1024) throw std::runtime_error("Number out of range");
+            double value = static_cast<double>(mantissa);
+            for (size_t i = 53; i < bits; i++) value *= 2;
+            return value;
+        }
+
+    private:
+        // 1280 bits hold every number below 2^1024 with room to detect the rest
+        static constexpr size_t limbCount = 40;
+        uint32_t limbs[limbCount] = {};
+        size_t used = 0;  // Limbs below which every set bit is
+        bool tooLarge = false;
+
+        constexpr bool bit(size_t i) const { return (limbs[i / 32] >> (i % 32)) & 1; }
+
+        constexpr size_t bitLength() const {
+            for (size_t i = used * 32; i > 0; i--) {
+                if (bit(i - 1)) return i;
+            }
+            return 0;
+        }
+
+        // The 64 bits below bit number end
+        constexpr uint64_t top64(size_t end) const {
+            uint64_t value = 0;
+            for (size_t i = end; i-- > end - 64;) value = (value << 1) | bit(i);
+            return value;
+        }
+
+        constexpr bool anyBelow(size_t end) const {
+            for (size_t i = 0; i < end; i++) {
+                if (bit(i)) return true;
+            }
+            return false;
+        }
+    };
+
+    // std::isspace() and std::isdigit() in the "C" locale, which are not constexpr
+    static constexpr bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+    static constexpr bool isDigit(char c) { return c >= '0' && c <= '9'; }
+};
+
+constexpr double apply(char op, double left, double right) {
+    switch (op) {
+        case '+': return left + right;
+        case '-': return left - right;
+        case '*': return left * right;
+        default: return left / right;
+    }
+}
+
+// Parse and compute in one pass; the operands are combined in the same
+// order as BinaryExpr::evaluate() combines them
+class Calculator {
+public:
+    constexpr explicit Calculator(std::string_view text) : reader(text) {}
+
+    constexpr double run() {
+        double value = expression();
+        if (!reader.atEnd()) throw std::runtime_error("Unexpected token");
+        return value;
+    }
+
+    // After run() has thrown, the start of the token it failed at
+    constexpr size_t offset() const { return reader.offset(); }
+
+private:
+    Reader reader;
+
+    constexpr double expression() {
+        double value = term();
+        while (true) {
+            if (reader.match('+')) {
+                value = apply('+', value, term());
+            } else if (reader.match('-')) {
+                value = apply('-', value, term());
+            } else {
+                return value;
+            }
+        }
+    }
+
+    constexpr double term() {
+        double value = factor();
+        while (true) {
+            if (reader.match('*')) {
+                value = apply('*', value, factor());
+            } else if (reader.match('/')) {
+                value = apply('/', value, factor());
+            } else {
+                return value;
+            }
+        }
+    }
+
+    constexpr double factor() {
+        if (reader.atNumber()) return reader.number();
+        if (reader.peek() == '$') throw std::runtime_error("Arguments need CONSTEXPR_CALC");
+        throw std::runtime_error("Unexpected token");
+    }
+};
+
+// The value of a constant expression
+constexpr double evaluate(std::string_view text) {
+    return Calculator(text).run();
+}
+
+// Expression trees for CONSTEXPR_CALC, stored in postorder (root last)
+
+enum class Kind { Number, Argument, Operator };
+
+struct Node {
+    Kind kind = Kind::Number;
+    double value = 0;     // Number
+    size_t argument = 0;  // Argument
+    char op = 0;          // Operator: one of + - * /
+    size_t left = 0;      // Operator: where the operands are
+    size_t right = 0;
+};
+
+template <size_t Capacity>
+struct Tree {
+    std::array<Node, Capacity> nodes{};
+    size_t count = 0;
+    size_t arguments = 0;  // One more than the highest argument number
+
+    constexpr size_t root() const { return count - 1; }
+};
+
+// Room for every tree of the text: numbers and arguments, and one operator
+// fewer than them (folding only ever removes nodes)
+constexpr size_t capacity(std::string_view text) {
+    Reader reader(text);
+    size_t operands = 0;
+    while (!reader.atEnd()) {
+        if (reader.atNumber()) {
+            reader.number();
+            operands++;
+        } else if (reader.peek() == '$') {
+            reader.argument();
+            operands++;
+        } else {
+            reader.match(reader.peek());
+        }
+    }
+    return operands > 0 ? 2 * operands - 1 : 1;
+}
+
+template <size_t Capacity>
+class TreeBuilder {
+public:
+    constexpr explicit TreeBuilder(std::string_view text) : reader(text) {}
+
+    constexpr Tree<Capacity> run() {
+        expression();
+        if (!reader.atEnd()) throw std::runtime_error("Unexpected token");
+        return tree;
+    }
+
+private:
+    Reader reader;
+    Tree<Capacity> tree;
+
+    // Both operands are the last nodes added. If they are numbers the
+    // operation is done right away; otherwise an operator node joins them.
+    constexpr void binary(char op, size_t left) {
+        size_t right = tree.root();
+        Node& l = tree.nodes[left];
+        Node& r = tree.nodes[right];
+        if (l.kind == Kind::Number && r.kind == Kind::Number) {
+            l.value = apply(op, l.value, r.value);
+            tree.count = left + 1;
+            return;
+        }
+        Node& node = tree.nodes[tree.count++];
+        node.kind = Kind::Operator;
+        node.op = op;
+        node.left = left;
+        node.right = right;
+    }
+
+    constexpr void expression() {
+        term();
+        while (true) {
+            size_t left = tree.root();
+            if (reader.match('+')) {
+                term();
+                binary('+', left);
+            } else if (reader.match('-')) {
+                term();
+                binary('-', left);
+            } else {
+                return;
+            }
+        }
+    }
+
+    constexpr void term() {
+        factor();
+        while (true) {
+            size_t left = tree.root();
+            if (reader.match('*')) {
+                factor();
+                binary('*', left);
+            } else if (reader.match('/')) {
+                factor();
+                binary('/', left);
+            } else {
+                return;
+            }
+        }
+    }
+
+    constexpr void factor() {
+        Node& node = tree.nodes[tree.count];
+        if (reader.atNumber()) {
+            node.kind = Kind::Number;
+            node.value = reader.number();
+        } else if (reader.peek() == '$') {
+            node.kind = Kind::Argument;
+            node.argument = reader.argument();
+            if (node.argument + 1 > tree.arguments) tree.arguments = node.argument + 1;
+        } else {
+            throw std::runtime_error("Unexpected token");
+        }
+        tree.count++;
+    }
+};
+
+// Source is a type whose static text() returns the expression; see CONSTEXPR_CALC
+template <typename Source>
+class Evaluator {
+    static constexpr std::string_view text = Source::text();
+    static constexpr auto tree = TreeBuilder<capacity(text)>(text).run();
+
+    // One instantiation per node, so each becomes a few inlined instructions
+    template <size_t Index>
+    static constexpr double at(const double* values) {
+        constexpr Node node = tree.nodes[Index];
+        if constexpr (node.kind == Kind::Number) {
+            return node.value;
+        } else if constexpr (node.kind == Kind::Argument) {
+            return values[node.argument];
+        } else {
+            double left = at<node.left>(values);
+            double right = at<node.right>(values);
+            return apply(node.op, left, right);
+        }
+    }
+
+public:
+    // How many arguments the expression takes ($0 to $arguments-1)
+    static constexpr size_t arguments = tree.arguments;
+
+    // Nodes left once constants are folded; 1 for a constant expression
+    static constexpr size_t nodes = tree.count;
+
+    template <typename... Args>
+    constexpr double operator()(Args... args) const {
+        static_assert(sizeof...(Args) == arguments, "wrong number of arguments for the expression");
+        const double values[] = {static_cast<double>(args)..., 0.0};
+        return at<tree.root()>(values);
+    }
+};
+
+template <typename Source>
+constexpr Evaluator<Source> compile(Source) {
+    return {};
+}
+
+}  // namespace ConstexprCalc
+
+// An evaluator for the expression, which must be a string literal. The
+// literal is wrapped in a local type so that it can select a template.
+#define CONSTEXPR_CALC(expression)                                               \
+    ::ConstexprCalc::compile([] {                                                \
+        struct Source {                                                          \
+            static constexpr std::string_view text() { return expression; }      \
+        };                                                                       \
+        return Source{};                                                         \
+    }())
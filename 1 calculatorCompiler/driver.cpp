@@ -0,0 +1,139 @@
+#include "driver.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "codegen.hpp"
+#include "assembler.hpp"
+#include "linker.hpp"
+#include "object.hpp"
+#include "onepass.hpp"
+#include "alloc.hpp"
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+std::vector<uint32_t> compileToMachineCode(const std::string& source, Machine machine) {
+    // Lexical analysis
+    AllocationTracker::enter(AllocationTracker::Lex);
+    Lexer lexer(source);
+    auto tokens = lexer.tokenize();
+
+    // Parsing
+    AllocationTracker::enter(AllocationTracker::Parse);
+    Parser parser(tokens);
+    auto expr = parser.parse();
+
+    // Code generation
+    AllocationTracker::enter(AllocationTracker::Codegen);
+    CodeGenerator codegen(machine);
+    expr->generateCode(codegen);
+
+    // Split assembly into lines
+    AllocationTracker::enter(AllocationTracker::Assemble);
+    std::string assembly = codegen.getCode();
+    std::vector<std::string> lines;
+    std::stringstream ss(assembly);
+    std::string line;
+    while (std::getline(ss, line)) {
+        if (!line.empty()) {
+            lines.push_back(line);
+        }
+    }
+
+    // Assembly
+    Assembler assembler(machine);
+    return assembler.assemble(lines);
+}
+
+double evaluateExpression(const std::string& source) {
+    Lexer lexer(source);
+    auto tokens = lexer.tokenize();
+    Parser parser(tokens);
+    return parser.parse()->evaluate();
+}
+
+BuildDriver::BuildDriver(std::string cacheDir, bool onePass, Machine machine)
+    : cacheDir(std::move(cacheDir)), onePass(onePass), machine(machine) {}
+
+// Object files are named after the source, plus a hash of its path so that
+// sources with the same name in different directories do not collide
+std::string BuildDriver::objectPath(const std::string& source) const {
+    std::string absolute = std::filesystem::absolute(source).string();
+    char suffix[17];
+    std::snprintf(suffix, sizeof(suffix), "%016llx",
+                  static_cast<unsigned long long>(hashBytes(absolute.data(), absolute.size())));
+    std::string stem = std::filesystem::path(source).stem().string();
+    return (std::filesystem::path(cacheDir) / (stem + "-" + suffix + ".o")).string();
+}
+
+bool BuildDriver::isUpToDate(const std::string& objectPath, uint64_t sourceHash) const {
+    if (!std::filesystem::exists(objectPath)) {
+        return false;
+    }
+    try {
+        ObjectFile object(objectPath);
+        return object.sourceHash() == sourceHash && object.machine() == machine;
+    } catch (const std::runtime_error&) {
+        // Corrupt or from another format version: just compile it again
+        return false;
+    }
+}
+
+void BuildDriver::build(const std::vector<std::string>& sources, const std::string& outputPath) {
+    compiled = 0;
+    reused = 0;
+    std::filesystem::create_directories(cacheDir);
+
+    std::vector<std::string> objects;
+    for (const auto& source : sources) {
+        AllocationTracker::enter(AllocationTracker::Other);
+        std::ifstream file(source, std::ios::binary);
+        if (!file) {
+            throw std::runtime_error("Cannot open source file: " + source);
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        std::string text = buffer.str();
+
+        std::string object = objectPath(source);
+        uint64_t sourceHash = hashBytes(text.data(), text.size());
+        objects.push_back(object);
+
+        if (isUpToDate(object, sourceHash)) {
+            reused++;
+            continue;
+        }
+
+        // The lexer does not expect anything after the expression
+        while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back()))) {
+            text.pop_back();
+        }
+        // Still charged to the assembler: writing out what it made. One pass
+        // does every stage at once, so all of it counts as code generation.
+        std::vector<uint32_t> machineCode;
+        if (onePass) {
+            AllocationTracker::enter(AllocationTracker::Codegen);
+            machineCode = compileOnePass(text, machine);
+        } else {
+            machineCode = compileToMachineCode(text, machine);
+        }
+        std::vector<Symbol> symbols = {
+            {"_" + std::filesystem::path(source).stem().string(), 0, false}
+        };
+        writeObjectFile(object, machineCode, symbols, {}, sourceHash, machine);
+        compiled++;
+    }
+
+    // Link straight from the mapped objects
+    AllocationTracker::enter(AllocationTracker::Link);
+    Linker linker;
+    std::vector<std::unique_ptr<ObjectFile>> mapped;
+    for (const auto& object : objects) {
+        mapped.push_back(std::make_unique<ObjectFile>(object));
+        linker.addObjectFile(*mapped.back());
+    }
+    linker.createExecutable(outputPath);
+}
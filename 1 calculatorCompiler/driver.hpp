@@ -0,0 +1,46 @@
+#pragma once
+#include "target.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Run one expression through lexer, parser, code generator and assembler
+std::vector<uint32_t> compileToMachineCode(const std::string& source, Machine machine = Machine::Arm64);
+
+// Same as the calculator's evaluate(): lexer, parser, Expression::evaluate()
+double evaluateExpression(const std::string& source);
+
+/*
+Separate compilation with a cache of object files.
+
+Each source file holds one expression and becomes one object file in the
+cache directory, defining a symbol named after the file ("_" + stem). On
+every build the driver hashes each source and compares it with the source
+hash stored in its cached object: unchanged sources are not recompiled,
+changed (or new, or unreadable) ones are. Then every object is mapped and
+linked into the executable. With onePass, sources are compiled by
+compileOnePass() (onepass.hpp) instead; the objects are the same either way.
+Objects are for one machine (target.hpp); one built for another is compiled
+again.
+*/
+class BuildDriver {
+public:
+    explicit BuildDriver(std::string cacheDir, bool onePass = false, Machine machine = Machine::Arm64);
+
+    // Bring the cache up to date and link all sources into outputPath
+    void build(const std::vector<std::string>& sources, const std::string& outputPath);
+
+    // What the last build did
+    int compiledCount() const { return compiled; }
+    int reusedCount() const { return reused; }
+
+private:
+    std::string cacheDir;
+    bool onePass;
+    Machine machine;
+    int compiled = 0;
+    int reused = 0;
+
+    std::string objectPath(const std::string& source) const;
+    bool isUpToDate(const std::string& objectPath, uint64_t sourceHash) const;
+};
@@ -1,4 +1,5 @@
 #include "linker.hpp"
+#include "object.hpp"
 #include <fstream>
 #include <stdexcept>
 
@@ -25,6 +26,22 @@ void Linker::addObjectFile(const std::vector<uint32_t>& code,
                       fileRelocations.end());
 }
 
+void Linker::addObjectFile(const ObjectFile& object) {
+    // Code words are copied straight out of the mapping
+    objectCode.emplace_back(object.code(), object.code() + object.codeCount());
+
+    for (size_t i = 0; i < object.symbolCount(); i++) {
+        const ObjectSymbol& sym = object.symbols()[i];
+        std::string name = object.string(sym.nameOffset);
+        symbolTable[name] = Symbol{name, sym.address, sym.isExternal != 0};
+    }
+
+    for (size_t i = 0; i < object.relocationCount(); i++) {
+        const ObjectRelocation& reloc = object.relocations()[i];
+        relocations.push_back(Relocation{reloc.offset, object.string(reloc.symbolOffset), reloc.type});
+    }
+}
+
 void Linker::createExecutable(const std::string& outputPath) {
     // Resolve all symbol addresses
     resolveSymbols();
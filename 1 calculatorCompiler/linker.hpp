@@ -10,6 +10,8 @@ struct Symbol {
     bool isExternal;
 };
 
+class ObjectFile;
+
 struct Relocation {
     uint64_t offset;    // Where to apply the relocation
     std::string symbol; // Symbol to link to
@@ -24,6 +26,9 @@ public:
     void addObjectFile(const std::vector<uint32_t>& code,
                       const std::vector<Symbol>& symbols,
                       const std::vector<Relocation>& relocations);
+
+    // Add an object file mapped from disk (see object.hpp)
+    void addObjectFile(const ObjectFile& object);
                       
     // Add a library to link against
     void addLibrary(const std::string& libraryPath);
@@ -1,46 +1,267 @@
+#include "driver.hpp"
+#include "linker.hpp"
+#include "alloc.hpp"
+#include "constexpr_calc.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
-#include "codegen.hpp"
-#include "assembler.hpp"
-#include "linker.hpp"
+#include "server.hpp"
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <functional>
+#include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <thread>
+
+// calc_compiler [--alloc-stats] build [-o output] [--cache dir] [--one-pass] [--target arm64|rv64] source...
+// Compiles each source to a cached object file and links them
+static int build(int argc, char* argv[]) {
+    std::string output = "calculator";
+    std::string cacheDir = ".calc-cache";
+    bool onePass = false;
+    std::string target = "arm64";
+    std::vector<std::string> sources;
+
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            output = argv[++i];
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cacheDir = argv[++i];
+        } else if (arg == "--one-pass") {
+            onePass = true;
+        } else if (arg == "--target" && i + 1 < argc) {
+            target = argv[++i];
+        } else {
+            sources.push_back(arg);
+        }
+    }
+    if (sources.empty()) {
+        std::cerr << "Usage: calc_compiler [--alloc-stats] build [-o output] [--cache dir] [--one-pass] "
+                     "[--target arm64|rv64] source...\n";
+        return 1;
+    }
+
+    try {
+        BuildDriver driver(cacheDir, onePass, parseMachine(target));
+        driver.build(sources, output);
+        std::cout << "Compiled " << driver.compiledCount() << ", reused "
+                  << driver.reusedCount() << " cached object(s)\n";
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+// The result of an expression, or its error
+static std::string outcome(const std::function<double()>& compute) {
+    try {
+        double value = compute();
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.17g", value);
+        return text;
+    } catch (const std::exception& e) {
+        return std::string("error: ") + e.what();
+    }
+}
+
+// calc_compiler check [expression...]
+// Evaluates each expression (or each line of standard input) with the
+// runtime front end and with ConstexprCalc::evaluate(), and reports where
+// they differ. Text after an expression is not counted: the runtime parser
+// ignores it and ConstexprCalc rejects it. Such a rejection only agrees if
+// ConstexprCalc stopped at the token the runtime parser stopped at, and the
+// text before it gives the same result both ways.
+static int check(int argc, char* argv[]) {
+    std::vector<std::string> expressions(argv + 2, argv + argc);
+    if (expressions.empty()) {
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            expressions.push_back(line);
+        }
+    }
+
+    int mismatches = 0;
+    for (const auto& text : expressions) {
+        size_t runtimeTokens = 0;
+        std::string runtime = outcome([&] {
+            Lexer lexer(text);
+            auto tokens = lexer.tokenize();
+            Parser parser(tokens);
+            double value = parser.parse()->evaluate();
+            runtimeTokens = parser.consumed();
+            return value;
+        });
+        size_t stoppedAt = 0;
+        std::string compiled = outcome([&] {
+            ConstexprCalc::Calculator calculator(text);
+            try {
+                return calculator.run();
+            } catch (...) {
+                stoppedAt = calculator.offset();
+                throw;
+            }
+        });
+        // Both fail, for whatever reason: they agree that it is not an expression
+        bool runtimeFailed = runtime.compare(0, 6, "error:") == 0;
+        bool compiledFailed = compiled.compare(0, 6, "error:") == 0;
+        bool agree = runtime == compiled || (runtimeFailed && compiledFailed);
+        if (!agree && !runtimeFailed && compiled == "error: Unexpected token") {
+            // Trailing text: the same expression in front of the same token
+            std::string prefix = text.substr(0, stoppedAt);
+            prefix.erase(prefix.find_last_not_of(" \t\n\v\f\r") + 1);
+            agree = Lexer(prefix).tokenize().size() - 1 == runtimeTokens &&
+                    outcome([&] { return ConstexprCalc::evaluate(prefix); }) == runtime;
+        }
+        if (!agree) {
+            mismatches++;
+            std::cout << text << "\n    runtime:   " << runtime << "\n    constexpr: " << compiled << "\n";
+        }
+    }
+    std::cout << expressions.size() << " expression(s), " << mismatches << " mismatch(es)\n";
+    return mismatches == 0 ? 0 : 1;
+}
+
+static const char* const defaultSocket = "/tmp/calc_compiler.sock";
+
+static CompileServer* runningServer = nullptr;
+
+static void stopServer(int) {
+    if (runningServer) runningServer->stop();
+}
+
+// calc_compiler [--alloc-stats] serve [--socket path] [--workers n]
+// Answers compile and evaluate requests (server.hpp) until interrupted
+static int serve(int argc, char* argv[]) {
+    std::string socketPath = defaultSocket;
+    unsigned workers = std::max(std::thread::hardware_concurrency(), 1u);
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--socket" && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else {
+            std::cerr << "Usage: calc_compiler [--alloc-stats] serve [--socket path] [--workers n]\n";
+            return 1;
+        }
+    }
+    // The tracker counts from one thread only
+    if (AllocationTracker::enabled) workers = 1;
+
+    try {
+        CompileServer server(socketPath, workers);
+        runningServer = &server;
+        struct sigaction action = {};
+        action.sa_handler = stopServer;
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        std::cout << "Serving on " << socketPath << " with " << workers << " worker(s)" << std::endl;
+
+        server.run();
+        runningServer = nullptr;
+        std::cout << "Answered " << server.requestCount() << " request(s) in "
+                  << server.batchCount() << " batch(es), largest " << server.largestBatch() << "\n";
+    } catch (const std::exception& e) {
+        runningServer = nullptr;
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
+
+// calc_compiler load [--socket path] [--connections n] [--depth n] [--requests n]
+//                    [--terms n] [--compile | --one-pass | --evaluate]
+// Puts a running server under load and reports its latency and throughput
+static int load(int argc, char* argv[]) {
+    LoadOptions options;
+    options.socketPath = defaultSocket;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--socket" && hasValue) {
+            options.socketPath = argv[++i];
+        } else if (arg == "--connections" && hasValue) {
+            options.connections = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--depth" && hasValue) {
+            options.depth = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--requests" && hasValue) {
+            options.requests = std::stol(argv[++i]);
+        } else if (arg == "--terms" && hasValue) {
+            options.terms = std::stol(argv[++i]);
+        } else if (arg == "--compile") {
+            options.kind = Protocol::Compile;
+        } else if (arg == "--one-pass") {
+            options.kind = Protocol::CompileOnePass;
+        } else if (arg == "--evaluate") {
+            options.kind = Protocol::Evaluate;
+        } else {
+            std::cerr << "Usage: calc_compiler load [--socket path] [--connections n] [--depth n] "
+                         "[--requests n] [--terms n] [--compile | --one-pass | --evaluate]\n";
+            return 1;
+        }
+    }
+
+    try {
+        LoadReport report = runLoad(options);
+        std::cout << std::fixed << std::setprecision(1)
+                  << report.requests << " request(s) in " << std::setprecision(2) << report.seconds << " s: "
+                  << std::setprecision(0) << report.requests / report.seconds << " requests/s, "
+                  << std::setprecision(1) << "p50 " << report.p50 << " us, p99 " << report.p99
+                  << " us, max " << report.max << " us\n"
+                  << report.failed << " failed, " << report.mismatched << " mismatched\n";
+        return report.mismatched == 0 ? 0 : 1;
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+// Prints the allocation report however main() returns
+struct AllocationReport {
+    ~AllocationReport() {
+        if (AllocationTracker::enabled) {
+            AllocationTracker::report(std::cerr);
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    // calc_compiler --alloc-stats [build ...]: count allocations per stage
+    AllocationReport allocationReport;
+    if (argc > 1 && std::string(argv[1]) == "--alloc-stats") {
+        AllocationTracker::enabled = true;
+        argc--;
+        argv++;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "build") {
+        return build(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "check") {
+        return check(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "serve") {
+        return serve(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "load") {
+        return load(argc, argv);
+    }
 
-int main() {
     while (true) {
+        AllocationTracker::enter(AllocationTracker::Other);
         std::string input;
         std::cout << "> ";
-        std::getline(std::cin, input);
+        // End of input ends the session like "exit" does
+        if (!std::getline(std::cin, input)) break;
         
         if (input == "exit") break;
         
         try {
-            // Lexical analysis
-            Lexer lexer(input);
-            auto tokens = lexer.tokenize();
-            
-            // Parsing
-            Parser parser(tokens);
-            auto expr = parser.parse();
-            
-            // Code generation
-            CodeGenerator codegen;
-            expr->generateCode(codegen);
-            
-            // Split assembly into lines
-            std::string assembly = codegen.getCode();
-            std::vector<std::string> lines;
-            std::stringstream ss(assembly);
-            std::string line;
-            while (std::getline(ss, line)) {
-                if (!line.empty()) {
-                    lines.push_back(line);
-                }
-            }
-            
-            // Assembly
-            Assembler assembler;
-            std::vector<uint32_t> machineCode = assembler.assemble(lines);
+            // Lexer, parser, code generator and assembler
+            std::vector<uint32_t> machineCode = compileToMachineCode(input);
             
             // // Output machine code (for demonstration)
             // std::cout << "\nMachine code:\n";
@@ -57,6 +278,7 @@ int main() {
             std::vector<Relocation> relocations;
             
             // Create linker and add our object code
+            AllocationTracker::enter(AllocationTracker::Link);
             Linker linker;
             linker.addObjectFile(machineCode, symbols, relocations);
             
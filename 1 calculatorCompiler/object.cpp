@@ -0,0 +1,164 @@
+#include "object.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint64_t hashBytes(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Round up to the alignment every table starts on
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+void writeObjectFile(const std::string& path,
+                     const std::vector<uint32_t>& code,
+                     const std::vector<Symbol>& symbols,
+                     const std::vector<Relocation>& relocations,
+                     uint64_t sourceHash,
+                     Machine machine) {
+    // Build the string table first so the records can refer to it
+    std::string strings;
+    auto addString = [&strings](const std::string& name) {
+        uint32_t offset = static_cast<uint32_t>(strings.size());
+        strings += name;
+        strings += '\0';
+        return offset;
+    };
+
+    std::vector<ObjectSymbol> symbolRecords;
+    for (const auto& sym : symbols) {
+        symbolRecords.push_back({sym.address, addString(sym.name), sym.isExternal ? 1u : 0u});
+    }
+    std::vector<ObjectRelocation> relocationRecords;
+    for (const auto& reloc : relocations) {
+        relocationRecords.push_back({reloc.offset, addString(reloc.symbol), reloc.type});
+    }
+
+    ObjectHeader header = {};
+    std::memcpy(header.magic, ObjectFormat::magic, sizeof(header.magic));
+    header.version = ObjectFormat::version;
+    header.codeCount = static_cast<uint32_t>(code.size());
+    header.sourceHash = sourceHash;
+    header.machine = static_cast<uint32_t>(machine);
+    header.symbolCount = static_cast<uint32_t>(symbolRecords.size());
+    header.relocationCount = static_cast<uint32_t>(relocationRecords.size());
+    header.stringTableSize = static_cast<uint32_t>(strings.size());
+    header.codeOffset = sizeof(ObjectHeader);
+    header.symbolOffset = align8(header.codeOffset + code.size() * sizeof(uint32_t));
+    header.relocationOffset = header.symbolOffset + symbolRecords.size() * sizeof(ObjectSymbol);
+    header.stringOffset = header.relocationOffset + relocationRecords.size() * sizeof(ObjectRelocation);
+
+    // Lay out the body exactly as it will sit in the file, then hash it
+    std::vector<unsigned char> body(header.stringOffset + strings.size() - sizeof(ObjectHeader), 0);
+    auto place = [&body](uint64_t offset, const void* src, size_t bytes) {
+        if (bytes) std::memcpy(body.data() + (offset - sizeof(ObjectHeader)), src, bytes);
+    };
+    place(header.codeOffset, code.data(), code.size() * sizeof(uint32_t));
+    place(header.symbolOffset, symbolRecords.data(), symbolRecords.size() * sizeof(ObjectSymbol));
+    place(header.relocationOffset, relocationRecords.data(),
+          relocationRecords.size() * sizeof(ObjectRelocation));
+    place(header.stringOffset, strings.data(), strings.size());
+    header.contentHash = hashBytes(body.data(), body.size());
+
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Cannot create object file: " + path);
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(body.data()), body.size());
+        if (!file) {
+            throw std::runtime_error("Cannot write object file: " + path);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot replace object file: " + path);
+    }
+}
+
+ObjectFile::ObjectFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open object file: " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(ObjectHeader))) {
+        close(fd);
+        throw std::runtime_error("Not an object file: " + path);
+    }
+    size = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Cannot map object file: " + path);
+    }
+    data = static_cast<const unsigned char*>(mapping);
+
+    try {
+        validate(path);
+    } catch (...) {
+        munmap(const_cast<unsigned char*>(data), size);
+        throw;
+    }
+}
+
+ObjectFile::~ObjectFile() {
+    munmap(const_cast<unsigned char*>(data), size);
+}
+
+// Checked once at load time, so the accessors can trust every offset
+void ObjectFile::validate(const std::string& path) const {
+    const ObjectHeader& h = header();
+    if (std::memcmp(h.magic, ObjectFormat::magic, sizeof(h.magic)) != 0) {
+        throw std::runtime_error("Not an object file: " + path);
+    }
+    if (h.version != ObjectFormat::version) {
+        throw std::runtime_error("Object file has version " + std::to_string(h.version) +
+                                 ", expected " + std::to_string(ObjectFormat::version) + ": " + path);
+    }
+
+    // The tables must follow each other in order and end exactly at the end of the file
+    bool laidOut =
+        h.codeOffset == sizeof(ObjectHeader) &&
+        h.symbolOffset == align8(h.codeOffset + uint64_t(h.codeCount) * sizeof(uint32_t)) &&
+        h.relocationOffset == h.symbolOffset + uint64_t(h.symbolCount) * sizeof(ObjectSymbol) &&
+        h.stringOffset == h.relocationOffset + uint64_t(h.relocationCount) * sizeof(ObjectRelocation) &&
+        h.stringOffset + h.stringTableSize == size;
+    if (!laidOut) {
+        throw std::runtime_error("Corrupt object file layout: " + path);
+    }
+
+    if (hashBytes(data + sizeof(ObjectHeader), size - sizeof(ObjectHeader)) != h.contentHash) {
+        throw std::runtime_error("Object file content hash mismatch: " + path);
+    }
+
+    // Every name must start inside the string table, and the table must end with a NUL
+    if (h.stringTableSize > 0 && string(0)[h.stringTableSize - 1] != '\0') {
+        throw std::runtime_error("Corrupt object string table: " + path);
+    }
+    for (size_t i = 0; i < symbolCount(); i++) {
+        if (symbols()[i].nameOffset >= h.stringTableSize) {
+            throw std::runtime_error("Corrupt object symbol table: " + path);
+        }
+    }
+    for (size_t i = 0; i < relocationCount(); i++) {
+        if (relocations()[i].symbolOffset >= h.stringTableSize) {
+            throw std::runtime_error("Corrupt object relocation table: " + path);
+        }
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include "linker.hpp"
+#include "target.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+On-disk object file, so a source can be compiled once and linked many times.
+
+Everything is a fixed-size record at an 8-byte aligned offset, so a file
+that has been mmap'ed is used in place: the linker reads code words and
+table entries straight out of the mapping, with no parsing step.
+
+    ObjectHeader
+    code words          uint32_t         x codeCount
+    symbol table        ObjectSymbol     x symbolCount
+    relocation table    ObjectRelocation x relocationCount
+    string table        NUL-terminated names, referenced by offset
+
+contentHash covers everything after the header, so a truncated or
+corrupted file is rejected. sourceHash is the hash of the source text the
+object was compiled from; the build driver uses it to skip unchanged sources.
+machine is the target the code is for (target.hpp); it used to be a reserved
+zero, which is ARM64, the only target there was then.
+Integers are stored in host byte order; a file from a machine of the other
+endianness fails the magic/version check and is simply recompiled.
+*/
+
+namespace ObjectFormat {
+    const char magic[8] = {'C', 'A', 'L', 'C', 'O', 'B', 'J', '\0'};
+    const uint32_t version = 1;  // Bump whenever the layout below changes
+}
+
+struct ObjectHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t codeCount;
+    uint64_t sourceHash;
+    uint64_t contentHash;
+    uint32_t symbolCount;
+    uint32_t relocationCount;
+    uint32_t stringTableSize;
+    uint32_t machine;
+    // Byte offsets from the start of the file
+    uint64_t codeOffset;
+    uint64_t symbolOffset;
+    uint64_t relocationOffset;
+    uint64_t stringOffset;
+};
+
+struct ObjectSymbol {
+    uint64_t address;
+    uint32_t nameOffset;  // Into the string table
+    uint32_t isExternal;
+};
+
+struct ObjectRelocation {
+    uint64_t offset;
+    uint32_t symbolOffset;  // Name of the target symbol, in the string table
+    uint32_t type;
+};
+
+static_assert(sizeof(ObjectHeader) == 80, "object header layout changed");
+static_assert(sizeof(ObjectSymbol) == 16, "object symbol layout changed");
+static_assert(sizeof(ObjectRelocation) == 16, "object relocation layout changed");
+
+// 64-bit FNV-1a, used for both source and content hashes
+uint64_t hashBytes(const void* data, size_t size);
+
+// Write an object file. The file is written under a temporary name and
+// renamed into place, so a crash never leaves a half-written object behind.
+void writeObjectFile(const std::string& path,
+                     const std::vector<uint32_t>& code,
+                     const std::vector<Symbol>& symbols,
+                     const std::vector<Relocation>& relocations,
+                     uint64_t sourceHash,
+                     Machine machine = Machine::Arm64);
+
+// A read-only, memory-mapped object file
+class ObjectFile {
+public:
+    // Maps and validates the file; throws std::runtime_error if it is not a
+    // well-formed object of the current version
+    explicit ObjectFile(const std::string& path);
+    ~ObjectFile();
+
+    ObjectFile(const ObjectFile&) = delete;
+    ObjectFile& operator=(const ObjectFile&) = delete;
+
+    uint64_t sourceHash() const { return header().sourceHash; }
+    Machine machine() const { return static_cast<Machine>(header().machine); }
+
+    const uint32_t* code() const { return at<uint32_t>(header().codeOffset); }
+    size_t codeCount() const { return header().codeCount; }
+
+    const ObjectSymbol* symbols() const { return at<ObjectSymbol>(header().symbolOffset); }
+    size_t symbolCount() const { return header().symbolCount; }
+
+    const ObjectRelocation* relocations() const {
+        return at<ObjectRelocation>(header().relocationOffset);
+    }
+    size_t relocationCount() const { return header().relocationCount; }
+
+    // Name stored at a string table offset
+    const char* string(uint32_t offset) const {
+        return at<char>(header().stringOffset) + offset;
+    }
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+    const ObjectHeader& header() const { return *reinterpret_cast<const ObjectHeader*>(data); }
+
+    template <typename T>
+    const T* at(uint64_t offset) const { return reinterpret_cast<const T*>(data + offset); }
+
+    void validate(const std::string& path) const;
+};
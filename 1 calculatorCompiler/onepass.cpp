@@ -0,0 +1,168 @@
+#include "onepass.hpp"
+#include "selector.hpp"
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+
+// Machine code that grows at both ends: the words are front reversed, then back
+class Code {
+public:
+    size_t size() const { return front.size() + back.size(); }
+
+    template <typename Words>
+    void prepend(const Words& words) {
+        front.insert(front.end(), std::make_reverse_iterator(words.words + words.count),
+                     std::make_reverse_iterator(words.words));
+    }
+
+    template <typename Words>
+    void append(const Words& words) {
+        back.insert(back.end(), words.words, words.words + words.count);
+    }
+
+    void prepend(Code&& code) {
+        front.insert(front.end(), code.back.rbegin(), code.back.rend());
+        front.insert(front.end(), code.front.begin(), code.front.end());
+    }
+
+    void append(Code&& code) {
+        back.insert(back.end(), code.front.rbegin(), code.front.rend());
+        back.insert(back.end(), code.back.begin(), code.back.end());
+    }
+
+    // In place, so the code is not copied into a third buffer at the end
+    std::vector<uint32_t> words() && {
+        std::reverse(front.begin(), front.end());
+        front.insert(front.end(), back.begin(), back.end());
+        return std::move(front);
+    }
+
+private:
+    std::vector<uint32_t> front;
+    std::vector<uint32_t> back;
+};
+
+namespace {
+
+struct Waiting {
+    Code left;
+    Operation op;
+    int precedence;
+};
+
+// The words of each operation come from the target's tables (target.hpp):
+// all but those of a number are worked out while compiling
+template <typename Target>
+class OnePassCompiler {
+    using Selector = InstructionSelector<Target>;
+
+public:
+    explicit OnePassCompiler(const std::string& source) : source(source) {}
+
+    std::vector<uint32_t> compile() {
+        Code operand = number();
+        while (true) {
+            // Anything but an operator ends the expression, as in Parser::expression()
+            Operation op;
+            int precedence;
+            if (!binaryOperator(op, precedence)) break;
+            while (!waiting.empty() && waiting.back().precedence >= precedence) {
+                operand = reduce(std::move(operand));
+            }
+            waiting.push_back(Waiting{std::move(operand), op, precedence});
+            operand = number();
+        }
+        while (!waiting.empty()) {
+            operand = reduce(std::move(operand));
+        }
+
+        // The tree path only gets to the assembler once the parse succeeded,
+        // and it refuses the text of the number there
+        if (unencodable) {
+            auto load = Selector::select(Operation::LoadImmediate, 0);
+            throw std::runtime_error(Selector::invalidFormat(load.instructions[0].instruction));
+        }
+        return std::move(operand).words();
+    }
+
+private:
+    const std::string& source;
+    size_t position = 0;
+    std::vector<Waiting> waiting;
+    bool unencodable = false;
+
+    // Whitespace as the Lexer skips it
+    void skipWhitespace() {
+        while (position < source.size() && std::isspace(source[position])) {
+            position++;
+        }
+    }
+
+    Code number() {
+        skipWhitespace();
+        size_t start = position;
+        while (position < source.size() && std::isdigit(source[position])) {
+            position++;
+        }
+        if (position == start) {
+            throw std::runtime_error("Unexpected token");
+        }
+
+        // Converted as Parser::factor() and NumberExpr::generateCode() do.
+        // Those print a value of 2^31 or more as a negative number (or
+        // worse), which the assembler then refuses.
+        double value = std::stod(source.substr(start, position - start));
+        int immediate = 0;
+        if (value < 2147483648.0) {
+            immediate = static_cast<int>(value);
+        } else {
+            unencodable = true;
+        }
+        Code code;
+        code.append(Selector::encode(Operation::LoadImmediate, immediate));
+        return code;
+    }
+
+    bool binaryOperator(Operation& op, int& precedence) {
+        skipWhitespace();
+        if (position >= source.size()) return false;
+        switch (source[position]) {
+            case '+': op = Operation::Add; precedence = 1; break;
+            case '-': op = Operation::Subtract; precedence = 1; break;
+            case '*': op = Operation::Multiply; precedence = 2; break;
+            case '/': op = Operation::Divide; precedence = 2; break;
+            default: return false;
+        }
+        position++;
+        return true;
+    }
+
+    // right push left pop op, copying whichever operand is smaller
+    Code reduce(Code right) {
+        Waiting top = std::move(waiting.back());
+        waiting.pop_back();
+        if (top.left.size() >= right.size()) {
+            top.left.prepend(Selector::words(Operation::Push));
+            top.left.prepend(std::move(right));
+            top.left.append(Selector::words(Operation::Pop));
+            top.left.append(Selector::words(top.op));
+            return std::move(top.left);
+        }
+        right.append(Selector::words(Operation::Push));
+        right.append(std::move(top.left));
+        right.append(Selector::words(Operation::Pop));
+        right.append(Selector::words(top.op));
+        return right;
+    }
+};
+
+}  // namespace
+
+std::vector<uint32_t> compileOnePass(const std::string& source, Machine machine) {
+    switch (machine) {
+        case Machine::Rv64: return OnePassCompiler<Targets::Rv64>(source).compile();
+        default: return OnePassCompiler<Targets::Arm64>(source).compile();
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "target.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+One-pass compilation: machine code straight from the source text, with no
+tokens, no Expression tree, no assembly text and no assembler.
+
+The tree path emits, for every binary expression,
+
+    code(right)  push  code(left)  pop  op
+
+so the code for an operand comes after the code of everything to its right
+in the source, and a single left-to-right pass cannot just append. Instead
+each piece of code is kept in a Code buffer that grows at both ends, and an
+operator-precedence stack holds the operators still waiting for their right
+operand, each with the code of its left operand:
+
+    number         the operand's code loads it (mov on ARM64)
+    operator op    first reduce every waiting operator of the same or higher
+                   precedence, then wait with the operand as left operand
+    reduce         right operand's code, push in front of the left operand's
+                   code; pop and op after it (the smaller one is copied)
+    end            reduce everything left
+
+The result is word for word what compileToMachineCode() returns, including
+its errors: "Unexpected token" where the parser reports it, text after the
+expression ignored, and numbers the assembler cannot encode rejected only
+once the whole expression has been read. Memory is the source text plus
+the machine code (4 bytes per word), and nothing recurses, so expressions
+of millions of terms compile where the tree path runs out of stack.
+
+The instructions come from the same target tables as the tree path's
+(target.hpp), so this is true for every target.
+*/
+std::vector<uint32_t> compileOnePass(const std::string& source, Machine machine = Machine::Arm64);
@@ -33,8 +33,8 @@ public:
     double evaluate() const override { return value; }
     
     void generateCode(CodeGenerator& gen) override {
-        // Load immediate value into x0
-        gen.emit("mov x0, #" + std::to_string(static_cast<int>(value)));
+        // Load immediate value into the accumulator (x0 on ARM64)
+        gen.emit(Operation::LoadImmediate, static_cast<int>(value));
     }
 };
 
@@ -66,27 +66,27 @@ public:
         // Generate code for right side first
         right->generateCode(gen);
         // Save right result to stack
-        gen.emit("str x0, [sp, #-16]!");  // Pre-decrement sp by 16
+        gen.emit(Operation::Push);  // str x0, [sp, #-16]! on ARM64
         
         // Generate code for left side
         left->generateCode(gen);
         
         // Load right result back
-        gen.emit("ldr x1, [sp], #16");    // Post-increment sp by 16
+        gen.emit(Operation::Pop);   // ldr x1, [sp], #16 on ARM64
         
         // Perform operation
         switch (op) {
             case TokenType::PLUS:
-                gen.emit("add x0, x0, x1");
+                gen.emit(Operation::Add);
                 break;
             case TokenType::MINUS:
-                gen.emit("sub x0, x0, x1");
+                gen.emit(Operation::Subtract);
                 break;
             case TokenType::MULTIPLY:
-                gen.emit("mul x0, x0, x1");
+                gen.emit(Operation::Multiply);
                 break;
             case TokenType::DIVIDE:
-                gen.emit("sdiv x0, x0, x1");
+                gen.emit(Operation::Divide);
                 break;
             default:
                 throw std::runtime_error("Unknown operator");
@@ -103,6 +103,9 @@ public:
     
     ExprPtr parse();  // Main entry point for parsing
 
+    // How many tokens parse() used; the rest of the line is ignored
+    size_t consumed() const { return m_current; }
+
 private:
     const std::vector<Token>& m_tokens;  // Store reference to tokens
     size_t m_current;                    // Current position in token stream
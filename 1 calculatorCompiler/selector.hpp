@@ -0,0 +1,272 @@
+#pragma once
+#include "target.hpp"
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/*
+The code generator's operations turned into assembly and machine code for
+one target, from nothing but its tables (target.hpp):
+
+    select(operation, n)   the assembly instructions for the operation
+    print(instruction)     one of them as a line of text in the target's syntax
+    parse(line)            a line of text back into an instruction
+    encode(instruction)    its machine code: one word, or one or two for a
+                           pseudo-instruction
+    words(operation)       the machine code of an operation that takes no
+                           immediate, worked out while compiling
+
+Everything but print and parse is constexpr. A malformed line throws
+"Invalid <name> instruction format" and an unknown mnemonic "Unknown
+instruction: <mnemonic>", as the assembler always has.
+*/
+template <typename Target>
+class InstructionSelector {
+    static_assert(TargetDescription::valid<Target>(), "inconsistent target description");
+
+    using Instruction = TargetDescription::Instruction;
+    using Operand = TargetDescription::Operand;
+    using OperandKind = TargetDescription::OperandKind;
+    using Source = TargetDescription::Source;
+    using Step = TargetDescription::Step;
+    using Steps = TargetDescription::Steps;
+
+public:
+    // An instruction of the target with the values of its operands
+    struct Assembly {
+        uint8_t instruction = 0;
+        int64_t operands[3] = {};
+    };
+
+    struct Selection {
+        size_t count = 0;
+        Assembly instructions[2] = {};
+    };
+
+    // A pattern has at most two instructions, and each expands to at most two
+    struct Words {
+        size_t count = 0;
+        uint32_t words[4] = {};
+    };
+
+    static constexpr Selection select(Operation operation, int64_t immediate = 0) {
+        const Steps& pattern = Target::patterns[static_cast<size_t>(operation)].steps;
+        const int64_t arguments[3] = {immediate, 0, 0};
+        Selection selection;
+        for (size_t i = 0; i < pattern.count; i++) {
+            selection.instructions[selection.count++] = resolve(pattern.steps[i], arguments);
+        }
+        return selection;
+    }
+
+    // Appends the words of one instruction; a pseudo-instruction's forms
+    // only hold real ones (valid() checks), so this goes one level deep
+    static constexpr void encode(const Assembly& assembly, Words& out) {
+        const Instruction& instruction = Target::instructions[assembly.instruction];
+        int64_t values[3] = {};
+        wrapOperands(instruction, assembly, values);
+        if (!instruction.isPseudo()) {
+            out.words[out.count++] = place(instruction, values);
+            return;
+        }
+        const Steps& form = fits(values[instruction.fitsOperand], instruction.fitsBits)
+            ? instruction.shortForm
+            : instruction.longForm;
+        for (size_t i = 0; i < form.count; i++) {
+            Assembly real = resolve(form.steps[i], values);
+            const Instruction& realInstruction = Target::instructions[real.instruction];
+            int64_t realValues[3] = {};
+            wrapOperands(realInstruction, real, realValues);
+            out.words[out.count++] = place(realInstruction, realValues);
+        }
+    }
+
+    static constexpr Words encode(Operation operation, int64_t immediate = 0) {
+        Selection selection = select(operation, immediate);
+        Words out;
+        for (size_t i = 0; i < selection.count; i++) {
+            encode(selection.instructions[i], out);
+        }
+        return out;
+    }
+
+    // Every operation but LoadImmediate; defined below the class
+    static constexpr const Words& words(Operation operation);
+
+    static std::string invalidFormat(uint8_t instruction) {
+        return "Invalid " + std::string(Target::instructions[instruction].errorName) + " instruction format";
+    }
+
+    static void print(const Assembly& assembly, std::string& out) {
+        const Instruction& instruction = Target::instructions[assembly.instruction];
+        std::string_view syntax = instruction.syntax;
+        for (size_t c = 0; c < syntax.size(); c++) {
+            if (syntax[c] != '{') {
+                out += syntax[c];
+                continue;
+            }
+            size_t i = syntax[c + 1] - '0';
+            c += 2;
+            if (instruction.operands[i].kind == OperandKind::Register) {
+                out += Target::registers[assembly.operands[i] & 31];
+            } else {
+                out += std::to_string(assembly.operands[i]);
+            }
+        }
+    }
+
+    // False for an empty line or a label, which have no code
+    static bool parse(std::string_view line, Assembly& assembly) {
+        // The code generator indents every instruction
+        line.remove_prefix(std::min(line.find_first_not_of(' '), line.size()));
+        if (line.empty() || line[0] == '.' || line[0] == '_') {
+            return false;
+        }
+        std::string_view mnemonic = line.substr(0, line.find(' '));
+        for (uint8_t i = 0; i < Target::InstructionCount; i++) {
+            if (Target::instructions[i].mnemonic == mnemonic) {
+                assembly.instruction = i;
+                if (!match(Target::instructions[i], line, assembly)) {
+                    throw std::runtime_error(invalidFormat(i));
+                }
+                return true;
+            }
+        }
+        throw std::runtime_error("Unknown instruction: " + std::string(mnemonic));
+    }
+
+private:
+    static constexpr int64_t wrap(const Operand& operand, int64_t value) {
+        return operand.wrap ? value & ((int64_t(1) << operand.wrap) - 1) : value;
+    }
+
+    static constexpr void wrapOperands(const Instruction& instruction, const Assembly& assembly, int64_t values[3]) {
+        for (size_t i = 0; i < 3; i++) {
+            values[i] = wrap(instruction.operands[i], assembly.operands[i]);
+        }
+    }
+
+    static constexpr bool fits(int64_t value, int bits) {
+        return value >= -(int64_t(1) << (bits - 1)) && value < (int64_t(1) << (bits - 1));
+    }
+
+    static constexpr uint32_t place(const Instruction& instruction, const int64_t values[3]) {
+        uint32_t word = instruction.opcode;
+        for (size_t i = 0; i < 3; i++) {
+            const Operand& operand = instruction.operands[i];
+            if (operand.sliceCount == 0) continue;
+            uint64_t value = static_cast<uint64_t>(operand.scale == 1 ? values[i] : values[i] / operand.scale);
+            for (size_t s = 0; s < operand.sliceCount; s++) {
+                const TargetDescription::Slice& slice = operand.slices[s];
+                uint64_t bits = (value >> slice.from) & ((uint64_t(1) << slice.width) - 1);
+                word |= static_cast<uint32_t>(bits << slice.to);
+            }
+        }
+        return word;
+    }
+
+    static constexpr int64_t high20(int64_t value) { return (value + 0x800) >> 12; }
+
+    static constexpr Assembly resolve(const Step& step, const int64_t arguments[3]) {
+        Assembly assembly;
+        assembly.instruction = step.instruction;
+        for (size_t i = 0; i < 3; i++) {
+            const Source& source = step.operands[i];
+            switch (source.kind) {
+                case Source::None: break;
+                case Source::Register:
+                case Source::Constant: assembly.operands[i] = source.value; break;
+                case Source::Argument: assembly.operands[i] = arguments[source.value]; break;
+                case Source::High20: assembly.operands[i] = high20(arguments[source.value]); break;
+                case Source::Low12:
+                    assembly.operands[i] = arguments[source.value] - high20(arguments[source.value]) * 4096;
+                    break;
+            }
+        }
+        return assembly;
+    }
+
+    // The line against the instruction's syntax; text after it is ignored
+    static bool match(const Instruction& instruction, std::string_view line, Assembly& assembly) {
+        std::string_view syntax = instruction.syntax;
+        size_t position = 0;
+        for (size_t c = 0; c < syntax.size(); c++) {
+            if (syntax[c] == ' ') {
+                while (position < line.size() && std::isspace(static_cast<unsigned char>(line[position]))) {
+                    position++;
+                }
+            } else if (syntax[c] == '{') {
+                size_t i = syntax[c + 1] - '0';
+                c += 2;
+                if (!readOperand(instruction.operands[i], line, position, assembly.operands[i])) {
+                    return false;
+                }
+            } else if (position < line.size() && line[position] == syntax[c]) {
+                position++;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Digits, as a value below 2^31
+    static bool readNumber(std::string_view line, size_t& position, int64_t& value) {
+        size_t start = position;
+        value = 0;
+        while (position < line.size() && std::isdigit(static_cast<unsigned char>(line[position]))) {
+            value = value * 10 + (line[position++] - '0');
+            if (value > INT32_MAX) return false;
+        }
+        return position > start;
+    }
+
+    static bool readOperand(const Operand& operand, std::string_view line, size_t& position, int64_t& value) {
+        if (operand.kind == OperandKind::Register) {
+            size_t start = position;
+            while (position < line.size() && std::isalnum(static_cast<unsigned char>(line[position]))) {
+                position++;
+            }
+            std::string_view name = line.substr(start, position - start);
+            for (int i = 0; i < 32; i++) {
+                if (Target::registers[i] == name) {
+                    value = i;
+                    return true;
+                }
+            }
+            // xN names every register of every target
+            size_t digits = start + 1;
+            return name.size() > 1 && name[0] == 'x' && readNumber(line, digits, value) && digits == position;
+        }
+
+        bool negative = operand.kind == OperandKind::Signed && position < line.size() && line[position] == '-';
+        if (negative) position++;
+        if (!readNumber(line, position, value)) return false;
+        if (negative) value = -value;
+        if (operand.kind == OperandKind::Signed) {
+            int width = 0;
+            for (size_t s = 0; s < operand.sliceCount; s++) width += operand.slices[s].width;
+            return fits(value, width);
+        }
+        return true;
+    }
+};
+
+template <typename Target>
+inline constexpr auto operationWords = [] {
+    std::array<typename InstructionSelector<Target>::Words, operationCount> table{};
+    for (size_t i = 0; i < operationCount; i++) {
+        table[i] = InstructionSelector<Target>::encode(static_cast<Operation>(i));
+    }
+    return table;
+}();
+
+template <typename Target>
+constexpr const typename InstructionSelector<Target>::Words& InstructionSelector<Target>::words(Operation operation) {
+    return operationWords<Target>[static_cast<size_t>(operation)];
+}
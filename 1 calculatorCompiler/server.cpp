@@ -0,0 +1,492 @@
+#include "server.hpp"
+#include "driver.hpp"
+#include "onepass.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Protocol {
+
+void appendFrame(std::string& out, uint32_t id, uint8_t kind, const std::string& payload) {
+    uint32_t length = static_cast<uint32_t>(headerSize - sizeof(uint32_t) + payload.size());
+    out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    out.append(reinterpret_cast<const char*>(&id), sizeof(id));
+    out.push_back(static_cast<char>(kind));
+    out += payload;
+}
+
+bool takeFrame(const std::string& buffer, size_t& offset, Frame& frame) {
+    if (buffer.size() - offset < headerSize) return false;
+    uint32_t length;
+    std::memcpy(&length, buffer.data() + offset, sizeof(length));
+    if (length < headerSize - sizeof(uint32_t) || length > maxFrame) {
+        throw std::runtime_error("Bad frame length");
+    }
+    if (buffer.size() - offset < sizeof(uint32_t) + length) return false;
+    std::memcpy(&frame.id, buffer.data() + offset + 4, sizeof(frame.id));
+    frame.kind = static_cast<uint8_t>(buffer[offset + 8]);
+    frame.payload.assign(buffer, offset + headerSize, length - (headerSize - sizeof(uint32_t)));
+    offset += sizeof(uint32_t) + length;
+    return true;
+}
+
+}  // namespace Protocol
+
+static sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+static void setNonBlocking(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// The response frame to one request
+static std::string respond(const Protocol::Frame& request) {
+    std::string frame;
+    try {
+        std::string payload;
+        if (request.kind == Protocol::Compile || request.kind == Protocol::CompileOnePass) {
+            std::vector<uint32_t> words = request.kind == Protocol::Compile
+                ? compileToMachineCode(request.payload)
+                : compileOnePass(request.payload);
+            payload.assign(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(uint32_t));
+        } else if (request.kind == Protocol::Evaluate) {
+            double value = evaluateExpression(request.payload);
+            payload.assign(reinterpret_cast<const char*>(&value), sizeof(value));
+        } else {
+            throw std::runtime_error("Unknown request kind");
+        }
+        Protocol::appendFrame(frame, request.id, Protocol::Ok, payload);
+    } catch (const std::exception& e) {
+        Protocol::appendFrame(frame, request.id, Protocol::Failed, e.what());
+    }
+    return frame;
+}
+
+struct CompileServer::Connection {
+    int fd;
+    std::string input;
+    size_t consumed = 0;  // Of input, by frames already taken
+    std::string output;
+    size_t written = 0;   // Of output
+    bool closed = false;  // By the client, or for a bad frame
+};
+
+struct CompileServer::Request {
+    Connection* connection;
+    Protocol::Frame frame;
+    std::string response;
+};
+
+// The threads that work through a batch, the calling thread among them
+class CompileServer::Workers {
+public:
+    explicit Workers(unsigned count) {
+        for (unsigned i = 1; i < std::max(count, 1u); i++) {
+            threads.emplace_back([this] { loop(); });
+        }
+    }
+
+    ~Workers() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            shuttingDown = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) thread.join();
+    }
+
+    // Answer every request of the batch; returns once all are answered
+    void run(std::vector<Request>& requests) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            batch = &requests;
+            next = 0;
+            busy = static_cast<unsigned>(threads.size());
+            generation++;
+        }
+        wake.notify_all();
+        work();
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [this] { return busy == 0; });
+        batch = nullptr;
+    }
+
+private:
+    // Small enough to share out a small batch, large enough that workers
+    // do not all contend for next on a large one
+    static constexpr size_t chunk = 8;
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    std::vector<Request>* batch = nullptr;
+    std::atomic<size_t> next{0};
+    unsigned busy = 0;
+    uint64_t generation = 0;
+    bool shuttingDown = false;
+
+    void work() {
+        std::vector<Request>& requests = *batch;
+        while (true) {
+            size_t start = next.fetch_add(chunk);
+            if (start >= requests.size()) return;
+            size_t end = std::min(start + chunk, requests.size());
+            for (size_t i = start; i < end; i++) {
+                requests[i].response = respond(requests[i].frame);
+            }
+        }
+    }
+
+    void loop() {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                wake.wait(guard, [&] { return shuttingDown || generation != seen; });
+                if (shuttingDown) return;
+                seen = generation;
+            }
+            work();
+            std::lock_guard<std::mutex> guard(lock);
+            if (--busy == 0) finished.notify_one();
+        }
+    }
+};
+
+CompileServer::CompileServer(std::string path, unsigned workerCount) : socketPath(std::move(path)) {
+    sockaddr_un address = socketAddress(socketPath);
+
+    // A socket file nobody answers on is left over from a server that died
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool live = probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    if (probe >= 0) close(probe);
+    if (live) {
+        throw std::runtime_error("A server is already listening on " + socketPath);
+    }
+    unlink(socketPath.c_str());
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 ||
+        bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listenFd, SOMAXCONN) != 0) {
+        std::string reason = std::strerror(errno);
+        if (listenFd >= 0) close(listenFd);
+        throw std::runtime_error("Cannot listen on " + socketPath + ": " + reason);
+    }
+    setNonBlocking(listenFd);
+
+    if (pipe(wakeFds) != 0) {
+        close(listenFd);
+        unlink(socketPath.c_str());
+        throw std::runtime_error("Cannot create the wake pipe");
+    }
+    setNonBlocking(wakeFds[1]);
+
+    workers = std::make_unique<Workers>(workerCount);
+}
+
+CompileServer::~CompileServer() {
+    workers.reset();
+    for (auto& connection : connections) close(connection->fd);
+    close(listenFd);
+    close(wakeFds[0]);
+    close(wakeFds[1]);
+    unlink(socketPath.c_str());
+}
+
+void CompileServer::stop() {
+    stopping = true;
+    char byte = 0;
+    ssize_t ignored = write(wakeFds[1], &byte, 1);
+    (void)ignored;
+}
+
+void CompileServer::acceptAll() {
+    while (true) {
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) return;
+        setNonBlocking(fd);
+        connections.push_back(std::make_unique<Connection>());
+        connections.back()->fd = fd;
+    }
+}
+
+// Read what has arrived and add its complete requests to the batch;
+// false once the connection is finished with
+bool CompileServer::readAll(Connection& connection, std::vector<Request>& batch) {
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t count = read(connection.fd, buffer, sizeof(buffer));
+        if (count > 0) {
+            connection.input.append(buffer, count);
+            continue;
+        }
+        if (count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            connection.closed = true;
+        }
+        if (count < 0 && errno == EINTR) continue;
+        break;
+    }
+
+    try {
+        Protocol::Frame frame;
+        while (Protocol::takeFrame(connection.input, connection.consumed, frame)) {
+            batch.push_back(Request{&connection, std::move(frame), {}});
+        }
+    } catch (const std::runtime_error&) {
+        // Nothing after a bad frame can be trusted
+        connection.closed = true;
+        connection.input.clear();
+        connection.consumed = 0;
+        return false;
+    }
+    connection.input.erase(0, connection.consumed);
+    connection.consumed = 0;
+    return !connection.closed;
+}
+
+// Write as much of the pending output as the socket takes; false on error
+bool CompileServer::writeSome(Connection& connection) {
+    while (connection.written < connection.output.size()) {
+        ssize_t count = send(connection.fd, connection.output.data() + connection.written,
+                             connection.output.size() - connection.written, MSG_NOSIGNAL);
+        if (count > 0) {
+            connection.written += count;
+        } else if (count < 0 && errno == EINTR) {
+            continue;
+        } else {
+            if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            return false;
+        }
+    }
+    if (connection.written == connection.output.size()) {
+        connection.output.clear();
+        connection.written = 0;
+    }
+    return true;
+}
+
+void CompileServer::run() {
+    // Stop reading from a client this far behind on its responses
+    const size_t maxPending = 4 * 1024 * 1024;
+
+    std::vector<pollfd> polled;
+    std::vector<Request> batch;
+    while (!stopping) {
+        polled.clear();
+        polled.push_back({wakeFds[0], POLLIN, 0});
+        polled.push_back({listenFd, POLLIN, 0});
+        for (auto& connection : connections) {
+            short events = 0;
+            if (!connection->closed && connection->output.size() - connection->written < maxPending) {
+                events |= POLLIN;
+            }
+            if (connection->written < connection->output.size()) events |= POLLOUT;
+            polled.push_back({connection->fd, events, 0});
+        }
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("poll failed: ") + std::strerror(errno));
+        }
+        if (stopping) break;
+
+        // Every request that has arrived, from every connection, is one batch
+        batch.clear();
+        for (size_t i = 0; i < connections.size(); i++) {
+            if (polled[i + 2].revents & (POLLIN | POLLHUP | POLLERR)) {
+                readAll(*connections[i], batch);
+            }
+        }
+        if (polled[1].revents & POLLIN) {
+            acceptAll();
+        }
+
+        if (!batch.empty()) {
+            workers->run(batch);
+            requests += static_cast<long>(batch.size());
+            batches++;
+            largest = std::max(largest, batch.size());
+            for (auto& request : batch) {
+                request.connection->output += request.response;
+            }
+        }
+
+        // Connections that are finished, or whose client has gone, are dropped
+        // once their responses are out (or cannot be sent)
+        for (size_t i = 0; i < connections.size();) {
+            Connection& connection = *connections[i];
+            bool healthy = writeSome(connection);
+            bool drained = connection.written == connection.output.size();
+            if (!healthy || (connection.closed && drained)) {
+                close(connection.fd);
+                connections[i] = std::move(connections.back());
+                connections.pop_back();
+            } else {
+                i++;
+            }
+        }
+    }
+}
+
+CompileClient::CompileClient(const std::string& socketPath) {
+    sockaddr_un address = socketAddress(socketPath);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::string reason = std::strerror(errno);
+        if (fd >= 0) close(fd);
+        throw std::runtime_error("Cannot connect to " + socketPath + ": " + reason);
+    }
+}
+
+CompileClient::~CompileClient() {
+    close(fd);
+}
+
+void CompileClient::send(uint32_t id, Protocol::Kind kind, const std::string& text) {
+    std::string frame;
+    Protocol::appendFrame(frame, id, kind, text);
+    size_t written = 0;
+    while (written < frame.size()) {
+        ssize_t count = ::send(fd, frame.data() + written, frame.size() - written, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) throw std::runtime_error("Lost the connection to the server");
+        written += count;
+    }
+}
+
+Protocol::Frame CompileClient::receive() {
+    Protocol::Frame frame;
+    while (!Protocol::takeFrame(input, offset, frame)) {
+        if (offset > 0) {
+            input.erase(0, offset);
+            offset = 0;
+        }
+        char buffer[64 * 1024];
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) throw std::runtime_error("Lost the connection to the server");
+        input.append(buffer, count);
+    }
+    return frame;
+}
+
+// What the server should answer for text, as a response frame would carry it
+static std::string expectedPayload(Protocol::Kind kind, const std::string& text) {
+    Protocol::Frame request;
+    request.kind = kind;
+    request.payload = text;
+    std::string frame = respond(request);
+    return frame.substr(Protocol::headerSize - 1);  // Status byte, then payload
+}
+
+LoadReport runLoad(const LoadOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    const unsigned connections = std::max(options.connections, 1u);
+    const unsigned depth = std::max(options.depth, 1u);
+
+    struct Result {
+        std::vector<double> latencies;
+        long failed = 0;
+        long mismatched = 0;
+        std::string error;
+    };
+    std::vector<Result> results(connections);
+
+    // Each client has its own expressions, and what they should give, ready
+    // before the clock starts
+    const size_t variety = 64;
+    std::vector<std::vector<std::string>> texts(connections);
+    std::vector<std::vector<std::string>> expected(connections);
+    for (unsigned c = 0; c < connections; c++) {
+        std::mt19937 random(c + 1);
+        const char* operators[] = {" + ", " - ", " * ", " / "};
+        for (size_t i = 0; i < variety; i++) {
+            std::string text = std::to_string(random() % 65536);
+            for (long t = 1; t < options.terms; t++) {
+                text += operators[random() % 4];
+                text += std::to_string(random() % 65536);
+            }
+            expected[c].push_back(expectedPayload(options.kind, text));
+            texts[c].push_back(std::move(text));
+        }
+    }
+
+    auto client = [&](unsigned c) {
+        Result& result = results[c];
+        long share = options.requests / connections + (c < options.requests % connections ? 1 : 0);
+        result.latencies.reserve(share);
+        try {
+            CompileClient connection(options.socketPath);
+            std::deque<Clock::time_point> sentAt;
+            long sent = 0;
+            long received = 0;
+            while (received < share) {
+                while (sent < share && sentAt.size() < depth) {
+                    connection.send(static_cast<uint32_t>(sent), options.kind, texts[c][sent % variety]);
+                    sentAt.push_back(Clock::now());
+                    sent++;
+                }
+                Protocol::Frame response = connection.receive();
+                Clock::time_point now = Clock::now();
+                if (response.id != static_cast<uint32_t>(received)) {
+                    throw std::runtime_error("Response out of order");
+                }
+                result.latencies.push_back(std::chrono::duration<double, std::micro>(now - sentAt.front()).count());
+                sentAt.pop_front();
+
+                std::string answer = static_cast<char>(response.kind) + response.payload;
+                if (response.kind != Protocol::Ok) result.failed++;
+                if (answer != expected[c][received % variety]) result.mismatched++;
+                received++;
+            }
+        } catch (const std::exception& e) {
+            result.error = e.what();
+        }
+    };
+
+    Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned c = 0; c < connections; c++) {
+        threads.emplace_back(client, c);
+    }
+    for (auto& thread : threads) thread.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    LoadReport report;
+    std::vector<double> latencies;
+    for (auto& result : results) {
+        if (!result.error.empty()) throw std::runtime_error(result.error);
+        latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        report.failed += result.failed;
+        report.mismatched += result.mismatched;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    report.requests = static_cast<long>(latencies.size());
+    report.seconds = seconds;
+    if (!latencies.empty()) {
+        report.p50 = latencies[latencies.size() / 2];
+        report.p99 = latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)];
+        report.max = latencies.back();
+    }
+    return report;
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+A compile server: a long-running calc_compiler that takes expressions over
+a Unix domain socket, so a caller pays for a request and not for starting a
+process and warming its caches.
+
+Every message is a frame, with fields in host byte order (both ends are on
+the same machine):
+
+    u32 length    bytes after this field (5 + payload)
+    u32 id        chosen by the client and sent back in the response
+    u8  kind      request: Compile, CompileOnePass or Evaluate
+                  response: Ok or Failed
+    payload       request: the expression text
+                  response: the machine code words (Compile, CompileOnePass),
+                  the result as a double (Evaluate), or the error message
+
+A client may send many requests without waiting; the responses to one
+connection come back in the order of its requests. A frame longer than
+maxFrame closes the connection.
+
+The server is one thread doing poll() over the listening socket and every
+connection. Each round it reads all the complete requests that have
+arrived, from every connection, and hands them to its workers as one batch;
+each worker takes requests from the batch and answers them with the
+driver (driver.hpp) until none are left. Then the responses are written and the next
+round starts, with whatever arrived in the meantime as its batch, so the
+busier the server, the larger its batches.
+*/
+namespace Protocol {
+
+enum Kind : uint8_t { Compile = 1, CompileOnePass = 2, Evaluate = 3 };
+enum Status : uint8_t { Ok = 0, Failed = 1 };
+
+constexpr size_t headerSize = 9;
+constexpr uint32_t maxFrame = 64 * 1024 * 1024;
+
+struct Frame {
+    uint32_t id = 0;
+    uint8_t kind = 0;
+    std::string payload;
+};
+
+// Appends a whole frame to out
+void appendFrame(std::string& out, uint32_t id, uint8_t kind, const std::string& payload);
+
+// Takes the first complete frame off the front of buffer starting at offset;
+// false if it has not all arrived yet. Throws on a frame over maxFrame.
+bool takeFrame(const std::string& buffer, size_t& offset, Frame& frame);
+
+}  // namespace Protocol
+
+class CompileServer {
+public:
+    // Binds the socket (replacing a stale one) and starts workers - 1
+    // threads; the thread calling run() is the last worker
+    CompileServer(std::string socketPath, unsigned workers);
+    ~CompileServer();
+
+    // Serve until stop()
+    void run();
+
+    // Safe to call from a signal handler
+    void stop();
+
+    long requestCount() const { return requests; }
+    long batchCount() const { return batches; }
+    size_t largestBatch() const { return largest; }
+
+private:
+    struct Connection;
+    struct Request;
+    class Workers;
+
+    std::string socketPath;
+    int listenFd = -1;
+    int wakeFds[2] = {-1, -1};
+    std::atomic<bool> stopping{false};
+    std::unique_ptr<Workers> workers;
+    std::vector<std::unique_ptr<Connection>> connections;
+
+    long requests = 0;
+    long batches = 0;
+    size_t largest = 0;
+
+    void acceptAll();
+    bool readAll(Connection& connection, std::vector<Request>& batch);
+    bool writeSome(Connection& connection);
+};
+
+// A blocking connection to a CompileServer
+class CompileClient {
+public:
+    explicit CompileClient(const std::string& socketPath);
+    ~CompileClient();
+
+    CompileClient(const CompileClient&) = delete;
+    CompileClient& operator=(const CompileClient&) = delete;
+
+    void send(uint32_t id, Protocol::Kind kind, const std::string& text);
+
+    // The next response; throws if the server closed the connection
+    Protocol::Frame receive();
+
+private:
+    int fd = -1;
+    std::string input;
+    size_t offset = 0;
+};
+
+/*
+A load generator: connections clients, each keeping depth requests in
+flight, send requests of the given kind for expressions of terms random
+numbers and operators. Every response is checked against what this process
+computes for the same expression.
+*/
+struct LoadOptions {
+    std::string socketPath;
+    unsigned connections = 4;
+    unsigned depth = 8;
+    long requests = 100000;
+    long terms = 20;
+    Protocol::Kind kind = Protocol::Evaluate;
+};
+
+struct LoadReport {
+    long requests = 0;
+    long failed = 0;      // Answered with an error
+    long mismatched = 0;  // Answered differently from this process
+    double seconds = 0;
+    double p50 = 0;       // Latency in microseconds, from sending to receiving
+    double p99 = 0;
+    double max = 0;
+};
+
+LoadReport runLoad(const LoadOptions& options);
@@ -0,0 +1,321 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/*
+Target descriptions: what the code generator and the assembler need to know
+about an instruction set, as constexpr tables, so that a new target is a new
+table and not new code.
+
+The code generator only ever needs seven operations on three registers, an
+accumulator, a scratch register and the stack pointer:
+
+    LoadImmediate n    accumulator = n
+    Push               push the accumulator
+    Pop                pop into the scratch register
+    Add, Subtract,     accumulator = accumulator op scratch
+    Multiply, Divide
+
+A target lists its instructions and, for each operation, the instructions
+that carry it out (its pattern). For every instruction the table gives:
+
+    mnemonic, syntax   "add {0}, {1}, {2}": {i} is operand i, a space
+                       stands for any amount of whitespace
+    opcode             the fixed bits of the 32-bit word
+    operands           register or immediate, and the slices of the word
+                       its bits go to (an immediate can be split in two)
+
+A pseudo-instruction has no encoding of its own, but expands into one of two
+short sequences of real instructions depending on whether its value fits in
+a signed immediate: RISC-V's li becomes addi, or lui and addiw.
+
+InstructionSelector<Target> (selector.hpp) does the rest the same way for
+every target, and checks the tables while compiling: operand slices that
+overlap each other or the opcode, or patterns that refer to instructions
+that do not exist, do not compile.
+
+Numbers are loaded modulo 65536 on every target, which is what the 16-bit
+immediate of ARM64's mov has always made of them.
+*/
+
+// Values are stored in object files (object.hpp)
+enum class Machine : uint32_t { Arm64 = 0, Rv64 = 1 };
+
+inline const char* machineName(Machine machine) {
+    return machine == Machine::Rv64 ? "rv64" : "arm64";
+}
+
+inline Machine parseMachine(const std::string& name) {
+    if (name == "arm64") return Machine::Arm64;
+    if (name == "rv64") return Machine::Rv64;
+    throw std::runtime_error("Unknown target: " + name + " (expected arm64 or rv64)");
+}
+
+enum class Operation : uint8_t { LoadImmediate, Push, Pop, Add, Subtract, Multiply, Divide, Count };
+
+constexpr size_t operationCount = static_cast<size_t>(Operation::Count);
+
+namespace TargetDescription {
+
+// width bits of an operand, starting at its bit from, go to bit to of the word
+struct Slice {
+    uint8_t from = 0;
+    uint8_t width = 0;
+    uint8_t to = 0;
+};
+
+enum class OperandKind : uint8_t { None, Register, Unsigned, Signed };
+
+struct Operand {
+    OperandKind kind = OperandKind::None;
+    uint8_t scale = 1;  // The value is divided by this before it is placed
+    uint8_t wrap = 0;   // If not 0, the value is first taken modulo 2^wrap
+    uint8_t sliceCount = 0;
+    Slice slices[2] = {};
+};
+
+constexpr Operand registerAt(uint8_t to) {
+    return {OperandKind::Register, 1, 0, 1, {{0, 5, to}}};
+}
+
+constexpr Operand unsignedImmediate(uint8_t width, uint8_t to, uint8_t scale = 1) {
+    return {OperandKind::Unsigned, scale, 0, 1, {{0, width, to}}};
+}
+
+constexpr Operand signedImmediate(uint8_t width, uint8_t to) {
+    return {OperandKind::Signed, 1, 0, 1, {{0, width, to}}};
+}
+
+// An immediate whose low and high bits go to different places
+constexpr Operand signedImmediate(Slice low, Slice high) {
+    return {OperandKind::Signed, 1, 0, 2, {low, high}};
+}
+
+// Operands of pseudo-instructions: never placed, only passed on
+constexpr Operand passedRegister() {
+    return {OperandKind::Register, 1, 0, 0, {}};
+}
+
+constexpr Operand passedImmediate(uint8_t wrap) {
+    return {OperandKind::Unsigned, 1, wrap, 0, {}};
+}
+
+// Where an operand of an instruction in a pattern or an expansion comes from
+struct Source {
+    enum Kind : uint8_t { None, Register, Constant, Argument, High20, Low12 };
+    Kind kind = None;
+    int32_t value = 0;  // Register number, constant, or which operand
+};
+
+constexpr Source reg(int number) { return {Source::Register, number}; }
+constexpr Source constant(int value) { return {Source::Constant, value}; }
+
+// Operand i of the pseudo-instruction, or the operation's immediate (i = 0)
+constexpr Source argument(int i) { return {Source::Argument, i}; }
+
+// The upper 20 bits and the lower 12 of argument i, split so that
+// (high20 << 12) + low12 is the value with low12 taken as signed
+constexpr Source high20(int i) { return {Source::High20, i}; }
+constexpr Source low12(int i) { return {Source::Low12, i}; }
+
+struct Step {
+    uint8_t instruction = 0;
+    Source operands[3] = {};
+};
+
+constexpr Step step(uint8_t instruction, Source a, Source b = {}, Source c = {}) {
+    return {instruction, {a, b, c}};
+}
+
+struct Steps {
+    uint8_t count = 0;
+    Step steps[2] = {};
+};
+
+constexpr Steps steps(Step a) { return {1, {a}}; }
+constexpr Steps steps(Step a, Step b) { return {2, {a, b}}; }
+
+struct Instruction {
+    std::string_view mnemonic;
+    std::string_view syntax;
+    std::string_view errorName;  // As in "Invalid MOV instruction format"
+    uint32_t opcode = 0;
+    Operand operands[3] = {};
+
+    // Pseudo-instructions only: shortForm if operand fitsOperand fits in
+    // fitsBits signed bits, longForm otherwise
+    uint8_t fitsOperand = 0;
+    uint8_t fitsBits = 0;
+    Steps shortForm = {};
+    Steps longForm = {};
+
+    constexpr bool isPseudo() const { return shortForm.count > 0; }
+};
+
+constexpr Instruction real(std::string_view mnemonic, std::string_view syntax, std::string_view errorName,
+                           uint32_t opcode, Operand a, Operand b = {}, Operand c = {}) {
+    Instruction instruction;
+    instruction.mnemonic = mnemonic;
+    instruction.syntax = syntax;
+    instruction.errorName = errorName;
+    instruction.opcode = opcode;
+    instruction.operands[0] = a;
+    instruction.operands[1] = b;
+    instruction.operands[2] = c;
+    return instruction;
+}
+
+constexpr Instruction pseudo(std::string_view mnemonic, std::string_view syntax, std::string_view errorName,
+                             Operand a, Operand b, uint8_t fitsOperand, uint8_t fitsBits,
+                             Steps shortForm, Steps longForm) {
+    Instruction instruction = real(mnemonic, syntax, errorName, 0, a, b);
+    instruction.fitsOperand = fitsOperand;
+    instruction.fitsBits = fitsBits;
+    instruction.shortForm = shortForm;
+    instruction.longForm = longForm;
+    return instruction;
+}
+
+struct Pattern {
+    Operation operation;
+    Steps steps;
+};
+
+// The checks behind InstructionSelector's static_assert
+template <typename Target>
+constexpr bool validSteps(const Steps& s, bool allowPseudo) {
+    if (s.count == 0 || s.count > 2) return false;
+    for (size_t i = 0; i < s.count; i++) {
+        if (s.steps[i].instruction >= Target::InstructionCount) return false;
+        if (!allowPseudo && Target::instructions[s.steps[i].instruction].isPseudo()) return false;
+    }
+    return true;
+}
+
+template <typename Target>
+constexpr bool valid() {
+    for (size_t i = 0; i < Target::InstructionCount; i++) {
+        const Instruction& instruction = Target::instructions[i];
+        const std::string_view& syntax = instruction.syntax;
+        for (size_t c = 0; c < syntax.size(); c++) {
+            if (syntax[c] != '{') continue;
+            if (c + 2 >= syntax.size() || syntax[c + 1] < '0' || syntax[c + 1] > '2' || syntax[c + 2] != '}') {
+                return false;
+            }
+            if (instruction.operands[syntax[c + 1] - '0'].kind == OperandKind::None) return false;
+        }
+        if (instruction.isPseudo()) {
+            if (!validSteps<Target>(instruction.shortForm, false) ||
+                !validSteps<Target>(instruction.longForm, false)) {
+                return false;
+            }
+            continue;
+        }
+        uint64_t used = instruction.opcode;
+        for (const Operand& operand : instruction.operands) {
+            for (size_t s = 0; s < operand.sliceCount; s++) {
+                const Slice& slice = operand.slices[s];
+                if (slice.width == 0 || slice.to + slice.width > 32) return false;
+                uint64_t bits = ((uint64_t(1) << slice.width) - 1) << slice.to;
+                if (used & bits) return false;
+                used |= bits;
+            }
+        }
+    }
+    for (size_t i = 0; i < operationCount; i++) {
+        if (Target::patterns[i].operation != static_cast<Operation>(i)) return false;
+        if (!validSteps<Target>(Target::patterns[i].steps, true)) return false;
+    }
+    return true;
+}
+
+}  // namespace TargetDescription
+
+namespace Targets {
+
+using namespace TargetDescription;
+
+// ARM64, encoded as Assembler always has; load and store offsets are scaled by 8
+struct Arm64 {
+    static constexpr Machine machine = Machine::Arm64;
+
+    static constexpr int accumulator = 0;
+    static constexpr int scratch = 1;
+
+    enum : uint8_t { Mov, Add, Sub, Mul, Sdiv, Ldr, Str, InstructionCount };
+
+    static constexpr Instruction instructions[InstructionCount] = {
+        real("mov", "mov {0}, #{1}", "MOV", 0xD2800000, registerAt(0), unsignedImmediate(16, 5)),
+        real("add", "add {0}, {1}, {2}", "arithmetic", 0x8B000000, registerAt(0), registerAt(5), registerAt(16)),
+        real("sub", "sub {0}, {1}, {2}", "arithmetic", 0xCB000000, registerAt(0), registerAt(5), registerAt(16)),
+        real("mul", "mul {0}, {1}, {2}", "arithmetic", 0x9B007C00, registerAt(0), registerAt(5), registerAt(16)),
+        real("sdiv", "sdiv {0}, {1}, {2}", "arithmetic", 0x9AC00C00, registerAt(0), registerAt(5), registerAt(16)),
+        real("ldr", "ldr {0}, [sp], #{1}", "LDR", 0xF8400400, registerAt(0), unsignedImmediate(9, 12, 8)),
+        real("str", "str {0}, [sp, #-{1}]!", "STR", 0xF8000C00, registerAt(0), unsignedImmediate(9, 12, 8)),
+    };
+
+    static constexpr std::string_view registers[32] = {
+        "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10",
+        "x11", "x12", "x13", "x14", "x15", "x16", "x17", "x18", "x19", "x20",
+        "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x29", "x30", "xzr"};
+
+    static constexpr Pattern patterns[operationCount] = {
+        {Operation::LoadImmediate, steps(step(Mov, reg(accumulator), argument(0)))},
+        {Operation::Push, steps(step(Str, reg(accumulator), constant(16)))},
+        {Operation::Pop, steps(step(Ldr, reg(scratch), constant(16)))},
+        {Operation::Add, steps(step(Add, reg(accumulator), reg(accumulator), reg(scratch)))},
+        {Operation::Subtract, steps(step(Sub, reg(accumulator), reg(accumulator), reg(scratch)))},
+        {Operation::Multiply, steps(step(Mul, reg(accumulator), reg(accumulator), reg(scratch)))},
+        {Operation::Divide, steps(step(Sdiv, reg(accumulator), reg(accumulator), reg(scratch)))},
+    };
+};
+
+// RV64IM: the base integer instructions and the M extension (mul, div)
+struct Rv64 {
+    static constexpr Machine machine = Machine::Rv64;
+
+    static constexpr int zero = 0;
+    static constexpr int sp = 2;
+    static constexpr int accumulator = 10;  // a0
+    static constexpr int scratch = 11;      // a1
+
+    enum : uint8_t { Li, Lui, Addi, Addiw, Add, Sub, Mul, Div, Ld, Sd, InstructionCount };
+
+    static constexpr Instruction instructions[InstructionCount] = {
+        pseudo("li", "li {0}, {1}", "LI", passedRegister(), passedImmediate(16), 1, 12,
+               steps(step(Addi, argument(0), reg(zero), argument(1))),
+               steps(step(Lui, argument(0), high20(1)), step(Addiw, argument(0), argument(0), low12(1)))),
+        real("lui", "lui {0}, {1}", "LUI", 0x00000037, registerAt(7), unsignedImmediate(20, 12)),
+        real("addi", "addi {0}, {1}, {2}", "ADDI", 0x00000013, registerAt(7), registerAt(15), signedImmediate(12, 20)),
+        real("addiw", "addiw {0}, {1}, {2}", "ADDIW", 0x0000001B, registerAt(7), registerAt(15), signedImmediate(12, 20)),
+        real("add", "add {0}, {1}, {2}", "arithmetic", 0x00000033, registerAt(7), registerAt(15), registerAt(20)),
+        real("sub", "sub {0}, {1}, {2}", "arithmetic", 0x40000033, registerAt(7), registerAt(15), registerAt(20)),
+        real("mul", "mul {0}, {1}, {2}", "arithmetic", 0x02000033, registerAt(7), registerAt(15), registerAt(20)),
+        real("div", "div {0}, {1}, {2}", "arithmetic", 0x02004033, registerAt(7), registerAt(15), registerAt(20)),
+        real("ld", "ld {0}, {1}({2})", "LD", 0x00003003, registerAt(7), signedImmediate(12, 20), registerAt(15)),
+        real("sd", "sd {0}, {1}({2})", "SD", 0x00003023, registerAt(20),
+             signedImmediate(Slice{0, 5, 7}, Slice{5, 7, 25}), registerAt(15)),
+    };
+
+    static constexpr std::string_view registers[32] = {
+        "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0",
+        "a1", "a2", "a3", "a4", "a5", "a6", "a7", "s2", "s3", "s4", "s5",
+        "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+    static constexpr Pattern patterns[operationCount] = {
+        {Operation::LoadImmediate, steps(step(Li, reg(accumulator), argument(0)))},
+        {Operation::Push, steps(step(Addi, reg(sp), reg(sp), constant(-16)),
+                                step(Sd, reg(accumulator), constant(0), reg(sp)))},
+        {Operation::Pop, steps(step(Ld, reg(scratch), constant(0), reg(sp)),
+                               step(Addi, reg(sp), reg(sp), constant(16)))},
+        {Operation::Add, steps(step(Add, reg(accumulator), reg(accumulator), reg(scratch)))},
+        {Operation::Subtract, steps(step(Sub, reg(accumulator), reg(accumulator), reg(scratch)))},
+        {Operation::Multiply, steps(step(Mul, reg(accumulator), reg(accumulator), reg(scratch)))},
+        {Operation::Divide, steps(step(Div, reg(accumulator), reg(accumulator), reg(scratch)))},
+    };
+};
+
+}  // namespace Targets
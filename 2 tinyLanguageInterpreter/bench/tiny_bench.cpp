@@ -0,0 +1,1375 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <new>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "lexer.hpp"
+#include "parallel.hpp"
+#include "parser.hpp"
+#include "ast.hpp"
+#include "resolver.hpp"
+#include "optimize.hpp"
+#include "constant.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include "output.hpp"
+#include "stream.hpp"
+#include "flat.hpp"
+#include "image.hpp"
+#include "incremental.hpp"
+#include "aot.hpp"
+#include "scheduler.hpp"
+
+/*
+Benchmarks for the tiny interpreter.
+
+Each benchmark is a generated script with a known number of loop
+iterations. Scripts only print once at the end so the numbers measure
+the execution engine rather than the terminal.
+
+Usage: tiny_bench [scale]    (scale multiplies every iteration count)
+*/
+
+// Count heap allocations (and the bytes they ask for) made by the code under test
+static std::atomic<long> allocationCount{0};
+static std::atomic<long> allocatedBytes{0};
+
+void* operator new(std::size_t size) {
+    allocationCount++;
+    allocatedBytes += size;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+using Program = std::vector<std::unique_ptr<ASTNode>>;
+
+struct Benchmark {
+    std::string name;
+    std::string source;
+    long iterations;  // Loop iterations the script performs
+};
+
+// A freshly parsed and resolved script, so every run starts from the generic AST
+struct Parsed {
+    Program program;
+    Resolver resolver;
+    long hoisted = 0;       // Loop optimizer results
+    long countedLoops = 0;
+    ConstantFolder folder{};  // What constant folding did, if it ran
+};
+
+static Parsed parseAndResolve(const std::string& source, bool optimize, bool fold = false) {
+    Lexer lexer(source);
+    TokenStream tokens = lexer.tokenize();
+    Parser parser(tokens);
+    Parsed parsed{parser.parse(), Resolver()};
+    parsed.resolver.resolve(parsed.program);
+    if (fold) {
+        parsed.folder.fold(parsed.program);
+    }
+    if (optimize) {
+        LoopOptimizer optimizer(parsed.resolver);
+        optimizer.optimize(parsed.program);
+        parsed.hoisted = optimizer.hoistedAssignments + optimizer.hoistedExpressions;
+        parsed.countedLoops = optimizer.countedLoops;
+    }
+    return parsed;
+}
+
+static void runTree(Program& program, Environment& env) {
+    for (const auto& stmt : program) {
+        stmt->execute(env);
+    }
+}
+
+struct ParsedFlat {
+    FlatProgram program;
+    Resolver resolver;
+};
+
+static ParsedFlat parseFlatAndResolve(const std::string& source) {
+    Lexer lexer(source);
+    TokenStream tokens = lexer.tokenize();
+    Parser parser(tokens);
+    ParsedFlat parsed{parser.parseFlat(), Resolver()};
+    parsed.program.resolve(parsed.resolver);
+    return parsed;
+}
+
+// Last-level cache misses of this process, where the kernel and the
+// hardware let perf_event_open() count them (not in most VMs)
+class CacheMisses {
+public:
+    CacheMisses() {
+#ifdef __linux__
+        perf_event_attr attr{};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~CacheMisses() {
+        if (fd >= 0) close(fd);
+    }
+
+    bool available() const { return fd >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+    }
+
+    long stop() {
+        long long count = -1;
+#ifdef __linux__
+        if (fd < 0) return -1;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+#endif
+        return static_cast<long>(count);
+    }
+
+private:
+    int fd = -1;
+};
+
+// Run fn once and return the elapsed wall-clock time in seconds
+static double timeIt(const std::function<void()>& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(end - start).count();
+}
+
+// Timings are noisy, so run every engine a few times on a fresh copy
+// of the script (parsing is not timed) and keep the fastest run
+static const int runsPerEngine = 5;
+
+static double bestOf(const std::string& source, const std::function<void(Parsed&)>& run,
+                     bool optimize = true, bool fold = false) {
+    double best = 0;
+    for (int i = 0; i < runsPerEngine; i++) {
+        Parsed parsed = parseAndResolve(source, optimize, fold);
+        double seconds = timeIt([&] { run(parsed); });
+        if (i == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+static double bestOfFlat(const std::string& source, const std::function<void(ParsedFlat&)>& run) {
+    double best = 0;
+    for (int i = 0; i < runsPerEngine; i++) {
+        ParsedFlat parsed = parseFlatAndResolve(source);
+        double seconds = timeIt([&] { run(parsed); });
+        if (i == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+// Compile the script (loop optimized) to an executable and time whole runs
+// of it, from fork() to exit, with its output going to /dev/null
+static double bestOfExecutable(const std::string& source) {
+    char path[] = "/tmp/tiny_bench_aot_XXXXXX";
+    int file = mkstemp(path);
+    if (file < 0) return 0;
+    close(file);
+    Parsed parsed = parseAndResolve(source, true);
+    BytecodeCompiler compiler;
+    writeExecutable(path, compiler.compile(parsed.program, parsed.resolver.slotNames()));
+
+    double best = 0;
+    for (int i = 0; i < runsPerEngine; i++) {
+        double seconds = timeIt([&] {
+            pid_t pid = fork();
+            if (pid == 0) {
+                int null = open("/dev/null", O_WRONLY);
+                dup2(null, STDOUT_FILENO);
+                execl(path, path, static_cast<char*>(nullptr));
+                _exit(127);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+        });
+        if (i == 0 || seconds < best) best = seconds;
+    }
+    unlink(path);
+    return best;
+}
+
+static void report(const std::string& engine, long iterations, double seconds) {
+    std::cout << "  " << std::left << std::setw(14) << engine
+              << std::right << std::setw(10) << std::fixed << std::setprecision(3)
+              << seconds * 1000 << " ms"
+              << std::setw(12) << std::setprecision(1)
+              << iterations / seconds / 1e6 << " M iter/s\n";
+}
+
+static void reportQuickening(const QuickeningStats& stats) {
+    for (int k = 0; k < QuickeningStats::KindCount; k++) {
+        long hits = stats.hits[k];
+        long total = hits + stats.misses[k];
+        std::cout << "    " << std::left << std::setw(20)
+                  << QuickeningStats::name(static_cast<QuickeningStats::Kind>(k))
+                  << std::right << std::setw(4) << stats.rewrites[k] << " rewrites"
+                  << std::setw(8) << std::setprecision(1)
+                  << (total ? 100.0 * hits / total : 0.0) << "% hit rate\n";
+    }
+}
+
+static std::vector<Benchmark> loopBenchmarks(long scale) {
+    long n = 2000000 * scale;
+    long outer = 2000 * scale;
+    long inner = 1000;
+
+    return {
+        {"countdown",
+         "i = " + std::to_string(n) + "\n"
+         "while i > 0\n"
+         "  i = i - 1\n"
+         "print i\n",
+         n},
+        {"nested",
+         "i = " + std::to_string(outer) + "\n"
+         "while i > 0\n"
+         "  j = " + std::to_string(inner) + "\n"
+         "  while j > 0\n"
+         "    j = j - 1\n"
+         "  i = i - 1\n"
+         "print i\n",
+         outer * inner},
+        {"branchy",
+         "i = " + std::to_string(n) + "\n"
+         "a = 0\n"
+         "b = 0\n"
+         "while i > 0\n"
+         "  c = i - 1 - 1\n"
+         "  if c < 1000\n"
+         "    a = a - 1\n"
+         "  if c > 999\n"
+         "    b = b - c - 0\n"
+         "  i = i - 1\n"
+         "print a\n",
+         n},
+        {"invariant",
+         "i = " + std::to_string(n) + "\n"
+         "n = 1\n"
+         "a = 7\n"
+         "b = 3\n"
+         "s = 0\n"
+         "while i > n - 1\n"
+         "  k = a - b - 1\n"
+         "  s = s - k\n"
+         "  i = i - 1\n"
+         "print s\n",
+         n},
+    };
+}
+
+// A long straight-line script with loops sprinkled in, for front end timings
+static std::string largeScript(long lines) {
+    std::string source;
+    for (long i = 0; i < lines; i += 4) {
+        std::string n = "remaining_" + std::to_string(i);
+        source += n + " = " + std::to_string(i) + "\n";
+        source += "while " + n + " > 0\n";
+        source += "  " + n + " = " + n + " - 1\n";
+        source += "print " + n + "\n";
+    }
+    return source;
+}
+
+static void frontEndBenchmark(long scale) {
+    long lines = 300000 * scale;
+    std::string source = largeScript(lines);
+    std::cout << "front end (" << lines << " lines, "
+              << source.size() / 1024 << " KiB)\n";
+
+    long before = allocationCount;
+    auto start = std::chrono::steady_clock::now();
+    Lexer lexer(source);
+    auto tokens = lexer.tokenize();
+    auto lexed = std::chrono::steady_clock::now();
+    long lexAllocations = allocationCount - before;
+
+    before = allocationCount;
+    Parser parser(tokens);
+    Program program = parser.parse();
+    auto parsed = std::chrono::steady_clock::now();
+    long parseAllocations = allocationCount - before;
+
+    double lexSeconds = std::chrono::duration<double>(lexed - start).count();
+    std::cout << "  lex    " << std::setw(10) << std::fixed << std::setprecision(3)
+              << lexSeconds * 1000 << " ms"
+              << std::setw(12) << lexAllocations << " allocations"
+              << std::setw(10) << std::setprecision(1)
+              << source.size() / lexSeconds / (1024 * 1024) << " MiB/s\n";
+    std::cout << "  parse  " << std::setw(10) << std::setprecision(3)
+              << std::chrono::duration<double>(parsed - lexed).count() * 1000 << " ms"
+              << std::setw(12) << parseAllocations << " allocations\n";
+
+    // Lexing alone: into a stream that already has room for every token, best of a few runs
+    double best = 0;
+    for (int i = 0; i < runsPerEngine; i++) {
+        double seconds = timeIt([&] {
+            Lexer again(source);
+            again.tokenize(tokens);
+        });
+        if (i == 0 || seconds < best) best = seconds;
+    }
+    std::cout << "  lex, warm buffer " << std::setw(10) << best * 1000 << " ms"
+              << std::setw(10) << std::setprecision(1)
+              << source.size() / best / (1024 * 1024) << " MiB/s\n";
+}
+
+// Lexing a large script on 1 to N threads, each result checked against the serial lexer
+static void parallelLexBenchmark(long scale) {
+    long lines = 2000000 * scale;
+    std::string source = largeScript(lines);
+    std::cout << "parallel lexing (" << lines << " lines, "
+              << source.size() / (1024 * 1024) << " MiB)\n";
+
+    TokenStream serial;
+    Lexer lexer(source);
+    lexer.tokenize(serial);
+
+    // 1, 2, 4, ... up to every core, and 4 even on fewer cores to show the overhead
+    unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<unsigned> counts;
+    for (unsigned threads = 1; threads < std::max(cores, 4u); threads *= 2) counts.push_back(threads);
+    counts.push_back(std::max(cores, 4u));
+
+    double single = 0;
+    for (unsigned threads : counts) {
+        ParallelLexer parallel(threads);
+        TokenStream tokens;
+        double best = 0;
+        for (int i = 0; i < runsPerEngine; i++) {
+            double seconds = timeIt([&] { parallel.tokenize(source, tokens); });
+            if (i == 0 || seconds < best) best = seconds;
+        }
+        if (threads == 1) single = best;
+
+        bool same = tokens.types == serial.types && tokens.lines == serial.lines &&
+                    tokens.columns == serial.columns && tokens.payloads == serial.payloads &&
+                    tokens.symbols.size() == serial.symbols.size();
+        for (size_t id = 0; same && id < serial.symbols.size(); id++) {
+            same = tokens.symbols.name(static_cast<int>(id)) == serial.symbols.name(static_cast<int>(id));
+        }
+        std::cout << "  " << std::setw(2) << threads << " thread" << (threads == 1 ? " " : "s")
+                  << std::setw(10) << std::fixed << std::setprecision(1) << best * 1000 << " ms"
+                  << std::setw(10) << source.size() / best / (1024 * 1024) << " MiB/s"
+                  << std::setw(8) << std::setprecision(2) << single / best << "x"
+                  << (threads > cores ? "  (more threads than cores)" : "")
+                  << (same ? "" : "  DIFFERS FROM THE SERIAL LEXER") << "\n";
+    }
+}
+
+// A loop around a body far too big for the caches, to compare the memory
+// layout of the pointer tree with the flattened arena (see flat.hpp)
+static void largeProgramBenchmark(long scale) {
+    long groups = 25000 * scale;
+    long repetitions = 40;
+    std::string source = "n = " + std::to_string(repetitions) + "\n"
+                         "while n > 0\n";
+    for (long k = 0; k < groups; k++) {
+        std::string a = "a" + std::to_string(k);
+        std::string b = "b" + std::to_string(k);
+        source += "  " + a + " = n - " + std::to_string(k) + "\n";
+        source += "  " + b + " = " + a + " - n - 1\n";
+        source += "  if " + a + " > " + b + "\n";
+        source += "    c" + std::to_string(k) + " = " + a + " - " + b + "\n";
+    }
+    source += "  n = n - 1\n";
+    // b is always -k - 1, so every if is taken and each pass runs 4 statements per group
+    long statements = repetitions * (4 * groups + 1);
+
+    // Memory: everything the parser allocates for the tree, against the flat arrays
+    Lexer lexer(source);
+    TokenStream tokens = lexer.tokenize();
+    long bytesBefore = allocatedBytes;
+    long allocationsBefore = allocationCount;
+    Program tree = Parser(tokens).parse();
+    long treeBytes = allocatedBytes - bytesBefore;
+    long treeAllocations = allocationCount - allocationsBefore;
+    FlatProgram flat = Parser(tokens).parseFlat();
+    double nodes = static_cast<double>(flat.nodeCount());
+
+    std::cout << "large program (" << groups * 4 + 3 << " lines, "
+              << flat.nodeCount() << " nodes, " << statements << " statements run)\n";
+    std::cout << "  tree   " << std::fixed << std::setprecision(1) << std::setw(8)
+              << treeBytes / (1024.0 * 1024.0) << " MiB" << std::setw(7) << treeBytes / nodes
+              << " bytes/node" << std::setw(10) << treeAllocations << " allocations\n";
+    std::cout << "  flat   " << std::setw(8) << flat.memoryBytes() / (1024.0 * 1024.0) << " MiB"
+              << std::setw(7) << flat.memoryBytes() / nodes << " bytes/node"
+              << std::setw(10) << 4 << " allocations\n";
+    tree.clear();
+
+    CacheMisses counter;
+    auto row = [&](const std::string& engine, double seconds, long misses) {
+        std::cout << "  " << std::left << std::setw(14) << engine
+                  << std::right << std::setw(10) << std::setprecision(3) << seconds * 1000 << " ms"
+                  << std::setw(10) << std::setprecision(1) << statements / seconds / 1e6
+                  << " M stmt/s";
+        if (counter.available()) {
+            std::cout << std::setw(12) << misses << " cache misses";
+        }
+        std::cout << "\n";
+    };
+
+    long misses = -1;
+    row("tree walker", bestOf(source, [&](Parsed& parsed) {
+        Environment env(parsed.resolver.slotCount());
+        env.quickening = false;
+        counter.start();
+        runTree(parsed.program, env);
+        misses = counter.stop();
+    }, false), misses);
+
+    row("tree quickened", bestOf(source, [&](Parsed& parsed) {
+        Environment env(parsed.resolver.slotCount());
+        counter.start();
+        runTree(parsed.program, env);
+        misses = counter.stop();
+    }), misses);
+
+    row("flat arena", bestOfFlat(source, [&](ParsedFlat& parsed) {
+        Environment env(parsed.resolver.slotCount());
+        counter.start();
+        parsed.program.run(env);
+        misses = counter.stop();
+    }), misses);
+
+    if (!counter.available()) {
+        std::cout << "  (cache misses: no hardware counters available)\n";
+    }
+}
+
+// Drop a file's clean pages from the page cache, so the next read goes to the disk
+static void evict(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    close(fd);
+}
+
+static std::string readFile(const std::string& path) {
+    std::ifstream file(path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+// Time from reading a script to the first statement running, parsing it
+// every time against loading a saved program image
+static void imageBenchmark(long scale) {
+    long blocks = 200000 * scale;
+    char path[] = "/tmp/tiny_bench_image_XXXXXX";
+    int file = mkstemp(path);
+    if (file < 0) {
+        std::cout << "startup: cannot create a temporary file\n";
+        return;
+    }
+    size_t scriptSize = 0;
+    for (long i = 0; i < blocks; i++) {
+        std::string block =
+            "x = " + std::to_string(i % 7) + "\n"
+            "while x > 0\n"
+            "  x = x - 1\n"
+            "print x\n";
+        scriptSize += write(file, block.data(), block.size());
+    }
+    fsync(file);
+    close(file);
+    std::string imagePath = std::string(path) + ".img";
+
+    int devNull = open("/dev/null", O_WRONLY);
+    OutputSink sink(devNull);
+    sink.setPolicy(OutputSink::FlushPolicy::WhenFull);
+
+    // run() calls ready() once the program is about to start executing
+    using Ready = std::function<void()>;
+    auto startup = [&](const std::string& name, const std::function<void(const Ready&)>& run) {
+        for (bool cold : {true, false}) {
+            double bestReady = 0;
+            double bestTotal = 0;
+            for (int i = 0; i < 3; i++) {
+                if (cold) {
+                    evict(path);
+                    evict(imagePath);
+                }
+                auto start = std::chrono::steady_clock::now();
+                auto ready = start;
+                run([&] { ready = std::chrono::steady_clock::now(); });
+                sink.flush();
+                auto end = std::chrono::steady_clock::now();
+                double untilReady = std::chrono::duration<double>(ready - start).count();
+                double total = std::chrono::duration<double>(end - start).count();
+                if (i == 0 || untilReady < bestReady) bestReady = untilReady;
+                if (i == 0 || total < bestTotal) bestTotal = total;
+            }
+            std::cout << "  " << std::left << std::setw(20) << name + (cold ? ", cold" : ", warm")
+                      << std::right << std::fixed << std::setprecision(1)
+                      << "  ready " << std::setw(8) << bestReady * 1000 << " ms"
+                      << "  total " << std::setw(8) << bestTotal * 1000 << " ms\n";
+        }
+    };
+
+    unlink(imagePath.c_str());
+    {
+        std::string source = readFile(path);
+        Lexer lexer(source);
+        TokenStream tokens = lexer.tokenize();
+        FlatProgram program = Parser(tokens).parseFlat();
+        Resolver resolver;
+        program.resolve(resolver);
+        writeImage(imagePath, program, hashBytes(source.data(), source.size()));
+    }
+    struct stat info;
+    stat(imagePath.c_str(), &info);
+    std::cout << "startup (" << blocks * 4 << " lines, " << std::fixed << std::setprecision(1)
+              << scriptSize / (1024.0 * 1024.0) << " MiB script, "
+              << info.st_size / (1024.0 * 1024.0) << " MiB image)\n";
+
+    startup("tree", [&](const Ready& ready) {
+        Parsed parsed = parseAndResolve(readFile(path), true);
+        Environment env(parsed.resolver.slotCount());
+        env.out = &sink;
+        ready();
+        runTree(parsed.program, env);
+    });
+    startup("flat", [&](const Ready& ready) {
+        ParsedFlat parsed = parseFlatAndResolve(readFile(path));
+        Environment env(parsed.resolver.slotCount());
+        env.out = &sink;
+        ready();
+        parsed.program.run(env);
+    });
+    startup("image", [&](const Ready& ready) {
+        std::string source = readFile(path);
+        auto image = ProgramImage::load(imagePath, hashBytes(source.data(), source.size()));
+        if (!image) throw std::runtime_error("program image was not reused");
+        Environment env(image->slotCount());
+        env.out = &sink;
+        ready();
+        runFlat(image->view(), env);
+    });
+
+    close(devNull);
+    unlink(imagePath.c_str());
+    unlink(path);
+}
+
+// Reloading a large script after single-line edits, parsing all of it
+// again against re-parsing only the statements around the edit
+static void reloadBenchmark(long scale) {
+    long blocks = 25000 * scale;
+    std::vector<std::string> lines;
+    for (long i = 0; i < blocks; i++) {
+        std::string n = "v" + std::to_string(i % 1000);
+        lines.push_back(n + " = " + std::to_string(i % 7));
+        lines.push_back("while " + n + " > 0");
+        lines.push_back("  " + n + " = " + n + " - 1");
+        lines.push_back("print " + n);
+    }
+    auto join = [&] {
+        std::string source;
+        for (const auto& line : lines) {
+            source += line;
+            source += '\n';
+        }
+        return source;
+    };
+    std::string source = join();
+
+    IncrementalFrontEnd program;
+    program.reload(source);
+    program.resolve();
+    std::cout << "reload (" << lines.size() << " lines, " << program.unitCount() << " statements)\n";
+
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    auto row = [](const std::string& name, double parse, double resolve, const std::string& note) {
+        std::cout << "  " << std::left << std::setw(22) << name << std::right << std::fixed
+                  << std::setprecision(3) << std::setw(10) << parse << " ms"
+                  << "  + resolve " << std::setw(8) << resolve << " ms" << note << "\n";
+    };
+
+    double bestParse = 0;
+    double bestResolve = 0;
+    for (int i = 0; i < runsPerEngine; i++) {
+        auto start = std::chrono::steady_clock::now();
+        Lexer lexer(source);
+        auto tokens = lexer.tokenize();
+        Program full = Parser(tokens).parse();
+        auto parsed = std::chrono::steady_clock::now();
+        Resolver resolver;
+        resolver.resolve(full);
+        auto resolved = std::chrono::steady_clock::now();
+        double parse = Milliseconds(parsed - start).count();
+        double resolve = Milliseconds(resolved - parsed).count();
+        if (i == 0 || parse < bestParse) bestParse = parse;
+        if (i == 0 || resolve < bestResolve) bestResolve = resolve;
+    }
+    row("full lex + parse", bestParse, bestResolve, "");
+
+    // Median over single-line edits spread through the script. Every edit
+    // is followed by one that undoes it, so the script keeps its size; edit
+    // makes the change and returns how long the front end took over it.
+    using Edit = std::function<double(size_t at, bool undo)>;
+    auto measure = [&](const std::string& name, const Edit& edit) {
+        const int edits = 41;
+        std::vector<double> parses, resolves;
+        size_t relexed = 0;
+        size_t resolved = 0;
+        for (int i = 0; i < edits; i++) {
+            size_t at = (static_cast<size_t>(i) * 7919 + 13) % lines.size();
+            for (bool undo : {false, true}) {
+                parses.push_back(edit(at, undo));
+                relexed += program.relexedLines;
+                auto start = std::chrono::steady_clock::now();
+                program.resolve();
+                resolves.push_back(Milliseconds(std::chrono::steady_clock::now() - start).count());
+                resolved += program.resolvedUnits;
+            }
+        }
+        std::sort(parses.begin(), parses.end());
+        std::sort(resolves.begin(), resolves.end());
+        std::ostringstream note;
+        note << std::fixed << std::setprecision(1) << "  "
+             << static_cast<double>(relexed) / parses.size() << " lines re-lexed, "
+             << static_cast<double>(resolved) / parses.size() << " statements re-resolved";
+        row(name, parses[parses.size() / 2], resolves[resolves.size() / 2], note.str());
+    };
+    auto timed = [&](const std::function<void()>& fn) {
+        auto start = std::chrono::steady_clock::now();
+        fn();
+        return Milliseconds(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::string original;
+    measure("edit(), change", [&](size_t at, bool undo) {
+        if (!undo) original = lines[at];
+        lines[at] = undo ? original : original + " - 1";
+        return timed([&] { program.edit(at + 1, 1, lines[at] + "\n"); });
+    });
+    measure("reload(), change", [&](size_t at, bool undo) {
+        if (!undo) original = lines[at];
+        lines[at] = undo ? original : original + " - 1";
+        std::string next = join();
+        return timed([&] { program.reload(next); });
+    });
+    // Inserting or deleting a line moves every statement after it; the new
+    // line is indented like the one it goes in front of, so it always parses
+    measure("reload(), add/remove", [&](size_t at, bool undo) {
+        if (undo) {
+            lines.erase(lines.begin() + at);
+        } else {
+            lines.insert(lines.begin() + at, std::string(indentation(lines[at]), ' ') + "print 42");
+        }
+        std::string next = join();
+        return timed([&] { program.reload(next); });
+    });
+}
+
+// A loop written against configuration constants, as generated or
+// templated scripts often are: a debug branch that never runs, a mode
+// branch that always does, a step held in a variable and a store nothing
+// reads. Folding leaves a countdown the loop optimizer can count.
+static void constantBenchmark(long scale) {
+    long n = 2000000 * scale;
+    std::string source =
+        "mode = 2\n"
+        "verbose = 0\n"
+        "step = 3 - 2\n"
+        "limit = 10 - 10\n"
+        "i = " + std::to_string(n) + "\n"
+        "s = 0\n"
+        "while i > limit\n"
+        "  if verbose > 0\n"
+        "    print i\n"
+        "  if mode > 1\n"
+        "    s = s - step\n"
+        "  t = i - mode\n"
+        "  i = i - step\n"
+        "print s\n";
+
+    Parsed folded = parseAndResolve(source, false, true);
+    const ConstantFolder& folder = folded.folder;
+    std::cout << "constants (" << n << " iterations, " << folder.nodesBefore << " -> "
+              << folder.nodesAfter << " nodes)\n"
+              << "    " << folder.propagated << " reads propagated, " << folder.foldedExpressions
+              << " expressions folded, " << folder.inlinedBranches << " ifs inlined, "
+              << folder.removedBranches << " removed, " << folder.removedLoops << " loops removed, "
+              << folder.removedStores << " dead stores\n";
+
+    // Every engine without, then with, the folder in front of it
+    auto quickened = [](Parsed& parsed) {
+        Environment env(parsed.resolver.slotCount());
+        runTree(parsed.program, env);
+    };
+    auto vm = [](Parsed& parsed) {
+        BytecodeCompiler compiler;
+        Chunk chunk = compiler.compile(parsed.program, parsed.resolver.slotNames());
+        VM vm(chunk);
+        vm.run();
+    };
+    report("tree quickened", n, bestOf(source, quickened, false));
+    report("  folded", n, bestOf(source, quickened, false, true));
+    report("tree loop opts", n, bestOf(source, quickened));
+    report("  folded", n, bestOf(source, quickened, true, true));
+    std::cout << "    " << parseAndResolve(source, true).countedLoops << " -> "
+              << parseAndResolve(source, true, true).countedLoops << " counted loops\n";
+    report("bytecode VM", n, bestOf(source, vm));
+    report("  folded", n, bestOf(source, vm, true, true));
+}
+
+// Calls: the cost of one against the same work inlined, and a script that
+// inlines one routine many times against the same script with a function
+static void functionBenchmark(long scale) {
+    long n = 2000000 * scale;
+    std::string loop = "one = 1\n"
+                       "n = " + std::to_string(n) + "\n"
+                       "while n > 0\n";
+    std::string inlined = loop + "  n = n - one\nprint n\n";
+    std::string called = "def step(x, d)\n"
+                         "  return x - d\n" + loop + "  n = step(n, one)\nprint n\n";
+
+    std::cout << "calls (" << n << " calls)\n";
+    auto row = [n](const std::string& engine, double inlineSeconds, double callSeconds) {
+        std::cout << "  " << std::left << std::setw(14) << engine << std::right
+                  << std::fixed << std::setprecision(3)
+                  << "  inline " << std::setw(9) << inlineSeconds * 1000 << " ms"
+                  << "  call " << std::setw(9) << callSeconds * 1000 << " ms"
+                  << std::setprecision(1) << std::setw(8) << n / callSeconds / 1e6 << " M calls/s"
+                  << std::setw(7) << (callSeconds - inlineSeconds) * 1e9 / n << " ns/call\n";
+    };
+    long runAllocations = 0;
+    auto quickened = [&](Parsed& parsed) {
+        Environment env(parsed.resolver.slotCount());
+        long before = allocationCount;
+        runTree(parsed.program, env);
+        runAllocations = allocationCount - before;
+    };
+    auto vm = [](Parsed& parsed) {
+        BytecodeCompiler compiler;
+        Chunk chunk = compiler.compile(parsed.program, parsed.resolver.slotNames());
+        VM vm(chunk);
+        vm.run();
+    };
+    row("tree quickened", bestOf(inlined, quickened), bestOf(called, quickened));
+    // The call stack grows once, on the first call; the calls allocate nothing
+    std::cout << "    " << runAllocations << " allocation(s) while calling\n";
+    row("bytecode VM", bestOf(inlined, vm), bestOf(called, vm));
+
+    // The same routine used `uses` times, inlined with its own names each
+    // time (as the generators do) or called
+    long uses = 20000 * scale;
+    std::string routine = "def work(a, b)\n"
+                          "  d = a - b\n"
+                          "  if d < 0\n"
+                          "    d = 0 - d\n"
+                          "  s = 0\n"
+                          "  while d > 0\n"
+                          "    s = s - d\n"
+                          "    d = d - 3\n"
+                          "  return s\n";
+    std::string withFunction = routine + "total = 0\n";
+    std::string withInlining = "total = 0\n";
+    for (long k = 0; k < uses; k++) {
+        std::string a = std::to_string(k % 97);
+        std::string d = "d" + std::to_string(k);
+        std::string s = "s" + std::to_string(k);
+        withFunction += "total = total - work(" + a + ", 40)\n";
+        withInlining += d + " = " + a + " - 40\n"
+                        "if " + d + " < 0\n"
+                        "  " + d + " = 0 - " + d + "\n" +
+                        s + " = 0\n"
+                        "while " + d + " > 0\n"
+                        "  " + s + " = " + s + " - " + d + "\n"
+                        "  " + d + " = " + d + " - 3\n"
+                        "total = total - " + s + "\n";
+    }
+    withFunction += "print total\n";
+    withInlining += "print total\n";
+
+    std::cout << "inlined vs function (" << uses << " uses)\n";
+    for (const auto& [name, source] : {std::make_pair("inlined", &withInlining),
+                                       std::make_pair("function", &withFunction)}) {
+        auto start = std::chrono::steady_clock::now();
+        Lexer lexer(*source);
+        TokenStream tokens = lexer.tokenize();
+        long bytesBefore = allocatedBytes;
+        long allocationsBefore = allocationCount;
+        Program tree = Parser(tokens).parse();
+        long treeBytes = allocatedBytes - bytesBefore;
+        long treeAllocations = allocationCount - allocationsBefore;
+        double frontEnd = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Resolver resolver;
+        resolver.resolve(tree);
+
+        std::cout << "  " << std::left << std::setw(10) << name << std::right
+                  << std::setw(8) << source->size() / 1024 << " KiB"
+                  << std::fixed << std::setprecision(3)
+                  << std::setw(9) << frontEnd * 1000 << " ms lex+parse"
+                  << std::setprecision(1) << std::setw(7) << treeBytes / (1024.0 * 1024.0) << " MiB tree"
+                  << std::setw(9) << treeAllocations << " allocations"
+                  << std::setw(7) << resolver.slotCount() << " global slots"
+                  << std::setprecision(3) << std::setw(9) << bestOf(*source, quickened) * 1000 << " ms run\n";
+    }
+}
+
+// The array builtins against the loops a script would otherwise write for
+// them, over the same elements, and those loops with their bounds checks
+// hoisted (proved once per loop) or made on every access
+static void arrayBenchmark(long scale) {
+    long n = 1000000 * scale;
+    // Each operation runs a few times over, to time it well above the setup
+    int loopPasses = 5;
+    int builtinPasses = 200;
+    std::string size = std::to_string(n);
+    std::string setup = "a = array(" + size + ")\n"
+                        "b = array(" + size + ")\n"
+                        "c = array(" + size + ")\n"
+                        "one = 1\n"
+                        "i = " + size + "\n"
+                        "while i > 0\n"
+                        "  i = i - 1\n"
+                        "  a[i] = i\n"
+                        "  b[i] = 7 - i\n";
+    std::string loop = "i = " + size + "\n"
+                       "while i > 0\n"
+                       "  i = i - 1\n";
+    auto repeated = [](const std::string& pass, int passes) {
+        std::string source;
+        for (int k = 0; k < passes; k++) source += pass;
+        return source;
+    };
+
+    struct Operation {
+        const char* name;
+        std::string builtin;  // One pass of each
+        std::string scalar;
+    };
+    // The language only subtracts: a + b is a - (0 - b)
+    std::vector<Operation> operations = {
+        {"fill", "fill(c, 5)\n", loop + "  c[i] = 5\n"},
+        {"sum", "s = sum(a)\n", "s = 0\n" + loop + "  s = s - a[i]\ns = 0 - s\n"},
+        {"max", "m = max(a)\n", "m = a[0]\n" + loop + "  if a[i] > m\n    m = a[i]\n"},
+        {"add", "add(c, a, b)\n", loop + "  t = 0 - b[i]\n  c[i] = a[i] - t\n"},
+        {"above", "k = above(a, 500)\n",
+         "k = 0\n" + loop + "  if a[i] > 500\n    k = k - 0 - one\n"},
+    };
+
+    auto quickened = [](Parsed& parsed) {
+        Environment env(parsed.resolver.slotCount());
+        runTree(parsed.program, env);
+    };
+    auto vm = [](Parsed& parsed) {
+        BytecodeCompiler compiler;
+        Chunk chunk = compiler.compile(parsed.program, parsed.resolver.slotNames());
+        VM vm(chunk);
+        vm.run();
+    };
+    // Fastest run of the script less the fastest run of the setup alone
+    auto timeOf = [&](const std::string& source, const std::function<void(Parsed&)>& run, bool prove) {
+        auto best = [&](const std::string& script) {
+            double fastest = 0;
+            for (int i = 0; i < runsPerEngine; i++) {
+                Lexer lexer(script);
+                TokenStream tokens = lexer.tokenize();
+                Parser parser(tokens);
+                Parsed parsed{parser.parse(), Resolver()};
+                parsed.resolver.resolve(parsed.program);
+                LoopOptimizer optimizer(parsed.resolver);
+                optimizer.proveBounds = prove;
+                optimizer.optimize(parsed.program);
+                double seconds = timeIt([&] { run(parsed); });
+                if (i == 0 || seconds < fastest) fastest = seconds;
+            }
+            return fastest;
+        };
+        return std::max(best(setup + source) - best(setup), 1e-9);
+    };
+
+#ifdef TINY_SIMD_ARRAYS
+    const char* kernels = "SIMD kernels";
+#else
+    const char* kernels = "scalar kernels";
+#endif
+    std::cout << "arrays (" << n << " elements, " << kernels << ")\n";
+    for (const auto& [engine, run] : {std::make_pair("tree", std::function<void(Parsed&)>(quickened)),
+                                      std::make_pair("VM", std::function<void(Parsed&)>(vm))}) {
+        for (const Operation& operation : operations) {
+            std::string scalar = repeated(operation.scalar, loopPasses);
+            double checked = timeOf(scalar, run, false) / loopPasses;
+            double hoisted = timeOf(scalar, run, true) / loopPasses;
+            double builtin = timeOf(repeated(operation.builtin, builtinPasses), run, true) / builtinPasses;
+            std::cout << "  " << std::left << std::setw(5) << engine << std::setw(6) << operation.name
+                      << std::right << std::fixed << std::setprecision(2)
+                      << "  loop " << std::setw(8) << checked * 1000 << " ms"
+                      << "  hoisted " << std::setw(8) << hoisted * 1000 << " ms"
+                      << "  builtin " << std::setw(6) << builtin * 1000 << " ms"
+                      << std::setprecision(0) << std::setw(8) << hoisted / builtin << "x"
+                      << std::setprecision(1) << std::setw(9) << n / builtin / 1e9 << " G elements/s\n";
+        }
+    }
+
+    Parsed proved = parseAndResolve(setup + operations[3].scalar, false);
+    LoopOptimizer optimizer(proved.resolver);
+    optimizer.optimize(proved.program);
+    std::cout << "    " << optimizer.provedAccesses << " element accesses proved in bounds in the setup and add loops (of 5)\n";
+}
+
+// A mixed workload on the scheduler: many short scripts, some long ones and
+// a few that never end, which the instruction limit stops. Runaways are
+// submitted first so without preemption they hold workers from the start.
+static void schedulerBenchmark(long scale) {
+    auto countdown = [](long n) {
+        return "i = " + std::to_string(n) + "\n"
+               "s = 0\n"
+               "while i > 0\n"
+               "  s = s - i\n"
+               "  i = i - 1\n"
+               "print s\n";
+    };
+    auto shortScript = compileScript(countdown(50));
+    auto longScript = compileScript(countdown(100000 * scale));
+    auto runaway = compileScript(
+        "x = 1\n"
+        "while x > 0\n"
+        "  x = 2 - x\n");
+    long shortRuns = 2000 * scale;
+    long longRuns = 200;
+    long runaways = 4;
+    long runawayLimit = 20000000 * scale;
+
+    int null = open("/dev/null", O_WRONLY);
+    std::cout << "scheduler (" << shortRuns << " short, " << longRuns << " long, " << runaways
+              << " runaway scripts limited to " << runawayLimit << " instructions)\n";
+
+    auto run = [&](const std::string& name, unsigned workers, long budget) {
+        std::vector<std::shared_ptr<ScriptRun>> shortResults;
+        long instructions = 0;
+        long steals = 0;
+        double seconds = timeIt([&] {
+            Scheduler scheduler(workers, budget);
+            std::vector<std::shared_ptr<ScriptRun>> all;
+            for (long i = 0; i < runaways; i++) {
+                all.push_back(scheduler.submit(runaway, null, runawayLimit));
+            }
+            // Long and short runs interleaved, as they would arrive
+            for (long i = 0; i < shortRuns; i++) {
+                if (i % (shortRuns / longRuns) == 0) {
+                    all.push_back(scheduler.submit(longScript, null));
+                }
+                shortResults.push_back(scheduler.submit(shortScript, null));
+            }
+            scheduler.wait();
+            for (const auto& result : all) instructions += result->instructions();
+            for (const auto& result : shortResults) instructions += result->instructions();
+            steals = scheduler.steals();
+        });
+
+        std::vector<double> latencies;
+        for (const auto& result : shortResults) latencies.push_back(result->latency());
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&](double p) {
+            return latencies[static_cast<size_t>(p * (latencies.size() - 1))] * 1000;
+        };
+        std::cout << "  " << std::left << std::setw(22) << name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(8) << seconds * 1000 << " ms"
+                  << std::setw(9) << (shortRuns + longRuns + runaways) / seconds << " runs/s"
+                  << std::setw(8) << instructions / seconds / 1e6 << " M instr/s"
+                  << "  short p50 " << std::setprecision(2) << percentile(0.5)
+                  << " p99 " << percentile(0.99) << " max " << percentile(1.0) << " ms"
+                  << "  " << steals << " steals\n";
+    };
+
+    std::vector<unsigned> pools = {std::max(std::thread::hardware_concurrency(), 1u)};
+    if (pools[0] != 4) pools.push_back(4);
+    for (unsigned workers : pools) {
+        std::string pool = std::to_string(workers) + " worker" + (workers == 1 ? "" : "s");
+        run(pool + ", budget " + std::to_string(Scheduler::defaultBudget), workers, Scheduler::defaultBudget);
+        run(pool + ", no preemption", workers, std::numeric_limits<long>::max());
+    }
+    close(null);
+}
+
+// Print-heavy loops with standard output redirected to a file
+static void outputBenchmark(long scale) {
+    long n = 1000000 * scale;
+    std::string source =
+        "i = " + std::to_string(n) + "\n"
+        "while i > 0\n"
+        "  print i\n"
+        "  i = i - 1\n";
+
+    char path[] = "/tmp/tiny_bench_output_XXXXXX";
+    int file = mkstemp(path);
+    if (file < 0) {
+        std::cout << "output: cannot create a temporary file\n";
+        return;
+    }
+
+    std::cout << "output (" << n << " prints to a file)\n";
+    std::cout.flush();
+
+    // Point standard output at the file for the timed runs
+    int savedStdout = dup(STDOUT_FILENO);
+    auto redirect = [&] {
+        ftruncate(file, 0);
+        lseek(file, 0, SEEK_SET);
+        dup2(file, STDOUT_FILENO);
+    };
+    struct Result { std::string name; double seconds; };
+    std::vector<Result> results;
+
+    // What PrintNode used to do: one flush per value
+    redirect();
+    results.push_back({"iostream endl", bestOf(source, [n](Parsed&) {
+        for (long i = n; i > 0; i--) {
+            std::cout << i << std::endl;
+        }
+    })});
+
+    auto sinkRun = [&](const std::string& name, OutputSink::FlushPolicy policy,
+                       OutputSink::Format format, bool vm) {
+        redirect();
+        results.push_back({name, bestOf(source, [&](Parsed& parsed) {
+            OutputSink sink(STDOUT_FILENO);
+            sink.setPolicy(policy);
+            sink.setFormat(format);
+            if (vm) {
+                BytecodeCompiler compiler;
+                Chunk chunk = compiler.compile(parsed.program, parsed.resolver.slotNames());
+                VM machine(chunk, sink);
+                machine.run();
+            } else {
+                Environment env(parsed.resolver.slotCount());
+                env.out = &sink;
+                runTree(parsed.program, env);
+            }
+            sink.flush();
+        })});
+    };
+    using Policy = OutputSink::FlushPolicy;
+    using Format = OutputSink::Format;
+    sinkRun("tree, line", Policy::Line, Format::Text, false);
+    sinkRun("tree, full", Policy::WhenFull, Format::Text, false);
+    sinkRun("tree, exit", Policy::OnExit, Format::Text, false);
+    sinkRun("VM, full", Policy::WhenFull, Format::Text, true);
+    sinkRun("VM, binary", Policy::WhenFull, Format::Binary, true);
+
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+    close(file);
+    unlink(path);
+
+    for (const auto& result : results) {
+        std::cout << "  " << std::left << std::setw(14) << result.name
+                  << std::right << std::setw(10) << std::fixed << std::setprecision(3)
+                  << result.seconds * 1000 << " ms"
+                  << std::setw(12) << std::setprecision(1)
+                  << n / result.seconds / 1e6 << " M prints/s\n";
+    }
+}
+
+// A huge script run batch and streamed, each in a child process so each
+// gets its own peak RSS; output goes through a pipe to time the first line
+static void streamingBenchmark(long scale) {
+    long blocks = 500000 * scale;
+    char path[] = "/tmp/tiny_bench_stream_XXXXXX";
+    int file = mkstemp(path);
+    if (file < 0) {
+        std::cout << "streaming: cannot create a temporary file\n";
+        return;
+    }
+    size_t scriptSize = 0;
+    for (long i = 0; i < blocks; i++) {
+        std::string block =
+            "x = " + std::to_string(i % 7) + "\n"
+            "while x > 0\n"
+            "  x = x - 1\n"
+            "print x\n";
+        scriptSize += write(file, block.data(), block.size());
+    }
+    close(file);
+    std::cout << "streaming (" << blocks * 4 << " lines, "
+              << scriptSize / (1024 * 1024) << " MiB)\n";
+
+    for (bool streaming : {false, true}) {
+        int fds[2];
+        if (pipe(fds) != 0) break;
+        std::cout.flush();
+        auto start = std::chrono::steady_clock::now();
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            OutputSink sink(fds[1]);
+            sink.setPolicy(OutputSink::FlushPolicy::Line);
+            Environment env;
+            env.out = &sink;
+            try {
+                if (streaming) {
+                    int fd = open(path, O_RDONLY);
+                    StatementReader reader(fd);
+                    runStreaming(reader, env, true);
+                } else {
+                    std::ifstream script(path);
+                    std::stringstream buffer;
+                    buffer << script.rdbuf();
+                    Parsed parsed = parseAndResolve(buffer.str(), true);
+                    env.grow(parsed.resolver.slotCount());
+                    runTree(parsed.program, env);
+                }
+                sink.flush();
+            } catch (const std::exception&) {
+                _exit(1);
+            }
+            _exit(0);
+        }
+        close(fds[1]);
+
+        double firstOutput = -1;
+        char buffer[65536];
+        ssize_t count;
+        while ((count = read(fds[0], buffer, sizeof(buffer))) > 0) {
+            if (firstOutput < 0) {
+                firstOutput = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+            }
+        }
+        double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        close(fds[0]);
+
+        int status;
+        struct rusage usage;
+        wait4(pid, &status, 0, &usage);
+#ifdef __APPLE__
+        double peakMiB = usage.ru_maxrss / (1024.0 * 1024.0);  // Bytes on macOS
+#else
+        double peakMiB = usage.ru_maxrss / 1024.0;             // KiB on Linux
+#endif
+        std::cout << "  " << std::left << std::setw(10) << (streaming ? "streamed" : "batch")
+                  << std::right << std::fixed << std::setprecision(1)
+                  << "  first output " << std::setw(8) << firstOutput * 1000 << " ms"
+                  << "  total " << std::setw(8) << total * 1000 << " ms"
+                  << "  peak RSS " << std::setw(7) << peakMiB << " MiB\n";
+    }
+    unlink(path);
+}
+
+// Counted loops whose counter ends near the smallest int, which the first
+// one only reaches by wrapping around: every engine has to print what the
+// unoptimized tree walker prints. The outer loop runs long enough for the
+// JIT to compile it. Returns whether they all agree.
+static bool countedWraparoundCheck() {
+    std::string source =
+        "n = 2000\n"
+        "s = 0\n"
+        "while n > 0\n"
+        "  n = n - 1\n"
+        "  i = 1\n"
+        "  while i > 0 - 2147483647\n"
+        "    i = i - 1610612736\n"
+        "  j = 0\n"
+        "  while j > 0 - 2147483647\n"
+        "    j = j - 1073741824\n"
+        "  s = s - i - j\n"
+        "print i\n"
+        "print j\n"
+        "print s\n";
+
+    char path[] = "/tmp/tiny_bench_wrap_XXXXXX";
+    int file = mkstemp(path);
+    if (file < 0) {
+        std::cout << "counted wraparound: cannot create a temporary file\n";
+        return false;
+    }
+    // What run printed into the file, one line per value
+    auto output = [&](const std::function<void()>& run) {
+        ftruncate(file, 0);
+        lseek(file, 0, SEEK_SET);
+        run();
+        std::ifstream printed(path);
+        std::stringstream text;
+        text << printed.rdbuf();
+        return text.str();
+    };
+    auto tree = [&](bool optimize, bool fold, bool jit) {
+        return output([&] {
+            Parsed parsed = parseAndResolve(source, optimize, fold);
+            OutputSink sink(file);
+            Environment env(parsed.resolver.slotCount());
+            env.out = &sink;
+            env.jit = jit;
+            runTree(parsed.program, env);
+            sink.flush();
+        });
+    };
+    auto vm = [&](bool fold) {
+        return output([&] {
+            Parsed parsed = parseAndResolve(source, true, fold);
+            OutputSink sink(file);
+            BytecodeCompiler compiler;
+            Chunk chunk = compiler.compile(parsed.program, parsed.resolver.slotNames());
+            VM machine(chunk, sink);
+            machine.run();
+            sink.flush();
+        });
+    };
+
+    std::vector<std::pair<std::string, std::string>> results = {
+        {"tree", tree(false, false, false)},
+        {"tree loop opts", tree(true, false, false)},
+        {"tree folded", tree(true, true, false)},
+        {"tree + JIT", tree(true, false, true)},
+        {"bytecode VM", vm(false)},
+        {"VM folded", vm(true)},
+    };
+#if defined(__x86_64__) && defined(__linux__)
+    char executable[] = "/tmp/tiny_bench_wrap_aot_XXXXXX";
+    int exeFile = mkstemp(executable);
+    if (exeFile >= 0) {
+        close(exeFile);
+        Parsed parsed = parseAndResolve(source, true);
+        BytecodeCompiler compiler;
+        writeExecutable(executable, compiler.compile(parsed.program, parsed.resolver.slotNames()));
+        results.push_back({"AOT executable", output([&] {
+            pid_t pid = fork();
+            if (pid == 0) {
+                dup2(file, STDOUT_FILENO);
+                execl(executable, executable, static_cast<char*>(nullptr));
+                _exit(127);
+            }
+            int status;
+            waitpid(pid, &status, 0);
+        })});
+        unlink(executable);
+    }
+#endif
+    close(file);
+    unlink(path);
+
+    std::cout << "counted loops wrapping around\n";
+    bool agree = true;
+    for (const auto& [engine, printed] : results) {
+        bool same = printed == results.front().second;
+        agree = agree && same;
+        std::string values = printed.empty() ? printed : printed.substr(0, printed.size() - 1);
+        std::replace(values.begin(), values.end(), '\n', ' ');
+        std::cout << "  " << std::left << std::setw(14) << engine << "  " << values
+                  << (same ? "" : " DIFFERS FROM THE TREE WALKER") << "\n";
+    }
+    return agree;
+}
+
+int main(int argc, char* argv[]) {
+    long scale = argc > 1 ? std::stol(argv[1]) : 1;
+
+    // Every engine has to agree before any of them is timed
+    if (!countedWraparoundCheck()) return 1;
+
+    // First, while this process is still small: the children inherit its memory
+    streamingBenchmark(scale);
+    frontEndBenchmark(scale);
+    parallelLexBenchmark(scale);
+    imageBenchmark(scale);
+    reloadBenchmark(scale);
+    outputBenchmark(scale);
+    largeProgramBenchmark(scale);
+    constantBenchmark(scale);
+    functionBenchmark(scale);
+    arrayBenchmark(scale);
+    schedulerBenchmark(scale);
+
+    for (const auto& bench : loopBenchmarks(scale)) {
+        std::cout << bench.name << " (" << bench.iterations << " iterations)\n";
+
+        report("tree walker", bench.iterations, bestOf(bench.source, [](Parsed& parsed) {
+            Environment env(parsed.resolver.slotCount());
+            env.quickening = false;
+            runTree(parsed.program, env);
+        }, false));
+
+        report("flat arena", bench.iterations, bestOfFlat(bench.source, [](ParsedFlat& parsed) {
+            Environment env(parsed.resolver.slotCount());
+            parsed.program.run(env);
+        }));
+
+        long hoisted = 0;
+        long countedLoops = 0;
+        report("tree loop opts", bench.iterations, bestOf(bench.source, [&](Parsed& parsed) {
+            Environment env(parsed.resolver.slotCount());
+            env.quickening = false;
+            runTree(parsed.program, env);
+            hoisted = parsed.hoisted;
+            countedLoops = parsed.countedLoops;
+        }));
+        std::cout << "    " << hoisted << " hoisted, " << countedLoops << " counted loops\n";
+
+        report("tree quickened", bench.iterations, bestOf(bench.source, [](Parsed& parsed) {
+            Environment env(parsed.resolver.slotCount());
+            runTree(parsed.program, env);
+        }));
+        {
+            // Counted on a separate, untimed run so the timing matches the default
+            QuickeningStats stats;
+            Parsed parsed = parseAndResolve(bench.source, true);
+            Environment env(parsed.resolver.slotCount());
+            env.stats = &stats;
+            runTree(parsed.program, env);
+            reportQuickening(stats);
+        }
+
+        report("tree + JIT", bench.iterations, bestOf(bench.source, [](Parsed& parsed) {
+            Environment env(parsed.resolver.slotCount());
+            env.jit = true;
+            runTree(parsed.program, env);
+        }));
+
+        report("bytecode VM", bench.iterations, bestOf(bench.source, [](Parsed& parsed) {
+            BytecodeCompiler compiler;
+            Chunk chunk = compiler.compile(parsed.program, parsed.resolver.slotNames());
+            VM vm(chunk);
+            vm.run();
+        }));
+
+#if defined(__x86_64__) && defined(__linux__)
+        report("AOT executable", bench.iterations, bestOfExecutable(bench.source));
+#endif
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <ostream>
+
+/*
+Heap allocation accounting per pipeline stage (--alloc-stats).
+
+The interpreter executable replaces the global operator new and delete
+(alloc.cpp, not part of tiny_core). While the tracker is enabled every
+allocation is charged to the current stage and its size and stage go into
+a side table, so a free is taken off the stage that made the block whenever
+it happens. With the tracker off they cost one check of a flag over
+malloc() and free(). For each stage the report shows:
+
+    allocations, bytes    what the stage asked for
+    frees                 blocks of the stage freed so far
+    peak live             most bytes live in the whole process while the stage ran
+    kept                  bytes of the stage still live when it last ended
+
+so "kept" after lex is the token stream and after parse the AST.
+
+The front end marks its stages with AllocationTracker::enter(). Everything
+here is inline, so library code can mark stages without depending on the
+replaced operator new; in a program without it (tiny_bench) nothing is
+counted. Counting is not thread-safe: only the interpreter's own thread
+allocates while it is enabled.
+*/
+class AllocationTracker {
+public:
+    enum Stage { Other, Lex, Parse, Resolve, Optimize, Compile, Execute, StageCount };
+
+    // Static, so they start at zero
+    struct Counters {
+        long allocations;
+        long bytes;
+        long frees;
+        long peakLive;
+        long live;  // Bytes allocated by the stage and not freed yet
+        long kept;
+    };
+
+    static inline bool enabled = false;
+    static inline Stage stage = Other;
+    static inline Counters counters[StageCount];
+    static inline long live = 0;
+    static inline long peakLive = 0;
+
+    // Charge allocations to stage from now on; returns the previous stage
+    static Stage enter(Stage next) {
+        Stage previous = stage;
+        counters[previous].kept = counters[previous].live;
+        stage = next;
+        return previous;
+    }
+
+    static const char* name(Stage s) {
+        static const char* const names[StageCount] = {
+            "other", "lex", "parse", "resolve", "optimize", "compile", "execute"};
+        return names[s];
+    }
+
+    // Print a table of the counters (defined next to the replaced operator new)
+    static void report(std::ostream& out);
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include "bytecode.hpp"
+#include <cstddef>
+#include <string>
+
+/*
+Ahead-of-time compilation of a whole program to a standalone x86-64 Linux
+executable (--compile=FILE).
+
+The program is compiled to bytecode as for the VM and translated by the
+JIT's translator (jit.hpp) as a single function. A few hand-assembled
+routines make up the runtime, and everything is written out as a static
+ELF file with no interpreter, no libc and no relocations:
+
+    ELF header, 2 program headers
+    error messages      "Error: Undefined variable: x\n", ...
+    code                flush, print, the program, _start
+                        (one read+execute segment at 0x400000)
+    context, output buffer, variables, "assigned" flags
+                        (one zero-filled read+write segment after it)
+
+_start points a JitContext at the variables and calls the program. print
+formats the value into a 64 KiB buffer that is written to standard output
+when it fills up and when the program ends, like --flush=full. The
+program returns the JIT's status; an undefined variable or a failed write
+flushes what was printed, writes the interpreter's error message to
+standard error and exits with status 1. Output and exit status are
+therefore the same as running the script with the interpreter.
+
+The file is generated on any host; running it needs x86-64 Linux.
+*/
+
+// Compile a resolved program to an executable at path, written under a
+// temporary name and renamed into place. Returns the size of the file.
+size_t writeExecutable(const std::string& path, const Chunk& program);
@@ -0,0 +1,101 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+Integer arrays for the tiny language: "a = array(n)" gives a zeroed array of
+n ints in one block aligned to a cache line, so the bulk builtins below can
+run whole vector registers over it with aligned loads and stores.
+
+    len(a)             number of elements
+    fill(a, v)         every element becomes v
+    sum(a)             the total, wrapping around like subtraction does
+    min(a), max(a)     smallest and largest element; an error when empty
+    add(d, a, b)       d[k] = a[k] + b[k], wrapping; the three the same length
+    sub(d, a, b)       d[k] = a[k] - b[k]
+    above(a, v)        how many elements are greater than v
+    below(a, v)        how many are less than v
+
+The kernels use SSE2, which every x86-64 CPU has, and AVX2 as well when the
+build enables it (e.g. -march=native). Define TINY_NO_SIMD_ARRAYS to use
+only the scalar loops, for comparison. Every engine runs the same kernels,
+so they all agree on every result.
+*/
+#if defined(__SSE2__) && !defined(TINY_NO_SIMD_ARRAYS)
+#define TINY_SIMD_ARRAYS 1
+#endif
+
+class IntArray {
+public:
+    static const size_t alignment = 64;
+    // Longest array array() makes: 1 GiB of elements
+    static const int maxLength = 1 << 28;
+
+    IntArray() = default;
+    ~IntArray();
+
+    IntArray(IntArray&& other) noexcept : elements(other.elements), length(other.length) {
+        other.elements = nullptr;
+        other.length = 0;
+    }
+    IntArray& operator=(IntArray&& other) noexcept;
+    IntArray(const IntArray&) = delete;
+    IntArray& operator=(const IntArray&) = delete;
+
+    // A zeroed array of length elements; throws unless 0 <= length <= maxLength
+    static IntArray allocate(int length, const std::string& name);
+
+    int* data() { return elements; }
+    const int* data() const { return elements; }
+    int size() const { return static_cast<int>(length); }
+
+    // The element at index, or "Index i out of bounds for array name of length n"
+    int& at(int index, const std::string& name) {
+        if (static_cast<unsigned>(index) >= length) {
+            outOfBounds(index, name);
+        }
+        return elements[index];
+    }
+    // For indices a loop has already proved in bounds (see optimize.hpp)
+    int& operator[](int index) { return elements[index]; }
+
+    // The builtins; names are only for error messages
+    void fill(int value);
+    int sum() const;
+    int min(const std::string& name) const;
+    int max(const std::string& name) const;
+    int countAbove(int value) const;
+    int countBelow(int value) const;
+    // out = a + b (or a - b) element by element; out may be a or b
+    static void add(IntArray& out, const IntArray& a, const IntArray& b,
+                    const std::string& outName, const std::string& aName, const std::string& bName);
+    static void subtract(IntArray& out, const IntArray& a, const IntArray& b,
+                         const std::string& outName, const std::string& aName, const std::string& bName);
+
+    [[noreturn]] void outOfBounds(int index, const std::string& name) const;
+
+private:
+    int* elements = nullptr;
+    size_t length = 0;
+};
+
+// How many times a counted loop runs from counter, going down by step while
+// above bound, or -1 when the counter would wrap around below the smallest
+// int on the way: such a loop cannot be counted and tests its condition
+// every time, like the while it came from
+inline long long countedTrips(long long counter, long long bound, long long step) {
+    if (counter <= bound) return 0;
+    long long trips = (counter - bound + step - 1) / step;
+    return counter - trips * step < INT32_MIN ? -1 : trips;
+}
+
+// Whether a counted loop keeps inside an array of length elements: it runs
+// trips times from first, the counter going down by step each time, and
+// indexes the array with the counter minus offsets from low to high
+inline bool countedIndicesInBounds(long long first, long long trips, long long step,
+                                   long long low, long long high, int length) {
+    if (trips <= 0) return true;
+    long long last = first - (trips - 1) * step;
+    return last - high >= 0 && first - low < length;
+}
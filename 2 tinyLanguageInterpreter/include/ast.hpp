@@ -1,28 +1,197 @@
 #pragma once
+#include <algorithm>
 #include <string>
+#include <stdexcept>
 #include <vector>
 #include <memory>
-#include <unordered_map>
+#include <cstdint>
+#include "array.hpp"
+#include "output.hpp"
+#include "jit.hpp"
 
-// Forward declaration
+// Forward declarations
 class Environment;
+class BytecodeCompiler;
+class Resolver;
+class LoopOptimizer;
+class ConstantFolder;
+class Profiler;
+struct VariableUses;
 
 // Base class for all AST nodes
 class ASTNode {
 public:
     virtual ~ASTNode() = default;
     virtual int execute(Environment& env) = 0;
+    // Emit bytecode for this node (defined in compiler.cpp)
+    virtual void compile(BytecodeCompiler& compiler) const = 0;
+    // Assign variable slots before execution (defined in resolver.cpp)
+    virtual void resolve(Resolver& resolver) = 0;
+    // Faster replacement for this node once it has run, or nullptr (see quicken.hpp)
+    virtual std::unique_ptr<ASTNode> specialize(Environment& env) { return nullptr; }
+    // Record the variables this node reads and writes (defined in optimize.cpp)
+    virtual void collectUses(VariableUses& uses) const = 0;
+    // Loop-optimized replacement for this node, or nullptr (see optimize.hpp)
+    virtual std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) { return nullptr; }
+    // Constant-folded replacement for this node, or nullptr (see constant.hpp)
+    virtual std::unique_ptr<ASTNode> fold(ConstantFolder& folder);
+    // Drop assignments in nested blocks that nothing reads (defined in constant.cpp)
+    virtual void removeDeadStores(ConstantFolder& folder);
+    // Wrap the statements of nested blocks for profiling (defined in profile.cpp)
+    virtual void instrument(Profiler& profiler) {}
+
+    // Source line the node was parsed from, 0 for nodes made up by a pass
+    int getLine() const { return line; }
+    void setLine(int value) { line = value; }
+
+private:
+    int line = 0;
+};
+
+// Counters for the self-specializing tree walker (see quicken.hpp), kept
+// only when Environment::stats points at them (--quicken-stats)
+// A hit is an execution served by a specialized node, a miss is an
+// execution of a generic node of the shape the specialization takes
+// (x = x - 5, x > 5, and ifs and whiles testing x > 5) that has not been
+// rewritten yet, or never is because quickening is off. Nodes of any other
+// shape count as neither.
+struct QuickeningStats {
+    enum Kind { CompareVarConst, DecrementInPlace, FusedIf, FusedWhile, KindCount };
+
+    long rewrites[KindCount] = {};  // Nodes rewritten into the specialized form
+    long hits[KindCount] = {};
+    long misses[KindCount] = {};
+
+    static const char* name(Kind kind);
 };
 
 // Environment class to store variables
+// The Resolver numbers every variable, so values live in a flat array
+// indexed by slot instead of a map keyed by name.
+// The array is also the call stack: every call adds a frame of its
+// function's slots on top of it, and while the function runs its slots are
+// the ones get() and set() see (globals are the bottom frame). The stack
+// only grows when a call goes deeper than it ever has, so calls do not
+// allocate.
 class Environment {
 public:
-    void define(const std::string& name, int value);
-    int get(const std::string& name);
-    void assign(const std::string& name, int value);
+    static const size_t initialStack = 4096;  // Slots for frames, reserved by the first call
+
+    explicit Environment(size_t slotCount = 0)
+        : values(slotCount, 0), defined(slotCount, 0) { refresh(); }
+
+    // Frames point into the arrays
+    Environment(const Environment&) = delete;
+    Environment& operator=(const Environment&) = delete;
+
+    int get(int slot) const { return frameValues[slot]; }
+    void set(int slot, int value) {
+        frameValues[slot] = value;
+        frameDefined[slot] = 1;
+    }
+    bool isDefined(int slot) const { return frameDefined[slot]; }
+
+    // Make room for slots the Resolver added since (new slots are unassigned);
+    // only between top-level statements, when no call is running
+    void grow(size_t slotCount) {
+        if (slotCount > values.size()) {
+            values.resize(slotCount, 0);
+            defined.resize(slotCount, 0);
+            refresh();
+        }
+    }
+
+    // An array by the slot the Resolver gave it; one not allocated yet is
+    // empty. Growing the table moves the arrays, so references into it only
+    // last until the next call.
+    IntArray& array(int slot) {
+        if (static_cast<size_t>(slot) >= arrays.size()) {
+            arrays.resize(slot + 1);
+        }
+        return arrays[slot];
+    }
+
+    // Raw slot storage of the current frame for native code (see jit.hpp)
+    int* valueData() { return frameValues; }
+    uint8_t* definedData() { return frameDefined; }
+
+    // A call in progress. The caller pushes the arguments on top of the
+    // stack, then enter() makes them the first slots of a frame of
+    // frameSize slots (the rest unassigned) and makes it the current frame.
+    // When the Call goes away, even by an exception, the caller's frame is
+    // current again and everything the call pushed is gone.
+    class Call {
+    public:
+        explicit Call(Environment& env)
+            : env(env), callerBase(env.base), top(env.values.size()) {}
+        ~Call() {
+            env.values.resize(top);
+            env.defined.resize(top);
+            env.base = callerBase;
+            env.depth -= entered;
+            env.refresh();
+        }
+        Call(const Call&) = delete;
+        Call& operator=(const Call&) = delete;
+
+        void argument(int value) {
+            env.reserve(1);
+            env.values.push_back(value);
+            env.defined.push_back(1);
+        }
+        void enter(size_t frameSize) {
+            if (env.depth == maxCallDepth) {
+                throw std::runtime_error("Stack overflow");
+            }
+            env.reserve(top + frameSize - env.values.size());
+            env.values.resize(top + frameSize, 0);
+            env.defined.resize(top + frameSize, 0);
+            env.base = top;
+            env.depth++;
+            entered = true;
+            env.refresh();
+        }
+
+    private:
+        Environment& env;
+        size_t callerBase;
+        size_t top;  // Where the frame starts
+        bool entered = false;
+    };
+
+    // Where print statements write
+    OutputSink* out = &OutputSink::standardOutput();
+
+    // Whether nodes may rewrite themselves into specialized forms
+    bool quickening = true;
+    QuickeningStats* stats = nullptr;  // Counted into only when set
+
+    // Whether hot while loops may be compiled to machine code
+    bool jit = false;
 
 private:
-    std::unordered_map<std::string, int> values;
+    std::vector<int> values;
+    std::vector<uint8_t> defined;  // Only consulted for reads the Resolver could not prove safe
+    std::vector<IntArray> arrays;  // Arrays are global: functions cannot use them
+    size_t base = 0;               // Start of the current frame
+    int depth = 0;                 // Calls running
+    int* frameValues = nullptr;
+    uint8_t* frameDefined = nullptr;
+
+    void refresh() {
+        frameValues = values.data() + base;
+        frameDefined = defined.data() + base;
+    }
+
+    // Room for more slots without moving the arrays while a frame is being built
+    void reserve(size_t more) {
+        size_t needed = values.size() + more;
+        if (needed <= values.capacity()) return;
+        size_t capacity = std::max({needed, 2 * values.capacity(), values.size() + initialStack});
+        values.reserve(capacity);
+        defined.reserve(capacity);
+        refresh();
+    }
 };
 
 // Specific node types
@@ -30,6 +199,12 @@ class NumberNode : public ASTNode {
 public:
     explicit NumberNode(int value) : value(value) {}
     int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    int getValue() const { return value; }
 
 private:
     int value;
@@ -38,20 +213,47 @@ private:
 class VariableNode : public ASTNode {
 public:
     explicit VariableNode(std::string name) : name(std::move(name)) {}
+    // An already resolved read, for nodes created after the Resolver has run
+    VariableNode(std::string name, int slot, bool checked)
+        : name(std::move(name)), slot(slot), checked(checked) {}
     int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    const std::string& getName() const { return name; }
+    int getSlot() const { return slot; }
+    bool isChecked() const { return checked; }
 
 private:
     std::string name;
+    int slot = -1;        // Filled in by the Resolver
+    bool checked = true;  // False once the Resolver proves the variable is always assigned
 };
 
 class AssignmentNode : public ASTNode {
 public:
     AssignmentNode(std::string name, std::unique_ptr<ASTNode> value)
         : name(std::move(name)), value(std::move(value)) {}
+    // An already resolved assignment, for nodes created after the Resolver has run
+    AssignmentNode(std::string name, int slot, std::unique_ptr<ASTNode> value)
+        : name(std::move(name)), slot(slot), value(std::move(value)) {}
     int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> specialize(Environment& env) override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    int getSlot() const { return slot; }
+    const ASTNode* getValue() const { return value.get(); }
+    bool isDecrement() const;  // x = x - 5, which quickening specializes
 
 private:
     std::string name;
+    int slot = -1;  // Filled in by the Resolver
     std::unique_ptr<ASTNode> value;
 };
 
@@ -60,6 +262,13 @@ public:
     explicit PrintNode(std::unique_ptr<ASTNode> expression)
         : expression(std::move(expression)) {}
     int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    const ASTNode* getExpression() const { return expression.get(); }
 
 private:
     std::unique_ptr<ASTNode> expression;
@@ -72,10 +281,22 @@ public:
         : condition(std::move(condition))
         , body(std::move(body)) {}
     int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> specialize(Environment& env) override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+    void removeDeadStores(ConstantFolder& folder) override;
+    void instrument(Profiler& profiler) override;
+
+    const ASTNode* getCondition() const { return condition.get(); }
+    const std::vector<std::unique_ptr<ASTNode>>& getBody() const { return body; }
 
 private:
     std::unique_ptr<ASTNode> condition;
     std::vector<std::unique_ptr<ASTNode>> body;
+    bool quickened = false;  // Set once the body has run and been specialized
 };
 
 class WhileNode : public ASTNode {
@@ -85,10 +306,23 @@ public:
         : condition(std::move(condition))
         , body(std::move(body)) {}
     int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> specialize(Environment& env) override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+    void removeDeadStores(ConstantFolder& folder) override;
+    void instrument(Profiler& profiler) override;
+
+    const ASTNode* getCondition() const { return condition.get(); }
+    const std::vector<std::unique_ptr<ASTNode>>& getBody() const { return body; }
 
 private:
     std::unique_ptr<ASTNode> condition;
     std::vector<std::unique_ptr<ASTNode>> body;
+    bool quickened = false;  // Set once the body has run and been specialized
+    LoopTier tier;
 };
 
 class ComparisonNode : public ASTNode {
@@ -102,9 +336,217 @@ public:
         , op(op)
         , right(std::move(right)) {}
     int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> specialize(Environment& env) override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    const ASTNode* getLeft() const { return left.get(); }
+    const ASTNode* getRight() const { return right.get(); }
+    ASTNode* getLeft() { return left.get(); }
+    ASTNode* getRight() { return right.get(); }
+    Op getOp() const { return op; }
+    bool isVarConst() const;  // x > 5 or 5 < x, which quickening specializes
 
 private:
     std::unique_ptr<ASTNode> left;
     Op op;
     std::unique_ptr<ASTNode> right;
-};
\ No newline at end of file
+};
+
+class SubtractionNode : public ASTNode {
+public:
+    SubtractionNode(std::unique_ptr<ASTNode> left,
+                    std::unique_ptr<ASTNode> right)
+        : left(std::move(left))
+        , right(std::move(right)) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    const ASTNode* getLeft() const { return left.get(); }
+    const ASTNode* getRight() const { return right.get(); }
+
+private:
+    std::unique_ptr<ASTNode> left;
+    std::unique_ptr<ASTNode> right;
+};
+
+// def name(parameters) with its body, at the top level of a script. Running
+// the definition does nothing; calls run the body in a frame of their own.
+// The function has its own Resolver, so its parameters and locals get slots
+// 0, 1, ... of that frame, parameters first, and it cannot see globals.
+class FunctionNode : public ASTNode {
+public:
+    FunctionNode(std::string name,
+                 std::vector<std::string> parameters,
+                 std::vector<std::unique_ptr<ASTNode>> body,
+                 std::unique_ptr<ASTNode> result);
+    ~FunctionNode() override;
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+    void instrument(Profiler& profiler) override;
+
+    // Run the body on the arguments, evaluated in the caller's frame
+    int call(Environment& env, const std::vector<std::unique_ptr<ASTNode>>& arguments);
+
+    const std::string& getName() const { return name; }
+    size_t parameterCount() const { return parameters.size(); }
+    const std::vector<std::unique_ptr<ASTNode>>& getBody() const { return body; }
+    const ASTNode* getResult() const { return result.get(); }
+    size_t frameSize() const;  // Slots of a frame, once resolved
+    const std::vector<std::string>& slotNames() const;
+
+private:
+    std::string name;
+    std::vector<std::string> parameters;
+    std::vector<std::unique_ptr<ASTNode>> body;
+    std::unique_ptr<ASTNode> result;     // The return expression, or null for 0
+    std::unique_ptr<Resolver> resolver;  // The frame's slots, filled in by resolve()
+    bool quickened = false;  // Set once the body has run and been specialized
+    int running = 0;         // Calls of the function in progress
+};
+
+class CallNode : public ASTNode {
+public:
+    // A call on a line of its own drops its result
+    CallNode(std::string name, std::vector<std::unique_ptr<ASTNode>> arguments, bool statement)
+        : name(std::move(name)), arguments(std::move(arguments)), statement(statement) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    const std::string& getName() const { return name; }
+    const std::vector<std::unique_ptr<ASTNode>>& getArguments() const { return arguments; }
+
+private:
+    std::string name;
+    std::vector<std::unique_ptr<ASTNode>> arguments;
+    bool statement;
+    FunctionNode* function = nullptr;  // Filled in by the Resolver
+};
+
+// The array and index of an element read or write. A counted loop that has
+// proved the index in bounds for its whole run points proven at its flag
+// (see optimize.hpp); otherwise, or while the flag is false, every access
+// is checked against the array's length.
+struct ElementAccess {
+    std::string name;
+    int slot = -1;  // Filled in by the Resolver
+    std::unique_ptr<ASTNode> index;
+    const bool* proven = nullptr;
+
+    int& element(Environment& env, int i) const {
+        IntArray& array = env.array(slot);
+        return proven && *proven ? array[i] : array.at(i, name);
+    }
+};
+
+// name = array(length): a new zeroed array, replacing the one name held
+class NewArrayNode : public ASTNode {
+public:
+    NewArrayNode(std::string name, std::unique_ptr<ASTNode> length)
+        : name(std::move(name)), length(std::move(length)) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    const std::string& getName() const { return name; }
+    const ASTNode* getLength() const { return length.get(); }
+
+private:
+    std::string name;
+    int slot = -1;  // Filled in by the Resolver
+    std::unique_ptr<ASTNode> length;
+};
+
+// name[index]
+class ElementNode : public ASTNode {
+public:
+    ElementNode(std::string name, std::unique_ptr<ASTNode> index)
+        : access{std::move(name), -1, std::move(index)} {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    const ElementAccess& getAccess() const { return access; }
+
+private:
+    ElementAccess access;
+};
+
+// name[index] = value
+class ElementAssignmentNode : public ASTNode {
+public:
+    ElementAssignmentNode(std::string name, std::unique_ptr<ASTNode> index, std::unique_ptr<ASTNode> value)
+        : access{std::move(name), -1, std::move(index)}, value(std::move(value)) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    const ElementAccess& getAccess() const { return access; }
+    const ASTNode* getValue() const { return value.get(); }
+
+private:
+    ElementAccess access;
+    std::unique_ptr<ASTNode> value;
+};
+
+// A call of one of the array builtins (see array.hpp): its arrays first, by
+// name, then at most one value. Builtins that return nothing can only be
+// statements; the others drop their result when they are one.
+class BuiltinNode : public ASTNode {
+public:
+    enum class Kind { Length, Fill, Sum, Min, Max, Add, Subtract, Above, Below };
+
+    struct Signature {
+        const char* name;
+        Kind kind;
+        int arrays;    // Array arguments
+        bool value;    // Followed by one value argument
+        bool returns;  // Gives a value
+    };
+    // The builtin called name, or nullptr
+    static const Signature* find(const std::string& name);
+
+    BuiltinNode(const Signature& signature, std::vector<std::string> arrays,
+                std::unique_ptr<ASTNode> value, bool statement)
+        : signature(signature), arrays(std::move(arrays)), value(std::move(value)), statement(statement) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    std::unique_ptr<ASTNode> optimize(LoopOptimizer& optimizer) override;
+    std::unique_ptr<ASTNode> fold(ConstantFolder& folder) override;
+
+    Kind getKind() const { return signature.kind; }
+    const ASTNode* getValue() const { return value.get(); }
+
+private:
+    const Signature& signature;
+    std::vector<std::string> arrays;
+    std::vector<int> slots;           // Filled in by the Resolver
+    std::unique_ptr<ASTNode> value;   // Or null
+    bool statement;
+};
@@ -0,0 +1,91 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Instruction set of the tiny bytecode VM.
+// Every instruction is a 32-bit opcode word followed by its operand words.
+// Expressions are evaluated on a value stack; variables live in numbered slots.
+// A function's slots are numbered from 0 in its own frame.
+enum class OpCode : int32_t {
+    CONST,          // CONST value          push value
+    LOAD,           // LOAD slot            push variable
+    LOAD_CHECKED,   // LOAD_CHECKED slot    push variable, error if never assigned
+    STORE,          // STORE slot           pop into variable
+    SUB,            // pop r, pop l         push l - r
+    GREATER,        // pop r, pop l         push l > r
+    LESS,           // pop r, pop l         push l < r
+    JUMP,           // JUMP offset          continue at offset (relative to next instruction)
+    JUMP_IF_FALSE,  // JUMP_IF_FALSE offset pop, jump if the value is zero
+    PRINT,          // pop and print
+    HALT,           // stop execution
+    CALL,           // CALL function        pop the arguments into a new frame, run the function
+    RETURN,         // pop the result, back to the caller's frame, push the result
+    POP,            // pop and drop
+    // Arrays live in their own numbered slots; the builtins run the kernels
+    // of array.hpp. Every access is checked against the array's length,
+    // except the unchecked ones inside a loop whose BOUNDS_GUARD passed.
+    NEW_ARRAY,                // NEW_ARRAY array          pop the length, a new zeroed array
+    LOAD_ELEMENT,             // LOAD_ELEMENT array       pop the index, push the element
+    LOAD_ELEMENT_UNCHECKED,   // LOAD_ELEMENT_UNCHECKED array
+    STORE_ELEMENT,            // STORE_ELEMENT array      pop the value, pop the index, store
+    STORE_ELEMENT_UNCHECKED,  // STORE_ELEMENT_UNCHECKED array
+    LENGTH,                   // LENGTH array             push its length
+    FILL,                     // FILL array               pop a value into every element
+    SUM,                      // SUM array                push the total
+    MIN,                      // MIN array                push the smallest element
+    MAX,                      // MAX array                push the largest element
+    ADD_ARRAYS,               // ADD_ARRAYS out a b       out = a + b, element by element
+    SUB_ARRAYS,               // SUB_ARRAYS out a b       out = a - b
+    COUNT_ABOVE,              // COUNT_ABOVE array        pop v, push how many elements are > v
+    COUNT_BELOW,              // COUNT_BELOW array        pop v, push how many are < v
+    BOUNDS_GUARD              // BOUNDS_GUARD guard offset  jump unless the guard's loop stays in bounds
+};
+
+// Deepest nesting of calls; one more is a "Stack overflow" in every engine.
+// The tree walker recurses on the native stack, a few hundred bytes a call.
+const int maxCallDepth = 2000;
+
+// Number of operand words that follow the opcode
+int operandCount(OpCode op);
+
+// A compiled program: the code words plus the names of its variable slots
+struct Chunk {
+    // The code of a function follows the program's HALT
+    struct Function {
+        std::string name;
+        int32_t entry = 0;               // Code index of its first instruction
+        int32_t parameters = 0;          // Its first slots
+        int32_t frameSize = 0;
+        int maxStack = 0;                // Deepest value stack of its own code
+        std::vector<std::string> names;  // Slot number -> variable name, in its frame
+    };
+
+    // A counted loop's proof that its unchecked accesses stay in bounds:
+    // run with the counter and bound it starts with, it indexes every array
+    // with the counter minus offsets from low to high (see optimize.hpp)
+    struct BoundsGuard {
+        struct Range {
+            int32_t array;
+            long long low, high;
+        };
+        int32_t counter = -1;
+        int32_t boundSlot = -1;  // Or the constant bound
+        int32_t bound = 0;
+        int32_t step = 1;
+        std::vector<Range> ranges;
+    };
+
+    std::vector<int32_t> code;
+    std::vector<std::string> names; // Slot number -> variable name (for error messages)
+    int maxStack = 0;               // Deepest value stack the code can reach
+    std::vector<Function> functions;
+    std::vector<std::string> arrays;  // Array number -> name
+    std::vector<BoundsGuard> guards;
+
+    void write(OpCode op) { code.push_back(static_cast<int32_t>(op)); }
+    void write(int32_t operand) { code.push_back(operand); }
+
+    // Human readable listing, one instruction per line
+    std::string disassemble() const;
+};
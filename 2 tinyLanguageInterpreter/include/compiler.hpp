@@ -0,0 +1,85 @@
+#pragma once
+#include "ast.hpp"
+#include "bytecode.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Translates the AST into bytecode for the VM.
+
+Each node emits its own code through ASTNode::compile(), the same way the
+calculator's expressions drive its CodeGenerator. Control flow becomes
+relative jumps. The program must have been through the Resolver first;
+variables are compiled to the slots it assigned.
+
+    while x > 0              0   LOAD 0 (x)
+      x = x - 1              2   CONST 0
+                             4   GREATER
+                             5   JUMP_IF_FALSE 9 -> 16
+                             7   LOAD 0 (x)
+                             9   CONST 1
+                             11  SUB
+                             12  STORE 0 (x)
+                             14  JUMP -16 -> 0
+                             16  ...
+
+Functions are compiled after the program's HALT, each ending in RETURN,
+with their slots numbered in their own frames. A call pushes its
+arguments and CALLs the function by its index in Chunk::functions.
+
+A counted loop that proved some of its element accesses in bounds is
+compiled twice behind a BOUNDS_GUARD: first with those accesses unchecked,
+for runs the guard finds in bounds, then as it was, for every other run.
+
+    BOUNDS_GUARD 0 -> checked
+    <loop, proved accesses unchecked>
+    JUMP -> end
+  checked:
+    <loop, every access checked>
+  end:
+*/
+class BytecodeCompiler {
+public:
+    // Compile a resolved program; the returned chunk ends with HALT
+    Chunk compile(const std::vector<std::unique_ptr<ASTNode>>& program,
+                  const std::vector<std::string>& slotNames);
+
+    // Compile a single while loop on its own, for the JIT; ends with HALT
+    Chunk compileLoop(const ASTNode& condition,
+                      const std::vector<std::unique_ptr<ASTNode>>& body);
+
+    // Emission helpers used by the nodes' compile() methods
+    void emit(OpCode op);
+    void emit(OpCode op, int32_t operand);
+    size_t emitJump(OpCode op);        // Emit a forward jump, returns its operand position
+    void patchJump(size_t operand);    // Point a forward jump at the next instruction
+    void emitLoop(size_t loopStart);   // Emit a backward jump to loopStart
+    void emitLoad(int32_t slot, bool checked, const std::string& name);
+    void emitStore(int32_t slot, const std::string& name);
+    void emitCall(const FunctionNode* function, size_t argumentCount);
+    size_t position() const { return chunk.code.size(); }
+    void compileIf(const ASTNode& condition, const std::vector<std::unique_ptr<ASTNode>>& body);
+    void compileWhile(const ASTNode& condition, const std::vector<std::unique_ptr<ASTNode>>& body);
+    // A counted loop whose accesses pointing at proof are in bounds whenever guard holds
+    void compileGuardedLoop(const ASTNode& condition, const std::vector<std::unique_ptr<ASTNode>>& body,
+                            const bool* proof, Chunk::BoundsGuard guard);
+    void emitArray(OpCode op, int32_t array, const std::string& name);
+    void emitElement(OpCode checked, OpCode unchecked, const ElementAccess& access);
+    void emitArrays(OpCode op, const std::vector<int>& arrays, const std::vector<std::string>& arrayNames);
+
+private:
+    Chunk chunk;
+    int stackDepth = 0;
+    int* maxStack = nullptr;                 // Of the code being compiled: the program or a function
+    std::vector<std::string>* names = nullptr;
+    std::unordered_map<const FunctionNode*, int32_t> functionIndex;
+    std::vector<const bool*> proving;        // Proofs of the guarded copies being compiled
+
+    void compileFunction(const FunctionNode& function);
+
+    void adjustStack(OpCode op);
+    void nameSlot(int32_t slot, const std::string& name);
+    void nameArray(int32_t array, const std::string& name);
+};
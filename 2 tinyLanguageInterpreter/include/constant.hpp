@@ -0,0 +1,93 @@
+#pragma once
+#include "ast.hpp"
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+Constant propagation and dead code removal, run on the resolved AST before
+the loop optimizer.
+
+A forward pass walks the statements in order, knowing which slots hold the
+same constant on every path to the current statement:
+
+- a read of such a slot becomes the constant, and subtractions of two
+  constants are computed;
+- an if whose condition compares two constants is replaced by its body
+  (true) or removed (false), and so is a while that is false on entry;
+- after an if that may be skipped, only the constants both ways agree on
+  are kept; a loop forgets every slot it assigns, on entry and after it.
+
+A backward pass then removes dead stores: assignments whose value no read
+can see, because on every path the slot is assigned again first or never
+read before the program ends. An assignment whose value may fail
+("Undefined variable") stays, so every error still happens where it did,
+and an if left with an empty body goes too, unless its condition may fail.
+
+    x = 5                   print 5
+    if x > 3                y = 2
+      print x                 while y > 0
+    if x < 2        ->          print y
+      print 0                   y = y - 1
+    y = x - 3
+    while y > 0
+      print y
+      y = y - 1
+
+A function body is folded on its own, like a program whose only read
+after the end is the return expression. Calls cannot see the caller's
+variables, so they keep what is known about them, but they may print or
+fail, so a call is never removed.
+
+Arrays are not tracked: their elements are never known, and a statement
+that touches one may fail (an index out of bounds), so it is never removed.
+Its indices and values are folded like any other expression.
+
+What is removed could never run or be seen, so the program prints the same
+and fails the same way. The pass needs the whole program, since nothing is
+live after its last statement; --stream and --watch do not use it.
+*/
+class ConstantFolder {
+public:
+    // Fold the whole program
+    void fold(std::vector<std::unique_ptr<ASTNode>>& program);
+
+    // Helpers used by the nodes' fold() methods (forward pass)
+    void foldBlock(std::vector<std::unique_ptr<ASTNode>>& body);
+    void foldExpression(std::unique_ptr<ASTNode>& expression);
+    std::unique_ptr<ASTNode> foldRead(int slot, int line);
+    void foldAssignment(int slot, const ASTNode& value);
+    void foldIf(std::unique_ptr<ASTNode>& condition, std::vector<std::unique_ptr<ASTNode>>& body);
+    void foldLoop(std::unique_ptr<ASTNode>& condition, std::vector<std::unique_ptr<ASTNode>>& body);
+    void forget(const ASTNode& statement);  // Nothing known about what it assigns
+    void foldFunction(std::vector<std::unique_ptr<ASTNode>>& body, std::unique_ptr<ASTNode>& result);
+
+    // Helpers used by the nodes' removeDeadStores() methods (backward pass)
+    void sweepBlock(std::vector<std::unique_ptr<ASTNode>>& body);
+    void sweepIf(const ASTNode& condition, std::vector<std::unique_ptr<ASTNode>>& body);
+    void sweepLoop(const ASTNode& condition, std::vector<std::unique_ptr<ASTNode>>& body);
+    void markRead(const ASTNode& node);  // Whatever it reads is live in front of it
+
+    // What the pass did
+    long propagated = 0;         // Reads replaced by their constant
+    long foldedExpressions = 0;
+    long inlinedBranches = 0;
+    long removedBranches = 0;
+    long removedLoops = 0;
+    long removedStores = 0;
+    long nodesBefore = 0;
+    long nodesAfter = 0;
+
+private:
+    std::unordered_map<int, int> constants;  // Slot -> value, where known
+    std::unordered_set<int> live;            // Slots a later read may see
+    bool removing = true;                    // False while a loop's live slots are worked out
+
+    // Set by foldIf() and foldLoop() when the statement goes away; foldBlock()
+    // puts these statements (possibly none) in its place
+    bool replacing = false;
+    std::vector<std::unique_ptr<ASTNode>> replacement;
+
+    void replace(std::vector<std::unique_ptr<ASTNode>> statements);
+};
@@ -0,0 +1,110 @@
+#pragma once
+#include "ast.hpp"
+#include "token.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+Flattened AST, an alternative to the tree of ASTNode objects.
+
+Parser::parseFlat() builds the whole program into one FlatProgram: every
+node is a 16-byte FlatNode in a single array that acts as a bump arena
+(nodes refer to each other by index, and the array is reserved up front so
+parsing never moves it). A block is a contiguous range of the statements
+array, which holds the indices of its statement nodes in order:
+
+    x = 3                 nodes                     statements
+    while x > 0           0  Number 3               0  8    while body: 0..1
+      x = x - 1           1  Assign x, 0            1  1    top level:  1..3
+                          2  Load x                 2  9
+                          3  Number 0
+                          4  Greater 2, 3
+                          5  Load x
+                          6  Number 1
+                          7  Subtract 5, 6
+                          8  Assign x, 7
+                          9  While 4, body 0..1
+
+Children are added before their parents and inner blocks are closed before
+the blocks around them. The walker dispatches on FlatNode::kind with a
+switch instead of virtual calls.
+
+Flat programs are resolved with the same Resolver as the tree, but they
+have no loop optimizer, no quickening and no JIT: they exist to measure
+what the memory layout alone is worth.
+*/
+
+enum class FlatKind : uint8_t {
+    Number,       // a = value
+    Load,         // a = slot
+    LoadChecked,  // a = slot, error if the variable was never assigned
+    Subtract,     // b = left node, c = right node
+    Greater,      // b = left node, c = right node
+    Less,         // b = left node, c = right node
+    Assign,       // a = slot, b = value node
+    Print,        // b = expression node
+    If,           // a = condition node, b..c = body in FlatProgram::statements
+    While         // a = condition node, b..c = body in FlatProgram::statements
+};
+
+struct FlatNode {
+    FlatKind kind;
+    int32_t a;  // Until resolve(), Load and Assign hold the symbol id of their variable
+    uint32_t b;
+    uint32_t c;
+};
+static_assert(sizeof(FlatNode) == 16, "flat nodes should pack four to a cache line");
+
+// A flat program in memory owned by someone else: a FlatProgram, or a
+// program image mapped straight from disk (see image.hpp)
+struct FlatView {
+    const FlatNode* nodes;
+    const uint32_t* statements;
+    uint32_t topBegin;
+    uint32_t topEnd;
+    const uint32_t* nameOffsets;  // Slot -> offset of its NUL-terminated name in namePool
+    const char* namePool;
+};
+
+// Run a resolved flat program; env must have a slot for every variable
+void runFlat(const FlatView& program, Environment& env);
+
+class FlatProgram {
+public:
+    // Building, used by Parser::parseFlat()
+    void reserve(size_t nodeCount);
+    uint32_t add(FlatKind kind, int32_t a = 0, uint32_t b = 0, uint32_t c = 0);
+    void addStatement(uint32_t node) { pending.push_back(node); }
+    size_t openBlock() const { return pending.size(); }
+    // Move the statements added since openBlock() returned mark into one range
+    void closeBlock(size_t mark, uint32_t& begin, uint32_t& end);
+    void finish(const SymbolTable& symbols);
+
+    // Number the variables and check for undefined ones, like Resolver::resolve()
+    void resolve(Resolver& resolver);
+
+    void run(Environment& env) const { runFlat(view(), env); }
+    FlatView view() const;
+
+    size_t nodeCount() const { return nodes.size(); }
+    size_t statementCount() const { return statements.size(); }
+    size_t slotCount() const { return nameOffsets.size(); }
+    size_t namePoolSize() const { return namePool.size(); }
+    // Heap bytes held by the nodes and the block ranges
+    size_t memoryBytes() const;
+
+private:
+    std::vector<FlatNode> nodes;
+    std::vector<uint32_t> statements;
+    uint32_t topBegin = 0;
+    uint32_t topEnd = 0;
+
+    std::vector<uint32_t> pending;     // Statements of the blocks still being parsed
+    std::vector<std::string> symbols;  // Symbol id -> name, for resolution
+    std::vector<uint32_t> nameOffsets; // Slot -> name in namePool, for error messages
+    std::string namePool;              // Every slot's name followed by a NUL
+
+    void resolveNode(uint32_t index, Resolver& resolver);
+    void resolveBlock(uint32_t begin, uint32_t end, Resolver& resolver);
+};
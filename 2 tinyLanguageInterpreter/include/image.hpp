@@ -0,0 +1,91 @@
+#pragma once
+#include "flat.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/*
+Program images: a parsed and resolved FlatProgram saved to disk, so a
+later run of the same script can skip lexing, parsing and resolution.
+
+The flat program already links its nodes by index, so the image is just
+its arrays written out back to back, and a mapped image is run in place
+through a FlatView without building anything. Identical subtrees and
+identical blocks are stored once (the walker never writes to a node, so
+they can be shared), which keeps images of generated scripts small:
+
+    ImageHeader
+    nodes           FlatNode  x nodeCount
+    statements      uint32_t  x statementCount
+    name offsets    uint32_t  x slotCount
+    name pool       NUL-terminated variable names, namePoolSize bytes
+
+sourceHash identifies the script the image was built from, and version
+the layout; an image that does not match both is stale and is rebuilt.
+contentHash covers everything after the header, and loading also checks
+that every index and range in the image points inside it (children
+before their parents), so a damaged file is rebuilt instead of run.
+Integers are stored in host byte order; an image from a machine of the
+other endianness fails the magic/version check.
+*/
+
+namespace ImageFormat {
+    const char magic[8] = {'T', 'I', 'N', 'Y', 'I', 'M', 'G', '\0'};
+    const uint32_t version = 1;  // Bump whenever the layout or FlatNode changes
+}
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint64_t sourceHash;
+    uint64_t contentHash;
+    uint32_t statementCount;
+    uint32_t topBegin;
+    uint32_t topEnd;
+    uint32_t slotCount;
+    uint32_t namePoolSize;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(ImageHeader) == 56, "image header layout changed");
+static_assert(sizeof(ImageHeader) % alignof(FlatNode) == 0, "nodes must stay aligned");
+
+// 64-bit FNV-1a over 8-byte words (then the remaining bytes), for the
+// source and content hashes; a word at a time keeps hashing a large script
+// far below the cost of parsing it
+uint64_t hashBytes(const void* data, size_t size);
+
+// Write a resolved program's image. The file is written under a temporary
+// name and renamed into place, so a crash never leaves half an image behind.
+void writeImage(const std::string& path, const FlatProgram& program, uint64_t sourceHash);
+
+// A read-only, memory-mapped program image
+class ProgramImage {
+public:
+    // The image at path, or nullptr if it is missing, damaged or was built
+    // from a different source (or by a different version of the format)
+    static std::unique_ptr<ProgramImage> load(const std::string& path, uint64_t sourceHash);
+    ~ProgramImage();
+
+    ProgramImage(const ProgramImage&) = delete;
+    ProgramImage& operator=(const ProgramImage&) = delete;
+
+    const FlatView& view() const { return program; }
+    size_t slotCount() const { return header->slotCount; }
+    size_t size() const { return length; }
+
+private:
+    ProgramImage(void* data, size_t length);
+    bool validate();  // Also points the view at the arrays
+
+    void* data;
+    size_t length;
+    const ImageHeader* header;
+    FlatView program;
+};
+
+// Run source from the image at imagePath, first (re)building the image if
+// it is missing or stale. Returns whether the image had to be built.
+bool runWithImage(const std::string& source, const std::string& imagePath, Environment& env);
@@ -0,0 +1,104 @@
+#pragma once
+#include "ast.hpp"
+#include "resolver.hpp"
+#include "token.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+Incremental front end, for a long-lived process that reloads a script
+after small edits (--watch).
+
+The script is kept as lines, grouped into units: a unit is one top-level
+statement with the indented lines of its blocks (and any blank lines that
+follow), split by the same rule as the streaming reader. A block never
+crosses a unit boundary, so parsing the units one by one gives the same
+statements as parsing the whole file. Every unit keeps its own tokens and
+AST, with line numbers relative to the unit, so the units after an edit
+move without being touched.
+
+An edit (or a reload, which finds the changed lines by comparing the old
+and new text from both ends) re-lexes and re-parses only the units that
+contain changed lines, plus the unit in front of them when the edit starts
+with blank or indented lines that join its block. Splitting starts again
+at the first affected unit and stops as soon as it reaches the start of an
+unchanged old unit. A unit
+that does not lex or parse is kept as it is until an edit fixes it;
+resolve() parses it once more where it now sits and throws the error the
+whole script would have raised, with the line numbers of the current script.
+
+Slots and definite assignment depend on everything in front of a
+statement, so resolution restarts at the first edited unit: the Resolver
+is rolled back to the mark it had reached in front of it (see
+resolver.hpp) and resolves on until, after a unit that was not edited,
+its state is the one that unit saw last time. Everything after it keeps
+its slots. Specialized nodes resolve like the nodes they replaced, so a
+program can be run, edited, resolved and run again. The loop optimizer
+and the JIT rewrite the tree in ways a second resolution cannot undo, so
+they are not used on incremental programs.
+*/
+class IncrementalFrontEnd {
+public:
+    // A call could outlive the unit that defines its function
+    IncrementalFrontEnd() { resolver.allowFunctions = false; }
+
+    // Bring the program up to date with a new version of the whole script
+    void reload(const std::string& source);
+
+    // Replace lineCount lines starting at firstLine (1-based) with text,
+    // which holds zero or more complete lines
+    void edit(size_t firstLine, size_t lineCount, const std::string& text);
+
+    // Number the variables of the program after an edit; throws on undefined
+    // ones and on units that did not parse
+    void resolve();
+    void run(Environment& env) const;
+
+    size_t lineCount() const { return lines.size(); }
+    size_t unitCount() const { return units.size(); }
+    size_t slotCount() const { return resolver.slotCount(); }
+
+    // What the last reload or edit, and the last resolve(), had to redo
+    size_t relexedLines = 0;
+    size_t reparsedUnits = 0;
+    size_t resolvedUnits = 0;
+
+private:
+    struct Parsed {
+        TokenStream tokens;
+        std::vector<std::unique_ptr<ASTNode>> statements;
+    };
+
+    struct Unit {
+        size_t lineCount;
+        // Where the unit failed, if it did; resolve() raises the error again
+        enum Error : uint8_t { None, LexError, ParseError } error;
+        Resolver::Mark after;      // The resolver's state once it was resolved
+        std::unique_ptr<Parsed> parsed;
+    };
+
+    std::vector<std::string> lines;
+    std::vector<Unit> units;  // Small, so an edit shifts them cheaply
+    Resolver resolver;
+
+    // Units [dirtyBegin, dirtyEnd) changed since the last resolve(); those
+    // after them were resolved last time
+    bool dirty = false;
+    size_t failedUnits = 0;
+    size_t dirtyBegin = 0;
+    size_t dirtyEnd = 0;
+
+    // Replace lines [first, first + removed) with inserted and update the units
+    void apply(size_t first, size_t removed, std::vector<std::string> inserted);
+    size_t firstStatementLine(size_t start) const;
+    size_t unitIndentation(size_t start) const;
+    size_t unitEnd(size_t start) const;
+    Unit parseUnit(size_t start, size_t lineCount);
+};
+
+// Run the script at path, then run it again every time the file changes,
+// reloading it through an IncrementalFrontEnd. Errors are reported and
+// the watch goes on; it only ends when the process is stopped.
+void watchScript(const std::string& path, bool quickening);
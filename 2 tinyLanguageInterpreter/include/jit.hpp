@@ -0,0 +1,108 @@
+#pragma once
+#include "bytecode.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ASTNode;
+class Environment;
+class OutputSink;
+class X86Assembler;
+
+// Native code generation needs an x86-64 CPU and POSIX mmap
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define TINY_JIT_SUPPORTED 1
+#endif
+
+/*
+Tiered JIT for hot while loops.
+
+Every while node counts its interpreted iterations. When a loop reaches
+LoopTier::threshold, it is compiled to bytecode on its own and the bytecode
+is translated into x86-64 machine code in an mmap'd buffer:
+
+- the bytecode value stack maps onto scratch registers (its depth is known
+  at every instruction, so no stack memory is touched);
+- the four most used variables live in callee-saved registers for the
+  whole loop, the rest are read and written in the Environment's slots;
+- "CONST k" feeding SUB or a comparison becomes an immediate operand, and
+  a comparison feeding JUMP_IF_FALSE becomes cmp + conditional jump;
+- print calls back into the OutputSink.
+
+The native loop always returns to the interpreter: normally when the loop
+condition fails, or early with a status when a checked variable turns out
+to be undefined or output fails. The interpreter turns that status into
+the usual runtime error. Loops the translator cannot handle stay interpreted.
+*/
+
+// What the native code gets passed (field offsets are baked into the code)
+struct JitContext {
+    int* values;        // Environment slots
+    uint8_t* defined;   // Environment "has been assigned" flags
+    OutputSink* out;
+};
+
+// Native code returns one of these, or k > 0 when slot k - 1 was read
+// before it was assigned
+const int32_t STATUS_DONE = 0;
+const int32_t STATUS_OUTPUT_ERROR = -1;
+
+// Append the machine code for a chunk to a, as a function that takes a
+// JitContext* and returns a status. PRINT calls the function at
+// printAddress with (context->out, value); it returns nonzero when output
+// failed. False if the chunk uses something the translator does not handle.
+bool translateChunk(const Chunk& chunk, X86Assembler& a, uint64_t printAddress);
+
+// Native code for one while loop
+class NativeLoop {
+public:
+    // Translate a loop chunk (see BytecodeCompiler::compileLoop); nullptr if unsupported
+    static std::unique_ptr<NativeLoop> compile(const Chunk& loop);
+    ~NativeLoop();
+
+    NativeLoop(const NativeLoop&) = delete;
+    NativeLoop& operator=(const NativeLoop&) = delete;
+
+    // Run the loop to completion against env; throws the interpreter's runtime errors
+    void run(Environment& env) const;
+    size_t codeSize() const { return length; }
+
+private:
+    NativeLoop(void* code, size_t length, std::vector<std::string> names);
+
+    void* code;
+    size_t length;
+    std::vector<std::string> names;  // Slot names, for undefined variable errors
+};
+
+// Tiering state kept by each while node
+class LoopTier {
+public:
+    static const long threshold = 1000;  // Interpreted iterations before compiling
+
+    // Run the whole loop natively if it has been compiled; false means interpret it
+    bool enter(Environment& env) {
+        if (!native) return false;
+        native->run(env);
+        return true;
+    }
+
+    // Called after each interpreted iteration. Once the loop is hot it is
+    // compiled and the rest of this run executes natively; returns true
+    // when that has finished the loop.
+    bool iterate(const ASTNode& condition,
+                 const std::vector<std::unique_ptr<ASTNode>>& body,
+                 Environment& env) {
+        if (++iterations != threshold) return false;
+        return compileAndRun(condition, body, env);
+    }
+
+private:
+    long iterations = 0;
+    std::unique_ptr<NativeLoop> native;
+
+    bool compileAndRun(const ASTNode& condition,
+                       const std::vector<std::unique_ptr<ASTNode>>& body,
+                       Environment& env);
+};
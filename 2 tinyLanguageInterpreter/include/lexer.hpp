@@ -1,22 +1,28 @@
 #pragma once
 #include <string>
-#include <vector>
+#include <string_view>
 #include "token.hpp"
 
 class Lexer {
 public:
-    explicit Lexer(std::string source);
-    std::vector<Token> tokenize();
+    // firstLine numbers the first line of source, for sources cut from a larger script
+    explicit Lexer(std::string source, size_t firstLine = 1);
+    TokenStream tokenize();
+    // Same, into a stream that is cleared first (reusing its memory)
+    void tokenize(TokenStream& tokens);
 
 private:
     std::string source;
     size_t position = 0;
     size_t line = 1;
+    size_t lineStart = 0; // Position of the first character on the current line
+    int column = 0;       // Column of the token being scanned
 
     char advance();
     char peek();
     void skipWhitespace();
-    Token number();
-    Token identifier();
+    int32_t number();
+    std::string_view identifier();
+    TokenType keywordType(std::string_view id);
     bool isAtEnd();
 };
\ No newline at end of file
@@ -0,0 +1,165 @@
+#pragma once
+#include "ast.hpp"
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+Loop optimizations, run on the resolved AST before any engine sees it.
+
+Invariant hoisting: inside a while loop, "y = e" is moved in front of the
+loop when it is a top-level statement of the body, the only assignment to
+y anywhere in the loop, y is not read by the condition or by the
+statements before it, and e only reads variables the loop never assigns.
+Every iteration would compute the same y, so computing it once is enough.
+Subtractions whose operands are all invariant are likewise computed once
+into a temporary slot. The hoisted code runs under a copy of the loop's
+condition, so it only runs when the loop body would have run, and only
+reads the Resolver proved defined are hoisted, so it cannot fail early.
+
+    while i > n - 1            if i > n - 1
+      k = a - b                  k = a - b
+      s = s - k - i      ->      $0 = n - 1
+      i = i - 1                  while i > $0      (counted)
+                                   s = s - k - i
+                                   i = i - 1
+
+Counted loops: "while x > k" (or "k < x"), where k is a constant or a
+variable the loop does not assign and the only assignment to x is a
+top-level "x = x - c" with a constant c > 0, runs exactly
+ceil((x - k) / c) times. It becomes a CountedLoopNode, which evaluates the
+comparison once on entry and then runs the body that many times without
+testing the condition again. That count only holds while x stays an int:
+when the last x would be below the smallest int, subtraction wraps it
+around and the while goes on. A constant k that allows this keeps the
+while; with a variable k, a run that would wrap tests the condition every
+time on every engine, as the while would.
+
+Bounds checks: in a counted loop, an element access a[x] or a[x - d] (d a
+constant) to an array the loop does not make again sees x take exactly
+the values x, x - c, ... down to the last one above k (one step less after
+the decrement). The loop knows those on entry, so it checks the whole
+range against the array's length once instead of every access on every
+iteration:
+
+    while i > 0              On entry: if i - 1 < len(a) and the last index
+      s = s - a[i - 1]       (1 - 1 = 0) is not negative, no access is
+      i = i - 1              checked in this run; otherwise all of them are.
+
+The tree walker turns the result into a flag the proved accesses test; the
+bytecode compiler emits the loop twice, without and with the checks, and a
+BOUNDS_GUARD in front that picks one. Accesses in inner loops are proved by
+the innermost counted loop whose counter they use.
+*/
+
+// Variables read and written by a subtree
+struct VariableUses {
+    std::unordered_set<int> reads;
+    std::unordered_map<int, int> writes;  // Slot -> number of assignments
+    bool checkedReads = false;            // Some read may hit an undefined variable
+    std::unordered_set<int> allocated;    // Arrays made again (their length may change)
+
+    void read(int slot, bool checked) {
+        reads.insert(slot);
+        checkedReads = checkedReads || checked;
+    }
+    void write(int slot) { writes[slot]++; }
+    void block(const std::vector<std::unique_ptr<ASTNode>>& body) {
+        for (const auto& stmt : body) {
+            stmt->collectUses(*this);
+        }
+    }
+};
+
+class LoopOptimizer {
+public:
+    explicit LoopOptimizer(Resolver& resolver) : resolver(resolver) {}
+
+    // Optimize every loop in the program (temporaries get slots from the Resolver)
+    void optimize(std::vector<std::unique_ptr<ASTNode>>& program) { optimizeBlock(program); }
+
+    // Helpers used by the nodes' optimize() methods
+    void optimizeBlock(std::vector<std::unique_ptr<ASTNode>>& body);
+    void optimizeExpression(std::unique_ptr<ASTNode>& expression);
+    // An element access the innermost counted loop may prove in bounds
+    void recordAccess(ElementAccess& access);
+    std::unique_ptr<ASTNode> optimizeLoop(std::unique_ptr<ASTNode>& condition,
+                                          std::vector<std::unique_ptr<ASTNode>>& body);
+
+    // Off to leave every element access checked, for comparison
+    bool proveBounds = true;
+
+    // What the pass did
+    long hoistedAssignments = 0;
+    long hoistedExpressions = 0;
+    long countedLoops = 0;
+    long provedAccesses = 0;
+
+private:
+    // The innermost loop being optimized
+    struct Loop {
+        std::unordered_map<int, int> writes;               // What the loop assigns
+        std::vector<std::unique_ptr<ASTNode>> preheader;   // Hoisted statements
+        std::unordered_set<int> allocated;                 // Arrays the loop makes again
+    };
+
+    // An element access seen in the body of the loop being optimized, and
+    // the top-level statement of the body it is in
+    struct Access {
+        ElementAccess* access;
+        size_t statement;
+    };
+
+    Resolver& resolver;
+    Loop* loop = nullptr;  // Null outside loops and in loops that cannot hoist
+    std::vector<Access>* accesses = nullptr;  // Null outside loops
+    size_t statement = 0;
+
+    bool isInvariant(const VariableUses& uses) const;
+    void hoistAssignments(const ASTNode& condition, std::vector<std::unique_ptr<ASTNode>>& body);
+    std::unique_ptr<ASTNode> countedLoop(std::unique_ptr<ASTNode>& condition,
+                                         std::vector<std::unique_ptr<ASTNode>>& body,
+                                         const Loop& current,
+                                         const std::vector<Access>& found);
+};
+
+// while x > k with x = x - step as the only assignment to x
+class CountedLoopNode : public ASTNode {
+public:
+    CountedLoopNode(std::unique_ptr<ComparisonNode> condition,
+                    int step,
+                    std::vector<std::unique_ptr<ASTNode>> body)
+        : condition(std::move(condition))
+        , step(step)
+        , body(std::move(body)) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+    void instrument(Profiler& profiler) override;
+
+    // Accesses to array indexed with the counter minus offset will not be
+    // checked while the returned flag is set: this run keeps them in bounds
+    const bool* proveInBounds(int array, long long offset);
+
+private:
+    // The offsets an array is indexed with
+    struct Bounds {
+        int array;
+        long long low;
+        long long high;
+    };
+
+    std::unique_ptr<ComparisonNode> condition;  // Kept for the compiler and the JIT
+    int step;
+    std::vector<std::unique_ptr<ASTNode>> body;
+    bool quickened = false;  // Set once the body has run and been specialized
+    LoopTier tier;
+    std::vector<Bounds> bounds;
+    bool inBounds = false;
+
+    const VariableNode& counter() const;
+    const ASTNode& bound() const;
+    bool iterate(Environment& env);  // Run the body once; true when the JIT finished the loop
+};
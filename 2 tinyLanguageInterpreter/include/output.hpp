@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+Buffered output for print statements.
+
+std::cout << value << std::endl flushes (one write system call) on every
+print. OutputSink formats integers by hand into a large reusable buffer and
+writes it to the file descriptor according to a flush policy:
+
+    OnExit    keep everything until flush() or destruction (the buffer grows)
+    WhenFull  write whenever the buffer fills up
+    Line      write after every print, for interactive use
+
+The default is Line when the descriptor is a terminal and WhenFull otherwise.
+In Binary format each value is written as 4 raw bytes in native byte order
+instead of decimal text and a newline.
+*/
+class OutputSink {
+public:
+    enum class FlushPolicy { OnExit, WhenFull, Line };
+    enum class Format { Text, Binary };
+
+    static const size_t defaultCapacity = 64 * 1024;
+
+    explicit OutputSink(int fd, size_t capacity = defaultCapacity);
+    ~OutputSink();
+
+    OutputSink(const OutputSink&) = delete;
+    OutputSink& operator=(const OutputSink&) = delete;
+
+    // The process-wide sink for standard output, flushed at exit
+    static OutputSink& standardOutput();
+
+    void setPolicy(FlushPolicy newPolicy) { policy = newPolicy; }
+    void setFormat(Format newFormat) { format = newFormat; }
+    FlushPolicy getPolicy() const { return policy; }
+
+    // Output one printed value
+    void print(int value) {
+        // Leave room for the longest value ("-2147483648\n") without checking twice
+        if (capacity - used < 12) {
+            full();
+        }
+        if (format == Format::Text) {
+            used += formatInt(value, buffer.data() + used);
+            buffer[used++] = '\n';
+        } else {
+            writeRaw(value);
+        }
+        if (policy == FlushPolicy::Line) {
+            flush();
+        }
+    }
+
+    // Write out everything buffered so far
+    void flush();
+
+    // Writes the decimal digits of value to out, returns how many characters were written
+    static size_t formatInt(int value, char* out);
+
+private:
+    int fd;
+    std::vector<char> buffer;
+    size_t capacity;
+    size_t used = 0;
+    FlushPolicy policy;
+    Format format = Format::Text;
+
+    void full();
+    void writeRaw(int value);
+};
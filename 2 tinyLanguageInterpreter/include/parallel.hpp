@@ -0,0 +1,83 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "token.hpp"
+
+/*
+Lexes a large source on several threads, with exactly the result of
+Lexer::tokenize(): the same tokens, lines, columns, payloads and symbol ids.
+
+No token spans a line, so the source is cut just after newlines into about
+four chunks per thread, and each chunk is lexed by its own Lexer into its
+own TokenStream, numbering its lines from 1. Then:
+
+    - the newlines of the chunks before it give each chunk its first line
+    - each chunk's names are interned into the result in chunk order; ids
+      follow first appearance, so they come out as the serial lexer's, and
+      the chunk keeps a table from its own ids to those
+    - the chunks copy their tokens into place in parallel, moving their
+      lines and renumbering their identifiers, and drop their END tokens
+
+A chunk that fails (a number too large) is lexed again from its real first
+line, so the error is the first one the serial lexer would throw.
+
+Sources too small for two chunks of minimumChunk bytes, or a lexer with one
+thread, lex on the calling thread. The pool starts with the first source
+big enough and keeps its threads and the chunks' token buffers for the
+next one. While lexing, the chunks' tokens and the result are both held.
+*/
+class ParallelLexer {
+public:
+    static const size_t minimumChunk = 256 * 1024;
+
+    explicit ParallelLexer(unsigned threads = std::thread::hardware_concurrency());
+    ~ParallelLexer();
+
+    ParallelLexer(const ParallelLexer&) = delete;
+    ParallelLexer& operator=(const ParallelLexer&) = delete;
+
+    // firstLine numbers the first line of source, as for Lexer
+    TokenStream tokenize(std::string_view source, size_t firstLine = 1);
+    // Same, into a stream that is cleared first (reusing its memory)
+    void tokenize(std::string_view source, TokenStream& tokens, size_t firstLine = 1);
+
+    unsigned threads() const { return threadCount; }
+
+private:
+    struct Chunk {
+        std::string_view text;
+        TokenStream tokens;           // Without line offset or shared ids
+        std::vector<int32_t> ids;     // The chunk's symbol ids -> the result's
+        int firstLine = 0;
+        size_t firstToken = 0;        // Where its tokens go in the result
+        std::exception_ptr error;
+    };
+
+    unsigned threadCount;
+    std::vector<Chunk> chunks;
+
+    // The pool: the calling thread and threadCount - 1 workers take task
+    // indices from next until taskCount is reached
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;      // A new generation of tasks, or stopping
+    std::condition_variable finished;  // Every worker is done with the generation
+    std::function<void(size_t)> task;
+    size_t taskCount = 0;
+    std::atomic<size_t> next{0};
+    uint64_t generation = 0;
+    unsigned idle = 0;                 // Workers done with the current generation
+    bool stopping = false;
+
+    void split(std::string_view source);
+    void forEachChunk(const std::function<void(size_t)>& fn);
+    void work();
+    void runTasks();
+};
@@ -4,13 +4,19 @@
 #include <vector>
 #include <memory>
 
+class FlatProgram;
+
 class Parser {
 public:
-    explicit Parser(std::vector<Token> tokens);
+    // Tokens are read in place, so the stream must outlive the parser
+    explicit Parser(const TokenStream& tokens);
+    explicit Parser(TokenStream&& tokens) = delete;
     std::vector<std::unique_ptr<ASTNode>> parse();
+    // Parse into a flattened, arena-allocated program instead (see flat.hpp)
+    FlatProgram parseFlat();
 
 private:
-    std::vector<Token> tokens;
+    const TokenStream& tokens;
     size_t current = 0;
 
     // Parsing methods for different constructs
@@ -19,15 +25,36 @@ private:
     std::unique_ptr<ASTNode> ifStatement();
     std::unique_ptr<ASTNode> whileStatement();
     std::unique_ptr<ASTNode> printStatement();
+    std::unique_ptr<ASTNode> functionDefinition();
+    std::unique_ptr<ASTNode> call(bool statement);
+    std::unique_ptr<ASTNode> builtin(const BuiltinNode::Signature& signature, bool statement);
+    std::unique_ptr<ASTNode> elementAssignment();
     std::unique_ptr<ASTNode> expression();
+    std::unique_ptr<ASTNode> primary();
     std::unique_ptr<ASTNode> comparison();
-    std::vector<std::unique_ptr<ASTNode>> block();
+    std::vector<std::unique_ptr<ASTNode>> block(int indent);
+
+    // The same grammar, building FlatNodes (defined in flat.cpp)
+    uint32_t flatStatement(FlatProgram& program);
+    uint32_t flatAssignment(FlatProgram& program);
+    uint32_t flatLoopOrIf(FlatProgram& program, bool loop);
+    uint32_t flatExpression(FlatProgram& program);
+    uint32_t flatPrimary(FlatProgram& program);
+    uint32_t flatComparison(FlatProgram& program);
+    void flatBlock(FlatProgram& program, int indent, uint32_t& begin, uint32_t& end);
 
     // Helper methods
-    Token peek();
-    Token advance();
+    // Tokens are referred to by their index in the stream
+    TokenType peek();
+    int peekColumn();
+    size_t advance();
     bool check(TokenType type);
+    bool checkCall();     // A name followed by "("
+    bool checkBuiltin();  // array() or a builtin's name followed by "("
+    bool checkElement();  // A name followed by "["
     bool match(TokenType type);
-    Token consume(TokenType type, const std::string& message);
+    size_t consume(TokenType type, const std::string& message);
     bool isAtEnd();
+    std::string nameOf(size_t token);
+    std::unique_ptr<ASTNode> located(std::unique_ptr<ASTNode> node, size_t token);
 };
\ No newline at end of file
@@ -0,0 +1,103 @@
+#pragma once
+#include "ast.hpp"
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+Source-line profiler for the tree walker (--profile).
+
+Profiler::instrument() wraps every statement of a program in a ProfileNode
+once the optimizer has run. A ProfileNode counts its executions and times
+them, keeping a stack of the statements currently running, so every line
+gets an execution count, a total time (including the statements nested
+under it) and a self time (excluding them). Loops also report how often
+they were entered and how many iterations they ran.
+
+The results come out as a source listing annotated with those numbers and
+as folded stacks, one line per distinct stack of statements with its self
+time in nanoseconds, the input format of flamegraph.pl:
+
+    2: while i > 0;3: i = i - 1 1834021
+
+A program that is not profiled contains no ProfileNodes, so the normal
+interpreter pays nothing for the profiler. Nodes made up by the optimizer
+(the guard around hoisted code) have no line and are not wrapped. The JIT
+is not used while profiling, since native loops would bypass the counters.
+*/
+class Profiler {
+public:
+    explicit Profiler(const std::string& source);
+
+    // Wrap every statement, including those of nested blocks
+    void instrument(std::vector<std::unique_ptr<ASTNode>>& program);
+
+    // Helpers used by the nodes' instrument() methods
+    void instrumentBlock(std::vector<std::unique_ptr<ASTNode>>& body);
+    void addLoop(int line, const std::vector<std::unique_ptr<ASTNode>>& body);
+
+    // Called by ProfileNode around every execution
+    void enter(int line, uint32_t& cachedParent, uint32_t& cachedFrame);
+    void leave();
+
+    void writeListing(std::ostream& out) const;
+    void writeFoldedStacks(std::ostream& out) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct LineStats {
+        long count = 0;
+        Clock::duration total{};
+        Clock::duration self{};
+    };
+
+    struct Loop {
+        int line;
+        int bodyLine;  // Runs once per iteration, 0 if the body is empty
+    };
+
+    // One node of the tree of stacks seen so far
+    struct Frame {
+        uint32_t parent;
+        int line;
+        Clock::duration self{};
+    };
+
+    struct Running {
+        uint32_t frame;
+        Clock::time_point start;
+        Clock::duration children{};
+    };
+
+    std::vector<std::string> sourceLines;
+    std::vector<LineStats> lines;  // Indexed by line number
+    std::vector<Loop> loops;
+    std::vector<Frame> frames;     // frames[0] is the root, above the top-level statements
+    std::unordered_map<uint64_t, uint32_t> children;  // (parent, line) -> frame
+    std::vector<Running> stack;
+
+    uint32_t frameFor(uint32_t parent, int line);
+    std::string label(int line) const;
+};
+
+// A statement being profiled
+class ProfileNode : public ASTNode {
+public:
+    ProfileNode(std::unique_ptr<ASTNode> statement, Profiler& profiler);
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    std::unique_ptr<ASTNode> specialize(Environment& env) override;
+    void collectUses(VariableUses& uses) const override;
+
+private:
+    std::unique_ptr<ASTNode> statement;
+    Profiler& profiler;
+    uint32_t cachedParent = UINT32_MAX;  // Most statements are always entered from the same stack
+    uint32_t cachedFrame = 0;
+};
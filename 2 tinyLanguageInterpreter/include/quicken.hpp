@@ -0,0 +1,127 @@
+#pragma once
+#include "ast.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+Self-specializing nodes for the tree walker ("quickening").
+
+The parser only builds generic nodes. Once a node has run, the node that
+owns it asks it for a specialized replacement through ASTNode::specialize()
+and swaps it in place:
+
+    ComparisonNode  x > 5           ->  VarConstComparisonNode
+    AssignmentNode  x = x - 1       ->  DecrementNode
+    IfNode    with  x > 5           ->  IfVarConstNode    (comparison fused in)
+    WhileNode with  x > 5           ->  WhileVarConstNode (comparison fused in)
+
+Blocks are specialized by their owner after their first run, and a
+condition after its first evaluation. A WhileNode that is already running
+switches to the fused loop as soon as its first iteration has specialized
+the condition, so even a single long loop benefits.
+
+Only the owner ever replaces a node, and only after it has returned, so a
+node is never destroyed while it is executing. Under --quicken-stats,
+Environment::stats counts rewrites, hits and misses per specialization;
+otherwise it is null and nothing is counted.
+*/
+
+// Replace node with its specialized form, if it has one
+void quicken(std::unique_ptr<ASTNode>& node, Environment& env);
+void quickenBlock(std::vector<std::unique_ptr<ASTNode>>& body, Environment& env);
+
+// x > 5, x < 5
+class VarConstComparisonNode : public ASTNode {
+public:
+    VarConstComparisonNode(const VariableNode& variable, ComparisonNode::Op op, int value)
+        : name(variable.getName())
+        , slot(variable.getSlot())
+        , checked(variable.isChecked())
+        , op(op)
+        , value(value) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+
+    // The comparison itself, called directly by the fused if/while nodes
+    int test(Environment& env) const;
+
+private:
+    std::string name;
+    int slot;
+    bool checked;
+    ComparisonNode::Op op;
+    int value;
+};
+
+// x = x - 1
+class DecrementNode : public ASTNode {
+public:
+    DecrementNode(const VariableNode& variable, int amount)
+        : name(variable.getName())
+        , slot(variable.getSlot())
+        , checked(variable.isChecked())
+        , amount(amount) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+
+private:
+    std::string name;
+    int slot;
+    bool checked;
+    int amount;
+};
+
+// if x > 5 with the comparison fused into the node
+class IfVarConstNode : public ASTNode {
+public:
+    IfVarConstNode(std::unique_ptr<VarConstComparisonNode> condition,
+                   std::vector<std::unique_ptr<ASTNode>> body,
+                   bool quickened)
+        : condition(std::move(condition))
+        , body(std::move(body))
+        , quickened(quickened) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+
+private:
+    std::unique_ptr<VarConstComparisonNode> condition;
+    std::vector<std::unique_ptr<ASTNode>> body;
+    bool quickened;
+};
+
+// while x > 0 with the comparison fused into the node
+class WhileVarConstNode : public ASTNode {
+public:
+    WhileVarConstNode(std::unique_ptr<VarConstComparisonNode> condition,
+                      std::vector<std::unique_ptr<ASTNode>> body,
+                      bool quickened,
+                      LoopTier tier)
+        : condition(std::move(condition))
+        , body(std::move(body))
+        , quickened(quickened)
+        , tier(std::move(tier)) {}
+    int execute(Environment& env) override;
+    void compile(BytecodeCompiler& compiler) const override;
+    void resolve(Resolver& resolver) override;
+    void collectUses(VariableUses& uses) const override;
+
+    // The fused loop itself, shared with a WhileNode that switches over mid-run
+    static void loop(const VarConstComparisonNode& condition,
+                     std::vector<std::unique_ptr<ASTNode>>& body,
+                     bool& quickened,
+                     LoopTier& tier,
+                     Environment& env);
+
+private:
+    std::unique_ptr<VarConstComparisonNode> condition;
+    std::vector<std::unique_ptr<ASTNode>> body;
+    bool quickened;
+    LoopTier tier;
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include "ast.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/*
+Resolver pass, run after Parser::parse() and before execution.
+
+Gives every variable a dense integer slot so the Environment can be a flat
+array, and works out statically which reads are safe:
+
+- A read that no assignment can ever reach is reported as an error up front.
+- A read where the variable is assigned on every path leading to it
+  (definitely assigned) needs no runtime check.
+- Anything in between (e.g. assigned only inside an if body) keeps a
+  runtime "Undefined variable" check.
+
+Loops are walked twice: a discovery walk first records what the loop
+assigns, because those values flow back to its condition and body.
+
+Between top-level statements the state only grows (new slots, names that
+may be assigned, slots that are definitely assigned), so it is kept as a
+journal. A Mark records how far each part has got; the incremental front
+end rolls back to the mark in front of an edited statement, resolves from
+there, and stops once the state matches the one an unchanged statement
+was resolved against before.
+
+Functions are declared before anything is resolved, so a call may come
+before the definition and a function may call itself. Each function gets
+a Resolver of its own for its frame, sharing the table of functions.
+Front ends that drop statements once they have run (--stream, --watch)
+turn functions off, since a call would outlive its definition.
+
+Arrays are numbered apart from variables, in the order "a = array(n)"
+first names them; a name is either an array or a variable, never both.
+Like a variable, an array must be made somewhere before it is used (loops
+count their whole body). Arrays are global, and functions cannot use them.
+*/
+class Resolver {
+public:
+    // Resolve every node of the program; throws on reads of undefined variables
+    void resolve(const std::vector<std::unique_ptr<ASTNode>>& program);
+
+    // Whether the program may define functions
+    bool allowFunctions = true;
+
+    // A Resolver for the frame of a function, knowing the same functions
+    std::unique_ptr<Resolver> functionScope() const;
+    // The function a call refers to; throws when there is none or the arguments do not fit
+    FunctionNode* functionFor(const std::string& name, size_t argumentCount) const;
+
+    size_t slotCount() const { return names.size(); }
+    size_t arrayCount() const { return arrayNames.size(); }
+    const std::vector<std::string>& slotNames() const { return names; }
+
+    // A new slot for a value introduced by an optimization ("$0", "$1", ...)
+    int addTemporary();
+
+    // Helpers used by the nodes' resolve() methods
+    int slotFor(const std::string& name);
+    void resolveRead(const std::string& name, int& slot, bool& checked);
+    void resolveIf(ASTNode& condition, std::vector<std::unique_ptr<ASTNode>>& body);
+    void resolveLoop(ASTNode& condition, std::vector<std::unique_ptr<ASTNode>>& body);
+    void markAssigned(const std::string& name);
+    int declareArray(const std::string& name);  // At "name = array(n)"
+    int arrayFor(const std::string& name);       // Where an array is used
+    bool isPossiblyAssigned(const std::string& name) const;
+    bool isDefinitelyAssigned(int slot) const { return definite[slot]; }
+    bool discovering() const { return discoveryDepth > 0; }
+
+    // Definite assignment is forgotten after a body that may not run; the
+    // two calls bracket the body
+    std::vector<bool> saveDefinite();
+    void restoreDefinite(std::vector<bool> saved);
+
+    // How much of the journal existed at some point between two top-level statements
+    struct Mark {
+        size_t slots = 0;
+        size_t assigned = 0;
+        size_t definite = 0;
+        size_t arrays = 0;
+        bool operator==(const Mark& other) const {
+            return slots == other.slots && assigned == other.assigned && definite == other.definite &&
+                   arrays == other.arrays;
+        }
+    };
+
+    // Journal entries taken back by a rollback
+    struct Undone {
+        Mark from;
+        std::vector<std::string> names;
+        std::vector<std::string> assigned;
+        std::vector<int> definite;
+        std::vector<std::string> arrays;
+    };
+
+    Mark mark() const {
+        return {names.size(), assignedOrder.size(), definiteOrder.size(), arrayNames.size()};
+    }
+    // Forget everything resolved after the mark (also after a statement threw)
+    Undone rollback(const Mark& to);
+    // Whether the state now is the one the undone journal had reached at old
+    bool matches(const Undone& undone, const Mark& old) const;
+    // Put back the undone entries after old; only valid when matches() held at old
+    void redo(const Undone& undone, const Mark& old);
+
+    // While alive, nodes only record assignments and never report errors
+    class Discovery {
+    public:
+        explicit Discovery(Resolver& resolver) : resolver(resolver) { resolver.discoveryDepth++; }
+        ~Discovery() { resolver.discoveryDepth--; }
+    private:
+        Resolver& resolver;
+    };
+
+private:
+    using FunctionTable = std::unordered_map<std::string, FunctionNode*>;
+    std::shared_ptr<FunctionTable> functions = std::make_shared<FunctionTable>();
+
+    std::unordered_map<std::string, int> slots;
+    std::vector<std::string> names;      // Slot -> variable name
+    std::vector<bool> definite;          // Assigned on every path to this point
+    std::unordered_set<std::string> possible;  // Assigned on some path
+    std::vector<std::string> assignedOrder;    // possible, in the order names were added
+    std::vector<int> definiteOrder;            // Slots definitely assigned at the top level, in order
+    std::unordered_map<std::string, int> arraySlots;
+    std::vector<std::string> arrayNames;       // Array slot -> name
+    bool allowArrays = true;                   // False in a function's scope
+    int discoveryDepth = 0;
+    int bodyDepth = 0;                         // Inside an if or while body
+    int temporaries = 0;
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include "bytecode.hpp"
+#include "output.hpp"
+#include "vm.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Runs many tiny programs at once on a fixed pool of worker threads.
+
+A program is compiled once to a Chunk (parse, resolve, fold, optimize,
+compile) and never changes afterwards, so any number of runs share it
+through a shared_ptr<const Chunk>. Each run has its own execution context:
+a VM with its own variables and value stack, and its own OutputSink.
+
+Every worker owns a queue of runs. It takes the run at the front and gives
+it a slice of Scheduler::budget VM instructions (VM::run(budget)); a run
+that is not finished by then goes to the back of the queue, so a loop that
+never ends only ever holds a worker for one slice at a time. A worker whose
+queue is empty steals from the back of another worker's queue, and sleeps
+when there is nothing to steal anywhere.
+
+A run can also be given a limit on its total instructions, after which it
+fails with "Instruction limit exceeded", so runaway scripts end by themselves.
+*/
+
+// Compile a script for the scheduler; throws the front end's errors
+std::shared_ptr<const Chunk> compileScript(const std::string& source);
+
+// One run of a program, with its own variables and output
+class ScriptRun {
+public:
+    ScriptRun(std::shared_ptr<const Chunk> program, int fd, long limit);
+
+    // Only meaningful once the scheduler has finished the run
+    bool failed() const { return !error.empty(); }
+    const std::string& errorMessage() const { return error; }
+    long instructions() const { return vm.executed(); }
+    long slices() const { return sliceCount; }
+    double latency() const;  // Seconds from submission to the end of the run
+
+private:
+    friend class Scheduler;
+
+    std::shared_ptr<const Chunk> program;  // Before vm, which refers to it
+    OutputSink out;
+    VM vm;
+    long limit;                            // Instructions; 0 for no limit
+    long sliceCount = 0;
+    std::string error;
+    std::chrono::steady_clock::time_point submitted;
+    std::chrono::steady_clock::time_point finished;
+
+    // Run one slice; true once the run is over (done, failed or out of instructions)
+    bool slice(long budget);
+};
+
+class Scheduler {
+public:
+    static const long defaultBudget = 10000;
+
+    explicit Scheduler(unsigned workerCount = std::thread::hardware_concurrency(),
+                       long budget = defaultBudget);
+    ~Scheduler();  // Waits for every submitted run
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    // Queue a run of program that prints to fd. The run is finished once
+    // wait() returns.
+    std::shared_ptr<ScriptRun> submit(std::shared_ptr<const Chunk> program, int fd, long limit = 0);
+
+    // Block until every run submitted so far has finished
+    void wait();
+
+    size_t workerCount() const { return workers.size(); }
+    long steals() const { return stolen; }
+
+private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<std::shared_ptr<ScriptRun>> queue;
+        std::thread thread;
+    };
+
+    const long budget;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> nextWorker{0};  // Where submit() queues the next run
+    std::atomic<long> stolen{0};
+
+    // Sleeping workers and wait() block on these
+    std::mutex stateLock;
+    std::condition_variable workAvailable;
+    std::condition_variable allFinished;
+    long queued = 0;      // Runs sitting in a queue
+    long unfinished = 0;  // Runs submitted and not finished
+    bool stopping = false;
+
+    void work(size_t self);
+    std::shared_ptr<ScriptRun> take(size_t self);
+    void enqueue(size_t worker, std::shared_ptr<ScriptRun> run);
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include "ast.hpp"
+#include <string>
+#include <vector>
+
+/*
+Streaming mode, for scripts too large to hold in memory at once.
+
+A top-level statement is complete as soon as a line starts at or left of
+the column it started in (the lines of its block are indented further).
+StatementReader pulls the input in fixed-size chunks and hands out the
+source of one top-level statement at a time; runStreaming() lexes,
+parses, resolves, optimizes and runs each one, then drops its tokens and
+AST before reading on.
+
+Memory is bounded by the largest top-level statement plus the variables
+(the Environment and the Resolver keep one slot per distinct name), not
+by the size of the script. Errors in a statement are only found when it is
+reached, after everything before it has run.
+*/
+class StatementReader {
+public:
+    explicit StatementReader(int fd, size_t chunkSize = 64 * 1024);
+
+    // Source of the next top-level statement (and the line it starts on); false at end of input
+    bool next(std::string& statement, size_t& firstLine);
+
+    // Length of the longest statement handed out so far
+    size_t largestStatement() const { return largest; }
+
+private:
+    int fd;
+    std::vector<char> chunk;
+    size_t position = 0;
+    size_t end = 0;
+    bool atEnd = false;
+    size_t lineNumber = 0;  // Number of the line readLine() returned last
+
+    // The line that ended the previous statement, which starts the next one
+    std::string heldLine;
+    size_t heldNumber = 0;
+    bool held = false;
+
+    size_t largest = 0;
+
+    bool readLine(std::string& line);
+};
+
+// Leading spaces and tabs, i.e. the column of the line's first token
+size_t indentation(const std::string& line);
+bool isBlank(const std::string& line);
+
+// Run a whole script from reader, one top-level statement at a time
+void runStreaming(StatementReader& reader, Environment& env, bool optimizing);
@@ -1,25 +1,87 @@
 #pragma once
+#include <cstdint>
 #include <string>
+#include <string_view>
+#include <vector>
 
-enum class TokenType {
+enum class TokenType : uint8_t {
     NUMBER,     // Integer literals
-    IDENTIFIER, // Variable names
+    IDENTIFIER, // Variable, array and function names
     EQUALS,     // =
     GREATER,    // >
     LESS,       // <
     MINUS,      // -
+    LPAREN,     // (
+    RPAREN,     // )
+    COMMA,      // ,
+    LBRACKET,   // [
+    RBRACKET,   // ]
     IF,         // if keyword
     WHILE,      // while keyword
     PRINT,      // print keyword
+    DEF,        // def keyword
+    RETURN,     // return keyword
     EOL,        // End of line
     END         // End of file
 };
 
-class Token {
+// Interns identifier names: every distinct name gets a small integer id.
+// Names are stored back to back in one buffer and found through an
+// open-addressing hash table, so interning a name already seen allocates nothing.
+class SymbolTable {
 public:
-    Token(TokenType type, std::string value = "", int line = 0);
-    
-    TokenType type;
-    std::string value;
-    int line;
-};
\ No newline at end of file
+    int intern(std::string_view name);
+
+    // The view is only valid until the next call to intern()
+    std::string_view name(int id) const {
+        return std::string_view(pool).substr(offsets[id], lengths[id]);
+    }
+    size_t size() const { return offsets.size(); }
+
+    // Forget every name but keep the memory, for reuse
+    void clear();
+
+    // Intern every name of other, in the order of its ids; ids[i] becomes
+    // the id here of other's name i. Same as calling intern() for each, but
+    // with the hashes other already has and the buckets fetched ahead.
+    void merge(const SymbolTable& other, std::vector<int32_t>& ids);
+
+private:
+    std::string pool;               // All names, back to back
+    std::vector<uint32_t> offsets;  // Id -> start of the name in pool
+    std::vector<uint32_t> lengths;  // Id -> length of the name
+    std::vector<uint32_t> hashes;   // Id -> hash of the name, to skip most compares
+    std::vector<int32_t> buckets;   // Hash table of ids, -1 marks an empty bucket
+
+    void rehash(size_t bucketCount);
+    int insert(std::string_view name, uint32_t hash);
+};
+
+// The lexer's output, stored as parallel arrays (struct of arrays) rather
+// than one object per token. Token i is types[i], lines[i], columns[i] and
+// payloads[i]; no token owns a string.
+struct TokenStream {
+    std::vector<TokenType> types;
+    std::vector<int> lines;
+    std::vector<int> columns;    // Offset from the start of the line, used for block indentation
+    std::vector<int32_t> payloads;  // NUMBER: the value, IDENTIFIER: symbol id, otherwise 0
+    SymbolTable symbols;         // Names of the IDENTIFIER tokens
+
+    size_t size() const { return types.size(); }
+
+    // Empty the stream but keep its capacity, so it can be refilled without allocating
+    void clear() {
+        types.clear();
+        lines.clear();
+        columns.clear();
+        payloads.clear();
+        symbols.clear();
+    }
+
+    void push(TokenType type, int line, int column, int32_t payload = 0) {
+        types.push_back(type);
+        lines.push_back(line);
+        columns.push_back(column);
+        payloads.push_back(payload);
+    }
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include "array.hpp"
+#include "bytecode.hpp"
+#include "output.hpp"
+#include <cstdint>
+#include <vector>
+
+// Use direct-threaded dispatch where the compiler supports labels as values
+// (GCC and Clang). Everything else falls back to a switch in a loop; define
+// TINY_NO_COMPUTED_GOTO to force the switch for comparison.
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(TINY_NO_COMPUTED_GOTO)
+#define TINY_COMPUTED_GOTO 1
+#endif
+
+/*
+Stack-based virtual machine that runs a compiled Chunk.
+
+With computed goto the chunk is first translated into a threaded copy in
+which every opcode word is replaced by the address of its handler, so each
+instruction ends by jumping straight to the next handler instead of going
+back through a central switch.
+
+run(budget) executes at most budget instructions and then returns, keeping
+its place, so the next call carries on from there; the scheduler uses it to
+share worker threads between programs (see scheduler.hpp). The VM only
+reads the chunk, so any number of VMs can run one chunk at the same time.
+
+Calls keep their frames on one stack of slots, above the globals, and
+their values on the same value stack as the caller. Both only grow when a
+call goes deeper than any before it.
+*/
+class VM {
+public:
+    explicit VM(const Chunk& chunk, OutputSink& out = OutputSink::standardOutput());
+    void run();
+
+    // Run at most budget instructions, from where the last call stopped;
+    // returns true once the program has halted
+    bool run(long budget);
+    long executed() const { return instructions; }  // By run(budget), so far
+
+    // Value of a variable after the run (throws if it was never assigned)
+    int get(const std::string& name) const;
+
+private:
+    const Chunk& chunk;
+    OutputSink& out;               // Where PRINT writes
+    std::vector<int> slots;        // Variable values: the globals, then the frames of calls
+    std::vector<uint8_t> defined;  // Whether each slot has been assigned yet
+    std::vector<int> stack;        // Value stack, sized to chunk.maxStack until a call
+    std::vector<IntArray> arrays;  // Empty until array() gives them a length
+
+    // A call waiting for the function it called to return
+    struct CallFrame {
+        size_t returnAt;   // Code index to continue at
+        size_t base;       // The caller's frame
+        size_t top;
+        int32_t function;  // The callee
+    };
+    std::vector<CallFrame> calls;
+    size_t frameBase = 0;  // The current frame's slots are [frameBase, frameTop)
+    size_t frameTop = 0;
+
+    const std::vector<std::string>& slotNames() const;
+    bool inBounds(const Chunk::BoundsGuard& guard, const int* locals, const uint8_t* assigned) const;
+
+    // Where a run that used up its budget stopped
+    size_t resumeAt = 0;           // Code index of the next instruction
+    size_t depth = 0;              // Values on the stack
+    bool halted = false;
+    long instructions = 0;
+
+    template <bool Budgeted>
+    bool execute(long budget);
+
+#ifdef TINY_COMPUTED_GOTO
+    // One entry per code word: a handler address for opcodes, the raw value for operands
+    union Threaded {
+        const void* handler;
+        int32_t operand;
+    };
+    std::vector<Threaded> threaded;
+    const void* const* threadedFor = nullptr;  // The handler table threaded is built from
+#endif
+};
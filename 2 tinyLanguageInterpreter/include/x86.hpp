@@ -0,0 +1,93 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+A minimal x86-64 instruction encoder, just big enough for the code the
+tiny JIT and the ahead-of-time compiler emit. Instructions are appended to a byte buffer; jumps go to
+Labels that are patched once bound, so forward jumps work.
+
+32-bit operations ("Reg32" in the names) zero the upper half of the
+destination as usual on x86-64.
+*/
+class X86Assembler {
+public:
+    enum Reg : uint8_t {
+        RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+        R8, R9, R10, R11, R12, R13, R14, R15
+    };
+
+    // Condition codes, as encoded in Jcc/SETcc
+    enum Cond : uint8_t {
+        EQUAL = 0x4, NOT_EQUAL = 0x5,
+        LESS = 0xC, GREATER_EQUAL = 0xD, LESS_EQUAL = 0xE, GREATER = 0xF
+    };
+
+    struct Label {
+        int id;
+    };
+
+    const std::vector<uint8_t>& code() const { return bytes; }
+    size_t size() const { return bytes.size(); }
+
+    Label newLabel();
+    void bind(Label label);
+    // Fill in every jump to a label; all labels must be bound by now
+    void resolveLabels();
+
+    // Data movement
+    void movImm32(Reg dst, int32_t imm);
+    void movImm64(Reg dst, uint64_t imm);
+    void movReg32(Reg dst, Reg src);
+    void movReg64(Reg dst, Reg src);
+    void load32(Reg dst, Reg base, int32_t disp);    // mov dst32, [base + disp]
+    void store32(Reg base, int32_t disp, Reg src);   // mov [base + disp], src32
+    void load64(Reg dst, Reg base, int32_t disp);    // mov dst, [base + disp]
+    void store64(Reg base, int32_t disp, Reg src);   // mov [base + disp], src
+    void storeByteImm(Reg base, int32_t disp, uint8_t imm);  // mov byte [base + disp], imm
+    void load8(Reg dst, Reg base, int32_t disp);     // movzx dst32, byte [base + disp]
+    void store8(Reg base, int32_t disp, Reg src);    // mov byte [base + disp], src8
+
+    // Arithmetic and comparisons
+    void subReg32(Reg dst, Reg src);
+    void subImm32(Reg dst, int32_t imm);
+    void negReg32(Reg dst);
+    void divReg32(Reg src);           // Unsigned edx:eax / src: quotient in eax, remainder in edx
+    void cmpReg32(Reg left, Reg right);
+    void cmpImm32(Reg left, int32_t imm);
+    void cmpReg64(Reg left, Reg right);
+    void cmpByteImm(Reg base, int32_t disp, uint8_t imm);  // cmp byte [base + disp], imm
+    void testReg32(Reg a, Reg b);
+    void setcc(Cond cond, Reg dst);   // dst8 = cond ? 1 : 0
+    void movzx8(Reg dst, Reg src);    // dst32 = zero-extended src8
+    void addReg64(Reg dst, Reg src);
+    void addImm64(Reg dst, int32_t imm);
+    void subImm64(Reg dst, int32_t imm);
+
+    // Control flow
+    void jmp(Label target);
+    void jcc(Cond cond, Label target);
+    void call(Reg target);
+    void call(Label target);
+    void push(Reg reg);
+    void pop(Reg reg);
+    void ret();
+    void syscall();
+
+private:
+    std::vector<uint8_t> bytes;
+    std::vector<int64_t> labelPositions;  // -1 until bound
+
+    struct Fixup {
+        size_t position;  // Where the rel32 field starts
+        int label;
+    };
+    std::vector<Fixup> fixups;
+
+    void rex(bool wide, Reg reg, Reg base, bool forceForByte = false);
+    void modrmReg(Reg reg, Reg rm);
+    void modrmMem(Reg reg, Reg base, int32_t disp);
+    void rel32(Label target);
+    void emit32(uint32_t value);
+};
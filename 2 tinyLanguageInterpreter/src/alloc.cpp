@@ -0,0 +1,154 @@
+#include "alloc.hpp"
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+// Size and stage of every block allocated while the tracker was on. The
+// table takes its own memory straight from malloc(), so it is not counted and
+// does not recurse into operator new, and it only exists once tracking starts:
+// until then operator new and delete are malloc() and free() behind one check.
+struct Block {
+    size_t size;
+    AllocationTracker::Stage stage;
+};
+
+template <typename T>
+struct MallocAllocator {
+    using value_type = T;
+    MallocAllocator() = default;
+    template <typename U>
+    MallocAllocator(const MallocAllocator<U>&) {}
+    T* allocate(size_t n) {
+        if (void* p = std::malloc(n * sizeof(T))) return static_cast<T*>(p);
+        throw std::bad_alloc();
+    }
+    void deallocate(T* p, size_t) { std::free(p); }
+    bool operator==(const MallocAllocator&) const { return true; }
+    bool operator!=(const MallocAllocator&) const { return false; }
+};
+
+using BlockTable = std::unordered_map<void*, Block, std::hash<void*>, std::equal_to<void*>,
+                                      MallocAllocator<std::pair<void* const, Block>>>;
+
+// Never destroyed: blocks are still freed after main() returns
+static BlockTable* blocks = nullptr;
+
+// Aligned blocks come from aligned_alloc(), which free() releases too
+static void* allocate(size_t size, size_t alignment = 0) noexcept {
+    size_t bytes = size ? size : 1;
+    void* p = alignment ? std::aligned_alloc(alignment, (bytes + alignment - 1) / alignment * alignment)
+                        : std::malloc(bytes);
+    if (!p || !AllocationTracker::enabled) return p;
+
+    using Tracker = AllocationTracker;
+    if (!blocks) {
+        void* table = std::malloc(sizeof(BlockTable));
+        if (!table) return p;
+        blocks = new (table) BlockTable();
+    }
+    try {
+        blocks->emplace(p, Block{size, Tracker::stage});
+    } catch (const std::bad_alloc&) {
+        return p;  // Left uncounted
+    }
+    auto& counters = Tracker::counters[Tracker::stage];
+    counters.allocations++;
+    counters.bytes += size;
+    counters.live += size;
+    Tracker::live += size;
+    if (Tracker::live > Tracker::peakLive) Tracker::peakLive = Tracker::live;
+    if (Tracker::live > counters.peakLive) counters.peakLive = Tracker::live;
+    return p;
+}
+
+static void release(void* p) noexcept {
+    // Looked up even once the tracker is off, so live bytes stay balanced
+    if (p && blocks) {
+        auto it = blocks->find(p);
+        if (it != blocks->end()) {
+            auto& counters = AllocationTracker::counters[it->second.stage];
+            counters.frees++;
+            counters.live -= it->second.size;
+            AllocationTracker::live -= it->second.size;
+            blocks->erase(it);
+        }
+    }
+    std::free(p);
+}
+
+void* operator new(size_t size) {
+    if (void* p = allocate(size)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    if (void* p = allocate(size)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    if (void* p = allocate(size, static_cast<size_t>(alignment))) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    if (void* p = allocate(size, static_cast<size_t>(alignment))) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { release(p); }
+void operator delete[](void* p) noexcept { release(p); }
+void operator delete(void* p, size_t) noexcept { release(p); }
+void operator delete[](void* p, size_t) noexcept { release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { release(p); }
+void operator delete(void* p, std::align_val_t) noexcept { release(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { release(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { release(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { release(p); }
+
+static std::string formatBytes(long bytes) {
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(1);
+    if (bytes < 1024) {
+        text << bytes << " B";
+    } else if (bytes < 1024 * 1024) {
+        text << bytes / 1024.0 << " KiB";
+    } else {
+        text << bytes / (1024.0 * 1024.0) << " MiB";
+    }
+    return text.str();
+}
+
+void AllocationTracker::report(std::ostream& out) {
+    // The stage still running ends here, and the report's own strings do not count
+    counters[stage].kept = counters[stage].live;
+    enabled = false;
+
+    out << std::left << std::setw(10) << "stage" << std::right
+        << std::setw(13) << "allocations" << std::setw(13) << "bytes"
+        << std::setw(11) << "frees" << std::setw(13) << "peak live"
+        << std::setw(13) << "kept" << "\n";
+    Counters total = {};
+    for (int s = 0; s < StageCount; s++) {
+        const Counters& c = counters[s];
+        if (c.allocations == 0) continue;
+        out << std::left << std::setw(10) << name(static_cast<Stage>(s)) << std::right
+            << std::setw(13) << c.allocations << std::setw(13) << formatBytes(c.bytes)
+            << std::setw(11) << c.frees << std::setw(13) << formatBytes(c.peakLive)
+            << std::setw(13) << formatBytes(c.kept) << "\n";
+        total.allocations += c.allocations;
+        total.bytes += c.bytes;
+        total.frees += c.frees;
+    }
+    out << std::left << std::setw(10) << "total" << std::right
+        << std::setw(13) << total.allocations << std::setw(13) << formatBytes(total.bytes)
+        << std::setw(11) << total.frees << std::setw(13) << formatBytes(peakLive)
+        << std::setw(13) << formatBytes(live) << "\n";
+}
@@ -0,0 +1,365 @@
+#include "aot.hpp"
+#include "jit.hpp"
+#include "x86.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+using Reg = X86Assembler::Reg;
+
+const uint64_t loadAddress = 0x400000;
+const uint64_t pageSize = 0x1000;
+const size_t elfHeaderSize = 64;
+const size_t programHeaderSize = 56;
+const size_t headersSize = elfHeaderSize + 2 * programHeaderSize;
+
+// Linux system calls
+const int32_t SYS_WRITE = 1;
+const int32_t SYS_EXIT_GROUP = 231;
+const int32_t LINUX_EINTR = 4;
+
+// The errors write() can fail with: Linux's number, and the host's for strerror()
+const struct {
+    int32_t number;
+    int host;
+} writeErrors[] = {
+    {1, EPERM}, {5, EIO}, {9, EBADF}, {11, EAGAIN}, {14, EFAULT}, {22, EINVAL},
+    {27, EFBIG}, {28, ENOSPC}, {32, EPIPE}, {104, ECONNRESET}, {122, EDQUOT}
+};
+
+// The zero-filled segment: the JitContext, then the output state (bytes
+// used, the errno of a failed write, then the buffer), then the variables
+// and their "assigned" flags
+const int32_t outputCapacity = 64 * 1024;
+const uint64_t contextOffset = 0;
+const uint64_t outputOffset = 32;
+const int32_t outputUsed = 0;
+const int32_t outputError = 4;
+const int32_t outputBuffer = 8;
+const uint64_t valuesOffset = outputOffset + outputBuffer + outputCapacity;
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Where everything ends up in memory
+struct Layout {
+    uint64_t codeAddress = 0;  // Position 0 of the assembler
+    uint64_t dataAddress = 0;  // The zero-filled segment
+    uint64_t slots = 0;
+
+    uint64_t context() const { return dataAddress + contextOffset; }
+    uint64_t output() const { return dataAddress + outputOffset; }
+    uint64_t values() const { return dataAddress + valuesOffset; }
+    uint64_t defined() const { return values() + slots * 4; }
+    uint64_t dataSize() const { return valuesOffset + slots * 5; }
+};
+
+struct Message {
+    int32_t code;        // The program's status, or the errno, that leads to it
+    uint64_t offset;     // From the start of the messages
+    size_t length;
+};
+
+// flush(rdi = output state): write the buffer to standard output, retrying
+// short and interrupted writes, and empty it. Returns 0, or the errno of a
+// failed write, which is also kept in the output state.
+void emitFlush(X86Assembler& a) {
+    auto again = a.newLabel();
+    auto done = a.newLabel();
+    auto failed = a.newLabel();
+
+    a.movReg64(X86Assembler::R9, X86Assembler::RDI);
+    a.movImm32(X86Assembler::R8, 0);  // Bytes written so far
+    a.bind(again);
+    a.load32(X86Assembler::RDX, X86Assembler::R9, outputUsed);
+    a.cmpReg32(X86Assembler::R8, X86Assembler::RDX);
+    a.jcc(X86Assembler::GREATER_EQUAL, done);
+    a.subReg32(X86Assembler::RDX, X86Assembler::R8);
+    a.movReg64(X86Assembler::RSI, X86Assembler::R9);
+    a.addReg64(X86Assembler::RSI, X86Assembler::R8);
+    a.addImm64(X86Assembler::RSI, outputBuffer);
+    a.movImm32(X86Assembler::RDI, 1);
+    a.movImm32(X86Assembler::RAX, SYS_WRITE);
+    a.syscall();
+    a.cmpImm32(X86Assembler::RAX, -LINUX_EINTR);
+    a.jcc(X86Assembler::EQUAL, again);
+    a.testReg32(X86Assembler::RAX, X86Assembler::RAX);
+    a.jcc(X86Assembler::LESS, failed);
+    a.addReg64(X86Assembler::R8, X86Assembler::RAX);
+    a.jmp(again);
+
+    a.bind(done);
+    a.movImm32(X86Assembler::RAX, 0);
+    a.store32(X86Assembler::R9, outputUsed, X86Assembler::RAX);
+    a.ret();
+    a.bind(failed);
+    a.negReg32(X86Assembler::RAX);
+    a.store32(X86Assembler::R9, outputError, X86Assembler::RAX);
+    a.ret();
+}
+
+// print(rdi = output state, esi = value): append the value in decimal and a
+// newline, flushing first if it might not fit. Returns 0, or nonzero when
+// the flush fails. The digits are built backwards in the red zone below rsp.
+void emitPrint(X86Assembler& a, X86Assembler::Label flush) {
+    auto room = a.newLabel();
+    auto positive = a.newLabel();
+    auto digit = a.newLabel();
+    auto copy = a.newLabel();
+    auto failed = a.newLabel();
+
+    a.load32(X86Assembler::RAX, X86Assembler::RDI, outputUsed);
+    a.cmpImm32(X86Assembler::RAX, outputCapacity - 12);
+    a.jcc(X86Assembler::LESS_EQUAL, room);
+    a.push(X86Assembler::RDI);
+    a.push(X86Assembler::RSI);
+    a.call(flush);
+    a.pop(X86Assembler::RSI);
+    a.pop(X86Assembler::RDI);
+    a.testReg32(X86Assembler::RAX, X86Assembler::RAX);
+    a.jcc(X86Assembler::NOT_EQUAL, failed);
+
+    // The magnitude as unsigned, so -2147483648 needs no special case
+    a.bind(room);
+    a.movReg32(X86Assembler::RAX, X86Assembler::RSI);
+    a.testReg32(X86Assembler::RAX, X86Assembler::RAX);
+    a.jcc(X86Assembler::GREATER_EQUAL, positive);
+    a.negReg32(X86Assembler::RAX);
+    a.bind(positive);
+    a.movReg64(X86Assembler::R8, X86Assembler::RSP);
+    a.subImm64(X86Assembler::R8, 1);
+    a.storeByteImm(X86Assembler::R8, 0, '\n');
+    a.movImm32(X86Assembler::RCX, 10);
+    a.bind(digit);
+    a.movImm32(X86Assembler::RDX, 0);
+    a.divReg32(X86Assembler::RCX);
+    a.subImm32(X86Assembler::RDX, -'0');
+    a.subImm64(X86Assembler::R8, 1);
+    a.store8(X86Assembler::R8, 0, X86Assembler::RDX);
+    a.testReg32(X86Assembler::RAX, X86Assembler::RAX);
+    a.jcc(X86Assembler::NOT_EQUAL, digit);
+    a.testReg32(X86Assembler::RSI, X86Assembler::RSI);
+    a.jcc(X86Assembler::GREATER_EQUAL, copy);
+    a.subImm64(X86Assembler::R8, 1);
+    a.storeByteImm(X86Assembler::R8, 0, '-');
+
+    // Copy [r8, rsp) to the end of the buffer
+    auto next = a.newLabel();
+    a.bind(copy);
+    a.load32(X86Assembler::RAX, X86Assembler::RDI, outputUsed);
+    a.movReg64(X86Assembler::R9, X86Assembler::RDI);
+    a.addReg64(X86Assembler::R9, X86Assembler::RAX);
+    a.bind(next);
+    a.load8(X86Assembler::RDX, X86Assembler::R8, 0);
+    a.store8(X86Assembler::R9, outputBuffer, X86Assembler::RDX);
+    a.addImm64(X86Assembler::R8, 1);
+    a.addImm64(X86Assembler::R9, 1);
+    a.subImm32(X86Assembler::RAX, -1);
+    a.cmpReg64(X86Assembler::R8, X86Assembler::RSP);
+    a.jcc(X86Assembler::NOT_EQUAL, next);
+    a.store32(X86Assembler::RDI, outputUsed, X86Assembler::RAX);
+    a.movImm32(X86Assembler::RAX, 0);
+    a.bind(failed);
+    a.ret();
+}
+
+// Write a message to standard error and exit with status 1
+void emitFail(X86Assembler& a, uint64_t messagesAddress, const Message& message) {
+    a.movImm32(X86Assembler::RDI, 2);
+    a.movImm64(X86Assembler::RSI, messagesAddress + message.offset);
+    a.movImm32(X86Assembler::RDX, static_cast<int32_t>(message.length));
+    a.movImm32(X86Assembler::RAX, SYS_WRITE);
+    a.syscall();
+    a.movImm32(X86Assembler::RDI, 1);
+    a.movImm32(X86Assembler::RAX, SYS_EXIT_GROUP);
+    a.syscall();
+}
+
+// Compare reg with every message's code and fail with the first that matches
+void emitDispatch(X86Assembler& a, Reg reg, uint64_t messagesAddress,
+                  const std::vector<Message>& messages) {
+    std::vector<X86Assembler::Label> stubs;
+    for (const auto& message : messages) {
+        stubs.push_back(a.newLabel());
+        a.cmpImm32(reg, message.code);
+        a.jcc(X86Assembler::EQUAL, stubs.back());
+    }
+    auto next = a.newLabel();
+    a.jmp(next);
+    for (size_t i = 0; i < messages.size(); i++) {
+        a.bind(stubs[i]);
+        emitFail(a, messagesAddress, messages[i]);
+    }
+    a.bind(next);
+}
+
+// _start: run the program, flush, and exit with 0, or with 1 after writing
+// the interpreter's message for the program's status or the failed write
+void emitStart(X86Assembler& a, const Layout& layout, uint64_t programAddress,
+               X86Assembler::Label flush, uint64_t messagesAddress,
+               const std::vector<Message>& undefined, const std::vector<Message>& writeFailures,
+               const Message& outputFailure) {
+    a.movImm64(X86Assembler::RDI, layout.context());
+    a.movImm64(X86Assembler::RAX, layout.values());
+    a.store64(X86Assembler::RDI, offsetof(JitContext, values), X86Assembler::RAX);
+    a.movImm64(X86Assembler::RAX, layout.defined());
+    a.store64(X86Assembler::RDI, offsetof(JitContext, defined), X86Assembler::RAX);
+    a.movImm64(X86Assembler::RAX, layout.output());
+    a.store64(X86Assembler::RDI, offsetof(JitContext, out), X86Assembler::RAX);
+    a.movImm64(X86Assembler::RAX, programAddress);
+    a.call(X86Assembler::RAX);
+
+    // Whatever was printed comes out before the error, as in the interpreter
+    auto failedOutput = a.newLabel();
+    a.movReg32(X86Assembler::RBX, X86Assembler::RAX);
+    a.cmpImm32(X86Assembler::RBX, STATUS_OUTPUT_ERROR);
+    a.jcc(X86Assembler::EQUAL, failedOutput);
+    a.movImm64(X86Assembler::RDI, layout.output());
+    a.call(flush);
+    a.testReg32(X86Assembler::RAX, X86Assembler::RAX);
+    a.jcc(X86Assembler::NOT_EQUAL, failedOutput);
+    emitDispatch(a, X86Assembler::RBX, messagesAddress, undefined);
+    a.movImm32(X86Assembler::RDI, 0);
+    a.movImm32(X86Assembler::RAX, SYS_EXIT_GROUP);
+    a.syscall();
+
+    a.bind(failedOutput);
+    a.movImm64(X86Assembler::RDI, layout.output());
+    a.load32(X86Assembler::RAX, X86Assembler::RDI, outputError);
+    emitDispatch(a, X86Assembler::RAX, messagesAddress, writeFailures);
+    emitFail(a, messagesAddress, outputFailure);
+    a.resolveLabels();
+}
+
+// Little-endian fields of the ELF headers
+void put(std::vector<uint8_t>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+void putProgramHeader(std::vector<uint8_t>& out, uint32_t flags, uint64_t address,
+                      uint64_t fileSize, uint64_t memorySize) {
+    put(out, 1, 4);            // PT_LOAD
+    put(out, flags, 4);
+    put(out, 0, 8);            // Offset: the text segment starts with the headers
+    put(out, address, 8);
+    put(out, address, 8);
+    put(out, fileSize, 8);
+    put(out, memorySize, 8);
+    put(out, pageSize, 8);
+}
+
+}  // namespace
+
+size_t writeExecutable(const std::string& path, const Chunk& program) {
+    if (!program.functions.empty()) {
+        throw std::runtime_error("Cannot compile functions to machine code");
+    }
+    if (!program.arrays.empty()) {
+        throw std::runtime_error("Cannot compile arrays to machine code");
+    }
+
+    // The interpreter's messages for every way the program can fail
+    std::string text;
+    auto message = [&](int32_t code, const std::string& what) {
+        Message result{code, text.size(), what.size() + 8};
+        text += "Error: " + what + "\n";
+        return result;
+    };
+    std::vector<Message> writeFailures;
+    for (const auto& error : writeErrors) {
+        writeFailures.push_back(message(error.number, std::string("Output error: ") + std::strerror(error.host)));
+    }
+    Message outputFailure = message(0, "Output error while printing");
+    std::vector<Message> undefined;
+    std::set<int32_t> checked;
+    for (size_t pc = 0; pc < program.code.size(); pc += 1 + operandCount(static_cast<OpCode>(program.code[pc]))) {
+        if (static_cast<OpCode>(program.code[pc]) == OpCode::LOAD_CHECKED) {
+            checked.insert(program.code[pc + 1]);
+        }
+    }
+    for (int32_t slot : checked) {
+        undefined.push_back(message(slot + 1, "Undefined variable: " + program.names[slot]));
+    }
+
+    Layout layout;
+    layout.slots = program.names.size();
+    uint64_t codeOffset = alignUp(headersSize + text.size(), 16);
+    layout.codeAddress = loadAddress + codeOffset;
+
+    // Every instruction has the same size whatever the addresses in it, so
+    // assemble once to find where the data segment goes, then for real
+    X86Assembler a;
+    uint64_t entry = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        a = X86Assembler();
+        auto flush = a.newLabel();
+        a.bind(flush);
+        emitFlush(a);
+        uint64_t printAddress = layout.codeAddress + a.size();
+        emitPrint(a, flush);
+        a.resolveLabels();
+
+        uint64_t programAddress = layout.codeAddress + a.size();
+        if (!translateChunk(program, a, printAddress)) {
+            throw std::runtime_error("Cannot compile this program to machine code");
+        }
+        entry = layout.codeAddress + a.size();
+        emitStart(a, layout, programAddress, flush, loadAddress + headersSize,
+                  undefined, writeFailures, outputFailure);
+
+        // One unmapped page between the segments
+        layout.dataAddress = alignUp(layout.codeAddress + a.size(), pageSize) + pageSize;
+    }
+
+    std::vector<uint8_t> file;
+    uint64_t fileSize = codeOffset + a.size();
+    file.reserve(fileSize);
+    // ELF header: 64-bit, little-endian, System V, executable for x86-64
+    const uint8_t ident[16] = {0x7F, 'E', 'L', 'F', 2, 1, 1, 0};
+    file.insert(file.end(), ident, ident + sizeof(ident));
+    put(file, 2, 2);                   // ET_EXEC
+    put(file, 62, 2);                  // EM_X86_64
+    put(file, 1, 4);
+    put(file, entry, 8);
+    put(file, elfHeaderSize, 8);       // Program headers follow
+    put(file, 0, 8);                   // No section headers
+    put(file, 0, 4);
+    put(file, elfHeaderSize, 2);
+    put(file, programHeaderSize, 2);
+    put(file, 2, 2);
+    put(file, 64, 2);
+    put(file, 0, 2);
+    put(file, 0, 2);
+    putProgramHeader(file, 5, loadAddress, fileSize, fileSize);  // R+X
+    putProgramHeader(file, 6, layout.dataAddress, 0, layout.dataSize());  // R+W, zero-filled
+    file.insert(file.end(), text.begin(), text.end());
+    file.resize(codeOffset, 0);
+    file.insert(file.end(), a.code().begin(), a.code().end());
+
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot create executable: " + path);
+        }
+        out.write(reinterpret_cast<const char*>(file.data()), file.size());
+        if (!out) {
+            throw std::runtime_error("Cannot write executable: " + path);
+        }
+    }
+    if (chmod(temporary.c_str(), 0755) != 0 || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot replace executable: " + path);
+    }
+    return file.size();
+}
@@ -0,0 +1,276 @@
+#include "array.hpp"
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#ifdef TINY_SIMD_ARRAYS
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Arrays start on a cache line, so a loop from element 0 in steps of a
+// whole register only ever loads and stores aligned vectors. Whatever is
+// left over goes through the scalar loop at the end of each kernel, which
+// computes in unsigned arithmetic to wrap around like the vector lanes do.
+
+#ifdef TINY_SIMD_ARRAYS
+inline __m128i load(const int* p) { return _mm_load_si128(reinterpret_cast<const __m128i*>(p)); }
+inline void store(int* p, __m128i v) { _mm_store_si128(reinterpret_cast<__m128i*>(p), v); }
+
+inline unsigned horizontalSum(__m128i v) {
+    alignas(16) int lanes[4];
+    store(lanes, v);
+    return static_cast<unsigned>(lanes[0]) + static_cast<unsigned>(lanes[1]) +
+           static_cast<unsigned>(lanes[2]) + static_cast<unsigned>(lanes[3]);
+}
+
+// SSE2 has no 32-bit min and max; SSE4.1 does
+template <bool Largest>
+inline __m128i pick(__m128i a, __m128i b) {
+#ifdef __SSE4_1__
+    return Largest ? _mm_max_epi32(a, b) : _mm_min_epi32(a, b);
+#else
+    __m128i greater = _mm_cmpgt_epi32(a, b);
+    __m128i wanted = Largest ? a : b;
+    __m128i other = Largest ? b : a;
+    return _mm_or_si128(_mm_and_si128(greater, wanted), _mm_andnot_si128(greater, other));
+#endif
+}
+
+template <bool Largest>
+inline int reduce(__m128i v, int best) {
+    alignas(16) int lanes[4];
+    store(lanes, v);
+    for (int lane : lanes) {
+        best = Largest ? std::max(best, lane) : std::min(best, lane);
+    }
+    return best;
+}
+
+#ifdef __AVX2__
+inline __m256i load256(const int* p) { return _mm256_load_si256(reinterpret_cast<const __m256i*>(p)); }
+inline void store256(int* p, __m256i v) { _mm256_store_si256(reinterpret_cast<__m256i*>(p), v); }
+inline __m128i halves(__m256i v) {
+    return _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+}
+#endif
+#endif
+
+void fillKernel(int* data, size_t n, int value) {
+    size_t i = 0;
+#ifdef TINY_SIMD_ARRAYS
+#ifdef __AVX2__
+    __m256i wide = _mm256_set1_epi32(value);
+    for (; i + 8 <= n; i += 8) store256(data + i, wide);
+#endif
+    __m128i narrow = _mm_set1_epi32(value);
+    for (; i + 4 <= n; i += 4) store(data + i, narrow);
+#endif
+    for (; i < n; i++) data[i] = value;
+}
+
+int sumKernel(const int* data, size_t n) {
+    size_t i = 0;
+    unsigned total = 0;
+#ifdef TINY_SIMD_ARRAYS
+    // Two accumulators, so consecutive adds do not wait for each other
+    __m128i first = _mm_setzero_si128();
+    __m128i second = _mm_setzero_si128();
+#ifdef __AVX2__
+    __m256i wideFirst = _mm256_setzero_si256();
+    __m256i wideSecond = _mm256_setzero_si256();
+    for (; i + 16 <= n; i += 16) {
+        wideFirst = _mm256_add_epi32(wideFirst, load256(data + i));
+        wideSecond = _mm256_add_epi32(wideSecond, load256(data + i + 8));
+    }
+    first = halves(_mm256_add_epi32(wideFirst, wideSecond));
+#endif
+    for (; i + 8 <= n; i += 8) {
+        first = _mm_add_epi32(first, load(data + i));
+        second = _mm_add_epi32(second, load(data + i + 4));
+    }
+    for (; i + 4 <= n; i += 4) {
+        first = _mm_add_epi32(first, load(data + i));
+    }
+    total = horizontalSum(_mm_add_epi32(first, second));
+#endif
+    for (; i < n; i++) total += static_cast<unsigned>(data[i]);
+    return static_cast<int>(total);
+}
+
+template <bool Largest>
+int extremeKernel(const int* data, size_t n) {
+    size_t i = 0;
+    int best = data[0];
+#ifdef TINY_SIMD_ARRAYS
+#ifdef __AVX2__
+    if (n >= 8) {
+        __m256i wide = load256(data);
+        for (i = 8; i + 8 <= n; i += 8) {
+            wide = Largest ? _mm256_max_epi32(wide, load256(data + i))
+                           : _mm256_min_epi32(wide, load256(data + i));
+        }
+        best = reduce<Largest>(pick<Largest>(_mm256_castsi256_si128(wide),
+                                             _mm256_extracti128_si256(wide, 1)), best);
+    }
+#endif
+    if (i + 4 <= n) {
+        __m128i narrow = load(data + i);
+        for (i += 4; i + 4 <= n; i += 4) {
+            narrow = pick<Largest>(narrow, load(data + i));
+        }
+        best = reduce<Largest>(narrow, best);
+    }
+#endif
+    for (; i < n; i++) {
+        best = Largest ? std::max(best, data[i]) : std::min(best, data[i]);
+    }
+    return best;
+}
+
+template <bool Subtract>
+void combineKernel(int* out, const int* a, const int* b, size_t n) {
+    size_t i = 0;
+#ifdef TINY_SIMD_ARRAYS
+#ifdef __AVX2__
+    for (; i + 8 <= n; i += 8) {
+        __m256i l = load256(a + i);
+        __m256i r = load256(b + i);
+        store256(out + i, Subtract ? _mm256_sub_epi32(l, r) : _mm256_add_epi32(l, r));
+    }
+#endif
+    for (; i + 4 <= n; i += 4) {
+        __m128i l = load(a + i);
+        __m128i r = load(b + i);
+        store(out + i, Subtract ? _mm_sub_epi32(l, r) : _mm_add_epi32(l, r));
+    }
+#endif
+    for (; i < n; i++) {
+        unsigned l = static_cast<unsigned>(a[i]);
+        unsigned r = static_cast<unsigned>(b[i]);
+        out[i] = static_cast<int>(Subtract ? l - r : l + r);
+    }
+}
+
+// A comparison is -1 in every lane that matches, so subtracting it counts
+template <bool Above>
+int countKernel(const int* data, size_t n, int value) {
+    size_t i = 0;
+    int count = 0;
+#ifdef TINY_SIMD_ARRAYS
+    __m128i narrowValue = _mm_set1_epi32(value);
+    __m128i narrow = _mm_setzero_si128();
+#ifdef __AVX2__
+    __m256i wideValue = _mm256_set1_epi32(value);
+    __m256i wide = _mm256_setzero_si256();
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = load256(data + i);
+        wide = _mm256_sub_epi32(wide, Above ? _mm256_cmpgt_epi32(v, wideValue)
+                                            : _mm256_cmpgt_epi32(wideValue, v));
+    }
+    narrow = halves(wide);
+#endif
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = load(data + i);
+        narrow = _mm_sub_epi32(narrow, Above ? _mm_cmpgt_epi32(v, narrowValue)
+                                             : _mm_cmpgt_epi32(narrowValue, v));
+    }
+    count = static_cast<int>(horizontalSum(narrow));
+#endif
+    for (; i < n; i++) {
+        count += Above ? data[i] > value : data[i] < value;
+    }
+    return count;
+}
+
+[[noreturn]] void emptyArray(const char* builtin, const std::string& name) {
+    throw std::runtime_error(std::string(builtin) + " of empty array " + name);
+}
+
+void checkLengths(const IntArray& a, const std::string& aName, const IntArray& b, const std::string& bName) {
+    if (a.size() != b.size()) {
+        throw std::runtime_error("Arrays of different lengths: " + aName + " has " +
+                                 std::to_string(a.size()) + " elements, " + bName + " has " +
+                                 std::to_string(b.size()));
+    }
+}
+
+}  // namespace
+
+IntArray::~IntArray() {
+    if (elements) {
+        ::operator delete(elements, std::align_val_t(alignment));
+    }
+}
+
+IntArray& IntArray::operator=(IntArray&& other) noexcept {
+    if (this != &other) {
+        this->~IntArray();
+        elements = other.elements;
+        length = other.length;
+        other.elements = nullptr;
+        other.length = 0;
+    }
+    return *this;
+}
+
+IntArray IntArray::allocate(int length, const std::string& name) {
+    if (length < 0 || length > maxLength) {
+        throw std::runtime_error("Invalid length for array " + name + ": " + std::to_string(length));
+    }
+    IntArray array;
+    if (length > 0) {
+        size_t bytes = static_cast<size_t>(length) * sizeof(int);
+        array.elements = static_cast<int*>(::operator new(bytes, std::align_val_t(alignment)));
+        std::memset(array.elements, 0, bytes);
+        array.length = static_cast<size_t>(length);
+    }
+    return array;
+}
+
+void IntArray::outOfBounds(int index, const std::string& name) const {
+    throw std::runtime_error("Index " + std::to_string(index) + " out of bounds for array " + name +
+                             " of length " + std::to_string(length));
+}
+
+void IntArray::fill(int value) {
+    fillKernel(elements, length, value);
+}
+
+int IntArray::sum() const {
+    return sumKernel(elements, length);
+}
+
+int IntArray::min(const std::string& name) const {
+    if (length == 0) emptyArray("min", name);
+    return extremeKernel<false>(elements, length);
+}
+
+int IntArray::max(const std::string& name) const {
+    if (length == 0) emptyArray("max", name);
+    return extremeKernel<true>(elements, length);
+}
+
+int IntArray::countAbove(int value) const {
+    return countKernel<true>(elements, length, value);
+}
+
+int IntArray::countBelow(int value) const {
+    return countKernel<false>(elements, length, value);
+}
+
+void IntArray::add(IntArray& out, const IntArray& a, const IntArray& b,
+                   const std::string& outName, const std::string& aName, const std::string& bName) {
+    checkLengths(out, outName, a, aName);
+    checkLengths(a, aName, b, bName);
+    combineKernel<false>(out.elements, a.elements, b.elements, out.length);
+}
+
+void IntArray::subtract(IntArray& out, const IntArray& a, const IntArray& b,
+                        const std::string& outName, const std::string& aName, const std::string& bName) {
+    checkLengths(out, outName, a, aName);
+    checkLengths(a, aName, b, bName);
+    combineKernel<true>(out.elements, a.elements, b.elements, out.length);
+}
@@ -1,25 +1,12 @@
 #include "ast.hpp"
-#include <iostream>
+#include "quicken.hpp"
+#include "resolver.hpp"
 #include <stdexcept>
 
-// Environment methods
-void Environment::define(const std::string& name, int value) {
-    values[name] = value;
-}
-
-int Environment::get(const std::string& name) {
-    auto it = values.find(name);
-    if (it == values.end()) {
-        throw std::runtime_error("Undefined variable: " + name);
-    }
-    return it->second;
-}
-
-void Environment::assign(const std::string& name, int value) {
-    if (values.find(name) == values.end()) {
-        throw std::runtime_error("Cannot assign to undefined variable: " + name);
-    }
-    values[name] = value;
+// Whether a generic if or while tests a condition quickening fuses into it
+static bool fusable(const ASTNode& condition) {
+    auto* comparison = dynamic_cast<const ComparisonNode*>(&condition);
+    return comparison && comparison->isVarConst();
 }
 
 // Node execution methods
@@ -28,40 +15,73 @@ int NumberNode::execute(Environment& env) {
 }
 
 int VariableNode::execute(Environment& env) {
-    return env.get(name);
+    if (checked && !env.isDefined(slot)) {
+        throw std::runtime_error("Undefined variable: " + name);
+    }
+    return env.get(slot);
 }
 
 int AssignmentNode::execute(Environment& env) {
+    if (env.stats && isDecrement()) {
+        env.stats->misses[QuickeningStats::DecrementInPlace]++;
+    }
     int val = value->execute(env);
-    env.define(name, val);
+    env.set(slot, val);
     return val;
 }
 
 int PrintNode::execute(Environment& env) {
     int val = expression->execute(env);
-    std::cout << val << std::endl;
+    env.out->print(val);
     return val;
 }
 
 int IfNode::execute(Environment& env) {
+    if (env.stats && fusable(*condition)) {
+        env.stats->misses[QuickeningStats::FusedIf]++;
+    }
     if (condition->execute(env)) {
         for (const auto& stmt : body) {
             stmt->execute(env);
         }
+        // The body has run once, so its statements can specialize themselves
+        if (!quickened && env.quickening) {
+            quickenBlock(body, env);
+            quickened = true;
+        }
     }
     return 0;  // Return value not used for control flow
 }
 
 int WhileNode::execute(Environment& env) {
+    if (env.jit && tier.enter(env)) return 0;
     while (condition->execute(env)) {
+        if (env.stats && fusable(*condition)) {
+            env.stats->misses[QuickeningStats::FusedWhile]++;
+        }
         for (const auto& stmt : body) {
             stmt->execute(env);
         }
+        if (!quickened && env.quickening) {
+            quickenBlock(body, env);
+            quickened = true;
+
+            // If the condition specialized too, finish this run in the fused loop
+            quicken(condition, env);
+            if (auto* fused = dynamic_cast<VarConstComparisonNode*>(condition.get())) {
+                WhileVarConstNode::loop(*fused, body, quickened, tier, env);
+                return 0;
+            }
+        }
+        if (env.jit && tier.iterate(*condition, body, env)) return 0;
     }
     return 0;  // Return value not used for control flow
 }
 
 int ComparisonNode::execute(Environment& env) {
+    if (env.stats && isVarConst()) {
+        env.stats->misses[QuickeningStats::CompareVarConst]++;
+    }
     int l = left->execute(env);
     int r = right->execute(env);
     
@@ -72,4 +92,123 @@ int ComparisonNode::execute(Environment& env) {
             return l < r;
     }
     return 0;  // Shouldn't reach here
-}
\ No newline at end of file
+}
+
+int SubtractionNode::execute(Environment& env) {
+    int l = left->execute(env);
+    int r = right->execute(env);
+    return l - r;
+}
+
+FunctionNode::FunctionNode(std::string name,
+                           std::vector<std::string> parameters,
+                           std::vector<std::unique_ptr<ASTNode>> body,
+                           std::unique_ptr<ASTNode> result)
+    : name(std::move(name))
+    , parameters(std::move(parameters))
+    , body(std::move(body))
+    , result(std::move(result)) {}
+
+FunctionNode::~FunctionNode() = default;
+
+int FunctionNode::execute(Environment& env) {
+    return 0;  // Defined before the program ran (see Resolver::resolve)
+}
+
+int FunctionNode::call(Environment& env, const std::vector<std::unique_ptr<ASTNode>>& arguments) {
+    Environment::Call frame(env);
+    for (const auto& argument : arguments) {
+        frame.argument(argument->execute(env));
+    }
+    frame.enter(resolver->slotCount());
+
+    // Nodes of the body may only be replaced once they have returned (see
+    // quicken.hpp), so a call made while the function is already running
+    // must not specialize anything: only the outermost call does
+    struct Running {
+        FunctionNode& function;
+        Environment& env;
+        bool quickening;
+        ~Running() {
+            function.running--;
+            env.quickening = quickening;
+        }
+    } guard{*this, env, env.quickening};
+    if (running++ > 0) {
+        env.quickening = false;
+    }
+
+    for (const auto& stmt : body) {
+        stmt->execute(env);
+    }
+    if (!quickened && env.quickening) {
+        quickenBlock(body, env);
+        quickened = true;
+    }
+    return result ? result->execute(env) : 0;
+}
+
+int CallNode::execute(Environment& env) {
+    return function->call(env, arguments);
+}
+
+int NewArrayNode::execute(Environment& env) {
+    int n = length->execute(env);
+    env.array(slot) = IntArray::allocate(n, name);
+    return 0;
+}
+
+int ElementNode::execute(Environment& env) {
+    return access.element(env, access.index->execute(env));
+}
+
+// The index and the value are both evaluated before the index is checked
+int ElementAssignmentNode::execute(Environment& env) {
+    int i = access.index->execute(env);
+    int val = value->execute(env);
+    access.element(env, i) = val;
+    return val;
+}
+
+static const BuiltinNode::Signature builtins[] = {
+    {"len", BuiltinNode::Kind::Length, 1, false, true},
+    {"fill", BuiltinNode::Kind::Fill, 1, true, false},
+    {"sum", BuiltinNode::Kind::Sum, 1, false, true},
+    {"min", BuiltinNode::Kind::Min, 1, false, true},
+    {"max", BuiltinNode::Kind::Max, 1, false, true},
+    {"add", BuiltinNode::Kind::Add, 3, false, false},
+    {"sub", BuiltinNode::Kind::Subtract, 3, false, false},
+    {"above", BuiltinNode::Kind::Above, 1, true, true},
+    {"below", BuiltinNode::Kind::Below, 1, true, true},
+};
+
+const BuiltinNode::Signature* BuiltinNode::find(const std::string& name) {
+    for (const auto& builtin : builtins) {
+        if (name == builtin.name) return &builtin;
+    }
+    return nullptr;
+}
+
+int BuiltinNode::execute(Environment& env) {
+    int v = value ? value->execute(env) : 0;
+    // Growing the table moves the arrays, so make room for all of them first
+    env.array(*std::max_element(slots.begin(), slots.end()));
+    IntArray& first = env.array(slots[0]);
+
+    switch (signature.kind) {
+        case Kind::Length: return first.size();
+        case Kind::Fill: first.fill(v); return 0;
+        case Kind::Sum: return first.sum();
+        case Kind::Min: return first.min(arrays[0]);
+        case Kind::Max: return first.max(arrays[0]);
+        case Kind::Add:
+            IntArray::add(first, env.array(slots[1]), env.array(slots[2]), arrays[0], arrays[1], arrays[2]);
+            return 0;
+        case Kind::Subtract:
+            IntArray::subtract(first, env.array(slots[1]), env.array(slots[2]), arrays[0], arrays[1], arrays[2]);
+            return 0;
+        case Kind::Above: return first.countAbove(v);
+        case Kind::Below: return first.countBelow(v);
+    }
+    return 0;  // Shouldn't reach here
+}
@@ -0,0 +1,120 @@
+#include "bytecode.hpp"
+#include <sstream>
+
+int operandCount(OpCode op) {
+    switch (op) {
+        case OpCode::CONST:
+        case OpCode::LOAD:
+        case OpCode::LOAD_CHECKED:
+        case OpCode::STORE:
+        case OpCode::JUMP:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::CALL:
+        case OpCode::NEW_ARRAY:
+        case OpCode::LOAD_ELEMENT:
+        case OpCode::LOAD_ELEMENT_UNCHECKED:
+        case OpCode::STORE_ELEMENT:
+        case OpCode::STORE_ELEMENT_UNCHECKED:
+        case OpCode::LENGTH:
+        case OpCode::FILL:
+        case OpCode::SUM:
+        case OpCode::MIN:
+        case OpCode::MAX:
+        case OpCode::COUNT_ABOVE:
+        case OpCode::COUNT_BELOW:
+            return 1;
+        case OpCode::BOUNDS_GUARD:
+            return 2;
+        case OpCode::ADD_ARRAYS:
+        case OpCode::SUB_ARRAYS:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+static const char* opName(OpCode op) {
+    switch (op) {
+        case OpCode::CONST: return "CONST";
+        case OpCode::LOAD: return "LOAD";
+        case OpCode::LOAD_CHECKED: return "LOAD_CHECKED";
+        case OpCode::STORE: return "STORE";
+        case OpCode::SUB: return "SUB";
+        case OpCode::GREATER: return "GREATER";
+        case OpCode::LESS: return "LESS";
+        case OpCode::JUMP: return "JUMP";
+        case OpCode::JUMP_IF_FALSE: return "JUMP_IF_FALSE";
+        case OpCode::PRINT: return "PRINT";
+        case OpCode::HALT: return "HALT";
+        case OpCode::CALL: return "CALL";
+        case OpCode::RETURN: return "RETURN";
+        case OpCode::POP: return "POP";
+        case OpCode::NEW_ARRAY: return "NEW_ARRAY";
+        case OpCode::LOAD_ELEMENT: return "LOAD_ELEMENT";
+        case OpCode::LOAD_ELEMENT_UNCHECKED: return "LOAD_ELEMENT_UNCHECKED";
+        case OpCode::STORE_ELEMENT: return "STORE_ELEMENT";
+        case OpCode::STORE_ELEMENT_UNCHECKED: return "STORE_ELEMENT_UNCHECKED";
+        case OpCode::LENGTH: return "LENGTH";
+        case OpCode::FILL: return "FILL";
+        case OpCode::SUM: return "SUM";
+        case OpCode::MIN: return "MIN";
+        case OpCode::MAX: return "MAX";
+        case OpCode::ADD_ARRAYS: return "ADD_ARRAYS";
+        case OpCode::SUB_ARRAYS: return "SUB_ARRAYS";
+        case OpCode::COUNT_ABOVE: return "COUNT_ABOVE";
+        case OpCode::COUNT_BELOW: return "COUNT_BELOW";
+        case OpCode::BOUNDS_GUARD: return "BOUNDS_GUARD";
+    }
+    return "???";
+}
+
+std::string Chunk::disassemble() const {
+    std::ostringstream out;
+    size_t pc = 0;
+    const std::vector<std::string>* slotNames = &names;
+    size_t function = 0;
+    while (pc < code.size()) {
+        // Each function starts with its name, and its slots are its own
+        if (function < functions.size() && pc == static_cast<size_t>(functions[function].entry)) {
+            out << functions[function].name << ":\n";
+            slotNames = &functions[function++].names;
+        }
+        OpCode op = static_cast<OpCode>(code[pc]);
+        out << pc << "\t" << opName(op);
+
+        if (operandCount(op) == 1) {
+            int32_t operand = code[pc + 1];
+            switch (op) {
+                case OpCode::LOAD:
+                case OpCode::LOAD_CHECKED:
+                case OpCode::STORE:
+                    out << " " << operand << " (" << (*slotNames)[operand] << ")";
+                    break;
+                case OpCode::CALL:
+                    out << " " << operand << " (" << functions[operand].name << ")";
+                    break;
+                case OpCode::JUMP:
+                case OpCode::JUMP_IF_FALSE:
+                    // Show the absolute target next to the relative offset
+                    out << " " << operand << " -> " << (pc + 2 + operand);
+                    break;
+                case OpCode::CONST:
+                    out << " " << operand;
+                    break;
+                default:
+                    // Every other one-operand instruction names an array
+                    out << " " << operand << " (" << arrays[operand] << ")";
+            }
+        } else if (op == OpCode::ADD_ARRAYS || op == OpCode::SUB_ARRAYS) {
+            for (int i = 1; i <= 3; i++) {
+                out << " " << code[pc + i] << " (" << arrays[code[pc + i]] << ")";
+            }
+        } else if (op == OpCode::BOUNDS_GUARD) {
+            int32_t offset = code[pc + 2];
+            out << " " << code[pc + 1] << " " << offset << " -> " << (pc + 3 + offset);
+        }
+        out << "\n";
+        pc += 1 + operandCount(op);
+    }
+    return out.str();
+}
@@ -0,0 +1,326 @@
+#include "compiler.hpp"
+#include <algorithm>
+
+Chunk BytecodeCompiler::compile(const std::vector<std::unique_ptr<ASTNode>>& program,
+                                const std::vector<std::string>& slotNames) {
+    chunk = Chunk();
+    chunk.names = slotNames;
+    stackDepth = 0;
+    maxStack = &chunk.maxStack;
+    names = &chunk.names;
+    proving.clear();
+
+    // Calls may come before the definition, so number the functions first
+    functionIndex.clear();
+    std::vector<const FunctionNode*> functions;
+    for (const auto& stmt : program) {
+        if (auto* function = dynamic_cast<const FunctionNode*>(stmt.get())) {
+            functionIndex[function] = static_cast<int32_t>(functions.size());
+            functions.push_back(function);
+        }
+    }
+    chunk.functions.resize(functions.size());
+
+    for (const auto& stmt : program) {
+        stmt->compile(*this);
+    }
+    emit(OpCode::HALT);
+
+    for (const FunctionNode* function : functions) {
+        compileFunction(*function);
+    }
+
+    return std::move(chunk);
+}
+
+void BytecodeCompiler::compileFunction(const FunctionNode& function) {
+    Chunk::Function& compiled = chunk.functions[functionIndex[&function]];
+    compiled.name = function.getName();
+    compiled.entry = static_cast<int32_t>(position());
+    compiled.parameters = static_cast<int32_t>(function.parameterCount());
+    compiled.frameSize = static_cast<int32_t>(function.frameSize());
+    compiled.names = function.slotNames();
+    stackDepth = 0;
+    maxStack = &compiled.maxStack;
+    names = &compiled.names;
+
+    for (const auto& stmt : function.getBody()) {
+        stmt->compile(*this);
+    }
+    if (function.getResult()) {
+        function.getResult()->compile(*this);
+    } else {
+        emit(OpCode::CONST, 0);
+    }
+    emit(OpCode::RETURN);
+}
+
+Chunk BytecodeCompiler::compileLoop(const ASTNode& condition,
+                                    const std::vector<std::unique_ptr<ASTNode>>& body) {
+    chunk = Chunk();
+    stackDepth = 0;
+    maxStack = &chunk.maxStack;
+    names = &chunk.names;
+    functionIndex.clear();
+    proving.clear();
+
+    compileWhile(condition, body);
+    emit(OpCode::HALT);
+
+    return std::move(chunk);
+}
+
+void BytecodeCompiler::emit(OpCode op) {
+    chunk.write(op);
+    adjustStack(op);
+}
+
+void BytecodeCompiler::emit(OpCode op, int32_t operand) {
+    chunk.write(op);
+    chunk.write(operand);
+    adjustStack(op);
+}
+
+size_t BytecodeCompiler::emitJump(OpCode op) {
+    // Placeholder offset, fixed up by patchJump() once the target is known
+    emit(op, 0);
+    return chunk.code.size() - 1;
+}
+
+void BytecodeCompiler::patchJump(size_t operand) {
+    // Offsets are relative to the instruction following the jump
+    chunk.code[operand] = static_cast<int32_t>(chunk.code.size() - (operand + 1));
+}
+
+void BytecodeCompiler::emitLoop(size_t loopStart) {
+    // The jump lands relative to the end of its own two words
+    int32_t offset = static_cast<int32_t>(loopStart) -
+                     static_cast<int32_t>(chunk.code.size() + 2);
+    emit(OpCode::JUMP, offset);
+}
+
+void BytecodeCompiler::compileIf(const ASTNode& condition,
+                                 const std::vector<std::unique_ptr<ASTNode>>& body) {
+    condition.compile(*this);
+    size_t skipBody = emitJump(OpCode::JUMP_IF_FALSE);
+
+    for (const auto& stmt : body) {
+        stmt->compile(*this);
+    }
+    patchJump(skipBody);
+}
+
+void BytecodeCompiler::compileWhile(const ASTNode& condition,
+                                    const std::vector<std::unique_ptr<ASTNode>>& body) {
+    size_t loopStart = position();
+    condition.compile(*this);
+    size_t exitLoop = emitJump(OpCode::JUMP_IF_FALSE);
+
+    for (const auto& stmt : body) {
+        stmt->compile(*this);
+    }
+    emitLoop(loopStart);
+    patchJump(exitLoop);
+}
+
+void BytecodeCompiler::compileGuardedLoop(const ASTNode& condition,
+                                         const std::vector<std::unique_ptr<ASTNode>>& body,
+                                         const bool* proof, Chunk::BoundsGuard guard) {
+    int32_t index = static_cast<int32_t>(chunk.guards.size());
+    chunk.guards.push_back(std::move(guard));
+    chunk.write(OpCode::BOUNDS_GUARD);
+    chunk.write(index);
+    chunk.write(0);
+    size_t toChecked = chunk.code.size() - 1;
+
+    proving.push_back(proof);
+    compileWhile(condition, body);
+    proving.pop_back();
+    size_t toEnd = emitJump(OpCode::JUMP);
+
+    patchJump(toChecked);
+    compileWhile(condition, body);
+    patchJump(toEnd);
+}
+
+void BytecodeCompiler::emitArray(OpCode op, int32_t array, const std::string& name) {
+    nameArray(array, name);
+    emit(op, array);
+}
+
+void BytecodeCompiler::emitElement(OpCode checked, OpCode unchecked, const ElementAccess& access) {
+    bool proved = access.proven && std::find(proving.begin(), proving.end(), access.proven) != proving.end();
+    emitArray(proved ? unchecked : checked, access.slot, access.name);
+}
+
+void BytecodeCompiler::emitArrays(OpCode op, const std::vector<int>& arrays,
+                                  const std::vector<std::string>& arrayNames) {
+    chunk.write(op);
+    for (size_t i = 0; i < arrays.size(); i++) {
+        nameArray(arrays[i], arrayNames[i]);
+        chunk.write(arrays[i]);
+    }
+    adjustStack(op);
+}
+
+void BytecodeCompiler::emitLoad(int32_t slot, bool checked, const std::string& name) {
+    nameSlot(slot, name);
+    emit(checked ? OpCode::LOAD_CHECKED : OpCode::LOAD, slot);
+}
+
+void BytecodeCompiler::emitStore(int32_t slot, const std::string& name) {
+    nameSlot(slot, name);
+    emit(OpCode::STORE, slot);
+}
+
+// The arguments are on the stack; the call leaves the result in their place.
+// A loop compiled on its own knows no functions and gets index -1, which
+// the JIT never runs (it does not translate calls).
+void BytecodeCompiler::emitCall(const FunctionNode* function, size_t argumentCount) {
+    auto it = functionIndex.find(function);
+    emit(OpCode::CALL, it == functionIndex.end() ? -1 : it->second);
+    // Pops the arguments, then pushes the result like a CONST
+    stackDepth -= static_cast<int>(argumentCount);
+    adjustStack(OpCode::CONST);
+}
+
+// Record slot names as they are used, so a chunk compiled from part of a
+// program can still name its variables in error messages
+void BytecodeCompiler::nameSlot(int32_t slot, const std::string& name) {
+    if (static_cast<size_t>(slot) >= names->size()) {
+        names->resize(slot + 1);
+    }
+    (*names)[slot] = name;
+}
+
+void BytecodeCompiler::nameArray(int32_t array, const std::string& name) {
+    if (static_cast<size_t>(array) >= chunk.arrays.size()) {
+        chunk.arrays.resize(array + 1);
+    }
+    chunk.arrays[array] = name;
+}
+
+// Track how deep the value stack gets so the VM can allocate it up front
+void BytecodeCompiler::adjustStack(OpCode op) {
+    switch (op) {
+        case OpCode::CONST:
+        case OpCode::LOAD:
+        case OpCode::LOAD_CHECKED:
+        case OpCode::LENGTH:
+        case OpCode::SUM:
+        case OpCode::MIN:
+        case OpCode::MAX:
+            stackDepth++;
+            break;
+        case OpCode::STORE_ELEMENT:
+        case OpCode::STORE_ELEMENT_UNCHECKED:
+            stackDepth -= 2;
+            break;
+        case OpCode::STORE:
+        case OpCode::SUB:
+        case OpCode::GREATER:
+        case OpCode::LESS:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::PRINT:
+        case OpCode::RETURN:
+        case OpCode::POP:
+        case OpCode::NEW_ARRAY:
+        case OpCode::FILL:
+            stackDepth--;
+            break;
+        default:
+            break;
+    }
+    if (stackDepth > *maxStack) {
+        *maxStack = stackDepth;
+    }
+}
+
+// Node compilation methods
+
+void NumberNode::compile(BytecodeCompiler& compiler) const {
+    compiler.emit(OpCode::CONST, value);
+}
+
+void VariableNode::compile(BytecodeCompiler& compiler) const {
+    compiler.emitLoad(slot, checked, name);
+}
+
+void AssignmentNode::compile(BytecodeCompiler& compiler) const {
+    value->compile(compiler);
+    compiler.emitStore(slot, name);
+}
+
+void PrintNode::compile(BytecodeCompiler& compiler) const {
+    expression->compile(compiler);
+    compiler.emit(OpCode::PRINT);
+}
+
+void IfNode::compile(BytecodeCompiler& compiler) const {
+    compiler.compileIf(*condition, body);
+}
+
+void WhileNode::compile(BytecodeCompiler& compiler) const {
+    compiler.compileWhile(*condition, body);
+}
+
+void ComparisonNode::compile(BytecodeCompiler& compiler) const {
+    left->compile(compiler);
+    right->compile(compiler);
+    compiler.emit(op == Op::Greater ? OpCode::GREATER : OpCode::LESS);
+}
+
+void SubtractionNode::compile(BytecodeCompiler& compiler) const {
+    left->compile(compiler);
+    right->compile(compiler);
+    compiler.emit(OpCode::SUB);
+}
+
+// A definition has no code where it stands; compile() adds the body after HALT
+void FunctionNode::compile(BytecodeCompiler& compiler) const {}
+
+void CallNode::compile(BytecodeCompiler& compiler) const {
+    for (const auto& argument : arguments) {
+        argument->compile(compiler);
+    }
+    compiler.emitCall(function, arguments.size());
+    if (statement) {
+        compiler.emit(OpCode::POP);
+    }
+}
+
+void NewArrayNode::compile(BytecodeCompiler& compiler) const {
+    length->compile(compiler);
+    compiler.emitArray(OpCode::NEW_ARRAY, slot, name);
+}
+
+void ElementNode::compile(BytecodeCompiler& compiler) const {
+    access.index->compile(compiler);
+    compiler.emitElement(OpCode::LOAD_ELEMENT, OpCode::LOAD_ELEMENT_UNCHECKED, access);
+}
+
+void ElementAssignmentNode::compile(BytecodeCompiler& compiler) const {
+    access.index->compile(compiler);
+    value->compile(compiler);
+    compiler.emitElement(OpCode::STORE_ELEMENT, OpCode::STORE_ELEMENT_UNCHECKED, access);
+}
+
+void BuiltinNode::compile(BytecodeCompiler& compiler) const {
+    if (value) {
+        value->compile(compiler);
+    }
+    switch (signature.kind) {
+        case Kind::Length: compiler.emitArray(OpCode::LENGTH, slots[0], arrays[0]); break;
+        case Kind::Fill: compiler.emitArray(OpCode::FILL, slots[0], arrays[0]); break;
+        case Kind::Sum: compiler.emitArray(OpCode::SUM, slots[0], arrays[0]); break;
+        case Kind::Min: compiler.emitArray(OpCode::MIN, slots[0], arrays[0]); break;
+        case Kind::Max: compiler.emitArray(OpCode::MAX, slots[0], arrays[0]); break;
+        case Kind::Add: compiler.emitArrays(OpCode::ADD_ARRAYS, slots, arrays); break;
+        case Kind::Subtract: compiler.emitArrays(OpCode::SUB_ARRAYS, slots, arrays); break;
+        case Kind::Above: compiler.emitArray(OpCode::COUNT_ABOVE, slots[0], arrays[0]); break;
+        case Kind::Below: compiler.emitArray(OpCode::COUNT_BELOW, slots[0], arrays[0]); break;
+    }
+    if (statement && signature.returns) {
+        compiler.emit(OpCode::POP);
+    }
+}
@@ -0,0 +1,416 @@
+#include "constant.hpp"
+#include "optimize.hpp"
+
+static std::unique_ptr<ASTNode> located(std::unique_ptr<ASTNode> node, int line) {
+    node->setLine(line);
+    return node;
+}
+
+// The value of a condition comparing two constants, if it is one
+static bool constantCondition(const ASTNode& condition, bool& value) {
+    auto* comparison = dynamic_cast<const ComparisonNode*>(&condition);
+    if (!comparison) return false;
+    auto* left = dynamic_cast<const NumberNode*>(comparison->getLeft());
+    auto* right = dynamic_cast<const NumberNode*>(comparison->getRight());
+    if (!left || !right) return false;
+    value = comparison->getOp() == ComparisonNode::Op::Greater ? left->getValue() > right->getValue()
+                                                               : left->getValue() < right->getValue();
+    return true;
+}
+
+static long countNodes(const ASTNode& node);
+
+static long countBlock(const std::vector<std::unique_ptr<ASTNode>>& body) {
+    long count = 0;
+    for (const auto& stmt : body) {
+        count += countNodes(*stmt);
+    }
+    return count;
+}
+
+static long countNodes(const ASTNode& node) {
+    if (auto* assignment = dynamic_cast<const AssignmentNode*>(&node)) {
+        return 1 + countNodes(*assignment->getValue());
+    }
+    if (auto* print = dynamic_cast<const PrintNode*>(&node)) {
+        return 1 + countNodes(*print->getExpression());
+    }
+    if (auto* branch = dynamic_cast<const IfNode*>(&node)) {
+        return 1 + countNodes(*branch->getCondition()) + countBlock(branch->getBody());
+    }
+    if (auto* loop = dynamic_cast<const WhileNode*>(&node)) {
+        return 1 + countNodes(*loop->getCondition()) + countBlock(loop->getBody());
+    }
+    if (auto* comparison = dynamic_cast<const ComparisonNode*>(&node)) {
+        return 1 + countNodes(*comparison->getLeft()) + countNodes(*comparison->getRight());
+    }
+    if (auto* subtraction = dynamic_cast<const SubtractionNode*>(&node)) {
+        return 1 + countNodes(*subtraction->getLeft()) + countNodes(*subtraction->getRight());
+    }
+    if (auto* function = dynamic_cast<const FunctionNode*>(&node)) {
+        long result = function->getResult() ? countNodes(*function->getResult()) : 0;
+        return 1 + countBlock(function->getBody()) + result;
+    }
+    if (auto* call = dynamic_cast<const CallNode*>(&node)) {
+        return 1 + countBlock(call->getArguments());
+    }
+    if (auto* array = dynamic_cast<const NewArrayNode*>(&node)) {
+        return 1 + countNodes(*array->getLength());
+    }
+    if (auto* element = dynamic_cast<const ElementNode*>(&node)) {
+        return 1 + countNodes(*element->getAccess().index);
+    }
+    if (auto* store = dynamic_cast<const ElementAssignmentNode*>(&node)) {
+        return 1 + countNodes(*store->getAccess().index) + countNodes(*store->getValue());
+    }
+    if (auto* builtin = dynamic_cast<const BuiltinNode*>(&node)) {
+        return 1 + (builtin->getValue() ? countNodes(*builtin->getValue()) : 0);
+    }
+    return 1;
+}
+
+void ConstantFolder::fold(std::vector<std::unique_ptr<ASTNode>>& program) {
+    nodesBefore = countBlock(program);
+
+    constants.clear();
+    foldBlock(program);
+
+    // Nothing is read after the last statement
+    live.clear();
+    removing = true;
+    sweepBlock(program);
+
+    nodesAfter = countBlock(program);
+}
+
+// Forward pass
+
+void ConstantFolder::foldBlock(std::vector<std::unique_ptr<ASTNode>>& body) {
+    std::vector<std::unique_ptr<ASTNode>> folded;
+    folded.reserve(body.size());
+    for (auto& stmt : body) {
+        auto result = stmt->fold(*this);
+        if (replacing) {
+            replacing = false;
+            for (auto& inlined : replacement) {
+                folded.push_back(std::move(inlined));
+            }
+            replacement.clear();
+            continue;
+        }
+        folded.push_back(result ? std::move(result) : std::move(stmt));
+    }
+    body = std::move(folded);
+}
+
+void ConstantFolder::foldExpression(std::unique_ptr<ASTNode>& expression) {
+    if (auto result = expression->fold(*this)) {
+        expression = std::move(result);
+    }
+}
+
+std::unique_ptr<ASTNode> ConstantFolder::foldRead(int slot, int line) {
+    auto it = constants.find(slot);
+    if (it == constants.end()) return nullptr;
+    propagated++;
+    return located(std::make_unique<NumberNode>(it->second), line);
+}
+
+void ConstantFolder::foldAssignment(int slot, const ASTNode& value) {
+    if (auto* number = dynamic_cast<const NumberNode*>(&value)) {
+        constants[slot] = number->getValue();
+    } else {
+        constants.erase(slot);
+    }
+}
+
+void ConstantFolder::foldIf(std::unique_ptr<ASTNode>& condition,
+                            std::vector<std::unique_ptr<ASTNode>>& body) {
+    foldExpression(condition);
+
+    bool taken;
+    if (constantCondition(*condition, taken)) {
+        if (taken) {
+            // The body always runs, so what it assigns is known afterwards too
+            foldBlock(body);
+            inlinedBranches++;
+            replace(std::move(body));
+        } else {
+            removedBranches++;
+            replace({});
+        }
+        return;
+    }
+
+    // Keep what holds whether or not the body ran
+    auto before = constants;
+    foldBlock(body);
+    for (auto it = before.begin(); it != before.end();) {
+        auto after = constants.find(it->first);
+        if (after == constants.end() || after->second != it->second) {
+            it = before.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    constants = std::move(before);
+}
+
+void ConstantFolder::foldLoop(std::unique_ptr<ASTNode>& condition,
+                              std::vector<std::unique_ptr<ASTNode>>& body) {
+    // A slot the loop assigns may hold any of its values at the condition
+    VariableUses uses;
+    condition->collectUses(uses);
+    uses.block(body);
+    for (const auto& write : uses.writes) {
+        constants.erase(write.first);
+    }
+
+    foldExpression(condition);
+
+    bool taken;
+    if (constantCondition(*condition, taken) && !taken) {
+        removedLoops++;
+        replace({});
+        return;
+    }
+
+    // The body may run any number of times, so it leaves nothing behind
+    auto entry = constants;
+    foldBlock(body);
+    constants = std::move(entry);
+}
+
+void ConstantFolder::foldFunction(std::vector<std::unique_ptr<ASTNode>>& body,
+                                  std::unique_ptr<ASTNode>& result) {
+    // The frame is new: nothing is known on entry, and after the body only
+    // the result is read
+    auto outerConstants = std::move(constants);
+    auto outerLive = std::move(live);
+    bool outerRemoving = removing;
+
+    constants.clear();
+    foldBlock(body);
+    if (result) {
+        foldExpression(result);
+    }
+    live.clear();
+    if (result) {
+        markRead(*result);
+    }
+    removing = true;
+    sweepBlock(body);
+
+    constants = std::move(outerConstants);
+    live = std::move(outerLive);
+    removing = outerRemoving;
+}
+
+void ConstantFolder::forget(const ASTNode& statement) {
+    VariableUses uses;
+    statement.collectUses(uses);
+    for (const auto& write : uses.writes) {
+        constants.erase(write.first);
+    }
+}
+
+void ConstantFolder::replace(std::vector<std::unique_ptr<ASTNode>> statements) {
+    replacing = true;
+    replacement = std::move(statements);
+}
+
+// Backward pass
+
+void ConstantFolder::sweepBlock(std::vector<std::unique_ptr<ASTNode>>& body) {
+    // Statements are only marked here and dropped in one go at the end, since
+    // erasing them one by one is quadratic in the length of the block
+    std::vector<bool> dropped(body.size());
+    size_t dropCount = 0;
+    for (size_t i = body.size(); i-- > 0;) {
+        ASTNode& stmt = *body[i];
+
+        if (auto* assignment = dynamic_cast<AssignmentNode*>(&stmt)) {
+            VariableUses value;
+            assignment->getValue()->collectUses(value);
+            if (!live.count(assignment->getSlot()) && !value.checkedReads) {
+                // Nothing sees the value, and computing it cannot fail
+                if (removing) {
+                    dropped[i] = true;
+                    dropCount++;
+                    removedStores++;
+                }
+                continue;
+            }
+            live.erase(assignment->getSlot());
+            live.insert(value.reads.begin(), value.reads.end());
+            continue;
+        }
+
+        stmt.removeDeadStores(*this);
+
+        // An if left without a body only evaluates its condition
+        auto* branch = dynamic_cast<IfNode*>(&stmt);
+        if (removing && branch && branch->getBody().empty()) {
+            VariableUses condition;
+            branch->getCondition()->collectUses(condition);
+            if (!condition.checkedReads) {
+                dropped[i] = true;
+                dropCount++;
+                removedBranches++;
+            }
+        }
+    }
+
+    if (dropCount == 0) return;
+    size_t kept = 0;
+    for (size_t i = 0; i < body.size(); i++) {
+        if (!dropped[i]) body[kept++] = std::move(body[i]);
+    }
+    body.resize(kept);
+}
+
+void ConstantFolder::sweepIf(const ASTNode& condition, std::vector<std::unique_ptr<ASTNode>>& body) {
+    // Live after the if: live after the body, or right away if it is skipped
+    auto after = live;
+    sweepBlock(body);
+    live.insert(after.begin(), after.end());
+    markRead(condition);
+}
+
+void ConstantFolder::sweepLoop(const ASTNode& condition, std::vector<std::unique_ptr<ASTNode>>& body) {
+    // Live at the condition: live after the loop, read by the condition, or
+    // live at the top of the body. The body leads back to the condition, so
+    // grow the set until it stops changing before removing anything.
+    auto after = live;
+    std::unordered_set<int> head = after;
+    VariableUses uses;
+    condition.collectUses(uses);
+    head.insert(uses.reads.begin(), uses.reads.end());
+
+    bool wasRemoving = removing;
+    removing = false;
+    while (true) {
+        live = head;
+        sweepBlock(body);
+        size_t size = head.size();
+        head.insert(live.begin(), live.end());
+        if (head.size() == size) break;
+    }
+    removing = wasRemoving;
+
+    live = head;
+    sweepBlock(body);
+    live = std::move(head);
+}
+
+void ConstantFolder::markRead(const ASTNode& node) {
+    VariableUses uses;
+    node.collectUses(uses);
+    live.insert(uses.reads.begin(), uses.reads.end());
+}
+
+// Per-node folding: reads become constants, subtractions of constants are
+// computed, and ifs and whiles hand their condition and body to the folder
+
+std::unique_ptr<ASTNode> ASTNode::fold(ConstantFolder& folder) {
+    folder.forget(*this);
+    return nullptr;
+}
+
+void ASTNode::removeDeadStores(ConstantFolder& folder) {
+    folder.markRead(*this);
+}
+
+std::unique_ptr<ASTNode> NumberNode::fold(ConstantFolder& folder) {
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> VariableNode::fold(ConstantFolder& folder) {
+    return folder.foldRead(slot, getLine());
+}
+
+std::unique_ptr<ASTNode> AssignmentNode::fold(ConstantFolder& folder) {
+    folder.foldExpression(value);
+    folder.foldAssignment(slot, *value);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> PrintNode::fold(ConstantFolder& folder) {
+    folder.foldExpression(expression);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> IfNode::fold(ConstantFolder& folder) {
+    folder.foldIf(condition, body);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> WhileNode::fold(ConstantFolder& folder) {
+    folder.foldLoop(condition, body);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> FunctionNode::fold(ConstantFolder& folder) {
+    folder.foldFunction(body, result);
+    return nullptr;
+}
+
+// The callee cannot see the caller's frame, so what is known about it still holds
+std::unique_ptr<ASTNode> CallNode::fold(ConstantFolder& folder) {
+    for (auto& argument : arguments) {
+        folder.foldExpression(argument);
+    }
+    return nullptr;
+}
+
+// Elements are not tracked: only the indices and values are folded
+std::unique_ptr<ASTNode> NewArrayNode::fold(ConstantFolder& folder) {
+    folder.foldExpression(length);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> ElementNode::fold(ConstantFolder& folder) {
+    folder.foldExpression(access.index);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> ElementAssignmentNode::fold(ConstantFolder& folder) {
+    folder.foldExpression(access.index);
+    folder.foldExpression(value);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> BuiltinNode::fold(ConstantFolder& folder) {
+    if (value) {
+        folder.foldExpression(value);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> ComparisonNode::fold(ConstantFolder& folder) {
+    // Comparisons only appear as conditions; foldIf() and foldLoop() decide them
+    folder.foldExpression(left);
+    folder.foldExpression(right);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> SubtractionNode::fold(ConstantFolder& folder) {
+    folder.foldExpression(left);
+    folder.foldExpression(right);
+    auto* l = dynamic_cast<const NumberNode*>(left.get());
+    auto* r = dynamic_cast<const NumberNode*>(right.get());
+    if (!l || !r) return nullptr;
+
+    folder.foldedExpressions++;
+    // Wraps around like the engines do
+    int value = static_cast<int>(static_cast<unsigned>(l->getValue()) - static_cast<unsigned>(r->getValue()));
+    return located(std::make_unique<NumberNode>(value), getLine());
+}
+
+void IfNode::removeDeadStores(ConstantFolder& folder) {
+    folder.sweepIf(*condition, body);
+}
+
+void WhileNode::removeDeadStores(ConstantFolder& folder) {
+    folder.sweepLoop(*condition, body);
+}
@@ -0,0 +1,326 @@
+#include "flat.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include <stdexcept>
+
+// Building
+
+void FlatProgram::reserve(size_t nodeCount) {
+    nodes.reserve(nodeCount);
+    statements.reserve(nodeCount);
+}
+
+uint32_t FlatProgram::add(FlatKind kind, int32_t a, uint32_t b, uint32_t c) {
+    nodes.push_back({kind, a, b, c});
+    return static_cast<uint32_t>(nodes.size() - 1);
+}
+
+void FlatProgram::closeBlock(size_t mark, uint32_t& begin, uint32_t& end) {
+    begin = static_cast<uint32_t>(statements.size());
+    statements.insert(statements.end(), pending.begin() + mark, pending.end());
+    end = static_cast<uint32_t>(statements.size());
+    pending.resize(mark);
+}
+
+void FlatProgram::finish(const SymbolTable& table) {
+    closeBlock(0, topBegin, topEnd);
+    pending = std::vector<uint32_t>();
+
+    // Give back what the reservation overestimated
+    nodes.shrink_to_fit();
+    statements.shrink_to_fit();
+
+    symbols.reserve(table.size());
+    for (size_t id = 0; id < table.size(); id++) {
+        symbols.emplace_back(table.name(static_cast<int>(id)));
+    }
+}
+
+size_t FlatProgram::memoryBytes() const {
+    return nodes.capacity() * sizeof(FlatNode) + statements.capacity() * sizeof(uint32_t);
+}
+
+// Parsing: the same grammar as the methods in parser.cpp
+
+FlatProgram Parser::parseFlat() {
+    FlatProgram program;
+    // Every node consumes at least one token, so this is never exceeded
+    program.reserve(tokens.size());
+
+    while (!isAtEnd() && peek() != TokenType::END) {
+        if (match(TokenType::EOL)) continue;
+        program.addStatement(flatStatement(program));
+        match(TokenType::EOL);
+    }
+
+    program.finish(tokens.symbols);
+    return program;
+}
+
+static const char* flatFunctions = "Functions are not supported by --flat and --image";
+static const char* flatArrays = "Arrays are not supported by --flat and --image";
+
+uint32_t Parser::flatStatement(FlatProgram& program) {
+    if (checkBuiltin() || checkElement()) {
+        throw std::runtime_error(flatArrays);
+    }
+    if (check(TokenType::DEF) || checkCall()) {
+        throw std::runtime_error(flatFunctions);
+    }
+    if (match(TokenType::IF)) {
+        return flatLoopOrIf(program, false);
+    }
+    if (match(TokenType::WHILE)) {
+        return flatLoopOrIf(program, true);
+    }
+    if (match(TokenType::PRINT)) {
+        return program.add(FlatKind::Print, 0, flatExpression(program));
+    }
+    return flatAssignment(program);
+}
+
+uint32_t Parser::flatAssignment(FlatProgram& program) {
+    size_t name = consume(TokenType::IDENTIFIER, "Expected variable name.");
+    consume(TokenType::EQUALS, "Expected '=' after variable name.");
+
+    uint32_t value = flatExpression(program);
+    return program.add(FlatKind::Assign, tokens.payloads[name], value);
+}
+
+uint32_t Parser::flatLoopOrIf(FlatProgram& program, bool loop) {
+    int indent = tokens.columns[current - 1];
+
+    uint32_t condition = flatComparison(program);
+    consume(TokenType::EOL, "Expected newline after condition.");
+
+    uint32_t begin, end;
+    flatBlock(program, indent, begin, end);
+
+    return program.add(loop ? FlatKind::While : FlatKind::If,
+                       static_cast<int32_t>(condition), begin, end);
+}
+
+uint32_t Parser::flatExpression(FlatProgram& program) {
+    uint32_t expr = flatPrimary(program);
+
+    while (match(TokenType::MINUS)) {
+        uint32_t right = flatPrimary(program);
+        expr = program.add(FlatKind::Subtract, 0, expr, right);
+    }
+
+    return expr;
+}
+
+uint32_t Parser::flatPrimary(FlatProgram& program) {
+    if (match(TokenType::NUMBER)) {
+        return program.add(FlatKind::Number, tokens.payloads[current - 1]);
+    }
+
+    if (checkBuiltin() || checkElement()) {
+        throw std::runtime_error(flatArrays);
+    }
+    if (checkCall()) {
+        throw std::runtime_error(flatFunctions);
+    }
+    if (match(TokenType::IDENTIFIER)) {
+        return program.add(FlatKind::LoadChecked, tokens.payloads[current - 1]);
+    }
+
+    throw std::runtime_error("Expected expression.");
+}
+
+uint32_t Parser::flatComparison(FlatProgram& program) {
+    uint32_t left = flatExpression(program);
+
+    if (match(TokenType::GREATER)) {
+        return program.add(FlatKind::Greater, 0, left, flatExpression(program));
+    }
+
+    if (match(TokenType::LESS)) {
+        return program.add(FlatKind::Less, 0, left, flatExpression(program));
+    }
+
+    throw std::runtime_error("Expected comparison operator.");
+}
+
+void Parser::flatBlock(FlatProgram& program, int indent, uint32_t& begin, uint32_t& end) {
+    size_t mark = program.openBlock();
+
+    while (!isAtEnd() && peek() != TokenType::END) {
+        if (match(TokenType::EOL)) continue;
+
+        if (peekColumn() <= indent) {
+            break;
+        }
+
+        program.addStatement(flatStatement(program));
+        match(TokenType::EOL);
+    }
+
+    if (program.openBlock() == mark) {
+        throw std::runtime_error("Expected at least one statement in block.");
+    }
+
+    program.closeBlock(mark, begin, end);
+}
+
+// Resolution: mirrors the nodes' resolve() methods in resolver.cpp.
+// Each node is resolved for real exactly once, after any discovery walks
+// over it, so Load and Assign can swap their symbol id for a slot in place.
+
+void FlatProgram::resolve(Resolver& resolver) {
+    resolveBlock(topBegin, topEnd, resolver);
+
+    nameOffsets.clear();
+    namePool.clear();
+    for (const auto& name : resolver.slotNames()) {
+        nameOffsets.push_back(static_cast<uint32_t>(namePool.size()));
+        namePool += name;
+        namePool += '\0';
+    }
+}
+
+void FlatProgram::resolveBlock(uint32_t begin, uint32_t end, Resolver& resolver) {
+    for (uint32_t i = begin; i < end; i++) {
+        resolveNode(statements[i], resolver);
+    }
+}
+
+void FlatProgram::resolveNode(uint32_t index, Resolver& resolver) {
+    FlatNode& node = nodes[index];
+    switch (node.kind) {
+        case FlatKind::Number:
+            break;
+        case FlatKind::Load:
+        case FlatKind::LoadChecked: {
+            int slot = node.a;
+            bool checked = true;
+            resolver.resolveRead(symbols[node.a], slot, checked);
+            if (!resolver.discovering()) {
+                node.a = slot;
+                node.kind = checked ? FlatKind::LoadChecked : FlatKind::Load;
+            }
+            break;
+        }
+        case FlatKind::Subtract:
+        case FlatKind::Greater:
+        case FlatKind::Less:
+            resolveNode(node.b, resolver);
+            resolveNode(node.c, resolver);
+            break;
+        case FlatKind::Assign: {
+            resolveNode(node.b, resolver);
+            const std::string& name = symbols[node.a];
+            int slot = resolver.discovering() ? node.a : resolver.slotFor(name);
+            resolver.markAssigned(name);
+            node.a = slot;
+            break;
+        }
+        case FlatKind::Print:
+            resolveNode(node.b, resolver);
+            break;
+        case FlatKind::While: {
+            // As in Resolver::resolveLoop(): record the loop's assignments first
+            Resolver::Discovery discovery(resolver);
+            resolveNode(node.a, resolver);
+            resolveBlock(node.b, node.c, resolver);
+        }
+            // Then resolve it like an if
+            [[fallthrough]];
+        case FlatKind::If: {
+            resolveNode(node.a, resolver);
+            auto before = resolver.saveDefinite();
+            resolveBlock(node.b, node.c, resolver);
+            resolver.restoreDefinite(std::move(before));
+            break;
+        }
+    }
+}
+
+// Execution
+
+namespace {
+
+// The walker keeps raw pointers to the arrays so the hot loop reloads nothing.
+// Most operands are numbers and variables, so those are read in place and
+// only nested expressions pay for a recursive call.
+struct FlatWalker {
+    const FlatNode* nodes;
+    const uint32_t* statements;
+    const uint32_t* nameOffsets;
+    const char* namePool;
+    Environment& env;
+
+    int operand(uint32_t index) {
+        const FlatNode& node = nodes[index];
+        switch (node.kind) {
+            case FlatKind::Number:
+                return node.a;
+            case FlatKind::Load:
+                return env.get(node.a);
+            case FlatKind::LoadChecked:
+                if (!env.isDefined(node.a)) undefined(node.a);
+                return env.get(node.a);
+            default:
+                return evaluate(node);
+        }
+    }
+
+    int evaluate(const FlatNode& node) {
+        int l = operand(node.b);
+        int r = operand(node.c);
+        switch (node.kind) {
+            case FlatKind::Subtract:
+                return l - r;
+            case FlatKind::Greater:
+                return l > r;
+            default:
+                return l < r;
+        }
+    }
+
+    [[noreturn]] void undefined(int slot) {
+        throw std::runtime_error(std::string("Undefined variable: ") + (namePool + nameOffsets[slot]));
+    }
+
+    void execute(uint32_t index) {
+        const FlatNode& node = nodes[index];
+        switch (node.kind) {
+            case FlatKind::Assign:
+                env.set(node.a, operand(node.b));
+                break;
+            case FlatKind::Print:
+                env.out->print(operand(node.b));
+                break;
+            case FlatKind::If:
+                if (evaluate(nodes[node.a])) {
+                    executeBlock(node.b, node.c);
+                }
+                break;
+            case FlatKind::While:
+                while (evaluate(nodes[node.a])) {
+                    executeBlock(node.b, node.c);
+                }
+                break;
+            default:
+                break;  // Expressions only appear inside statements
+        }
+    }
+
+    void executeBlock(uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++) {
+            execute(statements[i]);
+        }
+    }
+};
+
+} // namespace
+
+FlatView FlatProgram::view() const {
+    return {nodes.data(), statements.data(), topBegin, topEnd, nameOffsets.data(), namePool.data()};
+}
+
+void runFlat(const FlatView& program, Environment& env) {
+    FlatWalker walker{program.nodes, program.statements, program.nameOffsets, program.namePool, env};
+    walker.executeBlock(program.topBegin, program.topEnd);
+}
@@ -0,0 +1,345 @@
+#include "image.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "alloc.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+uint64_t hashBytes(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, sizeof(word));
+        hash ^= word;
+        hash *= 0x100000001b3ULL;
+    }
+    for (; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+namespace {
+
+// The program with identical subtrees stored once. The walker never writes
+// to nodes, so sharing them is safe; generated scripts repeat the same
+// statements over and over and shrink to a fraction of their size.
+struct CompactProgram {
+    std::vector<FlatNode> nodes;
+    std::vector<uint32_t> statements;
+    uint32_t topBegin = 0;
+    uint32_t topEnd = 0;
+};
+
+struct NodeKey {
+    FlatKind kind;
+    int32_t a;
+    uint32_t b;
+    uint32_t c;
+    bool operator==(const NodeKey& other) const {
+        return kind == other.kind && a == other.a && b == other.b && c == other.c;
+    }
+};
+
+struct NodeKeyHash {
+    size_t operator()(const NodeKey& key) const {
+        uint32_t fields[4] = {uint32_t(key.kind), uint32_t(key.a), key.b, key.c};
+        return hashBytes(fields, sizeof(fields));
+    }
+};
+
+struct BlockHash {
+    size_t operator()(const std::vector<uint32_t>& block) const {
+        return hashBytes(block.data(), block.size() * sizeof(uint32_t));
+    }
+};
+
+class Compactor {
+public:
+    Compactor(const FlatView& view, size_t nodeCount)
+        : view(view), nodeCount(nodeCount), remap(nodeCount) {}
+
+    CompactProgram run() {
+        // Children come before parents, so one pass in index order sees every child first
+        for (uint32_t i = 0; i < nodeCount; i++) {
+            FlatNode node = view.nodes[i];
+            switch (node.kind) {
+                case FlatKind::Subtract:
+                case FlatKind::Greater:
+                case FlatKind::Less:
+                    node.b = remap[node.b];
+                    node.c = remap[node.c];
+                    break;
+                case FlatKind::Assign:
+                case FlatKind::Print:
+                    node.b = remap[node.b];
+                    break;
+                case FlatKind::If:
+                case FlatKind::While:
+                    node.a = static_cast<int32_t>(remap[node.a]);
+                    block(node.b, node.c);
+                    break;
+                default:
+                    break;
+            }
+            NodeKey key{node.kind, node.a, node.b, node.c};
+            auto found = nodes.find(key);
+            if (found == nodes.end()) {
+                found = nodes.emplace(key, static_cast<uint32_t>(result.nodes.size())).first;
+                result.nodes.push_back(node);
+            }
+            remap[i] = found->second;
+        }
+        result.topBegin = view.topBegin;
+        result.topEnd = view.topEnd;
+        block(result.topBegin, result.topEnd);
+        return std::move(result);
+    }
+
+private:
+    const FlatView& view;
+    size_t nodeCount;
+    std::vector<uint32_t> remap;  // Old node index -> compacted index
+    std::unordered_map<NodeKey, uint32_t, NodeKeyHash> nodes;
+    std::unordered_map<std::vector<uint32_t>, uint32_t, BlockHash> blocks;  // -> start
+    CompactProgram result;
+
+    // Rewrite the range begin..end of the old statements into the compacted ones
+    void block(uint32_t& begin, uint32_t& end) {
+        std::vector<uint32_t> statements;
+        for (uint32_t i = begin; i < end; i++) {
+            statements.push_back(remap[view.statements[i]]);
+        }
+        auto found = blocks.find(statements);
+        if (found == blocks.end()) {
+            uint32_t start = static_cast<uint32_t>(result.statements.size());
+            result.statements.insert(result.statements.end(), statements.begin(), statements.end());
+            found = blocks.emplace(std::move(statements), start).first;
+        }
+        end = found->second + (end - begin);
+        begin = found->second;
+    }
+};
+
+} // namespace
+
+void writeImage(const std::string& path, const FlatProgram& program, uint64_t sourceHash) {
+    FlatView source = program.view();
+    CompactProgram compact = Compactor(source, program.nodeCount()).run();
+    FlatView view = source;
+    view.nodes = compact.nodes.data();
+    view.statements = compact.statements.data();
+    view.topBegin = compact.topBegin;
+    view.topEnd = compact.topEnd;
+
+    ImageHeader header = {};
+    std::memcpy(header.magic, ImageFormat::magic, sizeof(header.magic));
+    header.version = ImageFormat::version;
+    header.nodeCount = static_cast<uint32_t>(compact.nodes.size());
+    header.sourceHash = sourceHash;
+    header.statementCount = static_cast<uint32_t>(compact.statements.size());
+    header.topBegin = view.topBegin;
+    header.topEnd = view.topEnd;
+    header.slotCount = static_cast<uint32_t>(program.slotCount());
+    header.namePoolSize = static_cast<uint32_t>(program.namePoolSize());
+
+    // Lay out the body exactly as it will sit in the file, then hash it
+    size_t nodeBytes = header.nodeCount * sizeof(FlatNode);
+    size_t statementBytes = header.statementCount * sizeof(uint32_t);
+    size_t offsetBytes = header.slotCount * sizeof(uint32_t);
+    std::vector<unsigned char> body(nodeBytes + statementBytes + offsetBytes + header.namePoolSize, 0);
+    unsigned char* out = body.data();
+    for (uint32_t i = 0; i < header.nodeCount; i++) {
+        // Field by field, so the padding after kind is written as zeros
+        const FlatNode& node = view.nodes[i];
+        std::memcpy(out + offsetof(FlatNode, kind), &node.kind, sizeof(node.kind));
+        std::memcpy(out + offsetof(FlatNode, a), &node.a, sizeof(node.a));
+        std::memcpy(out + offsetof(FlatNode, b), &node.b, sizeof(node.b));
+        std::memcpy(out + offsetof(FlatNode, c), &node.c, sizeof(node.c));
+        out += sizeof(FlatNode);
+    }
+    auto place = [&out](const void* src, size_t bytes) {
+        if (bytes) std::memcpy(out, src, bytes);
+        out += bytes;
+    };
+    place(view.statements, statementBytes);
+    place(view.nameOffsets, offsetBytes);
+    place(view.namePool, header.namePoolSize);
+    header.contentHash = hashBytes(body.data(), body.size());
+
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Cannot create program image: " + path);
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(body.data()), body.size());
+        if (!file) {
+            throw std::runtime_error("Cannot write program image: " + path);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot replace program image: " + path);
+    }
+}
+
+std::unique_ptr<ProgramImage> ProgramImage::load(const std::string& path, uint64_t sourceHash) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return nullptr;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(ImageHeader))) {
+        close(fd);
+        return nullptr;
+    }
+    size_t length = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) return nullptr;
+
+    std::unique_ptr<ProgramImage> image(new ProgramImage(mapping, length));
+    if (image->header->sourceHash != sourceHash || !image->validate()) return nullptr;
+    return image;
+}
+
+ProgramImage::ProgramImage(void* data, size_t length)
+    : data(data), length(length), header(static_cast<const ImageHeader*>(data)) {
+    const unsigned char* base = static_cast<const unsigned char*>(data) + sizeof(ImageHeader);
+    program.nodes = reinterpret_cast<const FlatNode*>(base);
+    // The counts are only trusted once validate() has checked them against the length
+    program.statements = nullptr;
+    program.nameOffsets = nullptr;
+    program.namePool = nullptr;
+    program.topBegin = program.topEnd = 0;
+}
+
+ProgramImage::~ProgramImage() {
+    munmap(data, length);
+}
+
+// Checked once at load time, so the walker can trust every index
+bool ProgramImage::validate() {
+    const ImageHeader& h = *header;
+    if (std::memcmp(h.magic, ImageFormat::magic, sizeof(h.magic)) != 0 ||
+        h.version != ImageFormat::version) {
+        return false;
+    }
+
+    // The arrays must follow each other and end exactly at the end of the file
+    uint64_t expected = sizeof(ImageHeader) + uint64_t(h.nodeCount) * sizeof(FlatNode) +
+                        uint64_t(h.statementCount) * sizeof(uint32_t) +
+                        uint64_t(h.slotCount) * sizeof(uint32_t) + h.namePoolSize;
+    if (expected != length) return false;
+
+    const unsigned char* base = static_cast<const unsigned char*>(data);
+    if (hashBytes(base + sizeof(ImageHeader), length - sizeof(ImageHeader)) != h.contentHash) {
+        return false;
+    }
+
+    FlatView& view = program;
+    view.statements = reinterpret_cast<const uint32_t*>(view.nodes + h.nodeCount);
+    view.nameOffsets = view.statements + h.statementCount;
+    view.namePool = reinterpret_cast<const char*>(view.nameOffsets + h.slotCount);
+    view.topBegin = h.topBegin;
+    view.topEnd = h.topEnd;
+
+    // Names start inside the pool, and the pool ends with a NUL
+    if (h.slotCount > 0 && (h.namePoolSize == 0 || view.namePool[h.namePoolSize - 1] != '\0')) {
+        return false;
+    }
+    for (uint32_t slot = 0; slot < h.slotCount; slot++) {
+        if (view.nameOffsets[slot] >= h.namePoolSize) return false;
+    }
+
+    // Every reference must point at a node of the right sort, and children
+    // always come before their parents, which also rules out cycles
+    auto expression = [&](uint32_t index, uint32_t parent) {
+        return index < parent && view.nodes[index].kind <= FlatKind::Less;
+    };
+    auto condition = [&](uint32_t index, uint32_t parent) {
+        return index < parent && (view.nodes[index].kind == FlatKind::Greater ||
+                                  view.nodes[index].kind == FlatKind::Less);
+    };
+    auto block = [&](uint32_t begin, uint32_t end, uint32_t parent) {
+        if (begin > end || end > h.statementCount) return false;
+        for (uint32_t i = begin; i < end; i++) {
+            if (view.statements[i] >= parent || view.nodes[view.statements[i]].kind < FlatKind::Assign) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    if (!block(h.topBegin, h.topEnd, h.nodeCount)) return false;
+    for (uint32_t i = 0; i < h.nodeCount; i++) {
+        const FlatNode& node = view.nodes[i];
+        uint32_t a = static_cast<uint32_t>(node.a);
+        bool valid = false;
+        switch (node.kind) {
+            case FlatKind::Number:
+                valid = true;
+                break;
+            case FlatKind::Load:
+            case FlatKind::LoadChecked:
+                valid = a < h.slotCount;
+                break;
+            case FlatKind::Subtract:
+            case FlatKind::Greater:
+            case FlatKind::Less:
+                valid = expression(node.b, i) && expression(node.c, i);
+                break;
+            case FlatKind::Assign:
+                valid = a < h.slotCount && expression(node.b, i);
+                break;
+            case FlatKind::Print:
+                valid = expression(node.b, i);
+                break;
+            case FlatKind::If:
+            case FlatKind::While:
+                valid = condition(a, i) && block(node.b, node.c, i);
+                break;
+        }
+        if (!valid) return false;
+    }
+    return true;
+}
+
+bool runWithImage(const std::string& source, const std::string& imagePath, Environment& env) {
+    uint64_t sourceHash = hashBytes(source.data(), source.size());
+    if (auto image = ProgramImage::load(imagePath, sourceHash)) {
+        AllocationTracker::enter(AllocationTracker::Execute);
+        env.grow(image->slotCount());
+        runFlat(image->view(), env);
+        return false;
+    }
+
+    AllocationTracker::enter(AllocationTracker::Lex);
+    Lexer lexer(source);
+    TokenStream tokens = lexer.tokenize();
+    AllocationTracker::enter(AllocationTracker::Parse);
+    FlatProgram program = Parser(tokens).parseFlat();
+    AllocationTracker::enter(AllocationTracker::Resolve);
+    Resolver resolver;
+    program.resolve(resolver);
+    AllocationTracker::enter(AllocationTracker::Other);
+    writeImage(imagePath, program, sourceHash);
+
+    AllocationTracker::enter(AllocationTracker::Execute);
+    env.grow(resolver.slotCount());
+    program.run(env);
+    return true;
+}
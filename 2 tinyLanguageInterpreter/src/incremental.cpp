@@ -0,0 +1,305 @@
+#include "incremental.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "stream.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The lines of text; a last line without a newline still counts
+static std::vector<std::string_view> splitLines(std::string_view text) {
+    std::vector<std::string_view> result;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string_view::npos) end = text.size();
+        result.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return result;
+}
+
+void IncrementalFrontEnd::reload(const std::string& source) {
+    std::vector<std::string_view> next = splitLines(source);
+
+    // Everything between the common first and last lines has changed
+    size_t common = std::min(lines.size(), next.size());
+    size_t prefix = 0;
+    while (prefix < common && lines[prefix] == next[prefix]) {
+        prefix++;
+    }
+    size_t suffix = 0;
+    while (suffix < common - prefix
+           && lines[lines.size() - 1 - suffix] == next[next.size() - 1 - suffix]) {
+        suffix++;
+    }
+
+    std::vector<std::string> inserted(next.begin() + prefix, next.end() - suffix);
+    apply(prefix, lines.size() - prefix - suffix, std::move(inserted));
+}
+
+void IncrementalFrontEnd::edit(size_t firstLine, size_t lineCount, const std::string& text) {
+    if (firstLine == 0 || firstLine - 1 > lines.size() || lineCount > lines.size() - (firstLine - 1)) {
+        throw std::runtime_error("Edit outside the script: lines " + std::to_string(firstLine)
+                                 + " to " + std::to_string(firstLine + lineCount - 1));
+    }
+    std::vector<std::string_view> next = splitLines(text);
+    apply(firstLine - 1, lineCount, std::vector<std::string>(next.begin(), next.end()));
+}
+
+void IncrementalFrontEnd::apply(size_t first, size_t removed, std::vector<std::string> inserted) {
+    relexedLines = 0;
+    reparsedUnits = 0;
+
+    // Where the units start, before the edit
+    std::vector<size_t> starts;
+    starts.reserve(units.size());
+    size_t line = 0;
+    for (const auto& unit : units) {
+        starts.push_back(line);
+        line += unit.lineCount;
+    }
+
+    size_t changedEnd = first + inserted.size();
+    long shift = static_cast<long>(inserted.size()) - static_cast<long>(removed);
+    // Overwrite the lines in place as far as possible; most edits keep the line count
+    size_t kept = std::min(removed, inserted.size());
+    std::move(inserted.begin(), inserted.begin() + kept, lines.begin() + first);
+    lines.erase(lines.begin() + first + kept, lines.begin() + first + removed);
+    lines.insert(lines.begin() + first + kept,
+                 std::make_move_iterator(inserted.begin() + kept), std::make_move_iterator(inserted.end()));
+
+    // Start over at the unit holding the first edited line (units.size() when
+    // the edit appends), or at the one in front of it, if the edit begins
+    // with lines that belong to that unit's block
+    size_t firstUnit = units.size();
+    if (first < line) {
+        firstUnit = std::upper_bound(starts.begin(), starts.end(), first) - starts.begin() - 1;
+    }
+    if (firstUnit > 0 && (firstUnit == units.size() || starts[firstUnit] == first)
+        && first < lines.size()
+        && (isBlank(lines[first]) || indentation(lines[first]) > unitIndentation(starts[firstUnit - 1]))) {
+        firstUnit--;
+    }
+    size_t start = firstUnit < units.size() ? starts[firstUnit] : line;
+
+    // Split and parse until a unit would start where an old one, lying wholly
+    // after the edit, started; from there on the old units are still right
+    std::vector<Unit> fresh;
+    size_t reused = units.size();
+    size_t oldUnit = firstUnit;
+    while (start < lines.size()) {
+        if (start >= changedEnd) {
+            size_t oldStart = static_cast<size_t>(static_cast<long>(start) - shift);
+            while (oldUnit < units.size() && starts[oldUnit] < oldStart) {
+                oldUnit++;
+            }
+            if (oldUnit < units.size() && starts[oldUnit] == oldStart) {
+                reused = oldUnit;
+                break;
+            }
+        }
+        fresh.push_back(parseUnit(start, unitEnd(start) - start));
+        start += fresh.back().lineCount;
+    }
+
+    for (size_t i = firstUnit; i < reused; i++) {
+        failedUnits -= units[i].error != Unit::None;
+    }
+    for (const auto& unit : fresh) {
+        failedUnits += unit.error != Unit::None;
+    }
+    size_t replaced = std::min(fresh.size(), reused - firstUnit);
+    std::move(fresh.begin(), fresh.begin() + replaced, units.begin() + firstUnit);
+    units.erase(units.begin() + firstUnit + replaced, units.begin() + reused);
+    units.insert(units.begin() + firstUnit + replaced,
+                 std::make_move_iterator(fresh.begin() + replaced), std::make_move_iterator(fresh.end()));
+
+    // Add the new units to what needs resolving. A deletion can leave no new
+    // unit behind; what follows it is resolved again instead.
+    size_t changedUnits = std::min(std::max<size_t>(fresh.size(), 1), units.size() - firstUnit);
+    if (dirty) {
+        long moved = static_cast<long>(fresh.size()) - static_cast<long>(reused - firstUnit);
+        size_t end = dirtyEnd <= firstUnit ? dirtyEnd
+                   : dirtyEnd >= reused ? static_cast<size_t>(static_cast<long>(dirtyEnd) + moved)
+                   : firstUnit + fresh.size();
+        dirtyBegin = std::min(dirtyBegin, firstUnit);
+        dirtyEnd = std::max(end, firstUnit + changedUnits);
+    } else {
+        dirtyBegin = firstUnit;
+        dirtyEnd = firstUnit + changedUnits;
+    }
+    dirty = true;
+}
+
+size_t IncrementalFrontEnd::firstStatementLine(size_t start) const {
+    // Blank lines before the statement only occur at the top of the script
+    size_t line = start;
+    while (line < lines.size() && isBlank(lines[line])) {
+        line++;
+    }
+    return line;
+}
+
+size_t IncrementalFrontEnd::unitIndentation(size_t start) const {
+    size_t line = firstStatementLine(start);
+    return line < lines.size() ? indentation(lines[line]) : 0;
+}
+
+size_t IncrementalFrontEnd::unitEnd(size_t start) const {
+    size_t line = firstStatementLine(start);
+    if (line == lines.size()) return line;
+
+    // Same rule as StatementReader: the unit ends at the next line that is
+    // not indented further than its first one
+    size_t indent = indentation(lines[line]);
+    for (line++; line < lines.size(); line++) {
+        if (!isBlank(lines[line]) && indentation(lines[line]) <= indent) break;
+    }
+    return line;
+}
+
+// The unit's source, one line per line of the script
+static std::string unitSource(const std::vector<std::string>& lines, size_t start, size_t count) {
+    std::string text;
+    for (size_t line = start; line < start + count; line++) {
+        text += lines[line];
+        text += '\n';
+    }
+    return text;
+}
+
+IncrementalFrontEnd::Unit IncrementalFrontEnd::parseUnit(size_t start, size_t lineCount) {
+    relexedLines += lineCount;
+    reparsedUnits++;
+    Unit unit;
+    unit.lineCount = lineCount;
+    unit.error = Unit::LexError;
+    unit.parsed = std::make_unique<Parsed>();
+    try {
+        Lexer lexer(unitSource(lines, start, lineCount));
+        lexer.tokenize(unit.parsed->tokens);
+        unit.error = Unit::ParseError;
+        Parser parser(unit.parsed->tokens);
+        unit.parsed->statements = parser.parse();
+        unit.error = Unit::None;
+    } catch (const std::runtime_error&) {
+        // Kept until a later edit fixes it; resolve() reports it
+        unit.parsed->statements.clear();
+    }
+    return unit;
+}
+
+// Lex, then parse, the source of a broken unit with its current line numbers
+static void raiseError(const std::string& source, size_t firstLine) {
+    Lexer lexer(source, firstLine);
+    auto tokens = lexer.tokenize();
+    Parser parser(tokens);
+    parser.parse();
+}
+
+void IncrementalFrontEnd::resolve() {
+    resolvedUnits = 0;
+
+    // The whole script is lexed before any of it is parsed, and parsed
+    // before any of it is resolved, so report errors in that order
+    for (auto stage : {Unit::LexError, Unit::ParseError}) {
+        size_t start = 0;
+        for (size_t i = 0; i < units.size() && failedUnits > 0; i++) {
+            if (units[i].error == stage) {
+                raiseError(unitSource(lines, start, units[i].lineCount), start + 1);
+            }
+            start += units[i].lineCount;
+        }
+    }
+
+    if (!dirty) return;
+
+    // Resolve from the first changed unit; the ones after dirtyEnd were
+    // resolved against the journal that is about to be undone
+    auto markBefore = [&](size_t unit) { return unit > 0 ? units[unit - 1].after : Resolver::Mark{}; };
+    Resolver::Undone undone = resolver.rollback(markBefore(dirtyBegin));
+
+    for (size_t i = dirtyBegin; i < units.size(); i++) {
+        Unit& unit = units[i];
+        Resolver::Mark old = unit.after;
+        try {
+            resolver.resolve(unit.parsed->statements);
+        } catch (const std::runtime_error&) {
+            // Nothing after this unit can be trusted any more
+            resolver.rollback(markBefore(i));
+            dirtyBegin = i;
+            dirtyEnd = units.size();
+            throw;
+        }
+        resolvedUnits++;
+        unit.after = resolver.mark();
+
+        // Past the last change, and in the same state as last time: the rest
+        // is resolved already
+        if (i >= dirtyEnd && resolver.matches(undone, old)) {
+            resolver.redo(undone, old);
+            break;
+        }
+    }
+    dirty = false;
+}
+
+void IncrementalFrontEnd::run(Environment& env) const {
+    for (const auto& unit : units) {
+        for (const auto& stmt : unit.parsed->statements) {
+            stmt->execute(env);
+        }
+    }
+}
+
+void watchScript(const std::string& path, bool quickening) {
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    IncrementalFrontEnd program;
+    struct timespec seen = {};
+    off_t seenSize = -1;
+
+    while (true) {
+        // Polling keeps this portable; a script is saved far less often than this
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0
+            || (status.st_mtim.tv_sec == seen.tv_sec && status.st_mtim.tv_nsec == seen.tv_nsec
+                && status.st_size == seenSize)) {
+            usleep(200 * 1000);
+            continue;
+        }
+        seen = status.st_mtim;
+        seenSize = status.st_size;
+
+        std::ifstream file(path);
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+
+        auto began = std::chrono::steady_clock::now();
+        try {
+            program.reload(buffer.str());
+            program.resolve();
+            std::cerr << "Reloaded " << path << " in " << std::fixed << std::setprecision(3)
+                      << Milliseconds(std::chrono::steady_clock::now() - began).count() << " ms ("
+                      << program.relexedLines << " of " << program.lineCount() << " lines re-lexed, "
+                      << program.reparsedUnits << " of " << program.unitCount()
+                      << " statements re-parsed, " << program.resolvedUnits << " re-resolved)" << std::endl;
+
+            Environment env(program.slotCount());
+            env.quickening = quickening;
+            program.run(env);
+            OutputSink::standardOutput().flush();
+        } catch (const std::runtime_error& e) {
+            OutputSink::standardOutput().flush();
+            std::cerr << "Error: " << e.what() << std::endl;
+        }
+    }
+}
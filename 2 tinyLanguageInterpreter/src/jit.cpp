@@ -0,0 +1,357 @@
+#include "jit.hpp"
+#include "ast.hpp"
+#include "compiler.hpp"
+#include "x86.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+#ifdef TINY_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+namespace {
+
+using Reg = X86Assembler::Reg;
+
+// Bytecode value stack entry i lives in stackRegs[i]
+const Reg stackRegs[] = {
+    X86Assembler::RAX, X86Assembler::RCX, X86Assembler::RDX, X86Assembler::RSI,
+    X86Assembler::RDI, X86Assembler::R8, X86Assembler::R9, X86Assembler::R10,
+    X86Assembler::R11
+};
+const int stackRegCount = sizeof(stackRegs) / sizeof(stackRegs[0]);
+
+// Callee-saved registers that hold the most used variables
+const Reg variableRegs[] = {
+    X86Assembler::R12, X86Assembler::R13, X86Assembler::R14, X86Assembler::R15
+};
+const int variableRegCount = sizeof(variableRegs) / sizeof(variableRegs[0]);
+
+// Called from native code for PRINT; exceptions must not unwind through it
+int jitPrint(OutputSink* out, int value) {
+    try {
+        out->print(value);
+        return 0;
+    } catch (const std::runtime_error&) {
+        return 1;
+    }
+}
+
+// Translates one chunk into x86-64
+class Translator {
+public:
+    Translator(const Chunk& chunk, uint64_t printAddress) : chunk(chunk), printAddress(printAddress) {}
+
+    // False if the chunk uses something the translator does not handle
+    bool translate(X86Assembler& a);
+
+private:
+    const Chunk& chunk;
+    uint64_t printAddress;
+    std::map<int32_t, Reg> cached;             // Slot -> register holding it
+    std::map<int32_t, X86Assembler::Label> undefinedExits;  // Slot -> error exit stub
+
+    void chooseCachedVariables();
+    void load(X86Assembler& a, Reg dst, int32_t slot);
+    void store(X86Assembler& a, int32_t slot, Reg src);
+};
+
+void Translator::chooseCachedVariables() {
+    std::map<int32_t, int> uses;
+    size_t pc = 0;
+    while (pc < chunk.code.size()) {
+        OpCode op = static_cast<OpCode>(chunk.code[pc]);
+        if (op == OpCode::LOAD || op == OpCode::LOAD_CHECKED || op == OpCode::STORE) {
+            uses[chunk.code[pc + 1]]++;
+        }
+        pc += 1 + operandCount(op);
+    }
+
+    std::vector<std::pair<int, int32_t>> byUse;  // (uses, slot)
+    for (const auto& [slot, count] : uses) {
+        byUse.push_back({count, slot});
+    }
+    std::sort(byUse.rbegin(), byUse.rend());
+
+    for (size_t i = 0; i < byUse.size() && i < variableRegCount; i++) {
+        cached[byUse[i].second] = variableRegs[i];
+    }
+}
+
+void Translator::load(X86Assembler& a, Reg dst, int32_t slot) {
+    auto it = cached.find(slot);
+    if (it != cached.end()) {
+        a.movReg32(dst, it->second);
+    } else {
+        a.load32(dst, X86Assembler::RBX, slot * 4);
+    }
+}
+
+void Translator::store(X86Assembler& a, int32_t slot, Reg src) {
+    auto it = cached.find(slot);
+    if (it != cached.end()) {
+        a.movReg32(it->second, src);
+    } else {
+        a.store32(X86Assembler::RBX, slot * 4, src);
+    }
+    a.storeByteImm(X86Assembler::RBP, slot, 1);
+}
+
+bool Translator::translate(X86Assembler& a) {
+    if (chunk.maxStack > stackRegCount) return false;
+    chooseCachedVariables();
+
+    const auto& code = chunk.code;
+    std::vector<X86Assembler::Label> labels;  // One per code word, bound at instruction starts
+    for (size_t i = 0; i <= code.size(); i++) {
+        labels.push_back(a.newLabel());
+    }
+    X86Assembler::Label epilogue = a.newLabel();
+    X86Assembler::Label outputError = a.newLabel();
+
+    // Prologue: save callee-saved registers, keep the stack 16-byte aligned
+    // for calls, and load the context pointers and cached variables
+    a.push(X86Assembler::RBX);
+    a.push(X86Assembler::RBP);
+    for (Reg reg : variableRegs) a.push(reg);
+    a.subImm64(X86Assembler::RSP, 8);
+    a.store64(X86Assembler::RSP, 0, X86Assembler::RDI);
+    a.load64(X86Assembler::RBX, X86Assembler::RDI, offsetof(JitContext, values));
+    a.load64(X86Assembler::RBP, X86Assembler::RDI, offsetof(JitContext, defined));
+    for (const auto& [slot, reg] : cached) {
+        a.load32(reg, X86Assembler::RBX, slot * 4);
+    }
+
+    int depth = 0;
+    bool immediate = false;  // Top of stack is a CONST folded into the next instruction
+    int32_t immediateValue = 0;
+
+    size_t pc = 0;
+    while (pc < code.size()) {
+        a.bind(labels[pc]);
+        OpCode op = static_cast<OpCode>(code[pc]);
+        int32_t operand = operandCount(op) ? code[pc + 1] : 0;
+        size_t next = pc + 1 + operandCount(op);
+        OpCode nextOp = next < code.size() ? static_cast<OpCode>(code[next]) : OpCode::HALT;
+
+        switch (op) {
+            case OpCode::CONST:
+                if (nextOp == OpCode::SUB || nextOp == OpCode::GREATER || nextOp == OpCode::LESS) {
+                    immediate = true;
+                    immediateValue = operand;
+                } else {
+                    a.movImm32(stackRegs[depth], operand);
+                }
+                depth++;
+                break;
+
+            case OpCode::LOAD_CHECKED: {
+                auto exit = undefinedExits.find(operand);
+                if (exit == undefinedExits.end()) {
+                    exit = undefinedExits.emplace(operand, a.newLabel()).first;
+                }
+                a.cmpByteImm(X86Assembler::RBP, operand, 0);
+                a.jcc(X86Assembler::EQUAL, exit->second);
+                load(a, stackRegs[depth], operand);
+                depth++;
+                break;
+            }
+
+            case OpCode::LOAD:
+                load(a, stackRegs[depth], operand);
+                depth++;
+                break;
+
+            case OpCode::STORE:
+                depth--;
+                store(a, operand, stackRegs[depth]);
+                break;
+
+            case OpCode::SUB:
+                if (immediate) {
+                    a.subImm32(stackRegs[depth - 2], immediateValue);
+                } else {
+                    a.subReg32(stackRegs[depth - 2], stackRegs[depth - 1]);
+                }
+                immediate = false;
+                depth--;
+                break;
+
+            case OpCode::GREATER:
+            case OpCode::LESS: {
+                Reg left = stackRegs[depth - 2];
+                if (immediate) {
+                    a.cmpImm32(left, immediateValue);
+                } else {
+                    a.cmpReg32(left, stackRegs[depth - 1]);
+                }
+                immediate = false;
+                bool greater = op == OpCode::GREATER;
+
+                if (nextOp == OpCode::JUMP_IF_FALSE) {
+                    // Branch straight on the flags instead of materializing 0/1
+                    int32_t offset = code[next + 1];
+                    size_t target = next + 2 + offset;
+                    a.jcc(greater ? X86Assembler::LESS_EQUAL : X86Assembler::GREATER_EQUAL,
+                          labels[target]);
+                    depth -= 2;
+                    next += 2;
+                } else {
+                    a.setcc(greater ? X86Assembler::GREATER : X86Assembler::LESS, left);
+                    a.movzx8(left, left);
+                    depth--;
+                }
+                break;
+            }
+
+            case OpCode::JUMP:
+                a.jmp(labels[next + operand]);
+                break;
+
+            case OpCode::JUMP_IF_FALSE:
+                depth--;
+                a.testReg32(stackRegs[depth], stackRegs[depth]);
+                a.jcc(X86Assembler::EQUAL, labels[next + operand]);
+                break;
+
+            case OpCode::PRINT:
+                // Only the printed value may be live: the call clobbers scratch registers
+                if (depth != 1) return false;
+                depth--;
+                a.movReg32(X86Assembler::RSI, stackRegs[0]);
+                a.load64(X86Assembler::RDI, X86Assembler::RSP, 0);
+                a.load64(X86Assembler::RDI, X86Assembler::RDI, offsetof(JitContext, out));
+                a.movImm64(X86Assembler::RAX, printAddress);
+                a.call(X86Assembler::RAX);
+                a.testReg32(X86Assembler::RAX, X86Assembler::RAX);
+                a.jcc(X86Assembler::NOT_EQUAL, outputError);
+                break;
+
+            case OpCode::HALT:
+                a.movImm32(X86Assembler::RAX, STATUS_DONE);
+                a.jmp(epilogue);
+                break;
+
+            // Calls run their function on the interpreter's stack of frames
+            case OpCode::CALL:
+            case OpCode::RETURN:
+            case OpCode::POP:
+                return false;
+
+            // So do arrays, with their kernels
+            case OpCode::NEW_ARRAY:
+            case OpCode::LOAD_ELEMENT:
+            case OpCode::LOAD_ELEMENT_UNCHECKED:
+            case OpCode::STORE_ELEMENT:
+            case OpCode::STORE_ELEMENT_UNCHECKED:
+            case OpCode::LENGTH:
+            case OpCode::FILL:
+            case OpCode::SUM:
+            case OpCode::MIN:
+            case OpCode::MAX:
+            case OpCode::ADD_ARRAYS:
+            case OpCode::SUB_ARRAYS:
+            case OpCode::COUNT_ABOVE:
+            case OpCode::COUNT_BELOW:
+            case OpCode::BOUNDS_GUARD:
+                return false;
+        }
+        pc = next;
+    }
+    a.bind(labels[code.size()]);
+
+    // Early exits back to the interpreter
+    a.bind(outputError);
+    a.movImm32(X86Assembler::RAX, STATUS_OUTPUT_ERROR);
+    a.jmp(epilogue);
+    for (const auto& [slot, label] : undefinedExits) {
+        a.bind(label);
+        a.movImm32(X86Assembler::RAX, slot + 1);
+        a.jmp(epilogue);
+    }
+
+    // Epilogue: write cached variables back and restore registers.
+    // The status in eax is left alone.
+    a.bind(epilogue);
+    for (const auto& [slot, reg] : cached) {
+        a.store32(X86Assembler::RBX, slot * 4, reg);
+    }
+    a.addImm64(X86Assembler::RSP, 8);
+    for (int i = variableRegCount - 1; i >= 0; i--) a.pop(variableRegs[i]);
+    a.pop(X86Assembler::RBP);
+    a.pop(X86Assembler::RBX);
+    a.ret();
+
+    a.resolveLabels();
+    return true;
+}
+
+}  // namespace
+
+bool translateChunk(const Chunk& chunk, X86Assembler& a, uint64_t printAddress) {
+    Translator translator(chunk, printAddress);
+    return translator.translate(a);
+}
+
+NativeLoop::NativeLoop(void* code, size_t length, std::vector<std::string> names)
+    : code(code), length(length), names(std::move(names)) {}
+
+NativeLoop::~NativeLoop() {
+#ifdef TINY_JIT_SUPPORTED
+    munmap(code, length);
+#endif
+}
+
+std::unique_ptr<NativeLoop> NativeLoop::compile(const Chunk& loop) {
+#ifdef TINY_JIT_SUPPORTED
+    X86Assembler assembler;
+    if (!translateChunk(loop, assembler, reinterpret_cast<uint64_t>(&jitPrint))) {
+        return nullptr;
+    }
+
+    // Write the code, then flip the page to read+execute (never both writable and executable)
+    size_t length = assembler.size();
+    void* memory = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return nullptr;
+    }
+    std::memcpy(memory, assembler.code().data(), length);
+    if (mprotect(memory, length, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, length);
+        return nullptr;
+    }
+    return std::unique_ptr<NativeLoop>(new NativeLoop(memory, length, loop.names));
+#else
+    return nullptr;
+#endif
+}
+
+void NativeLoop::run(Environment& env) const {
+    JitContext context{env.valueData(), env.definedData(), env.out};
+    using Entry = int32_t (*)(JitContext*);
+    int32_t status = reinterpret_cast<Entry>(code)(&context);
+
+    if (status == STATUS_OUTPUT_ERROR) {
+        throw std::runtime_error("Output error while printing");
+    }
+    if (status > 0) {
+        throw std::runtime_error("Undefined variable: " + names[status - 1]);
+    }
+}
+
+bool LoopTier::compileAndRun(const ASTNode& condition,
+                             const std::vector<std::unique_ptr<ASTNode>>& body,
+                             Environment& env) {
+    BytecodeCompiler compiler;
+    native = NativeLoop::compile(compiler.compileLoop(condition, body));
+    if (!native) {
+        // Not translatable (or no JIT on this platform): stay interpreted
+        return false;
+    }
+    native->run(env);
+    return true;
+}
@@ -1,21 +1,177 @@
 #include "lexer.hpp"
-#include <cctype>
-#include <unordered_map>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
 
-// Define keywords that our language supports
-// These will be recognized as special tokens rather than regular identifiers
-static std::unordered_map<std::string, TokenType> keywords = {
+// SSE2 is part of x86-64, so the vector scanners are on by default there.
+// Define TINY_NO_SIMD_LEXER to use only the table-driven scalar loops, for
+// comparison. Building with AVX2 enabled (e.g. -march=native) adds a
+// 32-byte pass in front of the 16-byte one.
+#if defined(__SSE2__) && !defined(TINY_NO_SIMD_LEXER)
+#define TINY_SIMD_LEXER 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// Character classes, as bits in a 256-entry table. Unlike std::isspace and
+// friends this ignores the locale and is safe for bytes above 0x7F.
+enum CharClass : uint8_t {
+    BLANK = 1,  // Skipped between tokens: space, \t, \r, \v, \f (not \n)
+    DIGIT = 2,  // 0-9
+    ALPHA = 4,  // Letters, which start an identifier
+    IDENT = 8   // Letters, digits and '_', which continue one
+};
+
+constexpr std::array<uint8_t, 256> makeCharClasses() {
+    std::array<uint8_t, 256> classes{};
+    for (int c = 0; c < 256; c++) {
+        bool digit = c >= '0' && c <= '9';
+        bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        bool blank = c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+        classes[c] = (blank ? BLANK : 0) | (digit ? DIGIT : 0) | (alpha ? ALPHA : 0) |
+                     (digit || alpha || c == '_' ? IDENT : 0);
+    }
+    return classes;
+}
+
+constexpr std::array<uint8_t, 256> charClasses = makeCharClasses();
+
+inline bool isClass(char c, CharClass cls) {
+    return charClasses[static_cast<uint8_t>(c)] & cls;
+}
+
+#ifdef TINY_SIMD_LEXER
+// The same classes for 16 bytes at once, as 0xFF in every matching lane.
+// A byte is in [lo, hi] when min(byte - lo, hi - lo) == byte - lo (unsigned).
+inline __m128i inRange(__m128i bytes, char lo, char hi) {
+    __m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8(lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(static_cast<char>(hi - lo))), offset);
+}
+
+inline __m128i classMask(__m128i bytes, CharClass cls) {
+    __m128i digits = inRange(bytes, '0', '9');
+    if (cls == DIGIT) return digits;
+    if (cls == IDENT) {
+        // Setting bit 5 folds upper case onto lower case
+        __m128i letters = inRange(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), 'a', 'z');
+        __m128i underscore = _mm_cmpeq_epi8(bytes, _mm_set1_epi8('_'));
+        return _mm_or_si128(_mm_or_si128(letters, digits), underscore);
+    }
+    // BLANK: space, or \t..\r except \n
+    __m128i space = _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' '));
+    __m128i controls = _mm_andnot_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')),
+                                        inRange(bytes, '\t', '\r'));
+    return _mm_or_si128(space, controls);
+}
+
+#ifdef __AVX2__
+inline __m256i inRange(__m256i bytes, char lo, char hi) {
+    __m256i offset = _mm256_sub_epi8(bytes, _mm256_set1_epi8(lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(static_cast<char>(hi - lo))),
+                             offset);
+}
+
+inline __m256i classMask(__m256i bytes, CharClass cls) {
+    __m256i digits = inRange(bytes, '0', '9');
+    if (cls == DIGIT) return digits;
+    if (cls == IDENT) {
+        __m256i letters = inRange(_mm256_or_si256(bytes, _mm256_set1_epi8(0x20)), 'a', 'z');
+        __m256i underscore = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('_'));
+        return _mm256_or_si256(_mm256_or_si256(letters, digits), underscore);
+    }
+    __m256i space = _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' '));
+    __m256i controls = _mm256_andnot_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')),
+                                           inRange(bytes, '\t', '\r'));
+    return _mm256_or_si256(space, controls);
+}
+#endif
+#endif
+
+// Position of the first byte at or after position that is not in cls
+inline size_t skipClass(const char* data, size_t position, size_t size, CharClass cls) {
+#ifdef TINY_SIMD_LEXER
+#ifdef __AVX2__
+    while (position + 32 <= size) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + position));
+        uint32_t matches = static_cast<uint32_t>(_mm256_movemask_epi8(classMask(bytes, cls)));
+        if (matches != 0xFFFFFFFFu) return position + __builtin_ctz(~matches);
+        position += 32;
+    }
+#endif
+    while (position + 16 <= size) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + position));
+        uint32_t matches = static_cast<uint32_t>(_mm_movemask_epi8(classMask(bytes, cls)));
+        if (matches != 0xFFFFu) return position + __builtin_ctz(~matches);
+        position += 16;
+    }
+#endif
+    // The last few bytes (or everything, without SIMD)
+    while (position < size && isClass(data[position], cls)) {
+        position++;
+    }
+    return position;
+}
+
+// Keywords are found with a perfect hash: (length + first letter) % 8 gives
+// every keyword its own slot, so one lookup and one compare decide it.
+// The static_assert below fails if a new keyword collides.
+struct Keyword {
+    std::string_view text;
+    TokenType type;
+};
+
+constexpr Keyword keywordList[] = {
     {"if", TokenType::IF},
     {"while", TokenType::WHILE},
-    {"print", TokenType::PRINT}
+    {"print", TokenType::PRINT},
+    {"def", TokenType::DEF},
+    {"return", TokenType::RETURN}
 };
 
+constexpr size_t keywordSlots = 8;
+constexpr size_t longestKeyword = 6;
+
+constexpr size_t keywordHash(std::string_view id) {
+    return (id.size() + static_cast<unsigned char>(id[0])) % keywordSlots;
+}
+
+constexpr std::array<Keyword, keywordSlots> makeKeywordTable() {
+    std::array<Keyword, keywordSlots> table{};
+    for (const Keyword& keyword : keywordList) {
+        table[keywordHash(keyword.text)] = keyword;
+    }
+    return table;
+}
+
+constexpr std::array<Keyword, keywordSlots> keywordTable = makeKeywordTable();
+
+constexpr bool keywordHashIsPerfect() {
+    for (const Keyword& keyword : keywordList) {
+        if (keywordTable[keywordHash(keyword.text)].text != keyword.text) return false;
+        if (keyword.text.size() > longestKeyword) return false;
+    }
+    return true;
+}
+
+static_assert(keywordHashIsPerfect(), "keywords collide in keywordHash(); pick another hash");
+
+}  // namespace
+
 // Constructor: Initialize lexer with source code
-Lexer::Lexer(std::string source) : source(std::move(source)) {}
+Lexer::Lexer(std::string source, size_t firstLine)
+    : source(std::move(source)), line(firstLine) {}
 
 // Main tokenization method that processes the entire source code
-std::vector<Token> Lexer::tokenize() {
-    std::vector<Token> tokens;
+TokenStream Lexer::tokenize() {
+    TokenStream tokens;
+    tokenize(tokens);
+    return tokens;
+}
+
+void Lexer::tokenize(TokenStream& tokens) {
+    tokens.clear();
 
     while (!isAtEnd()) {
         // Skip any whitespace between tokens
@@ -24,27 +180,38 @@ std::vector<Token> Lexer::tokenize() {
 
         // Peek at the next character to determine token type
         char c = peek();
+        column = static_cast<int>(position - lineStart);
         
         // Handle numbers (integer literals)
-        if (std::isdigit(c)) {
-            tokens.push_back(number());
+        if (isClass(c, DIGIT)) {
+            tokens.push(TokenType::NUMBER, line, column, number());
         }
         // Handle identifiers (variable names) and keywords
-        else if (std::isalpha(c)) {
-            tokens.push_back(identifier());
+        else if (isClass(c, ALPHA)) {
+            std::string_view id = identifier();
+            TokenType type = keywordType(id);
+            // Only identifiers carry a payload: the interned id of their name
+            int32_t payload = type == TokenType::IDENTIFIER ? tokens.symbols.intern(id) : 0;
+            tokens.push(type, line, column, payload);
         }
         // Handle single-character tokens
         else {
             advance(); // Consume the character
             switch (c) {
-                case '=': tokens.emplace_back(TokenType::EQUALS, "=", line); break;
-                case '>': tokens.emplace_back(TokenType::GREATER, ">", line); break;
-                case '<': tokens.emplace_back(TokenType::LESS, "<", line); break;
-                case '-': tokens.emplace_back(TokenType::MINUS, "-", line); break;
+                case '=': tokens.push(TokenType::EQUALS, line, column); break;
+                case '>': tokens.push(TokenType::GREATER, line, column); break;
+                case '<': tokens.push(TokenType::LESS, line, column); break;
+                case '-': tokens.push(TokenType::MINUS, line, column); break;
+                case '(': tokens.push(TokenType::LPAREN, line, column); break;
+                case ')': tokens.push(TokenType::RPAREN, line, column); break;
+                case ',': tokens.push(TokenType::COMMA, line, column); break;
+                case '[': tokens.push(TokenType::LBRACKET, line, column); break;
+                case ']': tokens.push(TokenType::RBRACKET, line, column); break;
                 case '\n': 
                     // Track end of lines for proper indentation and scope management
-                    tokens.emplace_back(TokenType::EOL, "\\n", line);
+                    tokens.push(TokenType::EOL, line, column);
                     line++; // Increment line counter for error reporting
+                    lineStart = position; // Columns are measured from here
                     break;
                 default:
                     // In a production lexer, you'd want to handle unexpected characters
@@ -55,8 +222,7 @@ std::vector<Token> Lexer::tokenize() {
     }
 
     // Add final END token to signify end of input
-    tokens.emplace_back(TokenType::END, "", line);
-    return tokens;
+    tokens.push(TokenType::END, line, 0);
 }
 
 // Advance to next character in source and return current character
@@ -73,39 +239,44 @@ char Lexer::peek() {
 // Skip over spaces and tabs, but not newlines
 // Newlines are important for our language's structure
 void Lexer::skipWhitespace() {
-    while (!isAtEnd() && std::isspace(peek()) && peek() != '\n') {
-        advance();
-    }
+    position = skipClass(source.data(), position, source.size(), BLANK);
 }
 
-// Process and return a complete number token
-Token Lexer::number() {
-    std::string num;
-    // Collect all consecutive digits
-    while (!isAtEnd() && std::isdigit(peek())) {
-        num += advance();
+// Process a complete number and return its value
+int32_t Lexer::number() {
+    // Find where the digits end first, then accumulate them
+    size_t end = skipClass(source.data(), position, source.size(), DIGIT);
+    int64_t value = 0;
+    for (; position < end; position++) {
+        value = value * 10 + (source[position] - '0');
+        if (value > std::numeric_limits<int32_t>::max()) {
+            throw std::runtime_error("Number too large on line " + std::to_string(line));
+        }
     }
-    return Token(TokenType::NUMBER, num, line);
+    return static_cast<int32_t>(value);
 }
 
-// Process and return an identifier or keyword token
-Token Lexer::identifier() {
-    std::string id;
+// Process an identifier or keyword and return its text
+// The view points into the source, so no string is built
+std::string_view Lexer::identifier() {
+    size_t start = position;
     // Collect characters that can be part of an identifier
     // We allow alphanumeric characters and underscore
-    while (!isAtEnd() && (std::isalnum(peek()) || peek() == '_')) {
-        id += advance();
-    }
-    
-    // Check if the identifier is actually a keyword
-    auto it = keywords.find(id);
-    if (it != keywords.end()) {
-        // If it's a keyword, return the corresponding keyword token
-        return Token(it->second, id, line);
+    position = skipClass(source.data(), position, source.size(), IDENT);
+    return std::string_view(source).substr(start, position - start);
+}
+
+// Check if an identifier is actually a keyword
+TokenType Lexer::keywordType(std::string_view id) {
+    // Every keyword is short, so longer names skip the lookup
+    if (!id.empty() && id.size() <= longestKeyword) {
+        const Keyword& keyword = keywordTable[keywordHash(id)];
+        if (keyword.text == id) {
+            return keyword.type;
+        }
     }
-    
     // If it's not a keyword, it's a regular identifier (variable name)
-    return Token(TokenType::IDENTIFIER, id, line);
+    return TokenType::IDENTIFIER;
 }
 
 // Check if we've reached the end of the source code
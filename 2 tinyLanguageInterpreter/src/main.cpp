@@ -1,36 +1,344 @@
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
 #include "lexer.hpp"
+#include "parallel.hpp"
 #include "parser.hpp"
 #include "ast.hpp"
+#include "resolver.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+#include "quicken.hpp"
+#include "optimize.hpp"
+#include "constant.hpp"
+#include "stream.hpp"
+#include "flat.hpp"
+#include "profile.hpp"
+#include "image.hpp"
+#include "incremental.hpp"
+#include "aot.hpp"
+#include "alloc.hpp"
 
-int main() {
-    // Example program
-    std::string source = 
-        "x = 5\n"
-        "if x > 3\n"
-        "  print x\n"
-        "  while x > 0\n"
-        "    print x\n"
-        "    x = x - 1\n";
+// Example program, used when no script file is given
+static const char* exampleSource =
+    "x = 5\n"
+    "if x > 3\n"
+    "  print x\n"
+    "  while x > 0\n"
+    "    print x\n"
+    "    x = x - 1\n";
+
+static void usage() {
+    std::cerr << "Usage: tiny_interpreter [options] [script]\n"
+              << "  --vm             compile to bytecode and run it on the VM\n"
+              << "  --disassemble    print the bytecode instead of running it\n"
+              << "  --compile=FILE   write a standalone x86-64 Linux executable instead of running\n"
+              << "  --flat           parse into one flat node array and walk it with a switch\n"
+              << "                   (no loop optimizer, quickening or JIT)\n"
+              << "  --image[=FILE]   run --flat from a saved program image, rebuilding it when the\n"
+              << "                   script has changed (default: the script path plus .img)\n"
+              << "  --stream         run each top-level statement as soon as it has been read\n"
+              << "                   (reads standard input when no script is given)\n"
+              << "  --watch          run the script again whenever it changes, re-parsing only the\n"
+              << "                   edited statements (no loop optimizer or JIT)\n"
+              << "  --no-fold        skip constant propagation and dead code removal\n"
+              << "  --no-optimize    skip loop-invariant hoisting and counted loops\n"
+              << "  --no-quicken     keep the tree walker from specializing nodes\n"
+              << "  --quicken-stats  report specialization hit rates on stderr\n"
+              << "  --jit            compile hot while loops to machine code\n"
+              << "  --profile[=FILE] count and time every line, print an annotated listing on stderr\n"
+              << "                   and write folded stacks to FILE (default: profile.folded)\n"
+              << "  --flush=POLICY   when printed output is written: exit, full or line\n"
+              << "                   (default: line on a terminal, full otherwise)\n"
+              << "  --binary         print values as raw 4-byte integers\n"
+              << "  --alloc-stats    count heap allocations per stage (lex, parse, ...) and\n"
+              << "                   report them on stderr at exit\n"
+              << "  --lex-threads=N  lex large scripts on N threads (default: one per core)\n";
+}
+
+// Prints the allocation report however main() returns
+struct AllocationReport {
+    ~AllocationReport() {
+        if (AllocationTracker::enabled) {
+            AllocationTracker::report(std::cerr);
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    bool useVM = false;
+    bool disassemble = false;
+    bool streaming = false;
+    bool flat = false;
+    bool useImage = false;
+    bool watching = false;
+    std::string imagePath;
+    std::string executablePath;
+    bool folding = true;
+    bool optimizing = true;
+    bool quickening = true;
+    bool quickenStats = false;
+    bool jit = false;
+    bool profiling = false;
+    bool allocStats = false;
+    unsigned lexThreads = std::thread::hardware_concurrency();
+    std::string foldedPath = "profile.folded";
+    std::string path;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--vm") {
+            useVM = true;
+        } else if (arg == "--disassemble") {
+            disassemble = true;
+        } else if (arg.compare(0, 10, "--compile=") == 0 && arg.size() > 10) {
+            executablePath = arg.substr(10);
+        } else if (arg == "--flat") {
+            flat = true;
+        } else if (arg == "--image") {
+            useImage = true;
+        } else if (arg.compare(0, 8, "--image=") == 0) {
+            useImage = true;
+            imagePath = arg.substr(8);
+        } else if (arg == "--stream") {
+            streaming = true;
+        } else if (arg == "--watch") {
+            watching = true;
+        } else if (arg == "--no-fold") {
+            folding = false;
+        } else if (arg == "--no-optimize") {
+            optimizing = false;
+        } else if (arg == "--no-quicken") {
+            quickening = false;
+        } else if (arg == "--quicken-stats") {
+            quickenStats = true;
+        } else if (arg == "--jit") {
+            jit = true;
+        } else if (arg == "--profile") {
+            profiling = true;
+        } else if (arg.compare(0, 10, "--profile=") == 0) {
+            profiling = true;
+            foldedPath = arg.substr(10);
+        } else if (arg == "--flush=exit") {
+            OutputSink::standardOutput().setPolicy(OutputSink::FlushPolicy::OnExit);
+        } else if (arg == "--flush=full") {
+            OutputSink::standardOutput().setPolicy(OutputSink::FlushPolicy::WhenFull);
+        } else if (arg == "--flush=line") {
+            OutputSink::standardOutput().setPolicy(OutputSink::FlushPolicy::Line);
+        } else if (arg == "--binary") {
+            OutputSink::standardOutput().setFormat(OutputSink::Format::Binary);
+        } else if (arg == "--alloc-stats") {
+            allocStats = true;
+        } else if (arg.compare(0, 14, "--lex-threads=") == 0 && arg.size() > 14 && arg.size() < 20 &&
+                   arg.find_first_not_of("0123456789", 14) == std::string::npos) {
+            lexThreads = static_cast<unsigned>(std::stoul(arg.substr(14)));
+        } else if (!arg.empty() && arg[0] == '-') {
+            usage();
+            return 1;
+        } else {
+            path = arg;
+        }
+    }
+
+    if (useImage) {
+        if (path.empty() && imagePath.empty()) {
+            std::cerr << "Error: --image needs a script or an image path" << std::endl;
+            return 1;
+        }
+        if (imagePath.empty()) imagePath = path + ".img";
+        flat = true;
+    }
+
+    if (flat && (useVM || disassemble || streaming)) {
+        std::cerr << "Error: --flat is its own engine and cannot be combined with --vm or --stream" << std::endl;
+        return 1;
+    }
+
+    if (profiling && (useVM || disassemble || streaming || flat || jit)) {
+        std::cerr << "Error: --profile only runs on the tree walker, without --jit" << std::endl;
+        return 1;
+    }
+
+    if (!executablePath.empty() && (useVM || disassemble || streaming || flat || watching || jit || profiling)) {
+        std::cerr << "Error: --compile only combines with --no-fold and --no-optimize" << std::endl;
+        return 1;
+    }
+
+    if (allocStats && watching) {
+        std::cerr << "Error: --alloc-stats reports at exit, and --watch never exits" << std::endl;
+        return 1;
+    }
+
+    // Counting is not thread-safe, so the lexer gets no workers
+    if (allocStats) {
+        lexThreads = 1;
+    }
+
+    // From here on, reading the script counts as "other"
+    AllocationReport allocationReport;
+    AllocationTracker::enabled = allocStats;
+
+    if (watching) {
+        if (path.empty() || useVM || disassemble || streaming || flat || jit || profiling) {
+            std::cerr << "Error: --watch needs a script and only runs on the tree walker, without --jit" << std::endl;
+            return 1;
+        }
+        watchScript(path, quickening);
+        return 0;
+    }
+
+    if (streaming) {
+        if (useVM || disassemble) {
+            std::cerr << "Error: --stream only runs on the tree walker" << std::endl;
+            return 1;
+        }
+        int fd = path.empty() ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cerr << "Error: cannot open " << path << std::endl;
+            return 1;
+        }
+        try {
+            Environment env;
+            env.quickening = quickening;
+            env.jit = jit;
+            StatementReader reader(fd);
+            runStreaming(reader, env, optimizing);
+        } catch (const std::runtime_error& e) {
+            OutputSink::standardOutput().flush();
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    std::string source = exampleSource;
+    if (!path.empty()) {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "Error: cannot open " << path << std::endl;
+            return 1;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        source = buffer.str();
+    }
 
     try {
+        // A saved image replaces the whole front end
+        if (useImage) {
+            Environment env;
+            runWithImage(source, imagePath, env);
+            return 0;
+        }
+
         // Create lexer and get tokens
-        Lexer lexer(source);
-        auto tokens = lexer.tokenize();
+        AllocationTracker::enter(AllocationTracker::Lex);
+        ParallelLexer lexer(lexThreads);
+        auto tokens = lexer.tokenize(source);
 
         // Parse tokens into AST
+        AllocationTracker::enter(AllocationTracker::Parse);
         Parser parser(tokens);
+        if (flat) {
+            FlatProgram program = parser.parseFlat();
+            AllocationTracker::enter(AllocationTracker::Resolve);
+            Resolver resolver;
+            program.resolve(resolver);
+            AllocationTracker::enter(AllocationTracker::Execute);
+            Environment env(resolver.slotCount());
+            program.run(env);
+            return 0;
+        }
         auto statements = parser.parse();
 
-        // Execute the program
-        Environment env;
+        // Number the variables and check for undefined ones
+        AllocationTracker::enter(AllocationTracker::Resolve);
+        Resolver resolver;
+        resolver.resolve(statements);
+
+        // Propagate constants and drop code that can never run or be seen
+        AllocationTracker::enter(AllocationTracker::Optimize);
+        if (folding) {
+            ConstantFolder folder;
+            folder.fold(statements);
+        }
+
+        // Hoist loop-invariant code and turn countdown loops into counted loops
+        if (optimizing) {
+            LoopOptimizer optimizer(resolver);
+            optimizer.optimize(statements);
+        }
+
+        // Translate the bytecode to machine code and write it out as an executable
+        if (!executablePath.empty()) {
+            AllocationTracker::enter(AllocationTracker::Compile);
+            BytecodeCompiler compiler;
+            writeExecutable(executablePath, compiler.compile(statements, resolver.slotNames()));
+            return 0;
+        }
+
+        if (useVM || disassemble) {
+            // Compile the AST to bytecode and run it on the VM
+            AllocationTracker::enter(AllocationTracker::Compile);
+            BytecodeCompiler compiler;
+            Chunk chunk = compiler.compile(statements, resolver.slotNames());
+            if (disassemble) {
+                std::cout << chunk.disassemble();
+                return 0;
+            }
+            AllocationTracker::enter(AllocationTracker::Execute);
+            VM vm(chunk);
+            vm.run();
+            return 0;
+        }
+
+        // Wrap every statement in a counter and a timer
+        std::unique_ptr<Profiler> profiler;
+        if (profiling) {
+            profiler = std::make_unique<Profiler>(source);
+            profiler->instrument(statements);
+        }
+
+        // Execute the program by walking the tree
+        AllocationTracker::enter(AllocationTracker::Execute);
+        Environment env(resolver.slotCount());
+        env.quickening = quickening;
+        env.jit = jit;
+        QuickeningStats quickeningStats;
+        if (quickenStats) env.stats = &quickeningStats;
         for (const auto& stmt : statements) {
             stmt->execute(env);
         }
+
+        if (profiler) {
+            OutputSink::standardOutput().flush();
+            profiler->writeListing(std::cerr);
+            std::ofstream folded(foldedPath);
+            if (!folded) {
+                std::cerr << "Error: cannot write " << foldedPath << std::endl;
+                return 1;
+            }
+            profiler->writeFoldedStacks(folded);
+        }
+
+        if (quickenStats) {
+            for (int k = 0; k < QuickeningStats::KindCount; k++) {
+                long total = quickeningStats.hits[k] + quickeningStats.misses[k];
+                std::cerr << QuickeningStats::name(static_cast<QuickeningStats::Kind>(k))
+                          << ": " << quickeningStats.rewrites[k] << " rewrites, "
+                          << quickeningStats.hits[k] << "/" << total << " hits\n";
+            }
+        }
     } catch (const std::runtime_error& e) {
+        // Let the output printed before the error appear before the message
+        OutputSink::standardOutput().flush();
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
 
     return 0;
-}
\ No newline at end of file
+}
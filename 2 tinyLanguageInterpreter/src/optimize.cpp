@@ -0,0 +1,509 @@
+#include "optimize.hpp"
+#include "compiler.hpp"
+#include "quicken.hpp"
+#include "resolver.hpp"
+
+static std::unique_ptr<ASTNode> located(std::unique_ptr<ASTNode> node, int line) {
+    node->setLine(line);
+    return node;
+}
+
+// Copy of a loop condition for the guard around hoisted code, or nullptr
+// if it contains a node that cannot be copied
+static std::unique_ptr<ASTNode> cloneExpression(const ASTNode& node) {
+    if (auto* number = dynamic_cast<const NumberNode*>(&node)) {
+        return located(std::make_unique<NumberNode>(number->getValue()), node.getLine());
+    }
+    if (auto* variable = dynamic_cast<const VariableNode*>(&node)) {
+        return located(std::make_unique<VariableNode>(variable->getName(), variable->getSlot(),
+                                                      variable->isChecked()), node.getLine());
+    }
+    if (auto* subtraction = dynamic_cast<const SubtractionNode*>(&node)) {
+        auto left = cloneExpression(*subtraction->getLeft());
+        auto right = cloneExpression(*subtraction->getRight());
+        if (!left || !right) return nullptr;
+        return located(std::make_unique<SubtractionNode>(std::move(left), std::move(right)),
+                       node.getLine());
+    }
+    if (auto* comparison = dynamic_cast<const ComparisonNode*>(&node)) {
+        auto left = cloneExpression(*comparison->getLeft());
+        auto right = cloneExpression(*comparison->getRight());
+        if (!left || !right) return nullptr;
+        return located(std::make_unique<ComparisonNode>(std::move(left), comparison->getOp(),
+                                                        std::move(right)), node.getLine());
+    }
+    return nullptr;
+}
+
+void LoopOptimizer::optimizeBlock(std::vector<std::unique_ptr<ASTNode>>& body) {
+    for (auto& stmt : body) {
+        if (auto replacement = stmt->optimize(*this)) {
+            stmt = std::move(replacement);
+        }
+    }
+}
+
+void LoopOptimizer::optimizeExpression(std::unique_ptr<ASTNode>& expression) {
+    if (loop && dynamic_cast<SubtractionNode*>(expression.get())) {
+        VariableUses uses;
+        expression->collectUses(uses);
+        if (isInvariant(uses)) {
+            int slot = resolver.addTemporary();
+            const std::string& name = resolver.slotNames()[slot];
+            auto value = std::move(expression);
+            int line = value->getLine();
+            expression = located(std::make_unique<VariableNode>(name, slot, false), line);
+            loop->preheader.push_back(
+                located(std::make_unique<AssignmentNode>(name, slot, std::move(value)), line));
+            hoistedExpressions++;
+            return;
+        }
+    }
+    if (auto replacement = expression->optimize(*this)) {
+        expression = std::move(replacement);
+    }
+}
+
+void LoopOptimizer::recordAccess(ElementAccess& access) {
+    if (accesses) {
+        accesses->push_back({&access, statement});
+    }
+}
+
+bool LoopOptimizer::isInvariant(const VariableUses& uses) const {
+    if (uses.checkedReads || !uses.writes.empty()) return false;
+    for (int slot : uses.reads) {
+        auto it = loop->writes.find(slot);
+        if (it != loop->writes.end() && it->second > 0) return false;
+    }
+    return true;
+}
+
+void LoopOptimizer::hoistAssignments(const ASTNode& condition,
+                                     std::vector<std::unique_ptr<ASTNode>>& body) {
+    // Hoisting one assignment can make later ones invariant, so repeat until nothing moves
+    bool hoisted = true;
+    while (hoisted) {
+        hoisted = false;
+        VariableUses before;  // Reads that happen before the statement on the first iteration
+        condition.collectUses(before);
+
+        for (size_t i = 0; i < body.size() && !hoisted; i++) {
+            auto* assignment = dynamic_cast<AssignmentNode*>(body[i].get());
+            if (assignment) {
+                int slot = assignment->getSlot();
+                VariableUses value;
+                assignment->getValue()->collectUses(value);
+
+                if (loop->writes[slot] == 1 && !before.reads.count(slot) &&
+                    !value.reads.count(slot) && isInvariant(value)) {
+                    loop->writes.erase(slot);
+                    loop->preheader.push_back(std::move(body[i]));
+                    body.erase(body.begin() + i);
+                    hoistedAssignments++;
+                    hoisted = true;
+                    break;
+                }
+            }
+            body[i]->collectUses(before);
+        }
+    }
+}
+
+// Whether index is the counter minus a constant (or the counter itself),
+// and the constant
+static bool counterOffset(const ASTNode& index, int counter, long long& offset) {
+    if (auto* variable = dynamic_cast<const VariableNode*>(&index)) {
+        offset = 0;
+        return variable->getSlot() == counter;
+    }
+    auto* subtraction = dynamic_cast<const SubtractionNode*>(&index);
+    if (!subtraction) return false;
+    auto* variable = dynamic_cast<const VariableNode*>(subtraction->getLeft());
+    auto* constant = dynamic_cast<const NumberNode*>(subtraction->getRight());
+    if (!variable || !constant || variable->getSlot() != counter) return false;
+    offset = constant->getValue();
+    return true;
+}
+
+std::unique_ptr<ASTNode> LoopOptimizer::countedLoop(std::unique_ptr<ASTNode>& condition,
+                                                    std::vector<std::unique_ptr<ASTNode>>& body,
+                                                    const Loop& current,
+                                                    const std::vector<Access>& found) {
+    const auto& writes = current.writes;
+    auto* comparison = dynamic_cast<ComparisonNode*>(condition.get());
+    if (!comparison) return nullptr;
+
+    // x > k and k < x both count x down
+    bool greater = comparison->getOp() == ComparisonNode::Op::Greater;
+    auto* counter = dynamic_cast<const VariableNode*>(greater ? comparison->getLeft()
+                                                              : comparison->getRight());
+    const ASTNode* bound = greater ? comparison->getRight() : comparison->getLeft();
+    if (!counter) return nullptr;
+
+    auto assigned = [&writes](int slot) {
+        auto it = writes.find(slot);
+        return it == writes.end() ? 0 : it->second;
+    };
+    auto* boundVariable = dynamic_cast<const VariableNode*>(bound);
+    auto* boundNumber = dynamic_cast<const NumberNode*>(bound);
+    if (!boundNumber && !(boundVariable && assigned(boundVariable->getSlot()) == 0)) {
+        return nullptr;
+    }
+    if (assigned(counter->getSlot()) != 1) return nullptr;
+
+    // The one assignment must be x = x - c at the top level of the body
+    for (size_t decrement = 0; decrement < body.size(); decrement++) {
+        auto* assignment = dynamic_cast<const AssignmentNode*>(body[decrement].get());
+        if (!assignment || assignment->getSlot() != counter->getSlot()) continue;
+
+        auto* subtraction = dynamic_cast<const SubtractionNode*>(assignment->getValue());
+        if (!subtraction) return nullptr;
+        auto* self = dynamic_cast<const VariableNode*>(subtraction->getLeft());
+        auto* step = dynamic_cast<const NumberNode*>(subtraction->getRight());
+        if (!self || !step || self->getSlot() != counter->getSlot() || step->getValue() <= 0) {
+            return nullptr;
+        }
+        // The last counter is at least k - c + 1, which for a constant k
+        // too close to the smallest int wraps around from some start
+        if (boundNumber && static_cast<long long>(boundNumber->getValue()) - step->getValue() + 1 < INT32_MIN) {
+            return nullptr;
+        }
+
+        int slot = counter->getSlot();
+        int stride = step->getValue();
+        condition.release();
+        countedLoops++;
+        int line = comparison->getLine();
+        auto result = std::make_unique<CountedLoopNode>(std::unique_ptr<ComparisonNode>(comparison),
+                                                        stride, std::move(body));
+
+        // Accesses indexed with the counter, to arrays that keep their length
+        for (const Access& access : found) {
+            ElementAccess& element = *access.access;
+            long long offset;
+            if (!proveBounds || element.proven || current.allocated.count(element.slot) ||
+                !counterOffset(*element.index, slot, offset)) {
+                continue;
+            }
+            // After the decrement the counter is a step further down
+            if (access.statement > decrement) offset += stride;
+            element.proven = result->proveInBounds(element.slot, offset);
+            provedAccesses++;
+        }
+        return located(std::move(result), line);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> LoopOptimizer::optimizeLoop(std::unique_ptr<ASTNode>& condition,
+                                                     std::vector<std::unique_ptr<ASTNode>>& body) {
+    Loop current;
+    {
+        VariableUses uses;
+        condition->collectUses(uses);
+        uses.block(body);
+        current.writes = std::move(uses.writes);
+        current.allocated = std::move(uses.allocated);
+    }
+
+    // Nothing can be hoisted without a guard to put it under
+    auto guard = cloneExpression(*condition);
+
+    Loop* outer = loop;
+    std::vector<Access>* outerAccesses = accesses;
+    size_t outerStatement = statement;
+    std::vector<Access> found;
+    loop = guard ? &current : nullptr;
+    accesses = &found;
+    if (loop) {
+        hoistAssignments(*condition, body);
+    }
+    statement = 0;
+    optimizeExpression(condition);
+    // Inner loops optimize themselves, with their own Loop; accesses
+    // remember which statement of this body they are in
+    for (statement = 0; statement < body.size(); statement++) {
+        if (auto replacement = body[statement]->optimize(*this)) {
+            body[statement] = std::move(replacement);
+        }
+    }
+    loop = outer;
+    accesses = outerAccesses;
+    statement = outerStatement;
+
+    auto result = countedLoop(condition, body, current, found);
+
+    // What this loop did not prove, an outer counted loop still may
+    if (accesses) {
+        for (const Access& access : found) {
+            if (!access.access->proven) {
+                accesses->push_back({access.access, statement});
+            }
+        }
+    }
+    if (!result && current.preheader.empty()) return nullptr;
+    if (!result) {
+        int line = condition->getLine();
+        result = located(std::make_unique<WhileNode>(std::move(condition), std::move(body)), line);
+    }
+    if (current.preheader.empty()) return result;
+
+    current.preheader.push_back(std::move(result));
+    return std::make_unique<IfNode>(std::move(guard), std::move(current.preheader));
+}
+
+// Per-node optimization: only loops change, everything else just visits its children
+
+std::unique_ptr<ASTNode> AssignmentNode::optimize(LoopOptimizer& optimizer) {
+    optimizer.optimizeExpression(value);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> PrintNode::optimize(LoopOptimizer& optimizer) {
+    optimizer.optimizeExpression(expression);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> IfNode::optimize(LoopOptimizer& optimizer) {
+    optimizer.optimizeExpression(condition);
+    optimizer.optimizeBlock(body);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> WhileNode::optimize(LoopOptimizer& optimizer) {
+    return optimizer.optimizeLoop(condition, body);
+}
+
+// A function's loops get temporaries in its own frame
+std::unique_ptr<ASTNode> FunctionNode::optimize(LoopOptimizer& optimizer) {
+    LoopOptimizer inner(*resolver);
+    inner.optimize(body);
+    if (result) {
+        inner.optimizeExpression(result);
+    }
+    optimizer.hoistedAssignments += inner.hoistedAssignments;
+    optimizer.hoistedExpressions += inner.hoistedExpressions;
+    optimizer.countedLoops += inner.countedLoops;
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> CallNode::optimize(LoopOptimizer& optimizer) {
+    for (auto& argument : arguments) {
+        optimizer.optimizeExpression(argument);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> NewArrayNode::optimize(LoopOptimizer& optimizer) {
+    optimizer.optimizeExpression(length);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> ElementNode::optimize(LoopOptimizer& optimizer) {
+    optimizer.optimizeExpression(access.index);
+    optimizer.recordAccess(access);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> ElementAssignmentNode::optimize(LoopOptimizer& optimizer) {
+    optimizer.optimizeExpression(access.index);
+    optimizer.optimizeExpression(value);
+    optimizer.recordAccess(access);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> BuiltinNode::optimize(LoopOptimizer& optimizer) {
+    if (value) {
+        optimizer.optimizeExpression(value);
+    }
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> ComparisonNode::optimize(LoopOptimizer& optimizer) {
+    optimizer.optimizeExpression(left);
+    optimizer.optimizeExpression(right);
+    return nullptr;
+}
+
+std::unique_ptr<ASTNode> SubtractionNode::optimize(LoopOptimizer& optimizer) {
+    optimizer.optimizeExpression(left);
+    optimizer.optimizeExpression(right);
+    return nullptr;
+}
+
+// Variable uses
+
+void NumberNode::collectUses(VariableUses& uses) const {}
+
+void VariableNode::collectUses(VariableUses& uses) const {
+    uses.read(slot, checked);
+}
+
+void AssignmentNode::collectUses(VariableUses& uses) const {
+    value->collectUses(uses);
+    uses.write(slot);
+}
+
+void PrintNode::collectUses(VariableUses& uses) const {
+    expression->collectUses(uses);
+}
+
+void IfNode::collectUses(VariableUses& uses) const {
+    condition->collectUses(uses);
+    uses.block(body);
+}
+
+void WhileNode::collectUses(VariableUses& uses) const {
+    condition->collectUses(uses);
+    uses.block(body);
+}
+
+void ComparisonNode::collectUses(VariableUses& uses) const {
+    left->collectUses(uses);
+    right->collectUses(uses);
+}
+
+void SubtractionNode::collectUses(VariableUses& uses) const {
+    left->collectUses(uses);
+    right->collectUses(uses);
+}
+
+// A definition touches no variable of the frame it stands in
+void FunctionNode::collectUses(VariableUses& uses) const {}
+
+void CallNode::collectUses(VariableUses& uses) const {
+    for (const auto& argument : arguments) {
+        argument->collectUses(uses);
+    }
+    // The function may print or fail, so a call is never moved or dropped
+    uses.checkedReads = true;
+}
+
+// Arrays are not tracked like variables: whatever touches one may fail or
+// see what another statement stored, so it is never moved or dropped
+
+void NewArrayNode::collectUses(VariableUses& uses) const {
+    length->collectUses(uses);
+    uses.allocated.insert(slot);
+    uses.checkedReads = true;
+}
+
+void ElementNode::collectUses(VariableUses& uses) const {
+    access.index->collectUses(uses);
+    uses.checkedReads = true;
+}
+
+void ElementAssignmentNode::collectUses(VariableUses& uses) const {
+    access.index->collectUses(uses);
+    value->collectUses(uses);
+    uses.checkedReads = true;
+}
+
+void BuiltinNode::collectUses(VariableUses& uses) const {
+    if (value) {
+        value->collectUses(uses);
+    }
+    uses.checkedReads = true;
+}
+
+// Counted loop
+
+int CountedLoopNode::execute(Environment& env) {
+    if (env.jit && tier.enter(env)) return 0;
+
+    // Both sides are evaluated once, in the same order the comparison would
+    long long left = condition->getLeft()->execute(env);
+    long long right = condition->getRight()->execute(env);
+    bool greater = condition->getOp() == ComparisonNode::Op::Greater;
+    long long counter = greater ? left : right;
+    long long bound = greater ? right : left;
+    long long trips = countedTrips(counter, bound, step);
+
+    // A counter that wraps around is not counted: every engine tests the
+    // condition each time, with every access checked
+    if (trips < 0) {
+        inBounds = false;
+        while (condition->execute(env)) {
+            if (iterate(env)) return 0;
+        }
+        return 0;
+    }
+
+    // Every proved access checked once, for the whole run
+    if (!bounds.empty()) {
+        inBounds = true;
+        for (const Bounds& range : bounds) {
+            inBounds = inBounds && countedIndicesInBounds(counter, trips, step, range.low, range.high,
+                                                          env.array(range.array).size());
+        }
+    }
+
+    for (long long i = 0; i < trips; i++) {
+        if (iterate(env)) return 0;
+    }
+    return 0;
+}
+
+bool CountedLoopNode::iterate(Environment& env) {
+    for (const auto& stmt : body) {
+        stmt->execute(env);
+    }
+    if (!quickened && env.quickening) {
+        quickenBlock(body, env);
+        quickened = true;
+    }
+    return env.jit && tier.iterate(*condition, body, env);
+}
+
+void CountedLoopNode::compile(BytecodeCompiler& compiler) const {
+    if (bounds.empty()) {
+        compiler.compileWhile(*condition, body);
+        return;
+    }
+
+    Chunk::BoundsGuard guard;
+    guard.counter = counter().getSlot();
+    if (auto* number = dynamic_cast<const NumberNode*>(&bound())) {
+        guard.bound = number->getValue();
+    } else {
+        guard.boundSlot = static_cast<const VariableNode&>(bound()).getSlot();
+    }
+    guard.step = step;
+    for (const Bounds& range : bounds) {
+        guard.ranges.push_back({range.array, range.low, range.high});
+    }
+    compiler.compileGuardedLoop(*condition, body, &inBounds, std::move(guard));
+}
+
+const bool* CountedLoopNode::proveInBounds(int array, long long offset) {
+    for (Bounds& range : bounds) {
+        if (range.array == array) {
+            range.low = std::min(range.low, offset);
+            range.high = std::max(range.high, offset);
+            return &inBounds;
+        }
+    }
+    bounds.push_back({array, offset, offset});
+    return &inBounds;
+}
+
+// countedLoop() made sure of both
+const VariableNode& CountedLoopNode::counter() const {
+    bool greater = condition->getOp() == ComparisonNode::Op::Greater;
+    return static_cast<const VariableNode&>(greater ? *condition->getLeft() : *condition->getRight());
+}
+
+const ASTNode& CountedLoopNode::bound() const {
+    bool greater = condition->getOp() == ComparisonNode::Op::Greater;
+    return greater ? *condition->getRight() : *condition->getLeft();
+}
+
+void CountedLoopNode::resolve(Resolver& resolver) {
+    resolver.resolveLoop(*condition, body);
+}
+
+void CountedLoopNode::collectUses(VariableUses& uses) const {
+    condition->collectUses(uses);
+    uses.block(body);
+}
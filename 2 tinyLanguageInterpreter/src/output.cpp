@@ -0,0 +1,78 @@
+#include "output.hpp"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+OutputSink::OutputSink(int fd, size_t capacity)
+    : fd(fd)
+    , buffer(capacity)
+    , capacity(capacity)
+    , policy(isatty(fd) ? FlushPolicy::Line : FlushPolicy::WhenFull) {}
+
+OutputSink::~OutputSink() {
+    // Destructors must not throw; a failed final write is lost
+    try {
+        flush();
+    } catch (const std::runtime_error&) {
+    }
+}
+
+OutputSink& OutputSink::standardOutput() {
+    static OutputSink sink(STDOUT_FILENO);
+    return sink;
+}
+
+void OutputSink::flush() {
+    size_t written = 0;
+    while (written < used) {
+        ssize_t n = ::write(fd, buffer.data() + written, used - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            used = 0;
+            throw std::runtime_error(std::string("Output error: ") + std::strerror(errno));
+        }
+        written += static_cast<size_t>(n);
+    }
+    used = 0;
+}
+
+// Called when the next value might not fit in the buffer
+void OutputSink::full() {
+    if (policy == FlushPolicy::OnExit) {
+        // Keep everything: grow instead of writing
+        capacity *= 2;
+        buffer.resize(capacity);
+    } else {
+        flush();
+    }
+}
+
+void OutputSink::writeRaw(int value) {
+    int32_t raw = value;
+    std::memcpy(buffer.data() + used, &raw, sizeof(raw));
+    used += sizeof(raw);
+}
+
+size_t OutputSink::formatInt(int value, char* out) {
+    // Work on the magnitude as unsigned so INT_MIN does not overflow
+    uint32_t magnitude = value < 0 ? 0u - static_cast<uint32_t>(value)
+                                   : static_cast<uint32_t>(value);
+
+    // Produce digits backwards into a scratch buffer, then copy them out
+    char digits[10];
+    size_t count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    size_t length = 0;
+    if (value < 0) {
+        out[length++] = '-';
+    }
+    while (count > 0) {
+        out[length++] = digits[--count];
+    }
+    return length;
+}
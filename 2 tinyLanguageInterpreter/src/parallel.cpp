@@ -0,0 +1,160 @@
+#include "parallel.hpp"
+#include "lexer.hpp"
+#include <algorithm>
+#include <string>
+
+ParallelLexer::ParallelLexer(unsigned threads) : threadCount(std::max(threads, 1u)) {}
+
+ParallelLexer::~ParallelLexer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+TokenStream ParallelLexer::tokenize(std::string_view source, size_t firstLine) {
+    TokenStream tokens;
+    tokenize(source, tokens, firstLine);
+    return tokens;
+}
+
+void ParallelLexer::tokenize(std::string_view source, TokenStream& tokens, size_t firstLine) {
+    if (threadCount > 1 && source.size() >= 2 * minimumChunk) {
+        split(source);
+    } else {
+        chunks.clear();
+    }
+    if (chunks.size() < 2) {
+        Lexer lexer(std::string(source), firstLine);
+        lexer.tokenize(tokens);
+        return;
+    }
+
+    // Every chunk on its own, numbering its lines from 1
+    forEachChunk([this](size_t i) {
+        Chunk& chunk = chunks[i];
+        chunk.error = nullptr;
+        try {
+            Lexer lexer{std::string(chunk.text)};
+            lexer.tokenize(chunk.tokens);
+        } catch (...) {
+            chunk.error = std::current_exception();
+        }
+    });
+
+    // In order: first lines, where the tokens go, and the shared symbol ids
+    tokens.clear();
+    int line = static_cast<int>(firstLine);
+    size_t total = 0;
+    for (Chunk& chunk : chunks) {
+        chunk.firstLine = line;
+        if (chunk.error) {
+            // Again from its real first line, for the serial lexer's message
+            Lexer lexer(std::string(chunk.text), line);
+            lexer.tokenize(chunk.tokens);
+            std::rethrow_exception(chunk.error);
+        }
+        const TokenStream& own = chunk.tokens;
+        chunk.firstToken = total;
+        total += own.size() - 1;
+        // The END token is on the chunk's line after its last newline
+        line += own.lines.back() - 1;
+        tokens.symbols.merge(own.symbols, chunk.ids);
+    }
+
+    tokens.types.resize(total + 1);
+    tokens.lines.resize(total + 1);
+    tokens.columns.resize(total + 1);
+    tokens.payloads.resize(total + 1);
+
+    // Every chunk's tokens into place, without its END
+    forEachChunk([this, &tokens](size_t i) {
+        const Chunk& chunk = chunks[i];
+        const TokenStream& own = chunk.tokens;
+        size_t count = own.size() - 1;
+        size_t at = chunk.firstToken;
+        int lineOffset = chunk.firstLine - 1;
+        std::copy_n(own.types.begin(), count, tokens.types.begin() + at);
+        std::copy_n(own.columns.begin(), count, tokens.columns.begin() + at);
+        for (size_t k = 0; k < count; k++) {
+            tokens.lines[at + k] = own.lines[k] + lineOffset;
+            tokens.payloads[at + k] = own.types[k] == TokenType::IDENTIFIER
+                ? chunk.ids[own.payloads[k]]
+                : own.payloads[k];
+        }
+    });
+
+    tokens.types[total] = TokenType::END;
+    tokens.lines[total] = line;
+    tokens.columns[total] = 0;
+    tokens.payloads[total] = 0;
+}
+
+// About four chunks per thread, each ending just after a newline
+void ParallelLexer::split(std::string_view source) {
+    size_t count = std::min<size_t>(threadCount * 4, source.size() / minimumChunk);
+    size_t target = source.size() / count;
+    chunks.resize(count);
+    size_t used = 0;
+    size_t start = 0;
+    while (start < source.size()) {
+        size_t end = source.size();
+        if (used + 1 < count) {
+            size_t newline = source.find('\n', std::max(start, (used + 1) * target));
+            if (newline != std::string_view::npos) end = newline + 1;
+        }
+        chunks[used++].text = source.substr(start, end - start);
+        start = end;
+    }
+    chunks.resize(used);
+}
+
+void ParallelLexer::forEachChunk(const std::function<void(size_t)>& fn) {
+    if (workers.empty()) {
+        for (unsigned i = 1; i < threadCount; i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = fn;
+        taskCount = chunks.size();
+        next = 0;
+        idle = 0;
+        generation++;
+    }
+    wake.notify_all();
+    runTasks();
+
+    // Every worker checks in, so none is still on this generation when the next starts
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return idle == workers.size(); });
+}
+
+void ParallelLexer::work() {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+        }
+        runTasks();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle++;
+        }
+        finished.notify_one();
+    }
+}
+
+void ParallelLexer::runTasks() {
+    for (size_t i = next++; i < taskCount; i = next++) {
+        task(i);
+    }
+}
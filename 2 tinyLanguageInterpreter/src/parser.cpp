@@ -1,4 +1,5 @@
 #include "parser.hpp"
+#include <algorithm>
 #include <stdexcept>
 
 /*
@@ -15,30 +16,54 @@ Main Components and Flow:
    - ifStatement() - Processes if conditions and their blocks
    - whileStatement() - Handles while loops and their blocks
    - printStatement() - Manages print statements
-   - expression() - Processes basic expressions (numbers and variables)
+   - functionDefinition() - Handles def, only at the top level
+   - call() - Handles calls, as expressions or statements
+   - builtin() - Handles the array builtins (len, sum, fill, ...)
+   - elementAssignment() - Handles stores into arrays (a[i] = value)
+   - expression() - Processes subtraction chains of numbers and variables
    - comparison() - Handles comparison operations (>, <)
    - block() - Processes indented blocks of code
 
 Grammar Rules (in EBNF-like notation):
-program    → statement* END
-statement  → assignment | ifStatement | whileStatement | printStatement
-assignment → IDENTIFIER "=" expression EOL
+program    → (function | statement)* END
+function   → "def" IDENTIFIER "(" parameters? ")" EOL functionBody
+parameters → IDENTIFIER ("," IDENTIFIER)*
+functionBody → statement* ("return" expression)?   (indented, at least one line)
+statement  → assignment | elementAssignment | ifStatement | whileStatement
+             | printStatement | call
+assignment → IDENTIFIER "=" (expression | "array" "(" expression ")") EOL
+elementAssignment → IDENTIFIER "[" expression "]" "=" expression EOL
 ifStatement → "if" comparison EOL block
 whileStatement → "while" comparison EOL block
 printStatement → "print" expression EOL
-expression → NUMBER | IDENTIFIER
+expression → primary ("-" primary)*
+primary    → NUMBER | IDENTIFIER | IDENTIFIER "[" expression "]" | call
+call       → IDENTIFIER "(" (expression ("," expression)*)? ")"
+           | BUILTIN "(" IDENTIFIER ("," IDENTIFIER)* ("," expression)? ")"
 comparison → expression (">" | "<") expression
-block      → statement+
+block      → statement+   (each indented deeper than the if/while keyword)
+
+Blank lines are skipped wherever a statement may start. A return can only
+be the last line of a function body, so a function always runs to its end.
+"array" and the builtins' names (BuiltinNode::find) are only special in
+front of "(": they stay free as variable names, but not as function names.
 */
 
-Parser::Parser(std::vector<Token> tokens) : tokens(std::move(tokens)) {}
+Parser::Parser(const TokenStream& tokens) : tokens(tokens) {}
 
 std::vector<std::unique_ptr<ASTNode>> Parser::parse() {
     std::vector<std::unique_ptr<ASTNode>> statements;
     
     // Process statements until we reach the end of the file
-    while (!isAtEnd() && peek().type != TokenType::END) {
+    while (!isAtEnd() && peek() != TokenType::END) {
+        // Skip blank lines between statements
+        if (match(TokenType::EOL)) continue;
         try {
+            size_t first = current;
+            if (match(TokenType::DEF)) {
+                statements.push_back(located(functionDefinition(), first));
+                continue;
+            }
             statements.push_back(statement());
             // Each statement should end with a newline
             match(TokenType::EOL);
@@ -54,38 +79,63 @@ std::vector<std::unique_ptr<ASTNode>> Parser::parse() {
 std::unique_ptr<ASTNode> Parser::statement() {
     // Dispatcher function that determines the type of statement
     // and calls the appropriate specialized parser
+    size_t first = current;
     if (match(TokenType::IF)) {
-        return ifStatement();
+        return located(ifStatement(), first);
     }
     if (match(TokenType::WHILE)) {
-        return whileStatement();
+        return located(whileStatement(), first);
     }
     if (match(TokenType::PRINT)) {
-        return printStatement();
+        return located(printStatement(), first);
+    }
+    if (check(TokenType::DEF)) {
+        throw std::runtime_error("Functions can only be defined at the top level.");
+    }
+    if (check(TokenType::RETURN)) {
+        throw std::runtime_error("Expected 'return' only as the last line of a function.");
+    }
+    if (checkCall()) {
+        return located(call(true), first);
+    }
+    if (checkElement()) {
+        return located(elementAssignment(), first);
     }
     // If no keyword is matched, assume it's an assignment
-    return assignment();
+    return located(assignment(), first);
 }
 
 std::unique_ptr<ASTNode> Parser::assignment() {
     // Parse assignment statement: IDENTIFIER = expression
-    Token name = consume(TokenType::IDENTIFIER, "Expected variable name.");
+    size_t name = consume(TokenType::IDENTIFIER, "Expected variable name.");
     consume(TokenType::EQUALS, "Expected '=' after variable name.");
+
+    // name = array(length) makes a new array
+    if (checkCall() && nameOf(current) == "array") {
+        advance();
+        advance();
+        auto length = expression();
+        consume(TokenType::RPAREN, "Expected ')' after array length.");
+        return std::make_unique<NewArrayNode>(nameOf(name), std::move(length));
+    }
     
     // Parse the value being assigned
     auto value = expression();
-    return std::make_unique<AssignmentNode>(name.value, std::move(value));
+    return std::make_unique<AssignmentNode>(nameOf(name), std::move(value));
 }
 
 std::unique_ptr<ASTNode> Parser::ifStatement() {
     // Parse if statement: "if" comparison EOL block
     
+    // Remember where the keyword sits so the block knows its indentation
+    int indent = tokens.columns[current - 1];
+
     // First parse the condition
     auto condition = comparison();
     consume(TokenType::EOL, "Expected newline after condition.");
     
     // Then parse the indented block of code
-    auto body = block();
+    auto body = block(indent);
     
     return std::make_unique<IfNode>(std::move(condition), std::move(body));
 }
@@ -93,12 +143,14 @@ std::unique_ptr<ASTNode> Parser::ifStatement() {
 std::unique_ptr<ASTNode> Parser::whileStatement() {
     // Parse while statement: "while" comparison EOL block
     
+    int indent = tokens.columns[current - 1];
+
     // Similar to if statement, first parse condition
     auto condition = comparison();
     consume(TokenType::EOL, "Expected newline after condition.");
     
     // Then parse the indented block of code
-    auto body = block();
+    auto body = block(indent);
     
     return std::make_unique<WhileNode>(std::move(condition), std::move(body));
 }
@@ -109,17 +161,148 @@ std::unique_ptr<ASTNode> Parser::printStatement() {
     return std::make_unique<PrintNode>(std::move(value));
 }
 
+std::unique_ptr<ASTNode> Parser::functionDefinition() {
+    // Parse function: "def" IDENTIFIER "(" parameters? ")" EOL functionBody
+    int indent = tokens.columns[current - 1];
+
+    size_t name = consume(TokenType::IDENTIFIER, "Expected function name.");
+    if (nameOf(name) == "array" || BuiltinNode::find(nameOf(name))) {
+        throw std::runtime_error("Cannot define a function named " + nameOf(name) + ": it is a builtin.");
+    }
+    consume(TokenType::LPAREN, "Expected '(' after function name.");
+    std::vector<std::string> parameters;
+    if (!check(TokenType::RPAREN)) {
+        do {
+            std::string parameter = nameOf(consume(TokenType::IDENTIFIER, "Expected parameter name."));
+            if (std::find(parameters.begin(), parameters.end(), parameter) != parameters.end()) {
+                throw std::runtime_error("Duplicate parameter: " + parameter);
+            }
+            parameters.push_back(std::move(parameter));
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RPAREN, "Expected ')' after parameters.");
+    consume(TokenType::EOL, "Expected newline after parameters.");
+
+    // Like block(), except that the last line may be "return expression"
+    std::vector<std::unique_ptr<ASTNode>> body;
+    std::unique_ptr<ASTNode> result;
+    while (!isAtEnd() && peek() != TokenType::END) {
+        if (match(TokenType::EOL)) continue;
+        if (peekColumn() <= indent) break;
+        if (result) {
+            throw std::runtime_error("Expected 'return' only as the last line of a function.");
+        }
+        if (match(TokenType::RETURN)) {
+            result = expression();
+        } else {
+            body.push_back(statement());
+        }
+        match(TokenType::EOL);
+    }
+
+    if (body.empty() && !result) {
+        throw std::runtime_error("Expected at least one statement in block.");
+    }
+
+    return std::make_unique<FunctionNode>(nameOf(name), std::move(parameters),
+                                          std::move(body), std::move(result));
+}
+
+std::unique_ptr<ASTNode> Parser::call(bool statement) {
+    // Parse call: IDENTIFIER "(" (expression ("," expression)*)? ")"
+    size_t name = advance();
+    advance();  // The "(" checkCall() saw
+
+    std::string callee = nameOf(name);
+    if (callee == "array") {
+        throw std::runtime_error("Expected array() only on the right of an assignment.");
+    }
+    if (const auto* signature = BuiltinNode::find(callee)) {
+        return builtin(*signature, statement);
+    }
+
+    std::vector<std::unique_ptr<ASTNode>> arguments;
+    if (!check(TokenType::RPAREN)) {
+        do {
+            arguments.push_back(expression());
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RPAREN, "Expected ')' after arguments.");
+    return std::make_unique<CallNode>(std::move(callee), std::move(arguments), statement);
+}
+
+std::unique_ptr<ASTNode> Parser::builtin(const BuiltinNode::Signature& signature, bool statement) {
+    // Parse builtin: its arrays by name, then its value if it takes one
+    std::vector<std::string> arrays;
+    for (int i = 0; i < signature.arrays; i++) {
+        if (i > 0) consume(TokenType::COMMA, "Expected ',' between arguments.");
+        arrays.push_back(nameOf(consume(TokenType::IDENTIFIER, "Expected array name.")));
+    }
+    std::unique_ptr<ASTNode> value;
+    if (signature.value) {
+        consume(TokenType::COMMA, "Expected ',' between arguments.");
+        value = expression();
+    }
+    consume(TokenType::RPAREN, "Expected ')' after arguments.");
+
+    if (!statement && !signature.returns) {
+        throw std::runtime_error(std::string(signature.name) + "() does not return a value.");
+    }
+    return std::make_unique<BuiltinNode>(signature, std::move(arrays), std::move(value), statement);
+}
+
+std::unique_ptr<ASTNode> Parser::elementAssignment() {
+    // Parse element assignment: IDENTIFIER "[" expression "]" "=" expression
+    size_t name = advance();
+    advance();  // The "[" checkElement() saw
+    auto index = expression();
+    consume(TokenType::RBRACKET, "Expected ']' after index.");
+    consume(TokenType::EQUALS, "Expected '=' after element.");
+
+    auto value = expression();
+    return std::make_unique<ElementAssignmentNode>(nameOf(name), std::move(index), std::move(value));
+}
+
 std::unique_ptr<ASTNode> Parser::expression() {
-    // Currently handles only simple expressions:
+    // Parse expression: primary ("-" primary)*
+    // Subtraction is left associative, so "a - b - c" is "(a - b) - c"
+    auto expr = primary();
+
+    while (match(TokenType::MINUS)) {
+        size_t minus = current - 1;
+        auto right = primary();
+        expr = located(std::make_unique<SubtractionNode>(std::move(expr), std::move(right)), minus);
+    }
+
+    return expr;
+}
+
+std::unique_ptr<ASTNode> Parser::primary() {
+    // Handles the operands of an expression:
     // - Number literals
     // - Variable references
+    // - Array elements
+    // - Calls
     
     if (match(TokenType::NUMBER)) {
-        return std::make_unique<NumberNode>(std::stoi(tokens[current - 1].value));
+        return located(std::make_unique<NumberNode>(tokens.payloads[current - 1]), current - 1);
     }
     
+    if (checkCall()) {
+        size_t name = current;
+        return located(call(false), name);
+    }
+
+    if (checkElement()) {
+        size_t name = advance();
+        advance();  // "["
+        auto index = expression();
+        consume(TokenType::RBRACKET, "Expected ']' after index.");
+        return located(std::make_unique<ElementNode>(nameOf(name), std::move(index)), name);
+    }
+
     if (match(TokenType::IDENTIFIER)) {
-        return std::make_unique<VariableNode>(tokens[current - 1].value);
+        return located(std::make_unique<VariableNode>(nameOf(current - 1)), current - 1);
     }
     
     throw std::runtime_error("Expected expression.");
@@ -130,39 +313,41 @@ std::unique_ptr<ASTNode> Parser::comparison() {
     
     // Get left side of comparison
     auto left = expression();
+    size_t op = current;
     
     // Look for comparison operator and build appropriate node
     if (match(TokenType::GREATER)) {
         auto right = expression();
-        return std::make_unique<ComparisonNode>(
+        return located(std::make_unique<ComparisonNode>(
             std::move(left),
             ComparisonNode::Op::Greater,
             std::move(right)
-        );
+        ), op);
     }
     
     if (match(TokenType::LESS)) {
         auto right = expression();
-        return std::make_unique<ComparisonNode>(
+        return located(std::make_unique<ComparisonNode>(
             std::move(left),
             ComparisonNode::Op::Less,
             std::move(right)
-        );
+        ), op);
     }
     
     throw std::runtime_error("Expected comparison operator.");
 }
 
-std::vector<std::unique_ptr<ASTNode>> Parser::block() {
+std::vector<std::unique_ptr<ASTNode>> Parser::block(int indent) {
     // Parse a block of statements
-    // In our language, a block is a sequence of indented statements
+    // In our language, a block is a sequence of statements indented deeper
+    // than the keyword that opened it. The first dedented line ends the block.
     std::vector<std::unique_ptr<ASTNode>> statements;
     
-    while (!isAtEnd() && peek().type != TokenType::END) {
-        // This is a simplified indentation check
-        // A real interpreter would need more robust indentation handling
-        if (peek().type != TokenType::IDENTIFIER && 
-            peek().type != TokenType::PRINT) {
+    while (!isAtEnd() && peek() != TokenType::END) {
+        // Blank lines never end a block
+        if (match(TokenType::EOL)) continue;
+
+        if (peekColumn() <= indent) {
             break;
         }
         
@@ -179,22 +364,43 @@ std::vector<std::unique_ptr<ASTNode>> Parser::block() {
 
 // Helper methods for token management
 
-Token Parser::peek() {
+TokenType Parser::peek() {
     // Look at current token without consuming it
-    if (isAtEnd()) return tokens.back();
-    return tokens[current];
+    if (isAtEnd()) return tokens.types.back();
+    return tokens.types[current];
+}
+
+int Parser::peekColumn() {
+    if (isAtEnd()) return 0;
+    return tokens.columns[current];
 }
 
-Token Parser::advance() {
-    // Move to next token and return the current one
+size_t Parser::advance() {
+    // Move to next token and return the index of the current one
     if (!isAtEnd()) current++;
-    return tokens[current - 1];
+    return current - 1;
 }
 
 bool Parser::check(TokenType type) {
     // Check if current token matches expected type
     if (isAtEnd()) return false;
-    return peek().type == type;
+    return peek() == type;
+}
+
+bool Parser::checkCall() {
+    return check(TokenType::IDENTIFIER) && current + 1 < tokens.size() &&
+           tokens.types[current + 1] == TokenType::LPAREN;
+}
+
+bool Parser::checkBuiltin() {
+    if (!checkCall()) return false;
+    std::string name = nameOf(current);
+    return name == "array" || BuiltinNode::find(name);
+}
+
+bool Parser::checkElement() {
+    return check(TokenType::IDENTIFIER) && current + 1 < tokens.size() &&
+           tokens.types[current + 1] == TokenType::LBRACKET;
 }
 
 bool Parser::match(TokenType type) {
@@ -206,7 +412,7 @@ bool Parser::match(TokenType type) {
     return false;
 }
 
-Token Parser::consume(TokenType type, const std::string& message) {
+size_t Parser::consume(TokenType type, const std::string& message) {
     // Consume token of expected type or throw error
     if (check(type)) return advance();
     throw std::runtime_error(message);
@@ -215,4 +421,15 @@ Token Parser::consume(TokenType type, const std::string& message) {
 bool Parser::isAtEnd() {
     // Check if we've reached the end of the token stream
     return current >= tokens.size();
-}
\ No newline at end of file
+}
+
+std::unique_ptr<ASTNode> Parser::located(std::unique_ptr<ASTNode> node, size_t token) {
+    // Nodes remember the line of the token they start at (or hinge on)
+    node->setLine(tokens.lines[token]);
+    return node;
+}
+
+std::string Parser::nameOf(size_t token) {
+    // Identifier tokens carry the interned id of their name
+    return std::string(tokens.symbols.name(tokens.payloads[token]));
+}
@@ -0,0 +1,199 @@
+#include "profile.hpp"
+#include "optimize.hpp"
+#include "quicken.hpp"
+#include <algorithm>
+#include <iomanip>
+
+Profiler::Profiler(const std::string& source) {
+    // Line numbers start at 1, so sourceLines[0] stays empty
+    sourceLines.emplace_back();
+    size_t start = 0;
+    while (start < source.size()) {
+        size_t end = source.find('\n', start);
+        if (end == std::string::npos) end = source.size();
+        sourceLines.push_back(source.substr(start, end - start));
+        start = end + 1;
+    }
+    lines.resize(sourceLines.size());
+    frames.push_back({0, 0});
+}
+
+void Profiler::instrument(std::vector<std::unique_ptr<ASTNode>>& program) {
+    instrumentBlock(program);
+}
+
+void Profiler::instrumentBlock(std::vector<std::unique_ptr<ASTNode>>& body) {
+    for (auto& stmt : body) {
+        stmt->instrument(*this);
+        // A definition does nothing where it stands; its body is counted
+        if (dynamic_cast<FunctionNode*>(stmt.get())) continue;
+        int line = stmt->getLine();
+        if (line > 0 && static_cast<size_t>(line) < lines.size()) {
+            stmt = std::make_unique<ProfileNode>(std::move(stmt), *this);
+        }
+    }
+}
+
+void Profiler::addLoop(int line, const std::vector<std::unique_ptr<ASTNode>>& body) {
+    loops.push_back({line, body.empty() ? 0 : body.front()->getLine()});
+}
+
+uint32_t Profiler::frameFor(uint32_t parent, int line) {
+    uint64_t key = (static_cast<uint64_t>(parent) << 32) | static_cast<uint32_t>(line);
+    auto it = children.find(key);
+    if (it != children.end()) return it->second;
+
+    uint32_t frame = static_cast<uint32_t>(frames.size());
+    frames.push_back({parent, line});
+    children.emplace(key, frame);
+    return frame;
+}
+
+void Profiler::enter(int line, uint32_t& cachedParent, uint32_t& cachedFrame) {
+    uint32_t parent = stack.empty() ? 0 : stack.back().frame;
+    if (parent != cachedParent) {
+        cachedParent = parent;
+        cachedFrame = frameFor(parent, line);
+    }
+    lines[line].count++;
+    stack.push_back({cachedFrame, Clock::now()});
+}
+
+void Profiler::leave() {
+    Running done = stack.back();
+    stack.pop_back();
+    Clock::duration elapsed = Clock::now() - done.start;
+    Clock::duration self = elapsed - done.children;
+
+    Frame& frame = frames[done.frame];
+    frame.self += self;
+    lines[frame.line].total += elapsed;
+    lines[frame.line].self += self;
+    if (!stack.empty()) {
+        stack.back().children += elapsed;
+    }
+}
+
+std::string Profiler::label(int line) const {
+    // Frames are separated by ';' in folded stacks; the language has no use for it
+    const std::string& text = sourceLines[line];
+    size_t first = text.find_first_not_of(" \t");
+    size_t last = text.find_last_not_of(" \t\r");
+    std::string trimmed = first == std::string::npos ? "" : text.substr(first, last - first + 1);
+    return std::to_string(line) + ": " + trimmed;
+}
+
+void Profiler::writeListing(std::ostream& out) const {
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+    Clock::duration all{};
+    for (const auto& stats : lines) {
+        all += stats.self;
+    }
+    double allMs = Milliseconds(all).count();
+
+    out << std::fixed << "     count    total ms     self ms   self | source\n";
+    for (size_t line = 1; line < sourceLines.size(); line++) {
+        const LineStats& stats = lines[line];
+        if (stats.count > 0) {
+            double selfMs = Milliseconds(stats.self).count();
+            out << std::setw(10) << stats.count
+                << std::setw(12) << std::setprecision(3) << Milliseconds(stats.total).count()
+                << std::setw(12) << selfMs
+                << std::setw(6) << std::setprecision(1) << (allMs > 0 ? 100 * selfMs / allMs : 0.0)
+                << "% | ";
+        } else {
+            out << std::string(42, ' ') << "| ";
+        }
+        out << sourceLines[line] << "\n";
+    }
+
+    if (loops.empty()) return;
+    out << "loops\n";
+    for (const auto& loop : loops) {
+        const LineStats& stats = lines[loop.line];
+        if (stats.count == 0) continue;
+        long iterations = loop.bodyLine ? lines[loop.bodyLine].count : 0;
+        double totalMs = Milliseconds(stats.total).count();
+        out << "  line " << loop.line << ": entered " << stats.count
+            << (stats.count == 1 ? " time, " : " times, ")
+            << iterations << " iterations, " << std::setprecision(3) << totalMs << " ms";
+        if (iterations > 0) {
+            out << ", " << std::setprecision(1) << totalMs * 1e6 / iterations << " ns per iteration";
+        }
+        out << "\n";
+    }
+}
+
+void Profiler::writeFoldedStacks(std::ostream& out) const {
+    std::vector<std::string> path;
+    for (uint32_t i = 1; i < frames.size(); i++) {
+        long nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(frames[i].self).count();
+        if (nanoseconds <= 0) continue;
+
+        path.clear();
+        for (uint32_t frame = i; frame != 0; frame = frames[frame].parent) {
+            path.push_back(label(frames[frame].line));
+        }
+        std::reverse(path.begin(), path.end());
+        for (size_t j = 0; j < path.size(); j++) {
+            out << (j ? ";" : "") << path[j];
+        }
+        out << " " << nanoseconds << "\n";
+    }
+}
+
+// Profiled statements
+
+ProfileNode::ProfileNode(std::unique_ptr<ASTNode> statement, Profiler& profiler)
+    : statement(std::move(statement)), profiler(profiler) {
+    setLine(this->statement->getLine());
+}
+
+int ProfileNode::execute(Environment& env) {
+    // Leave the frame even when the statement throws
+    struct Scope {
+        Profiler& profiler;
+        ~Scope() { profiler.leave(); }
+    };
+    profiler.enter(getLine(), cachedParent, cachedFrame);
+    Scope scope{profiler};
+    return statement->execute(env);
+}
+
+void ProfileNode::compile(BytecodeCompiler& compiler) const {
+    statement->compile(compiler);
+}
+
+void ProfileNode::resolve(Resolver& resolver) {
+    statement->resolve(resolver);
+}
+
+std::unique_ptr<ASTNode> ProfileNode::specialize(Environment& env) {
+    // The statement specializes underneath; the wrapper stays
+    quicken(statement, env);
+    return nullptr;
+}
+
+void ProfileNode::collectUses(VariableUses& uses) const {
+    statement->collectUses(uses);
+}
+
+// Node instrumentation methods
+
+void IfNode::instrument(Profiler& profiler) {
+    profiler.instrumentBlock(body);
+}
+
+void WhileNode::instrument(Profiler& profiler) {
+    profiler.addLoop(getLine(), body);
+    profiler.instrumentBlock(body);
+}
+
+void CountedLoopNode::instrument(Profiler& profiler) {
+    profiler.addLoop(getLine(), body);
+    profiler.instrumentBlock(body);
+}
+
+void FunctionNode::instrument(Profiler& profiler) {
+    profiler.instrumentBlock(body);
+}
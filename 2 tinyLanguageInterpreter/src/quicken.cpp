@@ -0,0 +1,221 @@
+#include "quicken.hpp"
+#include "compiler.hpp"
+#include "optimize.hpp"
+#include "resolver.hpp"
+#include <stdexcept>
+
+const char* QuickeningStats::name(Kind kind) {
+    switch (kind) {
+        case CompareVarConst: return "compare var/const";
+        case DecrementInPlace: return "decrement in place";
+        case FusedIf: return "fused if";
+        case FusedWhile: return "fused while";
+        default: return "?";
+    }
+}
+
+void quicken(std::unique_ptr<ASTNode>& node, Environment& env) {
+    if (auto replacement = node->specialize(env)) {
+        replacement->setLine(node->getLine());
+        node = std::move(replacement);
+    }
+}
+
+void quickenBlock(std::vector<std::unique_ptr<ASTNode>>& body, Environment& env) {
+    for (auto& stmt : body) {
+        quicken(stmt, env);
+    }
+}
+
+// Generic nodes: decide whether a specialized form applies
+
+bool ComparisonNode::isVarConst() const {
+    if (dynamic_cast<const VariableNode*>(left.get())) {
+        return dynamic_cast<const NumberNode*>(right.get()) != nullptr;
+    }
+    return dynamic_cast<const NumberNode*>(left.get()) && dynamic_cast<const VariableNode*>(right.get());
+}
+
+std::unique_ptr<ASTNode> ComparisonNode::specialize(Environment& env) {
+    if (!isVarConst()) return nullptr;
+    auto* variable = dynamic_cast<const VariableNode*>(left.get());
+    auto* number = dynamic_cast<const NumberNode*>(right.get());
+    Op specializedOp = op;
+
+    // 5 < x is the same test as x > 5
+    if (!variable) {
+        variable = static_cast<const VariableNode*>(right.get());
+        number = static_cast<const NumberNode*>(left.get());
+        specializedOp = op == Op::Greater ? Op::Less : Op::Greater;
+    }
+
+    if (env.stats) env.stats->rewrites[QuickeningStats::CompareVarConst]++;
+    return std::make_unique<VarConstComparisonNode>(*variable, specializedOp, number->getValue());
+}
+
+// Only x = x - constant, reading the same variable it writes
+bool AssignmentNode::isDecrement() const {
+    auto* subtraction = dynamic_cast<const SubtractionNode*>(value.get());
+    if (!subtraction) return false;
+    auto* variable = dynamic_cast<const VariableNode*>(subtraction->getLeft());
+    return variable && variable->getSlot() == slot && dynamic_cast<const NumberNode*>(subtraction->getRight());
+}
+
+std::unique_ptr<ASTNode> AssignmentNode::specialize(Environment& env) {
+    if (!isDecrement()) return nullptr;
+    auto* subtraction = static_cast<const SubtractionNode*>(value.get());
+    auto* variable = static_cast<const VariableNode*>(subtraction->getLeft());
+    auto* number = static_cast<const NumberNode*>(subtraction->getRight());
+
+    if (env.stats) env.stats->rewrites[QuickeningStats::DecrementInPlace]++;
+    return std::make_unique<DecrementNode>(*variable, number->getValue());
+}
+
+// Take ownership of the condition if it has become a var/const comparison
+static std::unique_ptr<VarConstComparisonNode> takeVarConst(std::unique_ptr<ASTNode>& condition) {
+    auto* comparison = dynamic_cast<VarConstComparisonNode*>(condition.get());
+    if (!comparison) return nullptr;
+    condition.release();
+    return std::unique_ptr<VarConstComparisonNode>(comparison);
+}
+
+std::unique_ptr<ASTNode> IfNode::specialize(Environment& env) {
+    quicken(condition, env);
+    auto fused = takeVarConst(condition);
+    if (!fused) return nullptr;
+
+    if (env.stats) env.stats->rewrites[QuickeningStats::FusedIf]++;
+    return std::make_unique<IfVarConstNode>(std::move(fused), std::move(body), quickened);
+}
+
+std::unique_ptr<ASTNode> WhileNode::specialize(Environment& env) {
+    quicken(condition, env);
+    auto fused = takeVarConst(condition);
+    if (!fused) return nullptr;
+
+    if (env.stats) env.stats->rewrites[QuickeningStats::FusedWhile]++;
+    return std::make_unique<WhileVarConstNode>(std::move(fused), std::move(body), quickened,
+                                               std::move(tier));
+}
+
+// Specialized nodes
+
+int VarConstComparisonNode::test(Environment& env) const {
+    if (env.stats) env.stats->hits[QuickeningStats::CompareVarConst]++;
+    if (checked && !env.isDefined(slot)) {
+        throw std::runtime_error("Undefined variable: " + name);
+    }
+    int l = env.get(slot);
+    return op == ComparisonNode::Op::Greater ? l > value : l < value;
+}
+
+int VarConstComparisonNode::execute(Environment& env) {
+    return test(env);
+}
+
+int DecrementNode::execute(Environment& env) {
+    if (env.stats) env.stats->hits[QuickeningStats::DecrementInPlace]++;
+    if (checked && !env.isDefined(slot)) {
+        throw std::runtime_error("Undefined variable: " + name);
+    }
+    int val = env.get(slot) - amount;
+    env.set(slot, val);
+    return val;
+}
+
+int IfVarConstNode::execute(Environment& env) {
+    if (env.stats) env.stats->hits[QuickeningStats::FusedIf]++;
+    if (condition->test(env)) {
+        for (const auto& stmt : body) {
+            stmt->execute(env);
+        }
+        if (!quickened && env.quickening) {
+            quickenBlock(body, env);
+            quickened = true;
+        }
+    }
+    return 0;
+}
+
+void WhileVarConstNode::loop(const VarConstComparisonNode& condition,
+                             std::vector<std::unique_ptr<ASTNode>>& body,
+                             bool& quickened,
+                             LoopTier& tier,
+                             Environment& env) {
+    while (condition.test(env)) {
+        if (env.stats) env.stats->hits[QuickeningStats::FusedWhile]++;
+        for (const auto& stmt : body) {
+            stmt->execute(env);
+        }
+        if (!quickened && env.quickening) {
+            quickenBlock(body, env);
+            quickened = true;
+        }
+        if (env.jit && tier.iterate(condition, body, env)) return;
+    }
+}
+
+int WhileVarConstNode::execute(Environment& env) {
+    if (env.jit && tier.enter(env)) return 0;
+    loop(*condition, body, quickened, tier, env);
+    return 0;
+}
+
+// Specialized nodes compile and resolve exactly like the shapes they replace
+
+void VarConstComparisonNode::compile(BytecodeCompiler& compiler) const {
+    compiler.emitLoad(slot, checked, name);
+    compiler.emit(OpCode::CONST, value);
+    compiler.emit(op == ComparisonNode::Op::Greater ? OpCode::GREATER : OpCode::LESS);
+}
+
+void DecrementNode::compile(BytecodeCompiler& compiler) const {
+    compiler.emitLoad(slot, checked, name);
+    compiler.emit(OpCode::CONST, amount);
+    compiler.emit(OpCode::SUB);
+    compiler.emitStore(slot, name);
+}
+
+void IfVarConstNode::compile(BytecodeCompiler& compiler) const {
+    compiler.compileIf(*condition, body);
+}
+
+void WhileVarConstNode::compile(BytecodeCompiler& compiler) const {
+    compiler.compileWhile(*condition, body);
+}
+
+void VarConstComparisonNode::resolve(Resolver& resolver) {
+    resolver.resolveRead(name, slot, checked);
+}
+
+void DecrementNode::resolve(Resolver& resolver) {
+    resolver.resolveRead(name, slot, checked);
+    resolver.markAssigned(name);
+}
+
+void IfVarConstNode::resolve(Resolver& resolver) {
+    resolver.resolveIf(*condition, body);
+}
+
+void WhileVarConstNode::resolve(Resolver& resolver) {
+    resolver.resolveLoop(*condition, body);
+}
+
+void VarConstComparisonNode::collectUses(VariableUses& uses) const {
+    uses.read(slot, checked);
+}
+
+void DecrementNode::collectUses(VariableUses& uses) const {
+    uses.read(slot, checked);
+    uses.write(slot);
+}
+
+void IfVarConstNode::collectUses(VariableUses& uses) const {
+    condition->collectUses(uses);
+    uses.block(body);
+}
+
+void WhileVarConstNode::collectUses(VariableUses& uses) const {
+    condition->collectUses(uses);
+    uses.block(body);
+}
@@ -0,0 +1,323 @@
+#include "resolver.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+static const std::string noFunctions = "Functions need the whole script: --stream and --watch cannot run them";
+static const std::string noArrays = "Arrays cannot be used inside functions";
+
+void Resolver::resolve(const std::vector<std::unique_ptr<ASTNode>>& program) {
+    // Functions first, so calls can come before their definitions
+    for (const auto& stmt : program) {
+        auto* function = dynamic_cast<FunctionNode*>(stmt.get());
+        if (!function) continue;
+        if (!allowFunctions) {
+            throw std::runtime_error(noFunctions);
+        }
+        if (!functions->emplace(function->getName(), function).second) {
+            throw std::runtime_error("Function defined twice: " + function->getName());
+        }
+    }
+    for (const auto& stmt : program) {
+        stmt->resolve(*this);
+    }
+}
+
+std::unique_ptr<Resolver> Resolver::functionScope() const {
+    auto scope = std::make_unique<Resolver>();
+    scope->functions = functions;
+    scope->allowArrays = false;
+    return scope;
+}
+
+FunctionNode* Resolver::functionFor(const std::string& name, size_t argumentCount) const {
+    auto it = functions->find(name);
+    if (it == functions->end()) {
+        throw std::runtime_error(allowFunctions ? "Undefined function: " + name : noFunctions);
+    }
+    size_t parameters = it->second->parameterCount();
+    if (argumentCount != parameters) {
+        throw std::runtime_error("Function " + name + " takes " + std::to_string(parameters) +
+                                 (parameters == 1 ? " argument, " : " arguments, ") + "called with " +
+                                 std::to_string(argumentCount));
+    }
+    return it->second;
+}
+
+int Resolver::slotFor(const std::string& name) {
+    auto it = slots.find(name);
+    if (it != slots.end()) {
+        return it->second;
+    }
+    int slot = static_cast<int>(names.size());
+    slots.emplace(name, slot);
+    names.push_back(name);
+    definite.push_back(false);
+    return slot;
+}
+
+int Resolver::addTemporary() {
+    // '$' cannot start an identifier, so temporaries never clash with variables
+    return slotFor("$" + std::to_string(temporaries++));
+}
+
+void Resolver::markAssigned(const std::string& name) {
+    if (!discovering() && arraySlots.count(name)) {
+        throw std::runtime_error(name + " is an array, not a variable");
+    }
+    if (possible.insert(name).second) {
+        assignedOrder.push_back(name);
+    }
+    if (!discovering()) {
+        int slot = slotFor(name);
+        // Bodies restore definite assignment when they end; only the top level lasts
+        if (bodyDepth == 0 && !definite[slot]) {
+            definiteOrder.push_back(slot);
+        }
+        definite[slot] = true;
+    }
+}
+
+// Arrays get their slots in discovery walks too: one made anywhere in a
+// loop may be used anywhere in it
+int Resolver::declareArray(const std::string& name) {
+    if (!allowArrays) {
+        throw std::runtime_error(noArrays);
+    }
+    if (!discovering() && isPossiblyAssigned(name)) {
+        throw std::runtime_error(name + " is a variable, not an array");
+    }
+    auto it = arraySlots.find(name);
+    if (it != arraySlots.end()) {
+        return it->second;
+    }
+    int slot = static_cast<int>(arrayNames.size());
+    arraySlots.emplace(name, slot);
+    arrayNames.push_back(name);
+    return slot;
+}
+
+int Resolver::arrayFor(const std::string& name) {
+    if (!allowArrays) {
+        throw std::runtime_error(noArrays);
+    }
+    auto it = arraySlots.find(name);
+    if (it != arraySlots.end()) {
+        return it->second;
+    }
+    if (discovering()) return -1;
+    throw std::runtime_error(isPossiblyAssigned(name) ? name + " is a variable, not an array"
+                                                      : "Undefined array: " + name);
+}
+
+bool Resolver::isPossiblyAssigned(const std::string& name) const {
+    return possible.count(name) > 0;
+}
+
+void Resolver::resolveRead(const std::string& name, int& slot, bool& checked) {
+    if (discovering()) return;
+
+    if (!isPossiblyAssigned(name)) {
+        throw std::runtime_error(arraySlots.count(name) ? name + " is an array, not a variable"
+                                                        : "Undefined variable: " + name);
+    }
+    slot = slotFor(name);
+    checked = !isDefinitelyAssigned(slot);
+}
+
+void Resolver::resolveIf(ASTNode& condition, std::vector<std::unique_ptr<ASTNode>>& body) {
+    condition.resolve(*this);
+
+    // The body may be skipped, so its assignments are not definite afterwards
+    auto before = saveDefinite();
+    for (auto& stmt : body) {
+        stmt->resolve(*this);
+    }
+    restoreDefinite(std::move(before));
+}
+
+void Resolver::resolveLoop(ASTNode& condition, std::vector<std::unique_ptr<ASTNode>>& body) {
+    // Assignments anywhere in the loop reach the condition and the body
+    // through the back edge, so record them before resolving for real
+    {
+        Discovery discovery(*this);
+        condition.resolve(*this);
+        for (auto& stmt : body) {
+            stmt->resolve(*this);
+        }
+    }
+
+    // Resolving a loop is the same as an if: the body may run zero times
+    resolveIf(condition, body);
+}
+
+std::vector<bool> Resolver::saveDefinite() {
+    bodyDepth++;
+    return definite;
+}
+
+void Resolver::restoreDefinite(std::vector<bool> saved) {
+    bodyDepth--;
+    // Slots created inside the body were not definitely assigned before it
+    saved.resize(definite.size(), false);
+    definite = std::move(saved);
+}
+
+Resolver::Undone Resolver::rollback(const Mark& to) {
+    Undone undone;
+    undone.from = to;
+    undone.names.assign(names.begin() + to.slots, names.end());
+    undone.assigned.assign(assignedOrder.begin() + to.assigned, assignedOrder.end());
+    undone.definite.assign(definiteOrder.begin() + to.definite, definiteOrder.end());
+    undone.arrays.assign(arrayNames.begin() + to.arrays, arrayNames.end());
+
+    for (const auto& name : undone.names) {
+        slots.erase(name);
+    }
+    names.resize(to.slots);
+    for (const auto& name : undone.assigned) {
+        possible.erase(name);
+    }
+    assignedOrder.resize(to.assigned);
+    definiteOrder.resize(to.definite);
+    for (const auto& name : undone.arrays) {
+        arraySlots.erase(name);
+    }
+    arrayNames.resize(to.arrays);
+
+    // Rebuilt rather than patched: a statement that threw may have left
+    // bits of an unfinished body behind
+    definite.assign(names.size(), false);
+    for (int slot : definiteOrder) {
+        definite[slot] = true;
+    }
+    discoveryDepth = 0;
+    bodyDepth = 0;
+    return undone;
+}
+
+bool Resolver::matches(const Undone& undone, const Mark& old) const {
+    const Mark& from = undone.from;
+    if (!(mark() == old)) return false;
+
+    // Slots must line up exactly; names that may be assigned and definitely
+    // assigned slots only have to be the same sets. Both grew from the same
+    // state by the same number of entries, so containing the old ones is enough.
+    if (!std::equal(names.begin() + from.slots, names.end(), undone.names.begin())) return false;
+    if (!std::equal(arrayNames.begin() + from.arrays, arrayNames.end(), undone.arrays.begin())) return false;
+    for (size_t i = 0; i < old.assigned - from.assigned; i++) {
+        if (!possible.count(undone.assigned[i])) return false;
+    }
+    for (size_t i = 0; i < old.definite - from.definite; i++) {
+        if (!definite[undone.definite[i]]) return false;
+    }
+    return true;
+}
+
+void Resolver::redo(const Undone& undone, const Mark& old) {
+    const Mark& from = undone.from;
+    for (size_t i = old.slots - from.slots; i < undone.names.size(); i++) {
+        slotFor(undone.names[i]);
+    }
+    for (size_t i = old.assigned - from.assigned; i < undone.assigned.size(); i++) {
+        possible.insert(undone.assigned[i]);
+        assignedOrder.push_back(undone.assigned[i]);
+    }
+    for (size_t i = old.definite - from.definite; i < undone.definite.size(); i++) {
+        definite[undone.definite[i]] = true;
+        definiteOrder.push_back(undone.definite[i]);
+    }
+    for (size_t i = old.arrays - from.arrays; i < undone.arrays.size(); i++) {
+        declareArray(undone.arrays[i]);
+    }
+}
+
+// Node resolution methods
+
+void NumberNode::resolve(Resolver& resolver) {}
+
+void VariableNode::resolve(Resolver& resolver) {
+    resolver.resolveRead(name, slot, checked);
+}
+
+void AssignmentNode::resolve(Resolver& resolver) {
+    value->resolve(resolver);
+    if (!resolver.discovering()) {
+        slot = resolver.slotFor(name);
+    }
+    resolver.markAssigned(name);
+}
+
+void PrintNode::resolve(Resolver& resolver) {
+    expression->resolve(resolver);
+}
+
+void IfNode::resolve(Resolver& resolver) {
+    resolver.resolveIf(*condition, body);
+}
+
+void WhileNode::resolve(Resolver& resolver) {
+    resolver.resolveLoop(*condition, body);
+}
+
+void ComparisonNode::resolve(Resolver& resolver) {
+    left->resolve(resolver);
+    right->resolve(resolver);
+}
+
+void SubtractionNode::resolve(Resolver& resolver) {
+    left->resolve(resolver);
+    right->resolve(resolver);
+}
+
+void FunctionNode::resolve(Resolver& outer) {
+    // The parameters are assigned on entry and take the first slots
+    resolver = outer.functionScope();
+    for (const auto& parameter : parameters) {
+        resolver->markAssigned(parameter);
+    }
+    resolver->resolve(body);
+    if (result) {
+        result->resolve(*resolver);
+    }
+}
+
+void CallNode::resolve(Resolver& resolver) {
+    for (auto& argument : arguments) {
+        argument->resolve(resolver);
+    }
+    function = resolver.functionFor(name, arguments.size());
+}
+
+void NewArrayNode::resolve(Resolver& resolver) {
+    length->resolve(resolver);
+    slot = resolver.declareArray(name);
+}
+
+void ElementNode::resolve(Resolver& resolver) {
+    access.index->resolve(resolver);
+    access.slot = resolver.arrayFor(access.name);
+}
+
+void ElementAssignmentNode::resolve(Resolver& resolver) {
+    access.index->resolve(resolver);
+    value->resolve(resolver);
+    access.slot = resolver.arrayFor(access.name);
+}
+
+void BuiltinNode::resolve(Resolver& resolver) {
+    if (value) {
+        value->resolve(resolver);
+    }
+    slots.clear();
+    for (const auto& array : arrays) {
+        slots.push_back(resolver.arrayFor(array));
+    }
+}
+
+size_t FunctionNode::frameSize() const {
+    return resolver->slotCount();
+}
+
+const std::vector<std::string>& FunctionNode::slotNames() const {
+    return resolver->slotNames();
+}
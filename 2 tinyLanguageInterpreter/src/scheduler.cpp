@@ -0,0 +1,167 @@
+#include "scheduler.hpp"
+#include "compiler.hpp"
+#include "constant.hpp"
+#include "lexer.hpp"
+#include "optimize.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+std::shared_ptr<const Chunk> compileScript(const std::string& source) {
+    Lexer lexer(source);
+    auto tokens = lexer.tokenize();
+    Parser parser(tokens);
+    auto statements = parser.parse();
+    Resolver resolver;
+    resolver.resolve(statements);
+    ConstantFolder folder;
+    folder.fold(statements);
+    LoopOptimizer optimizer(resolver);
+    optimizer.optimize(statements);
+    BytecodeCompiler compiler;
+    return std::make_shared<const Chunk>(compiler.compile(statements, resolver.slotNames()));
+}
+
+// Runs print into a small buffer of their own; thousands of them may be alive at once
+static const size_t runOutputCapacity = 4096;
+
+ScriptRun::ScriptRun(std::shared_ptr<const Chunk> program, int fd, long limit)
+    : program(std::move(program))
+    , out(fd, runOutputCapacity)
+    , vm(*this->program, out)
+    , limit(limit) {
+    out.setPolicy(OutputSink::FlushPolicy::WhenFull);
+}
+
+double ScriptRun::latency() const {
+    return std::chrono::duration<double>(finished - submitted).count();
+}
+
+bool ScriptRun::slice(long budget) {
+    sliceCount++;
+    bool done;
+    try {
+        if (limit > 0) {
+            budget = std::min(budget, limit - vm.executed());
+        }
+        done = vm.run(budget);
+        if (!done && limit > 0 && vm.executed() >= limit) {
+            throw std::runtime_error("Instruction limit exceeded");
+        }
+        if (done) out.flush();
+    } catch (const std::runtime_error& e) {
+        // Whatever was printed before the error still comes out
+        try {
+            out.flush();
+        } catch (const std::runtime_error&) {
+        }
+        error = e.what();
+        done = true;
+    }
+    if (done) finished = std::chrono::steady_clock::now();
+    return done;
+}
+
+Scheduler::Scheduler(unsigned workerCount, long budget) : budget(budget) {
+    workerCount = std::max(workerCount, 1u);
+    for (unsigned i = 0; i < workerCount; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    // Start them only once every queue exists, since they steal from each other
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->thread = std::thread([this, i] { work(i); });
+    }
+}
+
+Scheduler::~Scheduler() {
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (auto& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+std::shared_ptr<ScriptRun> Scheduler::submit(std::shared_ptr<const Chunk> program, int fd, long limit) {
+    auto run = std::make_shared<ScriptRun>(std::move(program), fd, limit);
+    run->submitted = std::chrono::steady_clock::now();
+    // Counted before any worker can finish it, so wait() never sees it missing
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        unfinished++;
+    }
+    enqueue(nextWorker++ % workers.size(), run);
+    return run;
+}
+
+void Scheduler::wait() {
+    std::unique_lock<std::mutex> guard(stateLock);
+    allFinished.wait(guard, [this] { return unfinished == 0; });
+}
+
+void Scheduler::enqueue(size_t worker, std::shared_ptr<ScriptRun> run) {
+    {
+        std::lock_guard<std::mutex> guard(workers[worker]->lock);
+        workers[worker]->queue.push_back(std::move(run));
+    }
+    // Counted only once the run can be taken, so a worker woken for it finds it
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        queued++;
+    }
+    workAvailable.notify_one();
+}
+
+std::shared_ptr<ScriptRun> Scheduler::take(size_t self) {
+    // The oldest run in our own queue, so every run there gets its turn
+    {
+        Worker& own = *workers[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.queue.empty()) {
+            auto run = std::move(own.queue.front());
+            own.queue.pop_front();
+            return run;
+        }
+    }
+    // Otherwise the newest run of the first other worker that has one
+    for (size_t i = 1; i < workers.size(); i++) {
+        Worker& victim = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.queue.empty()) {
+            auto run = std::move(victim.queue.back());
+            victim.queue.pop_back();
+            stolen++;
+            return run;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::work(size_t self) {
+    while (true) {
+        auto run = take(self);
+        if (!run) {
+            std::unique_lock<std::mutex> guard(stateLock);
+            workAvailable.wait(guard, [this] { return stopping || queued > 0; });
+            if (stopping) return;
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            queued--;
+        }
+
+        if (!run->slice(budget)) {
+            enqueue(self, std::move(run));
+            continue;
+        }
+        std::lock_guard<std::mutex> guard(stateLock);
+        if (--unfinished == 0) {
+            allFinished.notify_all();
+        }
+    }
+}
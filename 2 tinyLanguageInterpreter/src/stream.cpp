@@ -0,0 +1,132 @@
+#include "stream.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "optimize.hpp"
+#include "alloc.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+
+size_t indentation(const std::string& line) {
+    size_t i = 0;
+    while (i < line.size() && (line[i] == ' ' || line[i] == '\t' || line[i] == '\r')) {
+        i++;
+    }
+    return i;
+}
+
+bool isBlank(const std::string& line) {
+    return indentation(line) == line.size();
+}
+
+StatementReader::StatementReader(int fd, size_t chunkSize) : fd(fd), chunk(chunkSize) {}
+
+bool StatementReader::readLine(std::string& line) {
+    line.clear();
+    while (true) {
+        if (position == end) {
+            if (atEnd) {
+                // A last line without a newline still counts
+                if (line.empty()) return false;
+                lineNumber++;
+                return true;
+            }
+            ssize_t count = read(fd, chunk.data(), chunk.size());
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string("Cannot read script: ") + std::strerror(errno));
+            }
+            position = 0;
+            end = static_cast<size_t>(count);
+            atEnd = count == 0;
+            continue;
+        }
+
+        const char* start = chunk.data() + position;
+        const char* newline = static_cast<const char*>(std::memchr(start, '\n', end - position));
+        if (newline) {
+            line.append(start, newline - start);
+            position += newline - start + 1;
+            lineNumber++;
+            return true;
+        }
+        line.append(start, end - position);
+        position = end;
+    }
+}
+
+bool StatementReader::next(std::string& statement, size_t& firstLine) {
+    statement.clear();
+
+    // The statement starts at the next non-blank line
+    std::string line;
+    size_t number;
+    do {
+        if (held) {
+            line.swap(heldLine);
+            number = heldNumber;
+            held = false;
+        } else if (readLine(line)) {
+            number = lineNumber;
+        } else {
+            return false;
+        }
+    } while (isBlank(line));
+
+    size_t indent = indentation(line);
+    firstLine = number;
+    statement += line;
+    statement += '\n';
+
+    // Indented lines belong to its block; blank ones are kept so line numbers stay right
+    while (readLine(line)) {
+        if (!isBlank(line) && indentation(line) <= indent) {
+            heldLine.swap(line);
+            heldNumber = lineNumber;
+            held = true;
+            break;
+        }
+        statement += line;
+        statement += '\n';
+    }
+
+    largest = std::max(largest, statement.size());
+    return true;
+}
+
+void runStreaming(StatementReader& reader, Environment& env, bool optimizing) {
+    Resolver resolver;
+    resolver.allowFunctions = false;
+    std::string source;
+    size_t firstLine;
+    TokenStream tokens;  // Reused for every statement
+
+    while (reader.next(source, firstLine)) {
+        AllocationTracker::enter(AllocationTracker::Lex);
+        Lexer lexer(std::move(source), firstLine);
+        lexer.tokenize(tokens);
+        AllocationTracker::enter(AllocationTracker::Parse);
+        Parser parser(tokens);
+        auto statements = parser.parse();
+
+        // The Resolver carries what earlier statements assigned over to this one
+        AllocationTracker::enter(AllocationTracker::Resolve);
+        resolver.resolve(statements);
+        if (optimizing) {
+            AllocationTracker::enter(AllocationTracker::Optimize);
+            LoopOptimizer optimizer(resolver);
+            optimizer.optimize(statements);
+        }
+
+        AllocationTracker::enter(AllocationTracker::Execute);
+        env.grow(resolver.slotCount());
+        for (const auto& stmt : statements) {
+            stmt->execute(env);
+        }
+        // The statement's AST is released here, before the next statement is read
+        AllocationTracker::enter(AllocationTracker::Other);
+    }
+}
@@ -1,4 +1,96 @@
 #include "token.hpp"
 
-Token::Token(TokenType type, std::string value, int line)
-    : type(type), value(std::move(value)), line(line) {}
\ No newline at end of file
+// FNV-1a, good enough for short identifiers
+static uint32_t hashName(std::string_view name) {
+    uint32_t hash = 2166136261u;
+    for (char c : name) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Only a hint, so compilers without it just skip it
+static inline void prefetch(const void* address) {
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+}
+
+int SymbolTable::intern(std::string_view name) {
+    // Keep the table at most half full
+    if ((offsets.size() + 1) * 2 > buckets.size()) {
+        rehash(buckets.empty() ? 64 : buckets.size() * 2);
+    }
+
+    return insert(name, hashName(name));
+}
+
+// The id of name, added if it is new; the table has room for it
+int SymbolTable::insert(std::string_view name, uint32_t hash) {
+    size_t mask = buckets.size() - 1;
+    size_t bucket = hash & mask;
+
+    // Linear probing until we find the name or an empty bucket
+    while (buckets[bucket] != -1) {
+        int id = buckets[bucket];
+        if (hashes[id] == hash && this->name(id) == name) {
+            return id;
+        }
+        bucket = (bucket + 1) & mask;
+    }
+
+    int id = static_cast<int>(offsets.size());
+    offsets.push_back(static_cast<uint32_t>(pool.size()));
+    lengths.push_back(static_cast<uint32_t>(name.size()));
+    hashes.push_back(hash);
+    pool.append(name);
+    buckets[bucket] = id;
+    return id;
+}
+
+void SymbolTable::merge(const SymbolTable& other, std::vector<int32_t>& ids) {
+    // Room for all of them up front, so the buckets stay where they are
+    size_t bucketCount = buckets.empty() ? 64 : buckets.size();
+    while ((offsets.size() + other.size() + 1) * 2 > bucketCount) bucketCount *= 2;
+    if (bucketCount != buckets.size()) rehash(bucketCount);
+
+    // Each name's bucket is requested a few names ahead, and the hash of
+    // the name found there (if any) halfway, so the cache misses overlap
+    size_t mask = buckets.size() - 1;
+    const size_t ahead = 16;
+    size_t count = other.size();
+    ids.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        if (i + ahead < count) {
+            prefetch(&buckets[other.hashes[i + ahead] & mask]);
+        }
+        if (i + ahead / 2 < count) {
+            int32_t id = buckets[other.hashes[i + ahead / 2] & mask];
+            if (id != -1) prefetch(&hashes[id]);
+        }
+        ids[i] = insert(other.name(static_cast<int>(i)), other.hashes[i]);
+    }
+}
+
+void SymbolTable::clear() {
+    pool.clear();
+    offsets.clear();
+    lengths.clear();
+    hashes.clear();
+    buckets.assign(buckets.size(), -1);
+}
+
+void SymbolTable::rehash(size_t bucketCount) {
+    buckets.assign(bucketCount, -1);
+    size_t mask = bucketCount - 1;
+    for (size_t id = 0; id < offsets.size(); id++) {
+        size_t bucket = hashes[id] & mask;
+        while (buckets[bucket] != -1) {
+            bucket = (bucket + 1) & mask;
+        }
+        buckets[bucket] = static_cast<int32_t>(id);
+    }
+}
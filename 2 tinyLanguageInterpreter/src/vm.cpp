@@ -0,0 +1,308 @@
+#include "vm.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+VM::VM(const Chunk& chunk, OutputSink& out)
+    : chunk(chunk)
+    , out(out)
+    , slots(chunk.names.size(), 0)
+    , defined(chunk.names.size(), 0)
+    , stack(chunk.maxStack + 1)
+    , arrays(chunk.arrays.size())
+    , frameTop(chunk.names.size()) {}
+
+const std::vector<std::string>& VM::slotNames() const {
+    return calls.empty() ? chunk.names : chunk.functions[calls.back().function].names;
+}
+
+// A loop whose counter or bound is unassigned fails in its condition, so
+// the checked copy runs it
+bool VM::inBounds(const Chunk::BoundsGuard& guard, const int* locals, const uint8_t* assigned) const {
+    if (!assigned[guard.counter] || (guard.boundSlot >= 0 && !assigned[guard.boundSlot])) {
+        return false;
+    }
+    long long counter = locals[guard.counter];
+    long long bound = guard.boundSlot >= 0 ? locals[guard.boundSlot] : guard.bound;
+    long long trips = countedTrips(counter, bound, guard.step);
+    if (trips < 0) return false;
+    for (const auto& range : guard.ranges) {
+        if (!countedIndicesInBounds(counter, trips, guard.step, range.low, range.high,
+                                    arrays[range.array].size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int VM::get(const std::string& name) const {
+    for (size_t slot = 0; slot < chunk.names.size(); slot++) {
+        if (chunk.names[slot] == name && defined[slot]) {
+            return slots[slot];
+        }
+    }
+    throw std::runtime_error("Undefined variable: " + name);
+}
+
+void VM::run() {
+    execute<false>(0);
+}
+
+bool VM::run(long budget) {
+    return execute<true>(budget);
+}
+
+// Budgeted runs count every instruction down and leave through "yield" once
+// the budget is gone; the unbudgeted copy of the loop has no such check
+template <bool Budgeted>
+bool VM::execute(long budget) {
+    if (halted) return true;
+    long given = budget;
+    int* sp = stack.data() + depth;  // Points one past the top of the value stack
+    int* locals = slots.data() + frameBase;
+    uint8_t* assigned = defined.data() + frameBase;
+
+#ifdef TINY_COMPUTED_GOTO
+    // Handler addresses, in OpCode order
+    static const void* const labels[] = {
+        &&op_CONST, &&op_LOAD, &&op_LOAD_CHECKED, &&op_STORE, &&op_SUB, &&op_GREATER,
+        &&op_LESS, &&op_JUMP, &&op_JUMP_IF_FALSE, &&op_PRINT, &&op_HALT, &&op_CALL,
+        &&op_RETURN, &&op_POP, &&op_NEW_ARRAY, &&op_LOAD_ELEMENT, &&op_LOAD_ELEMENT_UNCHECKED,
+        &&op_STORE_ELEMENT, &&op_STORE_ELEMENT_UNCHECKED, &&op_LENGTH, &&op_FILL, &&op_SUM,
+        &&op_MIN, &&op_MAX, &&op_ADD_ARRAYS, &&op_SUB_ARRAYS, &&op_COUNT_ABOVE, &&op_COUNT_BELOW,
+        &&op_BOUNDS_GUARD
+    };
+
+    // Thread the code once: opcodes become handler addresses, operands are copied
+    if (threadedFor != labels) {
+        threaded.resize(chunk.code.size());
+        size_t pc = 0;
+        while (pc < chunk.code.size()) {
+            OpCode op = static_cast<OpCode>(chunk.code[pc]);
+            threaded[pc].handler = labels[static_cast<int>(op)];
+            for (int i = 1; i <= operandCount(op); i++) {
+                threaded[pc + i].operand = chunk.code[pc + i];
+            }
+            pc += 1 + operandCount(op);
+        }
+        threadedFor = labels;
+    }
+
+    const Threaded* const base = threaded.data();
+    const Threaded* ip = base + resumeAt;
+#define CASE(name) op_##name:
+#define OPERAND() ((ip++)->operand)
+#define NEXT() if (Budgeted && --budget < 0) goto yield; goto *(ip++)->handler
+    NEXT();
+#else
+    const int32_t* const base = chunk.code.data();
+    const int32_t* ip = base + resumeAt;
+#define CASE(name) case OpCode::name:
+#define OPERAND() (*ip++)
+#define NEXT() break
+    for (;;) {
+        if (Budgeted && --budget < 0) goto yield;
+        switch (static_cast<OpCode>(*ip++)) {
+#endif
+
+    CASE(CONST) {
+        *sp++ = OPERAND();
+        NEXT();
+    }
+    CASE(LOAD) {
+        *sp++ = locals[OPERAND()];
+        NEXT();
+    }
+    CASE(LOAD_CHECKED) {
+        int32_t slot = OPERAND();
+        if (!assigned[slot]) {
+            throw std::runtime_error("Undefined variable: " + slotNames()[slot]);
+        }
+        *sp++ = locals[slot];
+        NEXT();
+    }
+    CASE(STORE) {
+        int32_t slot = OPERAND();
+        locals[slot] = *--sp;
+        assigned[slot] = 1;
+        NEXT();
+    }
+    CASE(SUB) {
+        int r = *--sp;
+        sp[-1] = sp[-1] - r;
+        NEXT();
+    }
+    CASE(GREATER) {
+        int r = *--sp;
+        sp[-1] = sp[-1] > r;
+        NEXT();
+    }
+    CASE(LESS) {
+        int r = *--sp;
+        sp[-1] = sp[-1] < r;
+        NEXT();
+    }
+    CASE(JUMP) {
+        int32_t offset = OPERAND();
+        ip += offset;
+        NEXT();
+    }
+    CASE(JUMP_IF_FALSE) {
+        int32_t offset = OPERAND();
+        if (!*--sp) {
+            ip += offset;
+        }
+        NEXT();
+    }
+    CASE(PRINT) {
+        out.print(*--sp);
+        NEXT();
+    }
+    CASE(HALT) {
+        halted = true;
+        if (Budgeted) instructions += given - budget;
+        return true;
+    }
+    CASE(CALL) {
+        int32_t index = OPERAND();
+        const Chunk::Function& function = chunk.functions[index];
+        if (calls.size() == maxCallDepth) {
+            throw std::runtime_error("Stack overflow");
+        }
+
+        // Room for the callee's values and frame; growing moves both stacks
+        size_t used = static_cast<size_t>(sp - stack.data()) - function.parameters;
+        if (used + function.maxStack + 1 > stack.size()) {
+            stack.resize(std::max(2 * stack.size(), used + function.maxStack + 1));
+            sp = stack.data() + used + function.parameters;
+        }
+        size_t top = frameTop + function.frameSize;
+        if (top > slots.size()) {
+            slots.resize(std::max(2 * slots.size(), top));
+            defined.resize(slots.size());
+        }
+
+        // The arguments become the first slots of the new frame
+        calls.push_back({static_cast<size_t>(ip - base), frameBase, frameTop, index});
+        frameBase = frameTop;
+        frameTop = top;
+        locals = slots.data() + frameBase;
+        assigned = defined.data() + frameBase;
+        sp -= function.parameters;
+        for (int32_t i = 0; i < function.parameters; i++) {
+            locals[i] = sp[i];
+            assigned[i] = 1;
+        }
+        std::fill(assigned + function.parameters, assigned + function.frameSize, 0);
+        ip = base + function.entry;
+        NEXT();
+    }
+    CASE(RETURN) {
+        CallFrame caller = calls.back();
+        calls.pop_back();
+        frameBase = caller.base;
+        frameTop = caller.top;
+        locals = slots.data() + frameBase;
+        assigned = defined.data() + frameBase;
+        ip = base + caller.returnAt;
+        NEXT();  // The result stays on top of the stack
+    }
+    CASE(POP) {
+        --sp;
+        NEXT();
+    }
+    CASE(NEW_ARRAY) {
+        int32_t array = OPERAND();
+        arrays[array] = IntArray::allocate(*--sp, chunk.arrays[array]);
+        NEXT();
+    }
+    CASE(LOAD_ELEMENT) {
+        int32_t array = OPERAND();
+        sp[-1] = arrays[array].at(sp[-1], chunk.arrays[array]);
+        NEXT();
+    }
+    CASE(LOAD_ELEMENT_UNCHECKED) {
+        sp[-1] = arrays[OPERAND()][sp[-1]];
+        NEXT();
+    }
+    CASE(STORE_ELEMENT) {
+        int32_t array = OPERAND();
+        sp -= 2;
+        arrays[array].at(sp[0], chunk.arrays[array]) = sp[1];
+        NEXT();
+    }
+    CASE(STORE_ELEMENT_UNCHECKED) {
+        int32_t array = OPERAND();
+        sp -= 2;
+        arrays[array][sp[0]] = sp[1];
+        NEXT();
+    }
+    CASE(LENGTH) {
+        *sp++ = arrays[OPERAND()].size();
+        NEXT();
+    }
+    CASE(FILL) {
+        arrays[OPERAND()].fill(*--sp);
+        NEXT();
+    }
+    CASE(SUM) {
+        *sp++ = arrays[OPERAND()].sum();
+        NEXT();
+    }
+    CASE(MIN) {
+        int32_t array = OPERAND();
+        *sp++ = arrays[array].min(chunk.arrays[array]);
+        NEXT();
+    }
+    CASE(MAX) {
+        int32_t array = OPERAND();
+        *sp++ = arrays[array].max(chunk.arrays[array]);
+        NEXT();
+    }
+    CASE(ADD_ARRAYS) {
+        int32_t result = OPERAND();
+        int32_t a = OPERAND();
+        int32_t b = OPERAND();
+        IntArray::add(arrays[result], arrays[a], arrays[b], chunk.arrays[result], chunk.arrays[a], chunk.arrays[b]);
+        NEXT();
+    }
+    CASE(SUB_ARRAYS) {
+        int32_t result = OPERAND();
+        int32_t a = OPERAND();
+        int32_t b = OPERAND();
+        IntArray::subtract(arrays[result], arrays[a], arrays[b],
+                           chunk.arrays[result], chunk.arrays[a], chunk.arrays[b]);
+        NEXT();
+    }
+    CASE(COUNT_ABOVE) {
+        sp[-1] = arrays[OPERAND()].countAbove(sp[-1]);
+        NEXT();
+    }
+    CASE(COUNT_BELOW) {
+        sp[-1] = arrays[OPERAND()].countBelow(sp[-1]);
+        NEXT();
+    }
+    CASE(BOUNDS_GUARD) {
+        const Chunk::BoundsGuard& guard = chunk.guards[OPERAND()];
+        int32_t offset = OPERAND();
+        if (!inBounds(guard, locals, assigned)) {
+            ip += offset;
+        }
+        NEXT();
+    }
+
+#ifndef TINY_COMPUTED_GOTO
+        }
+    }
+#endif
+
+yield:
+    // ip is at the instruction the budget ran out in front of
+    resumeAt = static_cast<size_t>(ip - base);
+    depth = static_cast<size_t>(sp - stack.data());
+    instructions += given;
+    return false;
+
+#undef CASE
+#undef OPERAND
+#undef NEXT
+}
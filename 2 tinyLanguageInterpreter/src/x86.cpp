@@ -0,0 +1,270 @@
+#include "x86.hpp"
+#include <stdexcept>
+
+X86Assembler::Label X86Assembler::newLabel() {
+    labelPositions.push_back(-1);
+    return Label{static_cast<int>(labelPositions.size() - 1)};
+}
+
+void X86Assembler::bind(Label label) {
+    labelPositions[label.id] = static_cast<int64_t>(bytes.size());
+}
+
+void X86Assembler::resolveLabels() {
+    for (const auto& fixup : fixups) {
+        int64_t target = labelPositions[fixup.label];
+        if (target < 0) {
+            throw std::runtime_error("JIT: jump to an unbound label");
+        }
+        // rel32 is measured from the end of the 4-byte field
+        int32_t offset = static_cast<int32_t>(target - static_cast<int64_t>(fixup.position + 4));
+        for (int i = 0; i < 4; i++) {
+            bytes[fixup.position + i] = static_cast<uint8_t>(offset >> (8 * i));
+        }
+    }
+    fixups.clear();
+}
+
+void X86Assembler::emit32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        bytes.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+// REX prefix: W for 64-bit operands, R/B extend the reg and rm fields.
+// Byte operations on SPL/BPL/SIL/DIL need a REX prefix even without extensions.
+void X86Assembler::rex(bool wide, Reg reg, Reg base, bool forceForByte) {
+    uint8_t prefix = 0x40;
+    if (wide) prefix |= 0x08;
+    if (reg >= R8) prefix |= 0x04;
+    if (base >= R8) prefix |= 0x01;
+    bool byteNeedsRex = forceForByte && ((reg >= RSP && reg <= RDI) || (base >= RSP && base <= RDI));
+    if (prefix != 0x40 || byteNeedsRex) {
+        bytes.push_back(prefix);
+    }
+}
+
+void X86Assembler::modrmReg(Reg reg, Reg rm) {
+    bytes.push_back(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+void X86Assembler::modrmMem(Reg reg, Reg base, int32_t disp) {
+    bool shortDisp = disp >= -128 && disp <= 127;
+    uint8_t mod = shortDisp ? 0x40 : 0x80;
+    bytes.push_back(static_cast<uint8_t>(mod | ((reg & 7) << 3) | (base & 7)));
+    // RSP and R12 as a base need a SIB byte
+    if ((base & 7) == RSP) {
+        bytes.push_back(0x24);
+    }
+    if (shortDisp) {
+        bytes.push_back(static_cast<uint8_t>(disp));
+    } else {
+        emit32(static_cast<uint32_t>(disp));
+    }
+}
+
+void X86Assembler::rel32(Label target) {
+    fixups.push_back({bytes.size(), target.id});
+    emit32(0);
+}
+
+void X86Assembler::movImm32(Reg dst, int32_t imm) {
+    rex(false, RAX, dst);
+    bytes.push_back(static_cast<uint8_t>(0xB8 + (dst & 7)));
+    emit32(static_cast<uint32_t>(imm));
+}
+
+void X86Assembler::movImm64(Reg dst, uint64_t imm) {
+    rex(true, RAX, dst);
+    bytes.push_back(static_cast<uint8_t>(0xB8 + (dst & 7)));
+    emit32(static_cast<uint32_t>(imm));
+    emit32(static_cast<uint32_t>(imm >> 32));
+}
+
+void X86Assembler::movReg32(Reg dst, Reg src) {
+    rex(false, src, dst);
+    bytes.push_back(0x89);
+    modrmReg(src, dst);
+}
+
+void X86Assembler::movReg64(Reg dst, Reg src) {
+    rex(true, src, dst);
+    bytes.push_back(0x89);
+    modrmReg(src, dst);
+}
+
+void X86Assembler::load32(Reg dst, Reg base, int32_t disp) {
+    rex(false, dst, base);
+    bytes.push_back(0x8B);
+    modrmMem(dst, base, disp);
+}
+
+void X86Assembler::store32(Reg base, int32_t disp, Reg src) {
+    rex(false, src, base);
+    bytes.push_back(0x89);
+    modrmMem(src, base, disp);
+}
+
+void X86Assembler::load64(Reg dst, Reg base, int32_t disp) {
+    rex(true, dst, base);
+    bytes.push_back(0x8B);
+    modrmMem(dst, base, disp);
+}
+
+void X86Assembler::store64(Reg base, int32_t disp, Reg src) {
+    rex(true, src, base);
+    bytes.push_back(0x89);
+    modrmMem(src, base, disp);
+}
+
+void X86Assembler::storeByteImm(Reg base, int32_t disp, uint8_t imm) {
+    rex(false, RAX, base);
+    bytes.push_back(0xC6);
+    modrmMem(RAX, base, disp);  // /0
+    bytes.push_back(imm);
+}
+
+void X86Assembler::load8(Reg dst, Reg base, int32_t disp) {
+    rex(false, dst, base);
+    bytes.push_back(0x0F);
+    bytes.push_back(0xB6);
+    modrmMem(dst, base, disp);
+}
+
+void X86Assembler::store8(Reg base, int32_t disp, Reg src) {
+    rex(false, src, base, true);
+    bytes.push_back(0x88);
+    modrmMem(src, base, disp);
+}
+
+void X86Assembler::subReg32(Reg dst, Reg src) {
+    rex(false, src, dst);
+    bytes.push_back(0x29);
+    modrmReg(src, dst);
+}
+
+void X86Assembler::subImm32(Reg dst, int32_t imm) {
+    rex(false, RAX, dst);
+    bytes.push_back(0x81);
+    modrmReg(static_cast<Reg>(5), dst);  // /5
+    emit32(static_cast<uint32_t>(imm));
+}
+
+void X86Assembler::negReg32(Reg dst) {
+    rex(false, RAX, dst);
+    bytes.push_back(0xF7);
+    modrmReg(static_cast<Reg>(3), dst);  // /3
+}
+
+void X86Assembler::divReg32(Reg src) {
+    rex(false, RAX, src);
+    bytes.push_back(0xF7);
+    modrmReg(static_cast<Reg>(6), src);  // /6
+}
+
+void X86Assembler::cmpReg32(Reg left, Reg right) {
+    rex(false, right, left);
+    bytes.push_back(0x39);
+    modrmReg(right, left);
+}
+
+void X86Assembler::cmpImm32(Reg left, int32_t imm) {
+    rex(false, RAX, left);
+    bytes.push_back(0x81);
+    modrmReg(static_cast<Reg>(7), left);  // /7
+    emit32(static_cast<uint32_t>(imm));
+}
+
+void X86Assembler::cmpReg64(Reg left, Reg right) {
+    rex(true, right, left);
+    bytes.push_back(0x39);
+    modrmReg(right, left);
+}
+
+void X86Assembler::cmpByteImm(Reg base, int32_t disp, uint8_t imm) {
+    rex(false, RAX, base);
+    bytes.push_back(0x80);
+    modrmMem(static_cast<Reg>(7), base, disp);  // /7
+    bytes.push_back(imm);
+}
+
+void X86Assembler::testReg32(Reg a, Reg b) {
+    rex(false, b, a);
+    bytes.push_back(0x85);
+    modrmReg(b, a);
+}
+
+void X86Assembler::setcc(Cond cond, Reg dst) {
+    rex(false, RAX, dst, true);
+    bytes.push_back(0x0F);
+    bytes.push_back(static_cast<uint8_t>(0x90 + cond));
+    modrmReg(RAX, dst);
+}
+
+void X86Assembler::movzx8(Reg dst, Reg src) {
+    rex(false, dst, src, true);
+    bytes.push_back(0x0F);
+    bytes.push_back(0xB6);
+    modrmReg(dst, src);
+}
+
+void X86Assembler::addReg64(Reg dst, Reg src) {
+    rex(true, src, dst);
+    bytes.push_back(0x01);
+    modrmReg(src, dst);
+}
+
+void X86Assembler::addImm64(Reg dst, int32_t imm) {
+    rex(true, RAX, dst);
+    bytes.push_back(0x81);
+    modrmReg(RAX, dst);  // /0
+    emit32(static_cast<uint32_t>(imm));
+}
+
+void X86Assembler::subImm64(Reg dst, int32_t imm) {
+    rex(true, RAX, dst);
+    bytes.push_back(0x81);
+    modrmReg(static_cast<Reg>(5), dst);  // /5
+    emit32(static_cast<uint32_t>(imm));
+}
+
+void X86Assembler::jmp(Label target) {
+    bytes.push_back(0xE9);
+    rel32(target);
+}
+
+void X86Assembler::jcc(Cond cond, Label target) {
+    bytes.push_back(0x0F);
+    bytes.push_back(static_cast<uint8_t>(0x80 + cond));
+    rel32(target);
+}
+
+void X86Assembler::call(Reg target) {
+    rex(false, RAX, target);
+    bytes.push_back(0xFF);
+    modrmReg(static_cast<Reg>(2), target);  // /2
+}
+
+void X86Assembler::call(Label target) {
+    bytes.push_back(0xE8);
+    rel32(target);
+}
+
+void X86Assembler::push(Reg reg) {
+    rex(false, RAX, reg);
+    bytes.push_back(static_cast<uint8_t>(0x50 + (reg & 7)));
+}
+
+void X86Assembler::pop(Reg reg) {
+    rex(false, RAX, reg);
+    bytes.push_back(static_cast<uint8_t>(0x58 + (reg & 7)));
+}
+
+void X86Assembler::ret() {
+    bytes.push_back(0xC3);
+}
+
+void X86Assembler::syscall() {
+    bytes.push_back(0x0F);
+    bytes.push_back(0x05);
+}